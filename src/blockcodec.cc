@@ -0,0 +1,280 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief BlockCodec source
+
+  A source that contains the realization of BlockCodec class.
+*/
+
+#include "blockcodec.h"
+
+#ifdef MEMORYACCESSOR_LZ4
+#include <lz4.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+
+/*!
+ \brief Get the codec used for compression.
+ \return kLz4 if built with LZ4, kRle otherwise.
+*/
+BlockCodec::Codec BlockCodec::Best() noexcept {
+#ifdef MEMORYACCESSOR_LZ4
+  return Codec::kLz4;
+#else
+  return Codec::kRle;
+#endif
+}
+
+/*!
+ \brief Get the name of a codec.
+ \param [in] codec The codec.
+ \return C-string with the name.
+*/
+const char *BlockCodec::Name(Codec codec) noexcept {
+  switch (codec) {
+  case Codec::kRle:
+    return "RLE";
+  case Codec::kLz4:
+    return "LZ4";
+  default:
+    return "stored";
+  }
+}
+
+/*!
+ \brief Get the size of a buffer for compressed data.
+ \param [in] size Size of a block.
+ \return Maximum size of the block compressed by any codec.
+*/
+size_t BlockCodec::Bound(size_t size) noexcept {
+  size_t bound{size + size / 0x80 + 0x10}; // literals of RLE
+#ifdef MEMORYACCESSOR_LZ4
+  bound = std::max(bound, static_cast<size_t>(LZ4_compressBound(
+                              static_cast<int>(size))));
+#endif
+  return bound;
+}
+
+/*!
+ \brief Compress a block.
+ \param [in] codec Codec to compress by (kRle or kLz4).
+ \param [in] src Data of the block.
+ \param [in] size Size of the block (less than 2 GiB).
+ \param [out] dst Buffer of Bound(size) bytes.
+ \return Size of compressed data, 0 if the codec is not available.
+*/
+size_t BlockCodec::Compress(Codec codec, const char *src, size_t size,
+                            char *dst) noexcept {
+  if (codec == Codec::kRle)
+    return CompressRle(src, size, dst);
+#ifdef MEMORYACCESSOR_LZ4
+  if (codec == Codec::kLz4)
+    return static_cast<size_t>(std::max(
+        LZ4_compress_default(src, dst, static_cast<int>(size),
+                             static_cast<int>(Bound(size))),
+        0));
+#endif
+  return 0;
+}
+
+/*!
+ \brief Decompress a block.
+ \param [in] codec Codec the block was compressed by.
+ \param [in] src Compressed data.
+ \param [in] size Size of compressed data.
+ \param [out] dst Buffer of raw_size bytes.
+ \param [in] raw_size Size of the block.
+ \return true if the data is valid and has exactly raw_size bytes.
+*/
+bool BlockCodec::Decompress(Codec codec, const char *src, size_t size,
+                            char *dst, size_t raw_size) noexcept {
+  switch (codec) {
+  case Codec::kStored:
+    if (size != raw_size)
+      return false;
+    std::memcpy(dst, src, size);
+    return true;
+  case Codec::kRle:
+    return DecompressRle(src, size, dst, raw_size);
+#ifdef MEMORYACCESSOR_LZ4
+  case Codec::kLz4:
+    return LZ4_decompress_safe(src, dst, static_cast<int>(size),
+                               static_cast<int>(raw_size)) ==
+           static_cast<int>(raw_size);
+#endif
+  default:
+    return false;
+  }
+}
+
+/*!
+ \brief Compress blocks of a batch.
+ \param [in] codec Codec to compress by.
+ \param [in,out] blocks Blocks with data and size set.
+ \param [in] threads Maximum amount of threads.
+ \throw std::bad_alloc If memory for compressed data cannot be allocated.
+ \throw std::system_error If a thread cannot be started.
+
+ Threads take blocks in order. A block that does not become smaller is marked
+ as stored. Buffers for compressed data are kept if they are big enough, so
+ blocks can be reused for the next batch.
+*/
+void BlockCodec::CompressBatch(Codec codec, std::span<Block> blocks,
+                               unsigned threads) noexcept(false) {
+  for (Block &block : blocks)
+    if (block.capacity < Bound(block.size)) {
+      block.compressed = std::make_unique_for_overwrite<char[]>(
+          Bound(block.size));
+      block.capacity = Bound(block.size);
+    }
+
+  std::atomic<size_t> next_block{0};
+  auto work{[codec, blocks, &next_block] {
+    for (size_t num{next_block++}; num < blocks.size(); num = next_block++) {
+      Block &block{blocks[num]};
+      block.compressed_size =
+          Compress(codec, block.data, block.size, block.compressed.get());
+      block.codec = block.compressed_size && block.compressed_size < block.size
+                        ? codec
+                        : Codec::kStored;
+    }
+  }};
+
+  threads = static_cast<unsigned>(
+      std::max<size_t>(std::min<size_t>(threads, blocks.size()), 1));
+  std::vector<std::thread> workers;
+  try {
+    for (unsigned i{1}; i < threads; i++)
+      workers.emplace_back(work);
+  } catch (...) {
+    for (std::thread &worker : workers)
+      worker.join();
+    throw;
+  }
+  work();
+  for (std::thread &worker : workers)
+    worker.join();
+}
+
+/*!
+ \brief Compress a block by the RLE codec.
+ \param [in] src Data of the block.
+ \param [in] size Size of the block.
+ \param [out] dst Buffer of Bound(size) bytes.
+ \return Size of compressed data.
+
+ Runs shorter than kMinRun are kept in literals. Runs of zeros are found by
+ 8 bytes at once.
+*/
+size_t BlockCodec::CompressRle(const char *src, size_t size,
+                               char *dst) noexcept {
+  size_t out{0}, literal_start{0}, pos{0};
+  auto flush_literals{[&](size_t end) {
+    while (literal_start < end) {
+      size_t count{std::min<size_t>(end - literal_start, 0x80)};
+      dst[out++] = static_cast<char>(count - 1);
+      std::memcpy(dst + out, src + literal_start, count);
+      out += count;
+      literal_start += count;
+    }
+  }};
+
+  while (pos < size) {
+    size_t run{pos + 1};
+    if (!src[pos]) {
+      uint64_t word{0};
+      while (run + sizeof(word) <= size &&
+             (std::memcpy(&word, src + run, sizeof(word)), !word))
+        run += sizeof(word);
+    }
+    while (run < size && src[run] == src[pos])
+      run++;
+    if (run - pos < kMinRun) {
+      pos = run;
+      continue;
+    }
+
+    flush_literals(pos);
+    size_t length{run - pos - kMinRun};
+    if (length < 0x7f)
+      dst[out++] = static_cast<char>(0x80 | length);
+    else {
+      dst[out++] = static_cast<char>(0xff);
+      for (length -= 0x7f; length >= 0x80; length >>= 7)
+        dst[out++] = static_cast<char>(0x80 | (length & 0x7f));
+      dst[out++] = static_cast<char>(length);
+    }
+    dst[out++] = src[pos];
+    pos = literal_start = run;
+  }
+  flush_literals(size);
+  return out;
+}
+
+/*!
+ \brief Decompress a block compressed by the RLE codec.
+ \param [in] src Compressed data.
+ \param [in] size Size of compressed data.
+ \param [out] dst Buffer of raw_size bytes.
+ \param [in] raw_size Size of the block.
+ \return true if the data is valid and has exactly raw_size bytes.
+*/
+bool BlockCodec::DecompressRle(const char *src, size_t size, char *dst,
+                               size_t raw_size) noexcept {
+  size_t in{0}, out{0};
+  while (in < size) {
+    uint8_t token{static_cast<uint8_t>(src[in++])};
+    if (token < 0x80) {
+      size_t count{static_cast<size_t>(token) + 1};
+      if (count > size - in || count > raw_size - out)
+        return false;
+      std::memcpy(dst + out, src + in, count);
+      in += count;
+      out += count;
+      continue;
+    }
+
+    size_t length{static_cast<size_t>(token & 0x7f)};
+    if (length == 0x7f) {
+      size_t extra{0};
+      for (uint8_t shift{0};; shift += 7) {
+        if (in == size || shift > 56)
+          return false;
+        uint8_t byte{static_cast<uint8_t>(src[in++])};
+        extra |= static_cast<size_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+          break;
+      }
+      length += extra;
+    }
+    length += kMinRun;
+    if (in == size || length > raw_size - out)
+      return false;
+    std::memset(dst + out, src[in++], length);
+    out += length;
+  }
+  return out == raw_size;
+}
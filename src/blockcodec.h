@@ -0,0 +1,101 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief BlockCodec header
+
+ A header that contains the definition of BlockCodec class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_BLOCKCODEC_H_
+#define MEMORYACCESSOR_SRC_BLOCKCODEC_H_
+
+#include <cstdint>
+#include <memory>
+#include <span>
+
+/*!
+ \brief A class that compresses independent blocks of data.
+
+ A block is compressed by LZ4 if the library was found at build time
+ (MEMORYACCESSOR_LZ4 is defined), otherwise by the built-in zero/RLE codec,
+ which is made for memory that is mostly zeros and runs of equal bytes. A block
+ that does not become smaller is kept stored, so the result is never bigger
+ than the block. Batches of blocks are compressed by multiple threads.
+
+ The RLE format is a sequence of tokens: a byte t < 0x80 is followed by t + 1
+ literal bytes; a byte 0x80 | n is a run of n + kMinRun equal bytes (if n is
+ 0x7f, a LEB128 number is added to the length), followed by the byte.
+*/
+class BlockCodec {
+public:
+  constexpr static size_t kMinRun{4}; //!< Minimum length of an RLE run.
+
+  /*!
+   \brief Codec of a block.
+  */
+  enum class Codec : uint8_t {
+    kStored, //!< Not compressed.
+    kRle,    //!< Built-in zero/RLE codec.
+    kLz4,    //!< LZ4 (only if built with it).
+  };
+
+  /*!
+   \brief A struct that represents a block of a batch.
+  */
+  struct Block {
+    const char *data{nullptr}; //!< Data of the block.
+    size_t size{0};            //!< Size of the block.
+    Codec codec{Codec::kStored};       //!< Codec the block was compressed by.
+    std::unique_ptr<char[]> compressed; //!< Buffer for compressed data.
+    size_t capacity{0};                 //!< Size of the buffer.
+    size_t compressed_size{0};          //!< Size of compressed data.
+
+    /*!
+     \brief Get the data to store.
+     \return Compressed data, or the data if the block is stored.
+    */
+    const char *Stored() const noexcept {
+      return codec == Codec::kStored ? data : compressed.get();
+    }
+
+    /*!
+     \brief Get the size of the data to store.
+     \return Size of compressed data, or the size if the block is stored.
+    */
+    size_t StoredSize() const noexcept {
+      return codec == Codec::kStored ? size : compressed_size;
+    }
+  };
+
+  static Codec Best() noexcept;
+  static const char *Name(Codec codec) noexcept;
+  static size_t Bound(size_t size) noexcept;
+  static size_t Compress(Codec codec, const char *src, size_t size,
+                         char *dst) noexcept;
+  static bool Decompress(Codec codec, const char *src, size_t size, char *dst,
+                         size_t raw_size) noexcept;
+  static void CompressBatch(Codec codec, std::span<Block> blocks,
+                            unsigned threads) noexcept(false);
+
+private:
+  static size_t CompressRle(const char *src, size_t size, char *dst) noexcept;
+  static bool DecompressRle(const char *src, size_t size, char *dst,
+                            size_t raw_size) noexcept;
+};
+
+#endif // MEMORYACCESSOR_SRC_BLOCKCODEC_H_
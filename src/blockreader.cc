@@ -0,0 +1,171 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief BlockReader source
+
+  A source that contains the realization of BlockReader class.
+*/
+
+#include "blockreader.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "blockcodec.h"
+#include "blockwriter.h"
+#include "tools.h"
+
+/*!
+ \brief Destroy the object, closing the opened file.
+*/
+BlockReader::~BlockReader() noexcept { Close(); }
+
+/*!
+ \brief Open a block file.
+ \param [in] path Path of the file.
+ \throw BlockFileEx If the file cannot be opened or read, or it is not a valid
+ block file (for example, it was not finished).
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ The previously opened file is closed. The header, the trailer and the index
+ are read and checked.
+*/
+void BlockReader::Open(const std::string &path) noexcept(false) {
+
+  Close();
+  fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0)
+    throw BlockFileEx();
+
+  try {
+    struct stat file_stat;
+    BlockWriter::Header header;
+    BlockWriter::Trailer trailer;
+    if (fstat(fd_, &file_stat) != 0 ||
+        static_cast<uint64_t>(file_stat.st_size) <
+            sizeof(header) + sizeof(trailer))
+      throw BlockFileEx();
+    uint64_t file_size{static_cast<uint64_t>(file_stat.st_size)};
+    if (!Tools::PreadAll(fd_, reinterpret_cast<char *>(&header),
+                         sizeof(header), 0) ||
+        !Tools::PreadAll(fd_, reinterpret_cast<char *>(&trailer),
+                         sizeof(trailer), file_size - sizeof(trailer)) ||
+        std::memcmp(header.magic, BlockWriter::kMagic,
+                    sizeof(BlockWriter::kMagic)) != 0 ||
+        std::memcmp(trailer.magic, BlockWriter::kMagic,
+                    sizeof(BlockWriter::kMagic)) != 0 ||
+        header.version != BlockWriter::kVersion || !header.block_size ||
+        header.block_size > BlockWriter::kBlockSize * 0x100)
+      throw BlockFileEx();
+
+    block_size_ = header.block_size;
+    if (trailer.index_offset > file_size - sizeof(trailer) ||
+        trailer.blocks != (file_size - sizeof(trailer) - trailer.index_offset) /
+                              sizeof(uint64_t) ||
+        trailer.blocks !=
+            (trailer.raw_size + block_size_ - 1) / block_size_)
+      throw BlockFileEx();
+    raw_size_ = trailer.raw_size;
+
+    index_.resize(trailer.blocks);
+    if (!Tools::PreadAll(fd_, reinterpret_cast<char *>(index_.data()),
+                         index_.size() * sizeof(uint64_t),
+                         trailer.index_offset))
+      throw BlockFileEx();
+    stored_ = std::make_unique_for_overwrite<char[]>(
+        BlockCodec::Bound(block_size_));
+    block_ = std::make_unique_for_overwrite<char[]>(block_size_);
+  } catch (...) {
+    Close();
+    throw;
+  }
+}
+
+/*!
+ \brief Close the opened file.
+*/
+void BlockReader::Close() noexcept {
+  if (fd_ >= 0)
+    close(fd_);
+  fd_ = -1;
+  block_size_ = 0;
+  raw_size_ = 0;
+  index_.clear();
+  stored_.reset();
+  block_.reset();
+  block_num_ = SIZE_MAX;
+}
+
+/*!
+ \brief Read raw data.
+ \param [in] offset Offset in raw data.
+ \param [out] dst Buffer to read to.
+ \param [in] size Amount of bytes to read.
+ \return Amount of bytes read, less than size only at the end of data.
+ \throw BlockFileEx If a block cannot be read or decompressed.
+*/
+size_t BlockReader::Read(uint64_t offset, char *dst,
+                         size_t size) noexcept(false) {
+  if (offset >= raw_size_)
+    return 0;
+  size = static_cast<size_t>(std::min<uint64_t>(size, raw_size_ - offset));
+  for (size_t done{0}; done < size;) {
+    size_t num{static_cast<size_t>((offset + done) / block_size_)},
+        in_block{static_cast<size_t>((offset + done) % block_size_)},
+        amount{std::min(block_size_ - in_block, size - done)};
+    LoadBlock(num);
+    std::memcpy(dst + done, block_.get() + in_block, amount);
+    done += amount;
+  }
+  return size;
+}
+
+/*!
+ \brief Read and decompress a block to the cache.
+ \param [in] num Number of the block.
+ \throw BlockFileEx If the block cannot be read or decompressed.
+*/
+void BlockReader::LoadBlock(size_t num) noexcept(false) {
+
+  if (num == block_num_)
+    return;
+  block_num_ = SIZE_MAX;
+  BlockWriter::BlockHeader block_header;
+  size_t raw_size{static_cast<size_t>(
+      std::min<uint64_t>(block_size_, raw_size_ - num * block_size_))};
+  if (!Tools::PreadAll(fd_, reinterpret_cast<char *>(&block_header),
+                       sizeof(block_header), index_[num]) ||
+      block_header.raw_size != raw_size ||
+      block_header.stored_size > BlockCodec::Bound(block_size_) ||
+      !Tools::PreadAll(fd_, stored_.get(), block_header.stored_size,
+                       index_[num] + sizeof(block_header)) ||
+      !BlockCodec::Decompress(
+          static_cast<BlockCodec::Codec>(block_header.codec), stored_.get(),
+          block_header.stored_size, block_.get(), raw_size))
+    throw BlockFileEx();
+  block_num_ = num;
+}
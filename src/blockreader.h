@@ -0,0 +1,100 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief BlockReader header
+
+ A header that contains the definition of BlockReader class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_BLOCKREADER_H_
+#define MEMORYACCESSOR_SRC_BLOCKREADER_H_
+
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*!
+ \brief A class that reads block files written by BlockWriter.
+
+ The index is loaded when a file is opened. A read at any offset decompresses
+ only blocks that contain the requested bytes, the latest block is cached.
+*/
+class BlockReader {
+public:
+  /*!
+   \brief Ex: A block file cannot be read
+
+   This exception is thrown when a block file cannot be opened or read, or it
+   is not a valid block file.
+  */
+  class BlockFileEx : public std::exception {
+    /*!
+     \brief "what" function of the exception.
+     \return C-string descripting the exception.
+    */
+    virtual const char *what() const noexcept override {
+      return "Error in reading a block file";
+    }
+  };
+
+  BlockReader() noexcept = default;
+
+  /*!
+   \brief Copy constructor (deleted).
+   \param [in] origin BlockReader instance to copy from.
+
+   Create a new object by copying an old one. Prohibited.
+  */
+  BlockReader(const BlockReader &origin) = delete;
+
+  /*!
+   \brief Copy-assignment operator (deleted).
+   \param [in] origin BlockReader instance to copy from.
+
+   Assign an object by copying other object. Prohibited.
+  */
+  BlockReader &operator=(const BlockReader &origin) = delete;
+
+  ~BlockReader() noexcept;
+
+  void Open(const std::string &path) noexcept(false);
+  void Close() noexcept;
+
+  /*!
+   \brief Get the size of raw data of the opened file.
+   \return The size.
+  */
+  uint64_t Size() const noexcept { return raw_size_; }
+
+  size_t Read(uint64_t offset, char *dst, size_t size) noexcept(false);
+
+private:
+  void LoadBlock(size_t num) noexcept(false);
+
+  int fd_{-1};                     //!< File descriptor of the opened file.
+  size_t block_size_{0};           //!< Raw size of blocks.
+  uint64_t raw_size_{0};           //!< Size of raw data.
+  std::vector<uint64_t> index_;    //!< Offsets of blocks.
+  std::unique_ptr<char[]> stored_; //!< Buffer for stored data of a block.
+  std::unique_ptr<char[]> block_;  //!< Data of the cached block.
+  size_t block_num_{SIZE_MAX};     //!< Number of the cached block.
+};
+
+#endif // MEMORYACCESSOR_SRC_BLOCKREADER_H_
@@ -0,0 +1,143 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief BlockWriter source
+
+  A source that contains the realization of BlockWriter class.
+*/
+
+#include "blockwriter.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "blockcodec.h"
+
+/*!
+ \brief Constructor.
+ \param [in] stream Stream to write to, it should be opened in binary mode.
+ \param [in] codec Codec of blocks.
+ \param [in] threads Amount of threads that compress blocks.
+ \throw std::bad_alloc If memory for the batch cannot be allocated.
+
+ Write the header of the file and set the batch buffer as the put area.
+*/
+BlockWriter::BlockWriter(std::ostream &stream, BlockCodec::Codec codec,
+                         unsigned threads) noexcept(false)
+    : stream_{stream}, codec_{codec}, threads_{std::max(threads, 1u)},
+      batch_size_{kBlockSize * kBatchBlocks * threads_},
+      batch_{std::make_unique_for_overwrite<char[]>(batch_size_)} {
+  Header header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.block_size = kBlockSize;
+  stream_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  offset_ = sizeof(header);
+  setp(batch_.get(), batch_.get() + batch_size_);
+}
+
+/*!
+ \brief Destroy the object, finishing the file.
+*/
+BlockWriter::~BlockWriter() noexcept { Finish(); }
+
+/*!
+ \brief Write the rest of data, the index and the trailer.
+ \return true if the stream has no errors.
+
+ Data written after Finish is discarded.
+*/
+bool BlockWriter::Finish() noexcept {
+  if (finished_)
+    return !stream_.fail();
+  finished_ = true;
+  try {
+    FlushBatch();
+  } catch (...) {
+    stream_.setstate(std::ios::badbit);
+    return false;
+  }
+
+  Trailer trailer{offset_, index_.size(), raw_size_, {}};
+  std::memcpy(trailer.magic, kMagic, sizeof(kMagic));
+  stream_.write(reinterpret_cast<const char *>(index_.data()),
+                static_cast<std::streamsize>(index_.size() * sizeof(uint64_t)));
+  stream_.write(reinterpret_cast<const char *>(&trailer), sizeof(trailer));
+  stream_.flush();
+  setp(nullptr, nullptr);
+  return !stream_.fail();
+}
+
+/*!
+ \brief Write the full batch to the stream.
+ \param [in] ch A character to put after the batch.
+ \return ch, or EOF in case of an error.
+*/
+BlockWriter::int_type BlockWriter::overflow(int_type ch) noexcept {
+  if (finished_)
+    return traits_type::eof();
+  try {
+    FlushBatch();
+  } catch (...) {
+    return traits_type::eof();
+  }
+  if (stream_.fail())
+    return traits_type::eof();
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+/*!
+ \brief Compress data of the put area and write it as blocks.
+ \throw std::bad_alloc If memory for compressed data cannot be allocated.
+ \throw std::system_error If a thread cannot be started.
+*/
+void BlockWriter::FlushBatch() noexcept(false) {
+  size_t size{static_cast<size_t>(pptr() - pbase())};
+  setp(batch_.get(), batch_.get() + batch_size_);
+  if (!size)
+    return;
+
+  blocks_.resize((size + kBlockSize - 1) / kBlockSize);
+  for (size_t i{0}; i < blocks_.size(); i++) {
+    blocks_[i].data = batch_.get() + i * kBlockSize;
+    blocks_[i].size = std::min(kBlockSize, size - i * kBlockSize);
+  }
+  BlockCodec::CompressBatch(codec_, blocks_, threads_);
+
+  for (const BlockCodec::Block &block : blocks_) {
+    BlockHeader block_header{static_cast<uint32_t>(block.StoredSize()),
+                             static_cast<uint32_t>(block.size),
+                             static_cast<uint8_t>(block.codec),
+                             {}};
+    stream_.write(reinterpret_cast<const char *>(&block_header),
+                  sizeof(block_header));
+    stream_.write(block.Stored(),
+                  static_cast<std::streamsize>(block.StoredSize()));
+    index_.push_back(offset_);
+    offset_ += sizeof(block_header) + block.StoredSize();
+    raw_size_ += block.size;
+  }
+}
@@ -0,0 +1,142 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief BlockWriter header
+
+ A header that contains the definition of BlockWriter class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_BLOCKWRITER_H_
+#define MEMORYACCESSOR_SRC_BLOCKWRITER_H_
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+#include "blockcodec.h"
+
+/*!
+ \brief A stream buffer that writes compressed blocks to a stream.
+
+ Data written to an std::ostream with this buffer is cut into blocks of
+ kBlockSize bytes, blocks are compressed by BlockCodec in batches (one batch
+ has kBatchBlocks blocks per thread) and written in order. A block file
+ consists of:
+ - Header: magic, version and size of blocks;
+ - every block: BlockHeader (stored and raw sizes, codec) and stored data;
+ - the index: offset of every BlockHeader;
+ - Trailer: offset of the index, amount of blocks, raw size and magic.
+
+ Every block except the last one has kBlockSize raw bytes, so a reader finds
+ the block of any offset by the index and decompresses only it (BlockReader).
+ The file is complete only after Finish.
+*/
+class BlockWriter : public std::streambuf {
+public:
+  constexpr static char kMagic[8]{'M', 'A', 'B', 'L',
+                                  'O', 'C', 'K', '\n'}; //!< File magic.
+  constexpr static uint32_t kVersion{1};      //!< Version of the format.
+  constexpr static size_t kBlockSize{0x40000}; //!< Raw size of a block.
+  constexpr static size_t kBatchBlocks{
+      2}; //!< Amount of blocks per thread in a batch.
+
+  /*!
+   \brief Header of a block file.
+  */
+  struct Header {
+    char magic[8];       //!< kMagic.
+    uint32_t version;    //!< kVersion.
+    uint32_t block_size; //!< kBlockSize.
+  };
+
+  /*!
+   \brief Header of a block.
+  */
+  struct BlockHeader {
+    uint32_t stored_size; //!< Size of stored data.
+    uint32_t raw_size;    //!< Size of the block.
+    uint8_t codec;        //!< BlockCodec::Codec.
+    uint8_t reserved[7];  //!< Zeros.
+  };
+
+  /*!
+   \brief Trailer of a block file.
+  */
+  struct Trailer {
+    uint64_t index_offset; //!< Offset of the index.
+    uint64_t blocks;       //!< Amount of blocks.
+    uint64_t raw_size;     //!< Size of raw data.
+    char magic[8];         //!< kMagic.
+  };
+
+  BlockWriter(std::ostream &stream, BlockCodec::Codec codec,
+              unsigned threads) noexcept(false);
+
+  /*!
+   \brief Copy constructor (deleted).
+   \param [in] origin BlockWriter instance to copy from.
+
+   Create a new object by copying an old one. Prohibited.
+  */
+  BlockWriter(const BlockWriter &origin) = delete;
+
+  /*!
+   \brief Copy-assignment operator (deleted).
+   \param [in] origin BlockWriter instance to copy from.
+
+   Assign an object by copying other object. Prohibited.
+  */
+  BlockWriter &operator=(const BlockWriter &origin) = delete;
+
+  ~BlockWriter() noexcept;
+
+  bool Finish() noexcept;
+
+  /*!
+   \brief Get the amount of raw bytes written to blocks.
+   \return The amount of bytes.
+  */
+  uint64_t RawSize() const noexcept { return raw_size_; }
+
+  /*!
+   \brief Get the amount of bytes written to the stream.
+   \return The amount of bytes.
+  */
+  uint64_t StoredSize() const noexcept { return offset_; }
+
+protected:
+  int_type overflow(int_type ch) noexcept override;
+
+private:
+  void FlushBatch() noexcept(false);
+
+  std::ostream &stream_;          //!< Stream to write to.
+  BlockCodec::Codec codec_;       //!< Codec of blocks.
+  unsigned threads_;              //!< Amount of threads.
+  size_t batch_size_;             //!< Size of the batch buffer.
+  std::unique_ptr<char[]> batch_; //!< Buffer of a batch.
+  std::vector<BlockCodec::Block> blocks_; //!< Blocks of a batch.
+  std::vector<uint64_t> index_;           //!< Offsets of written blocks.
+  uint64_t offset_{0};                    //!< Offset of the next block.
+  uint64_t raw_size_{0};                  //!< Raw size of written blocks.
+  bool finished_{false};                  //!< If Finish was called.
+};
+
+#endif // MEMORYACCESSOR_SRC_BLOCKWRITER_H_
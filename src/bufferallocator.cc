@@ -0,0 +1,139 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief BufferAllocator source
+
+  A source that contains the realization of BufferAllocator class.
+*/
+
+#include "bufferallocator.h"
+
+#include <sys/mman.h>
+
+#include <cstdint>
+#include <memory>
+#include <new>
+
+/*!
+ \brief Free a buffer.
+ \param [in] buffer The buffer.
+
+ Unmap the buffer if it is mapped, delete it from the heap otherwise.
+*/
+void BufferAllocator::Deleter::operator()(char *buffer) const noexcept {
+  if (mapped_size)
+    munmap(buffer, mapped_size);
+  else
+    ::operator delete[](buffer, std::align_val_t{kAlignment});
+}
+
+/*!
+ \brief Allocate a buffer.
+ \param [in] size Size of the buffer.
+ \param [in] huge_pages Back a big buffer by huge pages (true) or by 4 KiB
+ pages (false).
+ \param [out] backing If not nullptr, memory the buffer is backed by.
+ \return The buffer, uninitialized.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ A buffer of at least kHugePageSize bytes is mapped, falling back to the heap.
+*/
+BufferAllocator::Buffer BufferAllocator::Allocate(
+    size_t size, bool huge_pages, Backing *backing) noexcept(false) {
+  Backing result{Backing::kHeap};
+  Buffer buffer;
+  if (size >= kHugePageSize)
+    buffer = Map(size, huge_pages, result);
+  if (!buffer)
+    buffer = Buffer(new (std::align_val_t{kAlignment}) char[size], Deleter{0});
+
+  if (backing)
+    *backing = result;
+  return buffer;
+}
+
+/*!
+ \brief Get the name of a backing.
+ \param [in] backing The backing.
+ \return C-string with the name.
+*/
+const char *BufferAllocator::BackingName(Backing backing) noexcept {
+  switch (backing) {
+  case Backing::kPages:
+    return "4 KiB pages";
+  case Backing::kTransparent:
+    return "transparent huge pages";
+  case Backing::kHugetlb:
+    return "hugetlb pages";
+  default:
+    return "heap";
+  }
+}
+
+/*!
+ \brief Map a buffer anonymously.
+ \param [in] size Size of the buffer.
+ \param [in] huge_pages Back the buffer by huge pages.
+ \param [out] backing Memory the buffer is backed by, if it is mapped.
+ \return The buffer, or an empty one if it cannot be mapped.
+
+ The mapping is rounded up to kHugePageSize. MAP_HUGETLB fails at once if
+ there are not enough reserved huge pages; then the mapping is made of normal
+ pages, aligned to kHugePageSize (so the kernel can collapse it to huge pages)
+ by mapping one more huge page and unmapping the unaligned head and tail.
+*/
+BufferAllocator::Buffer BufferAllocator::Map(size_t size, bool huge_pages,
+                                             Backing &backing) noexcept {
+  size_t mapped_size{(size + kHugePageSize - 1) / kHugePageSize *
+                     kHugePageSize};
+  if (mapped_size < size)
+    return Buffer();
+
+  void *mapping{MAP_FAILED};
+  if (huge_pages) {
+    mapping = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (mapping != MAP_FAILED) {
+      backing = Backing::kHugetlb;
+      return Buffer(static_cast<char *>(mapping), Deleter{mapped_size});
+    }
+  }
+
+  size_t length{mapped_size + kHugePageSize};
+  mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED)
+    return Buffer();
+  uintptr_t start{reinterpret_cast<uintptr_t>(mapping)};
+  uintptr_t aligned{(start + kHugePageSize - 1) / kHugePageSize *
+                    kHugePageSize};
+  if (aligned != start)
+    munmap(mapping, aligned - start);
+  munmap(reinterpret_cast<void *>(aligned + mapped_size),
+         start + length - aligned - mapped_size);
+
+  char *buffer{reinterpret_cast<char *>(aligned)};
+  if (!huge_pages) {
+    madvise(buffer, mapped_size, MADV_NOHUGEPAGE);
+    backing = Backing::kPages;
+  } else
+    backing = madvise(buffer, mapped_size, MADV_HUGEPAGE) == 0
+                  ? Backing::kTransparent
+                  : Backing::kPages;
+  return Buffer(buffer, Deleter{mapped_size});
+}
@@ -0,0 +1,75 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief BufferAllocator header
+
+ A header that contains the definition of BufferAllocator class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_BUFFERALLOCATOR_H_
+#define MEMORYACCESSOR_SRC_BUFFERALLOCATOR_H_
+
+#include <cstdint>
+#include <memory>
+
+/*!
+ \brief A class that allocates buffers for copies and chunks of memory.
+
+ All buffers are aligned to kAlignment bytes for the comparing loops. Buffers
+ of at least kHugePageSize bytes are mapped anonymously: with huge pages, the
+ mapping is backed by reserved huge pages (MAP_HUGETLB) if there are any, by
+ transparent huge pages (MADV_HUGEPAGE) otherwise, so long scans cause less
+ TLB misses. Without huge pages, the mapping is advised to use 4 KiB pages
+ only. Smaller buffers, and big ones if mapping fails, are allocated on the
+ heap.
+*/
+class BufferAllocator {
+public:
+  constexpr static size_t kAlignment{64}; //!< Alignment of buffers.
+  constexpr static size_t kHugePageSize{
+      0x200000}; //!< Size of a huge page, smaller buffers are on the heap.
+
+  /*!
+   \brief Memory a buffer is backed by.
+  */
+  enum class Backing : uint8_t {
+    kHeap,        //!< The heap.
+    kPages,       //!< Anonymous mapping with 4 KiB pages.
+    kTransparent, //!< Anonymous mapping with transparent huge pages.
+    kHugetlb,     //!< Anonymous mapping with reserved huge pages.
+  };
+
+  /*!
+   \brief A struct that frees buffers on the heap or mapped.
+  */
+  struct Deleter {
+    size_t mapped_size; //!< Size of the mapping, 0 for the heap.
+    void operator()(char *buffer) const noexcept;
+  };
+
+  using Buffer = std::unique_ptr<char[], Deleter>; //!< An allocated buffer.
+
+  static Buffer Allocate(size_t size, bool huge_pages = true,
+                         Backing *backing = nullptr) noexcept(false);
+  static const char *BackingName(Backing backing) noexcept;
+
+private:
+  static Buffer Map(size_t size, bool huge_pages, Backing &backing) noexcept;
+};
+
+#endif // MEMORYACCESSOR_SRC_BUFFERALLOCATOR_H_
@@ -25,33 +25,56 @@
 
 #include "console.h"
 
+#include <fcntl.h>
 #include <readline/history.h>
 #include <readline/readline.h>
 #include <signal.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <array>
+#include <cctype> // isdigit
+#include <chrono>
 #include <cmath> // log10
+#include <csignal>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
-#include <iomanip> // setfill, setw
+#include <ctime> // clock
+#include <iomanip> // setfill, setw, setprecision
 #include <iostream>
 #include <map>
 #include <memory>
 #include <ostream>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "blockcodec.h"
+#include "blockreader.h"
+#include "blockwriter.h"
+#include "bufferallocator.h"
+#include "diffevents.h"
+#include "diffscanner.h"
 #include "hexviewer.h"
+#include "mapsdelta.h"
 #include "memoryaccessor.h"
+#include "pagerepository.h"
+#include "pointerindex.h"
 #include "segmentinfo.h"
+#include "snapshotfile.h"
 #include "tools.h"
+#include "watchpoint.h"
 
 bool ctrl_c_pressed{
     false}; //!< Shows if Ctrl-C was pressed if the instance of class Console is
@@ -79,6 +102,9 @@ static std::unordered_set<std::string>
 static Console *current_console_p{
     nullptr}; //!< Pointer to the current instance of Console class.
 
+static volatile std::sig_atomic_t diff_summary_requested{
+    0}; //!< Set when SIGUSR1 is received during "diff".
+
 extern "C" {
 /*!
  \brief Console Ctrl-C handler.
@@ -103,6 +129,16 @@ static void CtrlC(int signum) noexcept {
   ctrl_c_pressed = true;
 }
 
+/*!
+ \brief Diff summary request handler.
+ \param [in] signum Signal number.
+
+ Attached to SIGUSR1 during "diff", sets diff_summary_requested.
+*/
+static void DiffSummaryRequest([[maybe_unused]] int signum) noexcept {
+  diff_summary_requested = 1;
+}
+
 // Ниже 4 функции, за основу которых была взята функция из
 // документации: command_generator
 
@@ -289,6 +325,20 @@ static char **completion(const char *text, int start, int end) noexcept {
 // Конец заимствования.
 }
 
+/*!
+ \brief Format time as local date and time.
+ \param [in] time Seconds since the epoch.
+ \return std::string "YYYY-MM-DD HH:MM:SS".
+*/
+static std::string FormatTime(uint64_t time) noexcept {
+  std::time_t value{static_cast<std::time_t>(time)};
+  std::tm tm{};
+  localtime_r(&value, &tm);
+  std::ostringstream oss;
+  oss << std::put_time(&tm, "%Y-%m-%d %H:%M:%S");
+  return oss.str();
+}
+
 } // namespace memoryaccessor_console_src
 
 /*!
@@ -328,6 +378,7 @@ Console::~Console() noexcept {
 
   memoryaccessor_console_src::current_console_p = nullptr;
   rl_attempted_completion_function = nullptr;
+  memory_accessor_.SetJournal(nullptr);
 
   one_instance_created_ = false;
 }
@@ -509,6 +560,10 @@ void Console::PrintError0Arg(const Error0Arg &error) const noexcept {
       std::cerr << "Reached segment to which we don't have access."
                 << std::endl;
     break;
+  case Error0Arg::kPrintJournalFail:
+    std::cerr << "Couldn't record the write to the journal, it is not done."
+              << std::endl;
+    break;
   }
 }
 
@@ -862,6 +917,12 @@ uint8_t Console::WriteSegWrapper(char *src, const size_t &num, size_t start,
   try {
     try {
       memory_accessor_.WriteSegment(src, num, start, amount);
+    } catch (const WriteJournal::JournalFileEx &ex) {
+      PrintError0Arg(Error0Arg::kPrintJournalFail);
+      throw WrapperException(1);
+    } catch (const std::bad_alloc &ex) {
+      PrintError0Arg(Error0Arg::kPrintJournalFail);
+      throw WrapperException(1);
     } catch (const MemoryAccessor::PidNotSetEx &ex) {
       PrintError0Arg(Error0Arg::kPidNotSet);
       throw WrapperException(1);
@@ -924,16 +985,25 @@ uint8_t Console::ReadWrapper(char *dst, size_t address, size_t amount,
  \param [in] address Address to start from.
  \param [in] amount Number of bytes to write.
  \param [out] done_amount How much data were written (add to existing value).
+ \param [in] continued true if it is not the first piece of the write, so the
+ journal records the pieces as one write.
  \return Return code, 0 is success, 1 is a "bad" error (related to PID or
  /proc/PID/mem), 2 is a segment error.
 
  Write data to /proc/PID/mem and print messages to stderr in case of errors.
 */
 uint8_t Console::WriteWrapper(char *src, size_t address, size_t amount,
-                              size_t &done_amount) const noexcept {
+                              size_t &done_amount,
+                              bool continued) const noexcept {
   try {
     try {
-      memory_accessor_.Write(src, address, amount, done_amount);
+      memory_accessor_.Write(src, address, amount, done_amount, continued);
+    } catch (const WriteJournal::JournalFileEx &ex) {
+      PrintError0Arg(Error0Arg::kPrintJournalFail);
+      throw WrapperException(1);
+    } catch (const std::bad_alloc &ex) {
+      PrintError0Arg(Error0Arg::kPrintJournalFail);
+      throw WrapperException(1);
     } catch (const MemoryAccessor::PidNotSetEx &ex) {
       PrintError0Arg(Error0Arg::kPidNotSet);
       throw WrapperException(1);
@@ -955,461 +1025,3199 @@ uint8_t Console::WriteWrapper(char *src, size_t address, size_t amount,
 }
 
 /*!
- \brief Dump segment to unique_ptr (related to diff).
- \param [out] mem_dump Destination in which dump will be created.
- \param [in] num Number of the segment.
- \return Return code, 0 is success, 1 is a "bad" error (related to PID or
- /proc/PID/mem).
-
- Dump segment to unique_ptr variable located outside. If have no access or
- segment does not exist, unique_ptr contains nullptr. Returns 1 in case of a
- "bad" error, otherwise returns 0.
-*/
-uint8_t Console::DiffReadSeg(std::unique_ptr<char[]> &mem_dump,
-                             const size_t &num) noexcept {
-  mem_dump =
-      std::make_unique<char[]>(memory_accessor_.segment_infos_[num].end -
-                               memory_accessor_.segment_infos_[num].start);
-  switch (ReadSegWrapper(mem_dump.get(), num)) {
-  case 1:
+ \brief Parse a filter expression and print messages in case of errors.
+ \param [in] expression The expression.
+ \param [out] filter RegionFilter to parse the expression to.
+ \return Return code, 0 is success, 1 is an error.
+
+ Parse the expression by RegionFilter::Parse and print messages to stderr in
+ case of errors. An empty expression selects everything.
+*/
+uint8_t Console::ParseFilterWrapper(const std::string &expression,
+                                    RegionFilter &filter) const noexcept {
+  try {
+    filter.Parse(expression);
+  } catch (const RegionFilter::ParseEx &ex) {
+    std::cerr << "Invalid filter term: " << ex.term << std::endl;
+    return 1;
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to parse the filter." << std::endl;
     return 1;
-  case 2:
-    mem_dump.reset();
-  default:
-    return 0;
   }
+  return 0;
 }
 
 /*!
- \brief Compare parts of segments, print differences and replace if possible
- (related to diff). \param [in] old_dump Pointer to the beginning of an old
- segment. \param [in] new_dump Pointer to the beginning of a new segment. \param
- [in] o_offs Offset for an old segment. \param [in] n_offs Offset for a new
- segment. \param [in] amount Amount of data to process. \param [in] start_addr
- Address of the beginning of the compared data in victim process. \param [in]
- length Length of differences to find. \param [in] replacement String to replace
- difference.
-
- Compare parts of old and new segments specified by their offsets and amount of
- data to process, find differences of specified length and print to stdout, and
- replace found arrays to replacement string in memory, if replacement is not
- empty.
-*/
-void Console::DiffCompare(const char *old_dump, const char *new_dump,
-                          const size_t &o_offs, const size_t &n_offs,
-                          size_t amount, size_t start_addr,
-                          const size_t &length,
-                          const std::string &replacement) noexcept {
-  if (old_dump && new_dump) {
-    std::array<std::unique_ptr<char[]>, 2> found;
-    old_dump += o_offs;
-    new_dump += n_offs;
-    start_addr -= length;
-    std::ostringstream oss;
-    size_t done{0};
-
-    while (amount) {
-      found =
-          tools_.FindDifferencesOfLen(old_dump, new_dump, amount, done, length);
-      old_dump += done;
-      new_dump += done;
-      amount -= done;
-      start_addr += done;
-
-      if (found[0] && found[1]) {
-        std::cout << "Found:\n";
-        hex_viewer_.PrintHex(&std::cout, found[0].get(), length, start_addr,
-                             true);
-        hex_viewer_.PrintHex(&std::cout, found[1].get(), length, start_addr,
-                             true);
-
-        if (!replacement.empty()) {
-          oss.clear();
-          oss.str("");
-          oss << std::hex << start_addr;
-          HandleCommand("write " + oss.str() + " " + std::to_string(length) +
-                        " " + replacement);
-        }
-      }
+ \brief Parse a value of a type (related to diff and freeze).
+ \param [in] s String with the value.
+ \param [in] type Type of the value, not kRaw.
+ \param [out] int_value Bits of the value for integer types.
+ \param [out] float_value The value for floating point types.
+ \return 0 on success, 1 on error (the error is printed).
+
+ Integers may be decimal, octal or hexadecimal and have to fit in the type as
+ signed or unsigned values.
+*/
+uint8_t Console::DiffParseValue(const std::string &s,
+                                DiffScanner::ValueType type,
+                                uint64_t &int_value,
+                                double &float_value) const noexcept {
+  size_t bits{DiffScanner::TypeSize(type) * 8};
+  try {
+    size_t pos{0};
+    if (type == DiffScanner::ValueType::kFloat ||
+        type == DiffScanner::ValueType::kDouble)
+      float_value = std::stod(s, &pos);
+    else if (!s.empty() && s[0] == '-') {
+      int64_t value{std::stoll(s, &pos, 0)};
+      if (bits < 64 && value < -(int64_t{1} << (bits - 1)))
+        throw std::out_of_range(s);
+      int_value = static_cast<uint64_t>(value);
+    } else {
+      int_value = std::stoull(s, &pos, 0);
+      if (bits < 64 && int_value >> bits)
+        throw std::out_of_range(s);
     }
+    if (pos != s.length())
+      throw std::invalid_argument(s);
+  } catch (const std::invalid_argument &ex) {
+    std::cerr << "Invalid value: " << s << std::endl;
+    return 1;
+  } catch (const std::out_of_range &ex) {
+    std::cerr << "Value is out of range: " << s << std::endl;
+    return 1;
   }
+  return 0;
 }
 
 /*!
- \brief Go to next old segment (related to diff).
- \param [in,out] i Current number of the old segment in use.
- \param [in] old_segments_amount Amount of old segments.
- \param [out] it An iterator referring to the used old segment in full_dump.
- \param [out] full_dump Vector of dumped segments that is updating.
- \return Return code, 0 is success, 1 means that the end of old segments is
- reached.
-
- Increment old segment in use: add 1 to its number (i) and erase previous
- segment in full_dump.
+ \brief Parse the name of a type of values (related to diff and freeze).
+ \param [in] type_str Name of the type: i16, i32, i64, u16, u32, u64, f32 or
+ f64.
+ \param [out] type Parsed type.
+ \return 0 on success, 1 on error (the error is printed).
 */
-uint8_t
-Console::DiffOldNext(size_t &i, const size_t &old_segments_amount,
-                     std::vector<std::unique_ptr<char[]>>::iterator &it,
-                     std::vector<std::unique_ptr<char[]>> &full_dump) noexcept {
-  it = full_dump.erase(it);
-  i++;
-  if (i == old_segments_amount)
+uint8_t Console::ParseTypeWrapper(const std::string &type_str,
+                                  DiffScanner::ValueType &type) const noexcept {
+  using ValueType = DiffScanner::ValueType;
+  static const std::map<std::string, ValueType> kTypes{
+      {"i16", ValueType::kInt16},  {"i32", ValueType::kInt32},
+      {"i64", ValueType::kInt64},  {"u16", ValueType::kUint16},
+      {"u32", ValueType::kUint32}, {"u64", ValueType::kUint64},
+      {"f32", ValueType::kFloat},  {"f64", ValueType::kDouble}};
+
+  auto type_it{kTypes.find(type_str)};
+  if (type_it == kTypes.end()) {
+    std::cerr << "Invalid type: " << type_str << std::endl;
     return 1;
+  }
+  type = type_it->second;
   return 0;
 }
 
 /*!
- \brief Go to next new segment (related to diff).
- \param [in,out] j Current number of the new segment in use.
- \param [out] it An iterator referring to the used old segment in full_dump.
- \param [out] mem_dump unique_ptr containing dump of current new segment in use.
- \param [out] full_dump Vector of dumped segments that is updating.
- \return Return code, 0 is success, 1 means that the end of new segments is
- reached.
+ \brief Get bytes of a value of a type (related to diff and freeze).
+ \param [in] type Type of the value, not kRaw.
+ \param [in] int_value Bits of the value for integer types.
+ \param [in] float_value The value for floating point types.
+ \return DiffScanner::TypeSize(type) bytes of the value (little-endian).
+ \throw std::bad_alloc If memory cannot be allocated.
+*/
+std::string Console::ValueBytes(DiffScanner::ValueType type, uint64_t int_value,
+                                double float_value) noexcept(false) {
+  size_t size{DiffScanner::TypeSize(type)};
+  if (type == DiffScanner::ValueType::kFloat) {
+    float value{static_cast<float>(float_value)};
+    return {reinterpret_cast<const char *>(&value), size};
+  }
+  if (type == DiffScanner::ValueType::kDouble)
+    return {reinterpret_cast<const char *>(&float_value), size};
+  return {reinterpret_cast<const char *>(&int_value), size}; // little-endian
+}
 
- Increment new segment in use: insert previous new in full_dump before the old
- segment in use, add 1 to its number (j) and create dump of the next new segment
- in mem_dump.
+/*!
+ \brief Parse the type and the predicate of typed diff.
+ \param [in] type_str Name of the type, typed mode is off if it is empty.
+ \param [in] predicate_str Predicate: any, +N, -N, inc, dec or ~E.
+ \param [out] query Parsed query.
+ \return 0 on success, 1 on error (the error is printed).
 */
-uint8_t
-Console::DiffNewNext(size_t &j,
-                     std::vector<std::unique_ptr<char[]>>::iterator &it,
-                     std::unique_ptr<char[]> &mem_dump,
-                     std::vector<std::unique_ptr<char[]>> &full_dump) noexcept {
-  full_dump.insert(it, std::move(mem_dump));
-  it++;
-  j++;
-  if (DiffReadSeg(mem_dump, j))
-    return 2;
-  if (j == memory_accessor_.segment_infos_.size())
+uint8_t Console::DiffParseQuery(const std::string &type_str,
+                                const std::string &predicate_str,
+                                DiffScanner::Query &query) const noexcept {
+  using Predicate = DiffScanner::Predicate;
+
+  query = DiffScanner::Query();
+  if (type_str.empty()) {
+    if (!predicate_str.empty()) {
+      std::cerr << "Predicate needs a type." << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  if (ParseTypeWrapper(type_str, query.type) != 0)
+    return 1;
+
+  if (predicate_str.empty() || predicate_str == "any")
+    query.predicate = Predicate::kAny;
+  else if (predicate_str == "inc")
+    query.predicate = Predicate::kIncreased;
+  else if (predicate_str == "dec")
+    query.predicate = Predicate::kDecreased;
+  else if (predicate_str[0] == '+' || predicate_str[0] == '-' ||
+           predicate_str[0] == '~') {
+    query.predicate = predicate_str[0] == '+'   ? Predicate::kAdd
+                      : predicate_str[0] == '-' ? Predicate::kSub
+                                                : Predicate::kNear;
+    std::string value_str{predicate_str.substr(1)};
+    if (value_str.empty() || value_str[0] == '-' || value_str[0] == '+') {
+      std::cerr << "Invalid predicate: " << predicate_str << std::endl;
+      return 1;
+    }
+    if (DiffParseValue(value_str, query.type, query.int_value,
+                       query.float_value) != 0)
+      return 1;
+  } else {
+    std::cerr << "Invalid predicate: " << predicate_str << std::endl;
     return 1;
+  }
   return 0;
 }
 
 /*!
- \brief Handle command "help".
- \param [in] parent Related Command object.
- \param [in] args Arguments for the command.
-
- Print project name, version and description, and then list all descriptions of
- commands.
+ \brief Print a found difference and replace it if needed (related to diff).
+ \param [in] old_bytes Old version of the difference.
+ \param [in] new_bytes New version of the difference.
+ \param [in] address Address of the difference in victim process.
+ \param [in] length Length of old_bytes and new_bytes.
+ \param [in] size Size of the difference (greater than length if the bytes
+ are a preview of a range).
+ \param [in,out] state State of diff.
+
+ Record the difference to the stream of events with the path of its segment
+ (from the segments of state, if there are any, or from the latest maps) and
+ queue its replacement to the replacement string (no longer than the
+ difference), if replacement is not empty.
 */
-void Console::CommandHelp(const Command &parent,
-                          const std::vector<std::string> &args) noexcept {
-  PrintNameVer();
-  std::cout << kProjectDescription << std::endl;
-  //	std::cout << std::endl;
-  std::cout << "Commands:\n" << std::endl;
+void Console::DiffReport(const char *old_bytes, const char *new_bytes,
+                         size_t address, size_t length, size_t size,
+                         DiffState &state) noexcept {
+  const std::vector<SegmentInfo> &segment_infos{
+      state.segments.empty() ? memory_accessor_.segment_infos_
+                             : state.segments};
+  auto segment_it{std::partition_point(
+      segment_infos.begin(), segment_infos.end(),
+      [address](const SegmentInfo &info) { return info.end <= address; })};
+  static const std::string kNoSegment;
 
-  uint32_t middle{0};
-  for (const Command &command : kCommands) {
-    for (const std::array<std::string, 2> &line : command.description) {
-      if (line[0].length() > middle)
-        middle = line[0].length();
-    }
+  try {
+    state.events.Record(
+        address, old_bytes, new_bytes, length, size,
+        segment_it == segment_infos.end() ? kNoSegment : segment_it->path,
+        std::chrono::duration<double>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count());
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to record a difference." << std::endl;
   }
 
-  for (const Command &command : kCommands) {
-    PrintDescription(command, 2, middle);
-    std::cout << std::endl;
+  if (!state.replacement.empty()) {
+    try {
+      state.writes.Add(address, state.replacement.data(),
+                       std::min(size, state.replacement.length()));
+    } catch (const std::bad_alloc &ex) {
+      std::cerr << "Not enough memory to queue a replacement." << std::endl;
+    }
   }
 }
 
 /*!
- \brief Handle command "name".
- \param [in] parent Related Command object.
- \param [in] args Arguments for the command.
+ \brief Write queued replacements (related to diff).
+ \param [in,out] state State of diff.
 
- Search for PID by process name provided as the first argument and set PID by
- calling command_pid if only 1 PID found, or set PID number pid_num of found
- PIDs if pid_num is specified (starting from 0) as the second argument. Print
- usage otherwise.
+ Record the write batch of the pass to the journal as one write (if it is on),
+ apply it through memory_accessor_ and print how many replacements were
+ written, then clear the batch. A batch that cannot be recorded is not
+ written.
 */
-void Console::CommandName(const Command &parent,
-                          const std::vector<std::string> &args) noexcept {
-  if (args.size() < 1) {
-    ShowUsage(parent);
+void Console::DiffApplyWrites(DiffState &state) noexcept {
+  if (state.writes.Empty())
     return;
-  }
 
-  int pid_num{-1};
-  if (args.size() >= 2)
-    if (StoiWrapper(args[1], pid_num, "pid number") != 0)
-      return;
+  size_t written{JournalBatch(state.writes, false) == 0
+                     ? state.writes.Apply(memory_accessor_)
+                     : 0};
+  std::cout << "Replaced " << std::dec << written << " of "
+            << state.writes.Size() << " differences." << std::endl;
+  state.writes.Clear();
+}
 
-  std::unordered_set<pid_t> pids{tools_.FindPidsByName(args[0])};
-  switch (pids.size()) {
-  case 0:
-    std::cerr << "No PID found by name: " + args[0] << std::endl;
-    break;
+/*!
+ \brief Finish the unfinished run (related to diff).
+ \param [in,out] state State of diff.
 
-  case 1:
-    std::cout << "Found PID: " + std::to_string(*(pids.begin())) << std::endl;
-    HandleCommand("pid " + std::to_string(*(pids.begin())));
-    break;
+ Report the unfinished run of different bytes if its length is equal to the
+ length of differences to find, and forget it. In range mode, report the
+ unfinished range and forget it.
+*/
+void Console::DiffFlush(DiffState &state) noexcept {
+  if (state.run_length && state.run_length == state.length)
+    DiffReport(state.run_old.get(), state.run_new.get(), state.run_address,
+               state.length, state.length, state);
+  state.run_length = 0;
+
+  if (state.range.length)
+    DiffReport(state.range.old_bytes.data(), state.range.new_bytes.data(),
+               state.range.address,
+               std::min(state.range.preview, state.range.length),
+               state.range.length, state);
+  state.range.length = 0;
+}
 
-  default:
-    std::cout << "Found PIDs: ";
-    for (const pid_t &p : pids)
-      std::cout << std::to_string(p) + ' ';
-    std::cout << std::endl;
-    if (pid_num == -1)
-      std::cout << "Set any of them with the command \"pid\"." << std::endl;
-    else {
-      if (pid_num < 0 || pid_num > pids.size() - 1)
-        std::cerr << "Wrong found PID number: " << args[1] << std::endl;
-      else {
-        auto pid_iterator{pids.begin()};
-        std::advance(pid_iterator, pid_num);
-        HandleCommand("pid " + std::to_string(*pid_iterator));
+/*!
+ \brief Merge changed ranges of a block (related to diff).
+ \param [in,out] state State of diff.
+ \param [in] piece Result of DiffScanner::ScanRanges.
+
+ Continue the unfinished range with the first range of the block if the block
+ follows the previously merged one and the gap between them is short enough
+ (the preview is continued if the ranges touch), otherwise report it. Ranges
+ inside the block are reported when the next one does not continue them, the
+ last one stays unfinished.
+*/
+void Console::DiffMergeRanges(DiffState &state,
+                              const DiffScanner::Piece &piece) noexcept {
+  constexpr size_t kPreviewSize{DiffScanner::kPreviewSize};
+  DiffScanner::Range &pending{state.range};
+
+  if (pending.length && state.merged_end != piece.address)
+    DiffFlush(state);
+
+  for (const DiffScanner::Range &range : piece.ranges) {
+    if (pending.length &&
+        range.address - pending.address - pending.length <= state.gap) {
+      if (pending.preview < kPreviewSize &&
+          pending.address + pending.preview == range.address) {
+        size_t count{std::min(kPreviewSize - pending.preview, range.preview)};
+        std::memcpy(pending.old_bytes.data() + pending.preview,
+                    range.old_bytes.data(), count);
+        std::memcpy(pending.new_bytes.data() + pending.preview,
+                    range.new_bytes.data(), count);
+        pending.preview += count;
       }
+      pending.length = range.address + range.length - pending.address;
+    } else {
+      DiffFlush(state);
+      pending = range;
     }
-    break;
   }
+  state.merged_end = piece.address + piece.amount;
 }
 
 /*!
- \brief Handle command "pid".
- \param [in] parent Related Command object.
- \param [in] args Arguments for the command.
-
- Set PID provided as the first argument and parse /proc/PID/maps. Print usage
- otherwise.
+ \brief Merge the result of comparing a block (related to diff).
+ \param [in,out] state State of diff.
+ \param [in] piece Result of DiffScanner::ScanPiece.
+
+ Continue the unfinished run with the run at the start of the block, or report
+ and forget the unfinished run if it has ended. Then report runs of the
+ searched length found inside the block and keep the run at the end of the
+ block as the unfinished one, so runs are not cut on boundaries of blocks. In
+ range mode, ranges are merged by DiffMergeRanges.
 */
-void Console::CommandPid(const Command &parent,
-                         const std::vector<std::string> &args) noexcept {
-  if (args.size() < 1) {
-    ShowUsage(parent);
+void Console::DiffMergePiece(DiffState &state,
+                             const DiffScanner::Piece &piece) noexcept {
+  if (!piece.amount)
+    return;
+  if (state.ranges) {
+    DiffMergeRanges(state, piece);
     return;
   }
 
-  pid_t pid{0};
-  if (StoiWrapper(args[0], pid, "PID") != 0)
-    return;
+  if (state.run_length && state.run_address + state.run_length != piece.address)
+    DiffFlush(state);
+
+  if (piece.head.length) {
+    if (!state.run_length)
+      state.run_address = piece.address;
+    for (size_t i{0};
+         i < piece.head.old_bytes.size() && state.run_length + i < state.length;
+         i++) {
+      state.run_old[state.run_length + i] = piece.head.old_bytes[i];
+      state.run_new[state.run_length + i] = piece.head.new_bytes[i];
+    }
+    state.run_length += piece.head.length;
+    if (piece.head.length == piece.amount)
+      return;
+  }
 
-  try {
-    memory_accessor_.SetPid(pid);
-    std::cout << "Set PID: " << args[0] << std::endl;
-  } catch (const MemoryAccessor::ErrCheckingPidEx &ex) {
-    PrintError0Arg(Error0Arg::kErrCheckingPid);
-    return;
-  } catch (const MemoryAccessor::PidNotExistEx &ex) {
-    std::cerr << "The process with PID " << args[0] << " does not exist."
-              << std::endl;
-    return;
+  DiffFlush(state);
+
+  for (const DiffScanner::Run &run : piece.found)
+    DiffReport(run.old_bytes.data(), run.new_bytes.data(), run.address,
+               state.length, state.length, state);
+
+  if (piece.tail.length) {
+    state.run_address = piece.tail.address;
+    state.run_length = piece.tail.length;
+    std::memcpy(state.run_old.get(), piece.tail.old_bytes.data(),
+                piece.tail.old_bytes.size());
+    std::memcpy(state.run_new.get(), piece.tail.new_bytes.data(),
+                piece.tail.new_bytes.size());
   }
+}
 
-  std::cout << "Parsing /proc/" << args[0] << "/maps..." << std::endl;
-  if (ParseMapsWrapper() != 0)
+/*!
+ \brief Compare blocks of old and new data, print differences and replace if
+ possible (related to diff).
+ \param [in,out] state State of diff.
+ \param [in] old_dump Pointer to the old data.
+ \param [in] new_dump Pointer to the new data.
+ \param [in] amount Amount of data to process.
+ \param [in] start_addr Address of the beginning of the compared data in
+ victim process.
+
+ Compare old and new data, find differences of specified length, print them to
+ stdout and replace them to the replacement string in memory, if replacement is
+ not empty. Blocks may be passed in parts, runs continue from one part to the
+ next if it starts at the next address.
+*/
+void Console::DiffCompare(DiffState &state, const char *old_dump,
+                          const char *new_dump, size_t amount,
+                          size_t start_addr) noexcept {
+  diff_scanner_.Compare(old_dump, new_dump, amount, start_addr, state.length,
+                        state.piece);
+  DiffMergePiece(state, state.piece);
+}
+
+/*!
+ \brief Merge the result of a task of DiffScanner (related to diff).
+ \param [in,out] state State of diff.
+ \param [in] result Result of the task.
+
+ Merge compared blocks in order. In hash mode, compare copies of hot pages to
+ the new data and update them, and make pages hot if their hashes have
+ changed, so their next change can be found. Called in order of addresses.
+*/
+void Console::DiffMergeResult(DiffState &state,
+                              const DiffScanner::Result &result) noexcept {
+  constexpr size_t kPageSize{SnapshotStore::kPageSize};
+
+  if (!diff_store_.HashMode()) {
+    for (const DiffScanner::Piece &piece : result.pieces)
+      DiffMergePiece(state, piece);
     return;
+  }
 
-  bool any_special_segment_found{false};
-  for (const std::pair<std::string, SegmentInfo *> &p :
-       memory_accessor_.special_segment_found_) {
-    if (std::get<1>(p)) {
-      if (!any_special_segment_found) {
-        any_special_segment_found = true;
-        std::cout << "Found:";
+  for (size_t i{0}; i < result.pages.size(); i++) {
+    size_t offset{i * kPageSize},
+        size{std::min(kPageSize, result.amount - offset)},
+        address{result.address + offset};
+    bool changed{result.pages[i] == DiffScanner::PageState::kChanged};
+
+    SnapshotStore::HotPage *hot_page{
+        diff_store_.HotPagesCount() ? diff_store_.FindHotPage(address)
+                                    : nullptr};
+    if (hot_page) {
+      if (result.pages[i] != DiffScanner::PageState::kSame) {
+        DiffCompare(state, hot_page->data.get(), result.data + offset, size,
+                    address);
+        std::memcpy(hot_page->data.get(), result.data + offset, size);
       }
-      std::cout << " " << std::get<0>(p);
+      if (changed)
+        hot_page->last_change = state.iteration;
+    } else if (changed) {
+      hot_page = diff_store_.AddHotPage(address, state.iteration);
+      if (hot_page)
+        std::memcpy(hot_page->data.get(), result.data + offset, size);
     }
   }
-  if (any_special_segment_found)
-    std::cout << std::endl;
+}
 
-  std::cout << "Found "
-            << std::to_string(memory_accessor_.segment_infos_.size())
-            << (memory_accessor_.segment_infos_.size() == 1 ? " segment"
-                                                            : " segments")
-            << " in total." << std::endl;
+/*!
+ \brief Update stored segments and find differences (related to diff).
+ \param [in,out] state State of diff.
+ \return Return code, 0 is success, 1 is a "bad" error (not enough memory or
+ threads cannot be started), 2 means that Ctrl-C was pressed.
+
+ Update the layout of diff_store_ according to the latest maps (only memory
+ selected by the filter, cut to its address ranges), then make a pass with
+ diff_scanner_: kept regions are updated in place, fresh ones are read and
+ compared to the retired regions they overlap (in hash mode, only hashes of
+ pages and copies of hot pages are updated). Results are merged in order of
+ addresses, and replacements found by the pass are written at once after it.
+ Collapsed repeated changes are emitted if it is time. Retired regions are
+ released after the pass, and hot pages that have not changed for
+ kHotPageAge iterations are forgotten.
+*/
+uint8_t Console::DiffUpdate(DiffState &state) noexcept {
+  uint8_t result{0};
+  try {
+    const std::vector<SegmentInfo> *segment_infos{
+        &memory_accessor_.segment_infos_};
+    if (!state.filter.Empty()) {
+      state.segments.clear();
+      for (const RegionFilter::Interval &interval :
+           state.filter.Compile(memory_accessor_.segment_infos_)) {
+        state.segments.push_back(memory_accessor_.segment_infos_[interval.num]);
+        state.segments.back().start = interval.start;
+        state.segments.back().end = interval.end;
+      }
+      segment_infos = &state.segments;
+    }
+
+    diff_store_.Update(*segment_infos);
+    result = diff_scanner_.Scan(
+        memory_accessor_, diff_store_, tools_, state.length, state.iteration,
+        [this, &state](const DiffScanner::Result &task_result) {
+          DiffMergeResult(state, task_result);
+        },
+        [] { return ctrl_c_pressed; });
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to store segments." << std::endl;
+    return 1;
+  } catch (const SnapshotStore::ScratchFileEx &ex) {
+    std::cerr << "Couldn't create a scratch file in \""
+              << diff_store_.ScratchDir() << "\"." << std::endl;
+    return 1;
+  } catch (const std::system_error &ex) {
+    std::cerr << "Couldn't start threads: " << ex.what() << std::endl;
+    return 1;
+  }
+
+  if (result == 2) {
+    DiffApplyWrites(state);
+    ctrl_c_pressed = false;
+    return 2;
+  }
+
+  DiffFlush(state);
+  DiffApplyWrites(state);
+  try {
+    state.events.Flush(std::chrono::duration<double>(
+                           std::chrono::system_clock::now().time_since_epoch())
+                           .count(),
+                       false);
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to emit events." << std::endl;
+  }
+  diff_store_.ReleaseRetired();
+  if (diff_store_.HashMode())
+    diff_store_.AgeHotPages(state.iteration, kHotPageAge);
+  diff_store_.AdviseSpilled();
+  if (state.iteration % kDiffRebalancePeriod == kDiffRebalancePeriod - 1) {
+    try {
+      diff_store_.Rebalance();
+    } catch (const std::bad_alloc &ex) {
+      std::cerr << "Not enough memory to rebalance copies." << std::endl;
+    } catch (const SnapshotStore::ScratchFileEx &ex) {
+      std::cerr << "Couldn't create a scratch file in \""
+                << diff_store_.ScratchDir() << "\"." << std::endl;
+    }
+  }
+  state.read_bytes += diff_scanner_.ScannedBytes();
+  state.total_bytes += diff_scanner_.TotalBytes();
+  state.iteration++;
+  return 0;
 }
 
 /*!
- \brief Handle command "maps".
- \param [in] parent Related Command object.
- \param [in] args Arguments for the command.
+ \brief Wait before the next pass (related to diff).
+ \param [in,out] state State of diff.
+ \return Return code, 0 is success, 2 means that Ctrl-C was pressed.
+
+ Sleep until the latest pass has taken at least the interval, and until the
+ average reading speed and CPU usage of the pass fall to their budgets. Ctrl-C
+ is checked every kDiffSleepStep. Print the status if kDiffStatusPeriod has
+ passed since it was printed last time.
+*/
+uint8_t Console::DiffPause(DiffState &state) noexcept {
+  using Seconds = std::chrono::duration<double>;
+
+  double pause{static_cast<double>(state.interval) / 1000};
+  if (state.byte_budget)
+    pause = std::max(pause, static_cast<double>(diff_scanner_.ScannedBytes()) /
+                                static_cast<double>(state.byte_budget));
+  if (state.cpu_budget)
+    pause = std::max(pause, static_cast<double>(std::clock() -
+                                                state.pass_cpu_begin) /
+                                CLOCKS_PER_SEC * 100 /
+                                static_cast<double>(state.cpu_budget));
+
+  auto until{state.pass_begin +
+             std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                 Seconds(pause))};
+  for (auto now{std::chrono::steady_clock::now()}; now < until;
+       now = std::chrono::steady_clock::now()) {
+    if (ctrl_c_pressed) {
+      ctrl_c_pressed = false;
+      return 2;
+    }
+    if (memoryaccessor_console_src::diff_summary_requested)
+      DiffPrintSummary(state);
+    std::this_thread::sleep_for(
+        std::min<std::chrono::steady_clock::duration>(until - now,
+                                                      kDiffSleepStep));
+  }
 
- Print to stdout memory segments found by parsing /proc/PID/maps.
+  if (memoryaccessor_console_src::diff_summary_requested)
+    DiffPrintSummary(state);
+  if (std::chrono::steady_clock::now() - state.status_time >=
+      kDiffStatusPeriod) {
+    DiffPrintStatus(state);
+    state.status_time = std::chrono::steady_clock::now();
+  }
+  return 0;
+}
+
+/*!
+ \brief Print an event to the terminal (related to diff).
+ \param [in] event The event.
+
+ Print old and new bytes of a change, or of the latest change at an address
+ with the amount of changes collapsed into a repeat event.
 */
-void Console::CommandMaps(const Command &parent,
-                          const std::vector<std::string> &args) noexcept {
+void Console::DiffPrintEvent(const DiffEvents::Event &event) noexcept {
+  if (event.type == DiffEvents::EventType::kChange)
+    std::cout << "Found";
+  else
+    std::cout << "Changed " << std::dec << event.count << " more time(s), "
+              << event.total << " in total";
+  if (event.size > event.old_bytes.length()) // preview of a range
+    std::cout << " (" << std::dec << event.size << " bytes)";
+  std::cout << ":\n";
+  hex_viewer_.PrintHex(&std::cout, event.old_bytes.data(),
+                       event.old_bytes.length(), event.address, true);
+  hex_viewer_.PrintHex(&std::cout, event.new_bytes.data(),
+                       event.new_bytes.length(), event.address, true);
+}
+
+/*!
+ \brief Print the summary of events (related to diff).
+ \param [in,out] state State of diff.
+
+ Emit collapsed repeated changes, then print the amount of changes and
+ addresses and the most changed addresses to stdout, and write the summary to
+ the file for NDJSON, if it is opened. Clear the request of the summary.
+*/
+void Console::DiffPrintSummary(DiffState &state) noexcept {
+  memoryaccessor_console_src::diff_summary_requested = 0;
+  double time{std::chrono::duration<double>(
+                  std::chrono::system_clock::now().time_since_epoch())
+                  .count()};
   try {
-    memory_accessor_.CheckPid();
-    PrintSegments(memory_accessor_.segment_infos_);
-  } catch (const MemoryAccessor::PidNotSetEx &ex) {
-    PrintError0Arg(Error0Arg::kPidNotSet);
+    state.events.Flush(time, true);
+    std::cout << "Changes: " << std::dec << state.events.Changes() << " at "
+              << state.events.Addresses() << " address(es).\n";
+    for (const auto &[address, entry] : state.events.Top())
+      std::cout << "  " << std::hex << address << std::dec << "  "
+                << std::setw(10) << std::left << entry->total << entry->segment
+                << '\n';
+    std::cout << std::flush;
+    if (state.events_file.is_open())
+      state.events.WriteSummary(state.events_file, time);
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to print the summary." << std::endl;
   }
 }
 
 /*!
- \brief Handle command "view".
- \param [in] parent Related Command object.
- \param [in] args Arguments for the command.
+ \brief Print statistics of passes (related to diff).
+ \param [in] state State of diff.
 
- Print data of memory segment with name or PID provided as the first argument.
- If there are multiple segments with the same name, print data from the first
- matching. Keys available: "-h" - show hex (if no "-r" specified), "-r" - print
- raw data, "-f file" write output to file "file". Print usage in case of usage
- errors.
+ Print the amount of passes, the amount of bytes read, the average reading
+ speed, the coverage: the part of stored bytes that were read by a pass on
+ average, the peak RSS of the program and the size of spilled copies.
 */
-void Console::CommandView(const Command &parent,
-                          const std::vector<std::string> &args) noexcept {
-  bool raw{false}, hex{false};
+void Console::DiffPrintStatus(const DiffState &state) const noexcept {
+  double seconds{std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - state.begin)
+                     .count()};
+  double mib{static_cast<double>(state.read_bytes) / 0x100000};
+  std::ostringstream status;
+  status << "Passes: " << state.iteration << ", read " << std::fixed
+         << std::setprecision(1) << mib << " MiB ("
+         << (seconds > 0 ? mib / seconds : 0) << " MiB/s), coverage "
+         << (state.total_bytes ? static_cast<double>(state.read_bytes) * 100 /
+                                     static_cast<double>(state.total_bytes)
+                               : 0)
+         << "%, peak RSS "
+         << static_cast<double>(tools_.PeakRss()) / 0x100000 << " MiB";
+  if (size_t spilled{diff_store_.SpilledBytes()})
+    status << ", spilled " << static_cast<double>(spilled) / 0x100000
+           << " MiB";
+  status << '.';
+  std::cout << status.str() << std::endl;
+}
 
-  std::string file_path, segment;
+/*!
+ \brief Build the reverse pointer index (related to xref).
+ \return Return code, 0 is success, 1 is a "bad" error (related to PID or
+ /proc/PID/mem), 2 means that Ctrl-C was pressed.
 
-  uint32_t par_amount{static_cast<uint32_t>(args.size())};
-  for (uint32_t par_num{0}; par_num < par_amount; par_num++) {
-    if (args[par_num].empty())
-      continue;
+ Read all readable memory selected by xref_filter_ in chunks of
+ kScanChunkSize bytes and feed them to pointer_index_. Segments that cannot be
+ read are skipped. If the build is not finished, the index is reset.
+*/
+uint8_t Console::XrefBuild() noexcept {
+  uint8_t result{0};
+  auto buf{BufferAllocator::Allocate(kScanChunkSize)};
 
-    if (args[par_num][0] == '-') {
-      if (args[par_num].length() == 1)
+  pointer_index_.BeginBuild(memory_accessor_.segment_infos_,
+                            memory_accessor_.GetPid(),
+                            memory_accessor_.GetMapsVersion());
+  seg_not_exist_msg_enabled_ = seg_no_access_msg_enabled_ = false;
+
+  try {
+    for (const RegionFilter::Interval &interval :
+         xref_filter_.Compile(memory_accessor_.segment_infos_)) {
+      if (result)
+        break;
+      const SegmentInfo &segment_info{
+          memory_accessor_.segment_infos_[interval.num]};
+      if (!(segment_info.mode & 0b1000)) // not readable
         continue;
 
-      for (uint32_t ch_num{1}; ch_num < args[par_num].length(); ch_num++) {
-        switch (args[par_num][ch_num]) {
-        case 'r':
-          raw = true;
+      size_t start{interval.start - segment_info.start},
+          size{interval.end - interval.start};
+      for (size_t done_size{0}; done_size < size;
+           done_size += kScanChunkSize) {
+        if (ctrl_c_pressed) {
+          ctrl_c_pressed = false;
+          result = 2;
           break;
-        case 'h':
-          hex = true;
+        }
+
+        size_t amount{std::min(kScanChunkSize, size - done_size)};
+        uint8_t last_wrapper_exit_code{ReadSegWrapper(
+            buf.get(), interval.num, start + done_size, amount)};
+        if (last_wrapper_exit_code == 1)
+          result = 1;
+        if (last_wrapper_exit_code != 0)
           break;
-        case 'f':
-          if (par_num != par_amount - 1 && file_path.empty()) {
+
+        pointer_index_.AddBlock(buf.get(), amount, interval.start + done_size);
+      }
+    }
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to apply the filter." << std::endl;
+    result = 1;
+  }
+
+  seg_not_exist_msg_enabled_ = seg_no_access_msg_enabled_ = true;
+
+  if (result)
+    pointer_index_.Reset();
+  else
+    pointer_index_.FinishBuild();
+  return result;
+}
+
+/*!
+ \brief Print changes of segments (related to mapwatch and snapshot).
+ \param [in] maps_delta Changes found between old and new segments.
+ \param [in] old_infos Old segments maps_delta was computed from.
+ \param [in] new_infos New segments maps_delta was computed from.
+ \param [in] seconds Time passed since the old segments.
+
+ Print every change except unchanged segments on a separate line, starting
+ with the timestamp and the name of the likely system call.
+*/
+void Console::PrintMapsDelta(const MapsDelta &maps_delta,
+                             const std::vector<SegmentInfo> &old_infos,
+                             const std::vector<SegmentInfo> &new_infos,
+                             double seconds) const noexcept {
+  for (const MapsDelta::Change &change : maps_delta.Changes()) {
+    if (change.type == MapsDelta::ChangeType::kUnchanged)
+      continue;
+
+    const SegmentInfo &segment_info{change.new_num != MapsDelta::kNone
+                                        ? new_infos[change.new_num]
+                                        : old_infos[change.old_num]};
+    std::ostringstream oss;
+    oss << '[' << std::fixed << std::setprecision(6) << std::setw(12)
+        << seconds << "] ";
+
+    switch (change.type) {
+    case MapsDelta::ChangeType::kAdded:
+      oss << "mmap     ";
+      break;
+    case MapsDelta::ChangeType::kRemoved:
+      oss << "munmap   ";
+      break;
+    case MapsDelta::ChangeType::kResized:
+      oss << "resize   " << std::hex << old_infos[change.old_num].start << '-'
+          << old_infos[change.old_num].end << " -> ";
+      break;
+    case MapsDelta::ChangeType::kProtection:
+      oss << "mprotect "
+          << tools_.EncodePermissions(old_infos[change.old_num].mode)
+          << " -> ";
+      break;
+    default:
+      break;
+    }
+
+    oss << std::hex << segment_info.start << '-' << segment_info.end << ' '
+        << tools_.EncodePermissions(segment_info.mode) << ' '
+        << segment_info.path;
+    std::cout << oss.str() << '\n';
+  }
+  std::cout << std::flush;
+}
+
+/*!
+ \brief Compare common memory of two snapshots (related to snapshot).
+ \param [in,out] state State of diff in range mode, with segments of the old
+ snapshot.
+ \param [in] old_file The old snapshot.
+ \param [in] new_file The new snapshot, nullptr to compare to memory of the
+ process (/proc/PID/mem has to be opened by OpenSharedMem).
+ \param [in] maps_delta Changes between segments of the snapshots.
+ \param [out] compared_bytes Amount of bytes present in both snapshots.
+ \return Return code, 0 is success, 1 is a "bad" error (not enough memory),
+ 2 means that Ctrl-C was pressed.
+
+ Overlaps of segments are walked by kScanChunkSize bytes, memory of the process
+ is read by chunks. Inside a chunk, pages of the snapshots are compared with
+ memcmp, and different ones are scanned for ranges and merged, so ranges
+ continue across pages. Pages that are missing in either snapshot, and bytes
+ that cannot be read, are skipped.
+*/
+uint8_t Console::SnapshotCompare(DiffState &state,
+                                 const SnapshotFile &old_file,
+                                 const SnapshotFile *new_file,
+                                 const MapsDelta &maps_delta,
+                                 uint64_t &compared_bytes) noexcept {
+  constexpr size_t kPageSize{SnapshotFile::kPageSize};
+  const std::vector<SegmentInfo> &new_infos{
+      new_file ? new_file->Segments() : memory_accessor_.segment_infos_};
+  BufferAllocator::Buffer buf;
+  if (!new_file) {
+    try {
+      buf = BufferAllocator::Allocate(kScanChunkSize);
+    } catch (const std::bad_alloc &ex) {
+      std::cerr << "Not enough memory to read memory." << std::endl;
+      return 1;
+    }
+  }
+
+  // pointer to the bytes of a snapshot at an address (nullptr if the page is
+  // missing) and the amount of them left in the page, compressed pages are
+  // decompressed to a buffer of the file
+  char old_page[kPageSize], new_page[kPageSize];
+  auto locate{[](const SnapshotFile &file, size_t num, size_t address,
+                 char *buffer, size_t &available) -> const char * {
+    size_t offset{address - file.Segments()[num].start};
+    available = kPageSize - offset % kPageSize;
+    const char *page{file.Page(num, offset / kPageSize, buffer)};
+    return page ? page + offset % kPageSize : nullptr;
+  }};
+
+  compared_bytes = 0;
+  for (const MapsDelta::Overlap &overlap : maps_delta.Overlaps()) {
+    for (size_t chunk{overlap.start}; chunk < overlap.end;
+         chunk += kScanChunkSize) {
+      if (ctrl_c_pressed) {
+        ctrl_c_pressed = false;
+        return 2;
+      }
+
+      size_t chunk_end{std::min(overlap.end - chunk, kScanChunkSize) + chunk},
+          read_end{chunk_end};
+      if (!new_file)
+        read_end = chunk + (new_infos[overlap.new_num].mode & 0b1000
+                                ? memory_accessor_.ReadShared(
+                                      buf.get(), chunk, chunk_end - chunk)
+                                : 0);
+
+      for (size_t address{chunk}, step{0}; address < chunk_end;
+           address += step) {
+        size_t old_available{0}, new_available{chunk_end - address};
+        const char *old_bytes{
+            locate(old_file, overlap.old_num, address, old_page,
+                   old_available)},
+            *new_bytes{nullptr};
+        if (new_file)
+          new_bytes = locate(*new_file, overlap.new_num, address, new_page,
+                             new_available);
+        else if (address < read_end) {
+          new_bytes = buf.get() + (address - chunk);
+          new_available = read_end - address;
+        }
+        step = std::min({chunk_end - address, old_available, new_available});
+        if (!old_bytes || !new_bytes)
+          continue;
+
+        compared_bytes += step;
+        // equal bytes are scanned only if they may continue the pending range
+        bool pending{state.range.length && state.merged_end == address &&
+                     address - state.range.address - state.range.length <
+                         state.gap};
+        if (!pending && std::memcmp(old_bytes, new_bytes, step) == 0)
+          continue;
+        DiffScanner::ScanRanges(old_bytes, new_bytes, step, address, state.gap,
+                                state.piece);
+        DiffMergePiece(state, state.piece);
+      }
+    }
+  }
+  return 0;
+}
+
+/*!
+ \brief Save memory of the process to a snapshot file (related to snapshot).
+ \param [in] path Path of the file.
+ \param [in] filter_str Filter of saved memory (empty to save all segments).
+ \param [in] compress Compress pages by BlockCodec::Best with a thread per
+ CPU.
+
+ Maps are parsed again, selected segments are cut to the filter and saved with
+ SnapshotFile::Save. Print statistics of saving.
+*/
+void Console::SnapshotSave(const std::string &path,
+                           const std::string &filter_str,
+                           bool compress) noexcept {
+  RegionFilter filter;
+  if (ParseFilterWrapper(filter_str, filter) != 0)
+    return;
+  if (CheckPidWrapper() != 0 || ParseMapsWrapper() != 0)
+    return;
+
+  pid_t pid{memory_accessor_.GetPid()};
+  try {
+    memory_accessor_.OpenSharedMem();
+  } catch (const MemoryAccessor::MemFileEx &ex) {
+    PrintError0Arg(Error0Arg::kPrintErrOpenMem);
+    return;
+  }
+
+  std::cout << "Saving memory of PID " << pid << " to " << path
+            << ". Press Ctrl-C to stop." << std::endl;
+  auto begin{std::chrono::steady_clock::now()};
+  SnapshotFile::SaveStats stats;
+  std::vector<SegmentInfo> segment_infos;
+  uint8_t result{1};
+  try {
+    for (const RegionFilter::Interval &interval :
+         filter.Compile(memory_accessor_.segment_infos_)) {
+      segment_infos.push_back(memory_accessor_.segment_infos_[interval.num]);
+      segment_infos.back().start = interval.start;
+      segment_infos.back().end = interval.end;
+    }
+    result = SnapshotFile::Save(
+        path, pid, segment_infos, memory_accessor_,
+        compress ? BlockCodec::Best() : BlockCodec::Codec::kStored,
+        std::thread::hardware_concurrency(), [] { return ctrl_c_pressed; },
+        stats);
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to save the snapshot." << std::endl;
+  } catch (const std::system_error &ex) {
+    std::cerr << "Couldn't start threads: " << ex.what() << std::endl;
+  } catch (const SnapshotFile::SnapshotFileEx &ex) {
+    std::cerr << path << ": could not write the snapshot file" << std::endl;
+  }
+  memory_accessor_.CloseSharedMem();
+
+  if (result == 2) {
+    ctrl_c_pressed = false;
+    std::cout << "Stopped, the snapshot file is deleted." << std::endl;
+    return;
+  }
+  if (result != 0)
+    return;
+
+  double seconds{std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - begin)
+                     .count()};
+  std::cout << "Saved " << segment_infos.size() << " segment(s), "
+            << stats.pages << " page(s) (" << stats.zero_pages << " zero, "
+            << stats.missing_pages << " missing";
+  if (compress)
+    std::cout << ", " << stats.compressed_pages << " compressed by "
+              << BlockCodec::Name(BlockCodec::Best());
+  std::cout << "), " << std::fixed
+            << std::setprecision(1)
+            << static_cast<double>(stats.file_size) / 0x100000 << " MiB in "
+            << seconds << " s." << std::defaultfloat << std::endl;
+}
+
+/*!
+ \brief Compare a snapshot file to another one or to memory of the process
+ (related to snapshot).
+ \param [in] old_path Path of the old snapshot file.
+ \param [in] new_path Path of the new snapshot file or "live".
+ \param [in] gap_str Maximum amount of equal bytes inside a range (empty for
+ the default).
+ \param [in] events_path Path of the file for NDJSON (empty for none).
+ \param [in] quiet Do not print changes.
+
+ Print changes of segments with the time passed between the snapshots, then
+ changed ranges of common memory found by SnapshotCompare, the summary and the
+ amount of compared memory. Changes are reported like by "diff -r".
+*/
+void Console::SnapshotDiff(const std::string &old_path,
+                           const std::string &new_path,
+                           const std::string &gap_str,
+                           const std::string &events_path,
+                           bool quiet) noexcept {
+  DiffState state;
+  state.ranges = true;
+  state.gap = kDiffRangeGap;
+  if (!gap_str.empty())
+    if (StoullWrapper(gap_str, state.gap, "gap") != 0)
+      return;
+
+  bool live{new_path == "live"};
+  SnapshotFile old_file, new_file;
+  for (const auto &[file, path] :
+       {std::pair<SnapshotFile *, const std::string *>{&old_file, &old_path},
+        {live ? nullptr : &new_file, &new_path}}) {
+    if (!file)
+      continue;
+    try {
+      file->Open(*path);
+    } catch (const SnapshotFile::SnapshotFileEx &ex) {
+      std::cerr << *path << ": not a snapshot file or could not be read"
+                << std::endl;
+      return;
+    } catch (const std::bad_alloc &ex) {
+      std::cerr << "Not enough memory to read the snapshot." << std::endl;
+      return;
+    }
+  }
+
+  double seconds{0};
+  if (live) {
+    if (CheckPidWrapper() != 0 || ParseMapsWrapper() != 0)
+      return;
+    try {
+      memory_accessor_.OpenSharedMem();
+    } catch (const MemoryAccessor::MemFileEx &ex) {
+      PrintError0Arg(Error0Arg::kPrintErrOpenMem);
+      return;
+    }
+    if (old_file.GetHeader().pid !=
+        static_cast<uint64_t>(memory_accessor_.GetPid()))
+      std::cout << "The snapshot was saved from PID "
+                << old_file.GetHeader().pid << ", comparing to PID "
+                << memory_accessor_.GetPid() << '.' << std::endl;
+    seconds = std::chrono::duration<double>(
+                  std::chrono::system_clock::now().time_since_epoch())
+                  .count() -
+              static_cast<double>(old_file.GetHeader().time);
+  } else
+    seconds = static_cast<double>(new_file.GetHeader().time) -
+              static_cast<double>(old_file.GetHeader().time);
+
+  if (!events_path.empty()) {
+    state.events_file.open(events_path, std::ios::out | std::ios::trunc);
+    if (!state.events_file.good()) {
+      PrintFileNotOpened(events_path);
+      if (live)
+        memory_accessor_.CloseSharedMem();
+      return;
+    }
+    state.events.SetJsonStream(&state.events_file);
+  }
+  if (!quiet)
+    state.events.SetConsumer([this](const DiffEvents::Event &event) {
+      DiffPrintEvent(event);
+    });
+
+  const std::vector<SegmentInfo> &new_infos{
+      live ? memory_accessor_.segment_infos_ : new_file.Segments()};
+  MapsDelta maps_delta;
+  uint64_t compared_bytes{0};
+  uint8_t result{1};
+  try {
+    state.segments = old_file.Segments();
+    state.length = DiffScanner::kPreviewSize;
+    state.run_old = std::make_unique<char[]>(state.length);
+    state.run_new = std::make_unique<char[]>(state.length);
+    maps_delta.Compute(old_file.Segments(), new_infos);
+    PrintMapsDelta(maps_delta, old_file.Segments(), new_infos, seconds);
+    result = SnapshotCompare(state, old_file, live ? nullptr : &new_file,
+                             maps_delta, compared_bytes);
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to compare snapshots." << std::endl;
+  }
+  if (live)
+    memory_accessor_.CloseSharedMem();
+
+  if (result == 1)
+    return;
+  DiffFlush(state);
+  DiffPrintSummary(state);
+  std::cout << "Compared " << std::fixed << std::setprecision(1)
+            << static_cast<double>(compared_bytes) / 0x100000
+            << " MiB of common memory" << (result == 2 ? " (stopped)" : "")
+            << '.' << std::defaultfloat << std::endl;
+}
+
+/*!
+ \brief Write memory of the process back to the state of a snapshot file
+ (related to snapshot).
+ \param [in] path Path of the snapshot file.
+ \param [in] keep_stopped Stop threads of the process while memory is
+ restored.
+
+ Only writable segments of the snapshot are restored, and only if the process
+ has a segment with the same boundaries, permissions and path (a segment saved
+ in part only has to lie in it); other segments, including ones that grew or
+ shrank, are reported and skipped. Memory of the process is read by
+ kScanChunkSize bytes and compared to saved pages, pages that differ are
+ written back by one WriteBatch per chunk. The batches are recorded to the
+ journal (if it is on) as one write, restoring stops at a batch that cannot be
+ recorded. Missing pages and pages that cannot be read are skipped. Ctrl-C
+ is checked between chunks.
+
+ Pages are compared by memcmp instead of hashes: snapshot files do not store
+ hashes of pages, so hashing would read every saved and live page anyway and
+ then do more work than memcmp, which also stops at the first difference.
+*/
+void Console::SnapshotRestore(const std::string &path,
+                              bool keep_stopped) noexcept {
+  constexpr size_t kPageSize{SnapshotFile::kPageSize};
+  SnapshotFile snapshot_file;
+  try {
+    snapshot_file.Open(path);
+  } catch (const SnapshotFile::SnapshotFileEx &ex) {
+    std::cerr << path << ": not a snapshot file or could not be read"
+              << std::endl;
+    return;
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to read the snapshot." << std::endl;
+    return;
+  }
+  if (CheckPidWrapper() != 0)
+    return;
+
+  pid_t pid{memory_accessor_.GetPid()};
+  try {
+    memory_accessor_.OpenSharedMem();
+  } catch (const MemoryAccessor::MemFileEx &ex) {
+    PrintError0Arg(Error0Arg::kPrintErrOpenMem);
+    return;
+  }
+  if (snapshot_file.GetHeader().pid != static_cast<uint64_t>(pid))
+    std::cout << "The snapshot was saved from PID "
+              << snapshot_file.GetHeader().pid << ", restoring PID " << pid
+              << '.' << std::endl;
+  std::cout << "Restoring memory of PID " << pid << " from " << path
+            << ". Press Ctrl-C to stop." << std::endl;
+
+  BufferAllocator::Buffer buf;
+  char saved_page[kPageSize];
+  WriteBatch batch;
+  size_t segments{0}, skipped{0}, differing{0}, written{0};
+  uint64_t compared_bytes{0};
+  bool stopped{false}, recorded{false};
+  try {
+    buf = BufferAllocator::Allocate(kScanChunkSize);
+    if (keep_stopped) {
+      core_writer_.Attach(pid);
+      if (std::none_of(
+              core_writer_.Threads().begin(), core_writer_.Threads().end(),
+              [](const CoreWriter::Thread &thread) { return thread.attached; }))
+        std::cout << "Threads could not be stopped. " << kCheckSudoStr
+                  << std::endl;
+    }
+    if (ParseMapsWrapper() != 0) {
+      core_writer_.Detach();
+      memory_accessor_.CloseSharedMem();
+      return;
+    }
+
+    const std::vector<SegmentInfo> &live_infos{memory_accessor_.segment_infos_};
+    for (size_t num{0}; num < snapshot_file.Segments().size() && !stopped;
+         num++) {
+      const SegmentInfo &segment_info{snapshot_file.Segments()[num]};
+      if (!(segment_info.mode & 0b0100)) // not writable
+        continue;
+
+      auto live_it{std::partition_point(
+          live_infos.begin(), live_infos.end(),
+          [&segment_info](const SegmentInfo &info) {
+            return info.end <= segment_info.start;
+          })};
+      const char *reason{nullptr};
+      if (live_it == live_infos.end() || live_it->start > segment_info.start)
+        reason = "not mapped";
+      else if (snapshot_file.Part(num) ? live_it->end < segment_info.end
+                                       : live_it->start != segment_info.start ||
+                                             live_it->end != segment_info.end)
+        reason = "resized";
+      else if (live_it->mode != segment_info.mode)
+        reason = "permissions changed";
+      else if (live_it->path != segment_info.path)
+        reason = "mapped again";
+      if (reason) {
+        std::cout << "Skipped " << std::hex << segment_info.start << '-'
+                  << segment_info.end << std::dec << ' '
+                  << tools_.EncodePermissions(segment_info.mode) << ' '
+                  << segment_info.path << ": " << reason << '.' << std::endl;
+        skipped++;
+        continue;
+      }
+      segments++;
+
+      size_t size{segment_info.end - segment_info.start};
+      for (size_t done{0}; done < size; done += kScanChunkSize) {
+        if (ctrl_c_pressed) {
+          ctrl_c_pressed = false;
+          stopped = true;
+          break;
+        }
+        size_t amount{std::min(kScanChunkSize, size - done)},
+            read{memory_accessor_.ReadShared(
+                buf.get(), segment_info.start + done, amount)};
+        for (size_t page{0}; page < read; page += kPageSize) {
+          const char *saved{snapshot_file.Page(num, (done + page) / kPageSize,
+                                               saved_page)};
+          size_t page_size{std::min(kPageSize, read - page)};
+          if (!saved)
+            continue;
+          compared_bytes += page_size;
+          if (std::memcmp(saved, buf.get() + page, page_size) == 0)
+            continue;
+          batch.Add(segment_info.start + done + page, saved, page_size);
+          differing++;
+        }
+        if (!batch.Empty()) {
+          if (JournalBatch(batch, recorded) != 0) {
+            stopped = true;
+            break;
+          }
+          recorded = journal_on_;
+          written += batch.Apply(memory_accessor_);
+          batch.Clear();
+        }
+      }
+    }
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to restore memory." << std::endl;
+  }
+  core_writer_.Detach();
+  memory_accessor_.CloseSharedMem();
+
+  std::cout << (stopped ? "Stopped. " : "") << "Restored " << written << " of "
+            << differing << " differing page(s) in " << segments
+            << " segment(s), compared " << std::fixed << std::setprecision(1)
+            << static_cast<double>(compared_bytes) / 0x100000 << " MiB";
+  if (skipped)
+    std::cout << ", skipped " << skipped << " segment(s)";
+  std::cout << '.' << std::defaultfloat << std::endl;
+}
+
+/*!
+ \brief Add snapshots of the process to a page repository (related to repo).
+ \param [in,out] repository The opened repository.
+ \param [in] filter_str Filter of saved memory (empty to save all segments).
+ \param [in] interval Interval between snapshots in seconds, 0 to add one
+ snapshot.
+
+ Maps are parsed again before every snapshot, selected segments are cut to
+ the filter and added with PageRepository::Add. Print statistics of every
+ snapshot. Ctrl-C is checked every kDiffSleepStep between snapshots.
+*/
+void Console::RepoSave(PageRepository &repository,
+                       const std::string &filter_str,
+                       uint64_t interval) noexcept {
+  RegionFilter filter;
+  if (ParseFilterWrapper(filter_str, filter) != 0 || CheckPidWrapper() != 0)
+    return;
+
+  pid_t pid{memory_accessor_.GetPid()};
+  try {
+    memory_accessor_.OpenSharedMem();
+  } catch (const MemoryAccessor::MemFileEx &ex) {
+    PrintError0Arg(Error0Arg::kPrintErrOpenMem);
+    return;
+  }
+  if (interval)
+    std::cout << "Saving memory of PID " << pid << " every " << interval
+              << " s. Press Ctrl-C to stop." << std::endl;
+
+  seg_not_exist_msg_enabled_ = seg_no_access_msg_enabled_ = false;
+  for (;;) {
+    auto begin{std::chrono::steady_clock::now()};
+    if (ParseMapsWrapper() != 0)
+      break;
+
+    PageRepository::AddStats stats;
+    uint8_t result{1};
+    try {
+      std::vector<SegmentInfo> segment_infos;
+      for (const RegionFilter::Interval &interval :
+           filter.Compile(memory_accessor_.segment_infos_)) {
+        segment_infos.push_back(memory_accessor_.segment_infos_[interval.num]);
+        segment_infos.back().start = interval.start;
+        segment_infos.back().end = interval.end;
+      }
+      result = repository.Add(pid, segment_infos, memory_accessor_, tools_,
+                              [] { return ctrl_c_pressed; }, stats);
+    } catch (const std::bad_alloc &ex) {
+      std::cerr << "Not enough memory to save the snapshot." << std::endl;
+    } catch (const PageRepository::RepositoryEx &ex) {
+      std::cerr << "Couldn't write to the repository." << std::endl;
+    }
+    if (result == 2) {
+      ctrl_c_pressed = false;
+      std::cout << "Stopped, the snapshot is not saved." << std::endl;
+    }
+    if (result != 0)
+      break;
+
+    double seconds{std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count()};
+    std::cout << "Saved snapshot " << repository.Headers().size() - 1 << ": "
+              << stats.pages << " page(s) (" << stats.new_pages << " new, "
+              << stats.zero_pages << " zero, " << stats.missing_pages
+              << " missing) in " << std::fixed << std::setprecision(1)
+              << seconds << " s." << std::defaultfloat << std::endl;
+    if (!interval)
+      break;
+
+    bool stopped{false};
+    for (auto until{begin + std::chrono::seconds(interval)};
+         std::chrono::steady_clock::now() < until;) {
+      if (ctrl_c_pressed) {
+        ctrl_c_pressed = false;
+        stopped = true;
+        break;
+      }
+      std::this_thread::sleep_for(kDiffSleepStep);
+    }
+    if (stopped)
+      break;
+  }
+  seg_not_exist_msg_enabled_ = seg_no_access_msg_enabled_ = true;
+  memory_accessor_.CloseSharedMem();
+}
+
+/*!
+ \brief Handle command "help".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Print project name, version and description, and then list all descriptions of
+ commands.
+*/
+void Console::CommandHelp(const Command &parent,
+                          const std::vector<std::string> &args) noexcept {
+  PrintNameVer();
+  std::cout << kProjectDescription << std::endl;
+  //	std::cout << std::endl;
+  std::cout << "Commands:\n" << std::endl;
+
+  uint32_t middle{0};
+  for (const Command &command : kCommands) {
+    for (const std::array<std::string, 2> &line : command.description) {
+      if (line[0].length() > middle)
+        middle = line[0].length();
+    }
+  }
+
+  for (const Command &command : kCommands) {
+    PrintDescription(command, 2, middle);
+    std::cout << std::endl;
+  }
+
+  std::cout << "Filters (key \"-s\"):\n" << std::endl;
+  PrintDescription(kFilterDescription, 2, middle);
+}
+
+/*!
+ \brief Handle command "name".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Search for PID by process name provided as the first argument and set PID by
+ calling command_pid if only 1 PID found, or set PID number pid_num of found
+ PIDs if pid_num is specified (starting from 0) as the second argument. Print
+ usage otherwise.
+*/
+void Console::CommandName(const Command &parent,
+                          const std::vector<std::string> &args) noexcept {
+  if (args.size() < 1) {
+    ShowUsage(parent);
+    return;
+  }
+
+  int pid_num{-1};
+  if (args.size() >= 2)
+    if (StoiWrapper(args[1], pid_num, "pid number") != 0)
+      return;
+
+  std::unordered_set<pid_t> pids{tools_.FindPidsByName(args[0])};
+  switch (pids.size()) {
+  case 0:
+    std::cerr << "No PID found by name: " + args[0] << std::endl;
+    break;
+
+  case 1:
+    std::cout << "Found PID: " + std::to_string(*(pids.begin())) << std::endl;
+    HandleCommand("pid " + std::to_string(*(pids.begin())));
+    break;
+
+  default:
+    std::cout << "Found PIDs: ";
+    for (const pid_t &p : pids)
+      std::cout << std::to_string(p) + ' ';
+    std::cout << std::endl;
+    if (pid_num == -1)
+      std::cout << "Set any of them with the command \"pid\"." << std::endl;
+    else {
+      if (pid_num < 0 || pid_num > pids.size() - 1)
+        std::cerr << "Wrong found PID number: " << args[1] << std::endl;
+      else {
+        auto pid_iterator{pids.begin()};
+        std::advance(pid_iterator, pid_num);
+        HandleCommand("pid " + std::to_string(*pid_iterator));
+      }
+    }
+    break;
+  }
+}
+
+/*!
+ \brief Handle command "pid".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Set PID provided as the first argument and parse /proc/PID/maps. Print usage
+ otherwise.
+*/
+void Console::CommandPid(const Command &parent,
+                         const std::vector<std::string> &args) noexcept {
+  if (args.size() < 1) {
+    ShowUsage(parent);
+    return;
+  }
+
+  pid_t pid{0};
+  if (StoiWrapper(args[0], pid, "PID") != 0)
+    return;
+
+  try {
+    memory_accessor_.SetPid(pid);
+    std::cout << "Set PID: " << args[0] << std::endl;
+  } catch (const MemoryAccessor::ErrCheckingPidEx &ex) {
+    PrintError0Arg(Error0Arg::kErrCheckingPid);
+    return;
+  } catch (const MemoryAccessor::PidNotExistEx &ex) {
+    std::cerr << "The process with PID " << args[0] << " does not exist."
+              << std::endl;
+    return;
+  }
+
+  std::cout << "Parsing /proc/" << args[0] << "/maps..." << std::endl;
+  if (ParseMapsWrapper() != 0)
+    return;
+
+  bool any_special_segment_found{false};
+  for (const std::pair<std::string, SegmentInfo *> &p :
+       memory_accessor_.special_segment_found_) {
+    if (std::get<1>(p)) {
+      if (!any_special_segment_found) {
+        any_special_segment_found = true;
+        std::cout << "Found:";
+      }
+      std::cout << " " << std::get<0>(p);
+    }
+  }
+  if (any_special_segment_found)
+    std::cout << std::endl;
+
+  std::cout << "Found "
+            << std::to_string(memory_accessor_.segment_infos_.size())
+            << (memory_accessor_.segment_infos_.size() == 1 ? " segment"
+                                                            : " segments")
+            << " in total." << std::endl;
+}
+
+/*!
+ \brief Handle command "maps".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Print to stdout memory segments found by parsing /proc/PID/maps.
+*/
+void Console::CommandMaps(const Command &parent,
+                          const std::vector<std::string> &args) noexcept {
+  try {
+    memory_accessor_.CheckPid();
+    PrintSegments(memory_accessor_.segment_infos_);
+  } catch (const MemoryAccessor::PidNotSetEx &ex) {
+    PrintError0Arg(Error0Arg::kPidNotSet);
+  }
+}
+
+/*!
+ \brief Handle command "mapwatch".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Parse /proc/PID/maps every interval milliseconds (the 1st argument, optional,
+ default is 100) and print changes of memory segments with the time passed
+ since the start, until Ctrl-C is pressed or an error occurs. Changes are only
+ computed when the maps version changes, and the maps are not parsed at all if
+ their text is the same.
+*/
+void Console::CommandMapwatch(const Command &,
+                              const std::vector<std::string> &args) noexcept {
+  uint64_t interval{100};
+  if (args.size() >= 1)
+    if (StoullWrapper(args[0], interval, "interval") != 0)
+      return;
+
+  if (CheckPidWrapper() != 0 || ParseMapsWrapper() != 0)
+    return;
+
+  std::cout << "Watching maps of PID " << memory_accessor_.GetPid() << ", "
+            << memory_accessor_.segment_infos_.size()
+            << " segments. Press Ctrl-C to stop." << std::endl;
+
+  MapsDelta maps_delta;
+  uint64_t maps_version{memory_accessor_.GetMapsVersion()};
+  auto begin{std::chrono::steady_clock::now()};
+
+  for (;;) {
+    if (ctrl_c_pressed) {
+      ctrl_c_pressed = false;
+      break;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+    if (ParseMapsWrapper() != 0)
+      break;
+    if (memory_accessor_.GetMapsVersion() == maps_version)
+      continue;
+    maps_version = memory_accessor_.GetMapsVersion();
+
+    maps_delta.Compute(memory_accessor_.GetPreviousSegmentInfos(),
+                       memory_accessor_.segment_infos_);
+    PrintMapsDelta(maps_delta, memory_accessor_.GetPreviousSegmentInfos(),
+                   memory_accessor_.segment_infos_,
+                   std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count());
+  }
+}
+
+/*!
+ \brief Handle command "watch".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Install hardware breakpoints on length bytes at address (the 1st and the 2nd
+ arguments) in all threads of the process, catching writes, or reads and
+ writes if the 3rd argument is "rw", and print accesses until Ctrl-C is
+ pressed or the process exits.
+*/
+void Console::CommandWatch(const Command &parent,
+                           const std::vector<std::string> &args) noexcept {
+  std::vector<std::string> values;
+  for (const std::string &arg : args)
+    if (!arg.empty())
+      values.push_back(arg);
+  if (values.size() < 2 || values.size() > 3 ||
+      (values.size() == 3 && values[2] != "rw" && values[2] != "w")) {
+    ShowUsage(parent);
+    return;
+  }
+  bool read{values.size() == 3 && values[2] == "rw"};
+
+  size_t address{0};
+  uint64_t length{0};
+  if (ParseAddress(values[0], address) != 0 ||
+      StoullWrapper(values[1], length, "length") != 0)
+    return;
+  if (!Watchpoint::Valid(address, length)) {
+    std::cerr << "Length must be 1, 2, 4 or 8 and address must be aligned to "
+                 "it."
+              << std::endl;
+    return;
+  }
+
+  if (CheckPidWrapper() != 0 || ParseMapsWrapper() != 0)
+    return;
+
+  try {
+    Watchpoint watchpoint;
+    try {
+      watchpoint.Open(memory_accessor_.GetPid(), address, length, read);
+    } catch (const Watchpoint::BreakpointEx &ex) {
+      std::cerr << "Couldn't install hardware breakpoints. " << kCheckSudoStr
+                << std::endl;
+      return;
+    }
+    std::cout << "Watching " << (read ? "accesses" : "writes") << " to 0x"
+              << std::hex << address << std::dec << " (" << length
+              << " bytes) in " << watchpoint.Threads() << " threads of PID "
+              << memory_accessor_.GetPid() << ". Press Ctrl-C to stop."
+              << std::endl;
+    WatchLoop(watchpoint);
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to watch the address." << std::endl;
+  }
+}
+
+/*!
+ \brief Print accesses caught by breakpoints (related to watch).
+ \param [in,out] watchpoint Watchpoint with breakpoints installed.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Wait for samples by kWatchSleepStep, so Ctrl-C is checked, and look for new
+ threads every kWatchRescanPeriod. The first access of every pair of an
+ instruction and a thread is printed with the time passed since the start;
+ when watching stops, accesses are summed up by instructions and the
+ kWatchListed most frequent ones are printed.
+*/
+void Console::WatchLoop(Watchpoint &watchpoint) noexcept(false) {
+  std::map<uint64_t, uint64_t> counts;
+  std::set<std::pair<uint64_t, pid_t>> printed;
+  std::vector<Watchpoint::Hit> hits;
+  uint64_t total{0};
+  auto begin{std::chrono::steady_clock::now()}, rescanned{begin};
+
+  for (;;) {
+    if (ctrl_c_pressed) {
+      ctrl_c_pressed = false;
+      break;
+    }
+
+    bool ready{watchpoint.Wait(static_cast<int>(kWatchSleepStep.count()))};
+    auto now{std::chrono::steady_clock::now()};
+    if (now - rescanned >= kWatchRescanPeriod) {
+      rescanned = now;
+      if (!watchpoint.Rescan()) {
+        std::cout << "The process exited." << std::endl;
+        break;
+      }
+    }
+    if (!ready)
+      continue;
+
+    hits.clear();
+    watchpoint.Collect(hits);
+    for (const Watchpoint::Hit &hit : hits) {
+      total++;
+      counts[hit.ip]++;
+      if (!printed.insert({hit.ip, hit.tid}).second)
+        continue;
+      std::cout << '[' << std::fixed << std::setprecision(3)
+                << std::chrono::duration<double>(now - begin).count()
+                << std::defaultfloat << " s] TID " << hit.tid << " at 0x"
+                << std::hex << hit.ip << std::dec << ModuleOffset(hit.ip)
+                << std::endl;
+    }
+  }
+
+  std::vector<std::pair<uint64_t, uint64_t>> top(counts.begin(), counts.end());
+  size_t listed{std::min(kWatchListed, top.size())};
+  std::partial_sort(top.begin(), top.begin() + listed, top.end(),
+                    [](const auto &a, const auto &b) {
+                      return a.second != b.second ? a.second > b.second
+                                                  : a.first < b.first;
+                    });
+  std::cout << total << " accesses by " << counts.size() << " instructions";
+  if (watchpoint.Lost())
+    std::cout << ", " << watchpoint.Lost() << " more were lost";
+  std::cout << '.' << std::endl;
+  for (size_t i{0}; i < listed; i++)
+    std::cout << std::setw(10) << top[i].second << " 0x" << std::hex
+              << top[i].first << std::dec << ModuleOffset(top[i].first)
+              << std::endl;
+}
+
+/*!
+ \brief Get the module of an address (related to watch).
+ \param [in] address The address.
+ \return " (path+0xoffset)" where offset is relative to the start of the
+ file, " (name)" for a segment without a file, or an empty string if the
+ address is not inside segments.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Maps are parsed again if the address is not inside known segments, since the
+ instruction may be in a module loaded after the start.
+*/
+std::string Console::ModuleOffset(size_t address) const noexcept(false) {
+  for (bool parsed{false};; parsed = true) {
+    try {
+      const SegmentInfo &segment_info{
+          memory_accessor_
+              .segment_infos_[memory_accessor_.AddressInSegment(address)]};
+      if (segment_info.start <= address) {
+        if (segment_info.inode_id == 0)
+          return segment_info.path.empty() ? ""
+                                           : " (" + segment_info.path + ')';
+        std::ostringstream result;
+        result << " (" << segment_info.path << "+0x" << std::hex
+               << address - segment_info.start + segment_info.offset << ')';
+        return result.str();
+      }
+    } catch (const MemoryAccessor::SegmentEx &ex) {
+    }
+    if (parsed)
+      return "";
+    try {
+      memory_accessor_.ParseMaps();
+    } catch (const MemoryAccessor::BaseException &ex) {
+      return "";
+    }
+  }
+}
+
+/*!
+ \brief Print data of a part of a segment (related to view).
+ \param [in] stream_p Stream to print to.
+ \param [in] buf Buffer of buffer_size_ bytes.
+ \param [in] num Number of the segment.
+ \param [in] start Offset of the part relative to the start of the segment.
+ \param [in] size Size of the part.
+ \param [in] raw Print raw data.
+ \param [in] hex Show hex (if not raw).
+ \return Return code, 0 is success, 1 is a "bad" error (related to PID or
+ /proc/PID/mem), 2 is a segment error or Ctrl-C (ctrl_c_pressed stays true).
+
+ Read the part by blocks of buffer_size_ bytes and print every block.
+*/
+uint8_t Console::ViewInterval(std::ostream *stream_p, char *buf, size_t num,
+                              size_t start, size_t size, bool raw,
+                              bool hex) noexcept {
+  size_t address{memory_accessor_.segment_infos_[num].start + start};
+  for (size_t done_size{0}; done_size < size; done_size += buffer_size_) {
+    if (ctrl_c_pressed)
+      return 2;
+
+    size_t amount{std::min(buffer_size_, size - done_size)};
+    uint8_t last_wrapper_exit_code{
+        ReadSegWrapper(buf, num, start + done_size, amount)};
+    if (last_wrapper_exit_code != 0)
+      return last_wrapper_exit_code;
+
+    if (raw)
+      stream_p->write(buf, amount);
+    else
+      hex_viewer_.PrintHex(stream_p, buf, amount, address + done_size, hex);
+  }
+  return 0;
+}
+
+/*!
+ \brief Create a BlockWriter for an output file and print messages in case of
+ errors (related to view and read).
+ \param [in] file The opened file.
+ \param [out] writer Created BlockWriter.
+ \return Return code, 0 is success, 1 is an error.
+
+ Blocks are compressed by BlockCodec::Best with a thread per CPU.
+*/
+uint8_t
+Console::CompressWrapper(std::ostream &file,
+                         std::unique_ptr<BlockWriter> &writer) const noexcept {
+  try {
+    writer = std::make_unique<BlockWriter>(file, BlockCodec::Best(),
+                                           std::thread::hardware_concurrency());
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to compress the output." << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/*!
+ \brief Finish a compressed output file and print its sizes (related to view
+ and read).
+ \param [in] writer BlockWriter of the file.
+ \param [in] path Path of the file.
+*/
+void Console::FinishCompression(BlockWriter &writer,
+                                const std::string &path) const noexcept {
+  if (!writer.Finish()) {
+    std::cerr << path << ": could not write the compressed file" << std::endl;
+    return;
+  }
+  std::cout << "Compressed " << writer.RawSize() << " bytes to "
+            << writer.StoredSize() << " by "
+            << BlockCodec::Name(BlockCodec::Best()) << '.' << std::endl;
+}
+
+/*!
+ \brief Handle command "view".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Print data of memory segment with name or PID provided as the first argument.
+ If there are multiple segments with the same name, print data from the first
+ matching. Keys available: "-h" - show hex (if no "-r" specified), "-r" - print
+ raw data, "-f file" write output to file "file", "-z" - compress the file
+ (see CompressWrapper), "-s filter" - print readable memory selected by the
+ filter (only from the segment, if it is specified). Print usage in case of
+ usage errors.
+*/
+void Console::CommandView(const Command &parent,
+                          const std::vector<std::string> &args) noexcept {
+  bool raw{false}, hex{false}, compress{false};
+
+  std::string file_path, segment, filter_str;
+
+  uint32_t par_amount{static_cast<uint32_t>(args.size())};
+  for (uint32_t par_num{0}; par_num < par_amount; par_num++) {
+    if (args[par_num].empty())
+      continue;
+
+    if (args[par_num][0] == '-') {
+      if (args[par_num].length() == 1)
+        continue;
+
+      for (uint32_t ch_num{1}; ch_num < args[par_num].length(); ch_num++) {
+        std::string *value{nullptr};
+        switch (args[par_num][ch_num]) {
+        case 'r':
+          raw = true;
+          break;
+        case 'h':
+          hex = true;
+          break;
+        case 'z':
+          compress = true;
+          break;
+        case 'f':
+          value = &file_path;
+          break;
+        case 's':
+          value = &filter_str;
+          break;
+        }
+
+        if (value) {
+          if (par_num != par_amount - 1 && value->empty()) {
+            par_num++;
+            *value = args[par_num];
+            break;
+          } else {
+            ShowUsage(parent);
+            return;
+          }
+        }
+      }
+    } else {
+      if (segment.empty())
+        segment = args[par_num];
+    }
+  }
+
+  if (segment.empty() && filter_str.empty()) {
+    ShowUsage(parent);
+    return;
+  }
+  if (compress && file_path.empty()) {
+    std::cerr << "Key -z requires -f." << std::endl;
+    return;
+  }
+
+  RegionFilter filter;
+  if (ParseFilterWrapper(filter_str, filter) != 0)
+    return;
+
+  if (CheckPidWrapper() != 0)
+    return;
+
+  size_t num{SIZE_MAX},
+      segment_infos_size{memory_accessor_.segment_infos_.size()};
+  if (!segment.empty()) {
+    try {
+      num = std::stoull(segment);
+      if (num >= segment_infos_size) {
+        PrintError0Arg(Error0Arg::kPrintSegNotExist);
+        return;
+      }
+    } catch (const std::invalid_argument &ex) {
+      size_t i{0};
+
+      for (; i < segment_infos_size; i++) {
+        if (memory_accessor_.segment_infos_[i].path == segment) {
+          num = i;
+          break;
+        }
+      }
+
+      if (i >= segment_infos_size) {
+        PrintError0Arg(Error0Arg::kPrintSegNotExist);
+        return;
+      }
+    } catch (const std::out_of_range &ex) {
+      std::cerr << "Specified segment number is too big: " << segment
+                << std::endl;
+      return;
+    }
+
+    if (CheckSegNumWrapper(num) != 0)
+      return;
+  }
+
+  std::vector<RegionFilter::Interval> intervals;
+  try {
+    for (const RegionFilter::Interval &interval :
+         filter.Compile(memory_accessor_.segment_infos_))
+      if (num == SIZE_MAX
+              ? memory_accessor_.segment_infos_[interval.num].mode & 0b1000
+              : interval.num == num)
+        intervals.push_back(interval);
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to apply the filter." << std::endl;
+    return;
+  }
+  if (intervals.empty()) {
+    std::cerr << "No memory is selected by the filter." << std::endl;
+    return;
+  }
+
+  std::ostream *stream_p{nullptr};
+  std::ostream compressed{nullptr};
+  std::ofstream file;
+  std::unique_ptr<BlockWriter> writer;
+  if (!file_path.empty()) {
+    file.open(file_path, std::ios::out | std::ios::binary);
+    stream_p = &file;
+    if (compress) {
+      if (CompressWrapper(file, writer) != 0)
+        return;
+      compressed.rdbuf(writer.get());
+      stream_p = &compressed;
+    }
+  } else {
+    stream_p = &std::cout;
+  }
+
+  // Selected parts are printed one by one. A segment that cannot be read stops
+  // only a single segment, unless it was specified.
+
+  auto buf{std::make_unique<char[]>(buffer_size_)};
+  for (const RegionFilter::Interval &interval : intervals) {
+    const SegmentInfo &segment_info{
+        memory_accessor_.segment_infos_[interval.num]};
+    uint8_t last_wrapper_exit_code{ViewInterval(
+        stream_p, buf.get(), interval.num, interval.start - segment_info.start,
+        interval.end - interval.start, raw, hex)};
+    if (last_wrapper_exit_code == 1 || ctrl_c_pressed)
+      break;
+  }
+  ctrl_c_pressed = false;
+
+  if (raw && stream_p == &std::cout)
+    std::cout << std::endl;
+  if (writer)
+    FinishCompression(*writer, file_path);
+}
+
+/*!
+ \brief Handle command "read".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Read an amount of bytes provided as the 2nd argument starting from an address
+ provided as the 1st argument. Keys available: "-h" - show hex (if no "-r"
+ specified), "-r" - print raw data, "-f file" write output to file "file", "-z"
+ - compress the file (see CompressWrapper). Print usage in case of usage
+ errors.
+*/
+void Console::CommandRead(const Command &parent,
+                          const std::vector<std::string> &args) noexcept {
+  bool raw{false}, hex{false}, compress{false};
+
+  std::string file_path, addr_str, amount_str;
+
+  uint32_t par_amount{static_cast<uint32_t>(args.size())};
+  for (uint32_t par_num{0}; par_num < par_amount; par_num++) {
+    if (args[par_num].empty())
+      continue;
+
+    if (args[par_num][0] == '-') {
+      if (args[par_num].length() == 1)
+        continue;
+
+      for (uint32_t ch_num{1}; ch_num < args[par_num].length(); ch_num++) {
+        switch (args[par_num][ch_num]) {
+        case 'r':
+          raw = true;
+          break;
+        case 'h':
+          hex = true;
+          break;
+        case 'z':
+          compress = true;
+          break;
+        case 'f':
+          if (par_num != par_amount - 1 && file_path.empty()) {
+            par_num++;
+            file_path = args[par_num];
+          } else {
+            ShowUsage(parent);
+            return;
+          }
+          break;
+        }
+      }
+    } else {
+      if (addr_str.empty()) {
+        addr_str = args[par_num];
+        continue;
+      }
+      if (amount_str.empty()) {
+        amount_str = args[par_num];
+        continue;
+      }
+    }
+  }
+
+  if (addr_str.empty() || amount_str.empty()) {
+    ShowUsage(parent);
+    return;
+  }
+  if (compress && file_path.empty()) {
+    std::cerr << "Key -z requires -f." << std::endl;
+    return;
+  }
+
+  size_t address{0};
+  if (ParseAddress(addr_str, address))
+    return;
+
+  size_t amount{0};
+  if (StoullWrapper(amount_str, amount, "amount") != 0)
+    return;
+
+  if (CheckPidWrapper() != 0)
+    return;
+
+  std::ostream *stream_p{nullptr};
+  std::ostream compressed{nullptr};
+  std::ofstream file;
+  std::unique_ptr<BlockWriter> writer;
+  if (!file_path.empty()) {
+    file.open(file_path, std::ios::out | std::ios::binary);
+    stream_p = &file;
+    if (compress) {
+      if (CompressWrapper(file, writer) != 0)
+        return;
+      compressed.rdbuf(writer.get());
+      stream_p = &compressed;
+    }
+  } else {
+    stream_p = &std::cout;
+  }
+
+  auto buf{std::make_unique<char[]>(buffer_size_)};
+  size_t done_amount{0}, temp_done_amount{0};
+  uint8_t last_wrapper_exit_code{0};
+  if (raw) {
+    for (; amount >= buffer_size_; amount -= buffer_size_) {
+      if (ctrl_c_pressed) {
+        ctrl_c_pressed = false;
+        break;
+      }
+
+      last_wrapper_exit_code =
+          ReadWrapper(buf.get(), address, buffer_size_, temp_done_amount);
+      if (last_wrapper_exit_code != 0)
+        break;
+      stream_p->write(buf.get(), temp_done_amount);
+      done_amount += temp_done_amount;
+      address += temp_done_amount;
+    }
+    if (amount && last_wrapper_exit_code == 0) {
+      last_wrapper_exit_code =
+          ReadWrapper(buf.get(), address, amount, temp_done_amount);
+      if (last_wrapper_exit_code == 0) {
+        stream_p->write(buf.get(), temp_done_amount);
+        done_amount += temp_done_amount;
+        address += temp_done_amount;
+      }
+    }
+  } else {
+    for (; amount >= buffer_size_; amount -= buffer_size_) {
+      if (ctrl_c_pressed) {
+        ctrl_c_pressed = false;
+        break;
+      }
+
+      last_wrapper_exit_code =
+          ReadWrapper(buf.get(), address, buffer_size_, temp_done_amount);
+      if (last_wrapper_exit_code != 0)
+        break;
+      hex_viewer_.PrintHex(stream_p, buf.get(), temp_done_amount, address, hex);
+      done_amount += temp_done_amount;
+      address += temp_done_amount;
+    }
+    if (amount && last_wrapper_exit_code == 0) {
+      last_wrapper_exit_code =
+          ReadWrapper(buf.get(), address, amount, temp_done_amount);
+      if (last_wrapper_exit_code == 0) {
+        hex_viewer_.PrintHex(stream_p, buf.get(), temp_done_amount, address,
+                             hex);
+        done_amount += temp_done_amount;
+        address += temp_done_amount;
+      }
+    }
+  }
+
+  if (last_wrapper_exit_code == 2) {
+    if (raw)
+      stream_p->write(buf.get(), temp_done_amount);
+    else
+      hex_viewer_.PrintHex(stream_p, buf.get(), temp_done_amount, address, hex);
+    done_amount += temp_done_amount;
+  }
+
+  if (raw && stream_p == &std::cout)
+    std::cout << std::endl;
+  if (writer)
+    FinishCompression(*writer, file_path);
+
+  if (last_wrapper_exit_code != 1)
+    std::cout << done_amount << " bytes read." << std::endl;
+}
+
+/*!
+ \brief Record a piece of "write -f" to the journal.
+ \param [in] address Address of the piece.
+ \param [in] data Data of the piece.
+ \param [in] size Size of the piece (at most kWriteChunkSize).
+ \param [in] continued true if it is not the first piece.
+ \param [in,out] old_data Buffer for old bytes, allocated at the first call.
+ \return Return code, 0 is success, 1 means that the piece is not recorded
+ and must not be written.
+
+ Old bytes are read by the descriptor opened by OpenSharedMem, so the piece is
+ recorded as one write of MemoryAccessor::Write would be.
+*/
+uint8_t Console::JournalMapped(size_t address, const char *data, size_t size,
+                               bool continued,
+                               std::unique_ptr<char[]> &old_data) noexcept {
+  try {
+    if (!old_data)
+      old_data = std::make_unique_for_overwrite<char[]>(kWriteChunkSize);
+    if (memory_accessor_.ReadShared(old_data.get(), address, size) != size) {
+      PrintError0Arg(Error0Arg::kPrintSegNoAccess);
+      return 1;
+    }
+    journal_.Add(memory_accessor_.GetPid(), address, old_data.get(), data,
+                 size, continued);
+  } catch (const WriteJournal::JournalFileEx &ex) {
+    PrintError0Arg(Error0Arg::kPrintJournalFail);
+    return 1;
+  } catch (const std::bad_alloc &ex) {
+    PrintError0Arg(Error0Arg::kPrintJournalFail);
+    return 1;
+  }
+  return 0;
+}
+
+/*!
+ \brief Write a regular file to memory of the process (related to write).
+ \param [in] fd Descriptor of the file opened for reading.
+ \param [in] file_size Size of the file.
+ \param [in] path Path of the file.
+ \param [in] address Address to start from.
+ \param [in] amount Amount of bytes to write.
+
+ The file is mapped and written by WriteShared in pieces of up to
+ kWriteChunkSize bytes, each of them is one call even if it crosses boundaries
+ of adjacent segments. Ctrl-C is checked between pieces, the progress is
+ printed every kWriteStatusPeriod and the throughput at the end. If the
+ journal is on, every piece is recorded by JournalMapped before it is written.
+*/
+void Console::WriteMapped(int fd, size_t file_size, const std::string &path,
+                          size_t address, size_t amount) noexcept {
+  if (file_size < amount) {
+    std::cout << "File size is less than amount, setting amount to file size."
+              << std::endl;
+    amount = file_size;
+  }
+  if (!amount) {
+    std::cout << "0 bytes written." << std::endl;
+    return;
+  }
+
+  void *mapping{mmap(nullptr, amount, PROT_READ, MAP_PRIVATE, fd, 0)};
+  if (mapping == MAP_FAILED) {
+    PrintFileFail(path);
+    return;
+  }
+  madvise(mapping, amount, MADV_SEQUENTIAL);
+  const char *data{static_cast<const char *>(mapping)};
+  try {
+    memory_accessor_.OpenSharedMem();
+  } catch (const MemoryAccessor::MemFileEx &ex) {
+    PrintError0Arg(Error0Arg::kPrintErrOpenMem);
+    munmap(mapping, amount);
+    return;
+  }
+
+  auto begin{std::chrono::steady_clock::now()};
+  auto last_status{begin};
+  size_t done_amount{0};
+  std::unique_ptr<char[]> old_data;
+  while (done_amount < amount) {
+    if (ctrl_c_pressed) {
+      ctrl_c_pressed = false;
+      break;
+    }
+
+    size_t size{0};
+    try {
+      size = memory_accessor_.ContiguousSize(
+          address + done_amount,
+          std::min(kWriteChunkSize, amount - done_amount));
+    } catch (const MemoryAccessor::SegmentEx &ex) {
+      PrintError0Arg(Error0Arg::kPrintSegNotExist);
+      break;
+    }
+    if (journal_on_ && JournalMapped(address + done_amount, data + done_amount,
+                                     size, done_amount > 0, old_data) != 0)
+      break;
+    size_t written{memory_accessor_.WriteShared(
+        data + done_amount, address + done_amount, size)};
+    done_amount += written;
+    if (written < size) {
+      PrintError0Arg(Error0Arg::kPrintSegNoAccess);
+      break;
+    }
+
+    auto now{std::chrono::steady_clock::now()};
+    if (now - last_status >= kWriteStatusPeriod && done_amount < amount) {
+      last_status = now;
+      std::cout << "Written " << std::fixed << std::setprecision(1)
+                << static_cast<double>(done_amount) / 0x100000 << " of "
+                << static_cast<double>(amount) / 0x100000 << " MiB."
+                << std::defaultfloat << std::endl;
+    }
+  }
+  memory_accessor_.CloseSharedMem();
+  munmap(mapping, amount);
+
+  double seconds{std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - begin)
+                     .count()};
+  std::cout << done_amount << " bytes written in " << std::fixed
+            << std::setprecision(3) << seconds << " s ("
+            << std::setprecision(1)
+            << (seconds > 0 ? static_cast<double>(done_amount) / 0x100000 /
+                                  seconds
+                            : 0.0)
+            << " MiB/s)." << std::defaultfloat << std::endl;
+}
+
+/*!
+ \brief Handle command "write".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Write to memory an amount of bytes provided as the 2nd argument starting from
+ an address provided as the 1st argument. Data is taken either from the string
+ provided as the 3rd argument or the file specified in type "-f file". A
+ regular file is written by WriteMapped, other files (e.g. pipes) are read by
+ blocks of buffer_size_ bytes. Blocks of a string or a file are recorded to the
+ journal as one write. Print usage in case of usage errors.
+*/
+void Console::CommandWrite(const Command &parent,
+                           const std::vector<std::string> &args) noexcept {
+  std::string file_path, addr_str, amount_str;
+  const std::string *str_p{nullptr};
+  std::ifstream file;
+
+  uint32_t par_amount{static_cast<uint32_t>(args.size())};
+  for (uint32_t par_num{0}; par_num < par_amount; par_num++) {
+    if (args[par_num].empty())
+      continue;
+
+    if (args[par_num][0] == '-') {
+      if (args[par_num].length() == 1)
+        continue;
+
+      for (uint32_t ch_num{1}; ch_num < args[par_num].length(); ch_num++) {
+        if (args[par_num][ch_num] == 'f') {
+          if (par_num != par_amount - 1 && file_path.empty()) {
+            par_num++;
+            file_path = args[par_num];
+          } else {
+            ShowUsage(parent);
+            return;
+          }
+        }
+      }
+    } else {
+      if (addr_str.empty()) {
+        addr_str = args[par_num];
+        continue;
+      }
+      if (amount_str.empty()) {
+        amount_str = args[par_num];
+        continue;
+      }
+      if (!str_p) {
+        str_p = &args[par_num];
+        continue;
+      }
+    }
+  }
+
+  if (addr_str.empty() || amount_str.empty() || (!str_p && file_path.empty())) {
+    ShowUsage(parent);
+    return;
+  }
+
+  size_t address{0};
+  if (ParseAddress(addr_str, address))
+    return;
+
+  size_t amount{0};
+  if (StoullWrapper(amount_str, amount, "amount") != 0)
+    return;
+
+  if (str_p && str_p->length() < amount) {
+    std::cout << "String length is less than amount, setting amount to length."
+              << std::endl;
+    amount = str_p->length();
+  }
+
+  if (batch_open_) {
+    if (!file_path.empty()) {
+      std::cerr << "Writes from files cannot be queued, use \"batch commit\" "
+                   "or \"batch abort\" first."
+                << std::endl;
+      return;
+    }
+    try {
+      write_batch_.Add(address, str_p->data(), amount);
+    } catch (const std::bad_alloc &ex) {
+      std::cerr << "Not enough memory to queue the write." << std::endl;
+      return;
+    }
+    std::cout << "Queued " << amount << " bytes at 0x" << std::hex << address
+              << std::dec << " (" << write_batch_.Size()
+              << " writes in the batch)." << std::endl;
+    return;
+  }
+
+  int fd{-1};
+  struct stat file_stat {};
+  if (!file_path.empty()) {
+    fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 &&
+        (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode))) {
+      close(fd);
+      fd = -1;
+    }
+    if (fd < 0)
+      file.open(file_path, std::ios::in | std::ios::binary);
+    if (fd < 0 && !file.is_open()) {
+      PrintFileNotOpened(file_path);
+      return;
+    }
+  }
+
+  if (CheckPidWrapper() != 0) {
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+
+  if (fd >= 0) {
+    WriteMapped(fd, static_cast<size_t>(file_stat.st_size), file_path, address,
+                amount);
+    close(fd);
+    return;
+  }
+
+  auto buf{std::make_unique<char[]>(buffer_size_)};
+  size_t done_amount{0}, temp_done_amount{0}, gcount{0};
+  uint8_t last_wrapper_exit_code{0};
+  if (file.is_open()) {
+    for (; amount >= buffer_size_;
+         amount -= buffer_size_, address += buffer_size_) {
+      file.read(buf.get(), buffer_size_);
+      if (file.fail()) {
+        PrintFileFail(file_path);
+        break;
+      }
+      if ((gcount = file.gcount()) != buffer_size_) {
+        last_wrapper_exit_code =
+            WriteWrapper(buf.get(), address, gcount, temp_done_amount,
+                         done_amount != 0);
+        if (last_wrapper_exit_code == 0)
+          done_amount += temp_done_amount;
+        break;
+      }
+      last_wrapper_exit_code =
+          WriteWrapper(buf.get(), address, buffer_size_, temp_done_amount,
+                       done_amount != 0);
+      if (last_wrapper_exit_code != 0)
+        break;
+      done_amount += temp_done_amount;
+    }
+    if (amount && file.good() && last_wrapper_exit_code == 0) {
+      file.read(buf.get(), amount);
+      if (file.fail())
+        PrintFileFail(file_path);
+      else {
+        if ((gcount = file.gcount()) != buffer_size_)
+          last_wrapper_exit_code =
+              WriteWrapper(buf.get(), address, gcount, temp_done_amount,
+                           done_amount != 0);
+        else
+          last_wrapper_exit_code =
+              WriteWrapper(buf.get(), address, amount, temp_done_amount,
+                           done_amount != 0);
+        if (last_wrapper_exit_code == 0)
+          done_amount += temp_done_amount;
+      }
+    }
+  } else {
+    for (; amount >= buffer_size_;
+         amount -= buffer_size_, address += buffer_size_) {
+      str_p->copy(buf.get(), buffer_size_, done_amount);
+      last_wrapper_exit_code =
+          WriteWrapper(buf.get(), address, buffer_size_, temp_done_amount,
+                       done_amount != 0);
+      if (last_wrapper_exit_code != 0)
+        break;
+
+      done_amount += temp_done_amount;
+    }
+    if (amount && last_wrapper_exit_code == 0) {
+      str_p->copy(buf.get(), amount, done_amount);
+      last_wrapper_exit_code =
+          WriteWrapper(buf.get(), address, amount, temp_done_amount,
+                       done_amount != 0);
+      if (last_wrapper_exit_code == 0)
+        done_amount += temp_done_amount;
+    }
+  }
+
+  if (last_wrapper_exit_code != 1)
+    std::cout << done_amount << " bytes written." << std::endl;
+}
+
+/*!
+ \brief Handle command "batch".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ "batch begin" makes "write" queue string writes instead of doing them,
+ "batch commit" does them by BatchCommit, "batch abort" drops them, "batch"
+ without arguments lists them. Print usage in case of usage errors.
+*/
+void Console::CommandBatch(const Command &parent,
+                           const std::vector<std::string> &args) noexcept {
+  std::vector<std::string> values;
+  for (const std::string &arg : args)
+    if (!arg.empty())
+      values.push_back(arg);
+  if (values.size() > 1) {
+    ShowUsage(parent);
+    return;
+  }
+
+  if (values.empty()) {
+    if (!batch_open_) {
+      std::cout << "No batch is open." << std::endl;
+      return;
+    }
+    for (const WriteBatch::Entry &entry : write_batch_.Entries())
+      std::cout << "0x" << std::hex << entry.address << std::dec << ' '
+                << entry.length << std::endl;
+    std::cout << write_batch_.Size() << " writes, " << write_batch_.Bytes()
+              << " bytes queued." << std::endl;
+  } else if (values[0] == "begin") {
+    if (batch_open_) {
+      std::cerr << "A batch is already open." << std::endl;
+      return;
+    }
+    write_batch_.Clear();
+    batch_open_ = true;
+    std::cout << "Batch started, writes are queued until \"batch commit\"."
+              << std::endl;
+  } else if (values[0] == "commit" || values[0] == "abort") {
+    if (!batch_open_) {
+      std::cerr << "No batch is open." << std::endl;
+      return;
+    }
+    if (values[0] == "commit")
+      BatchCommit();
+    else {
+      std::cout << write_batch_.Size() << " writes dropped." << std::endl;
+      write_batch_.Clear();
+      batch_open_ = false;
+    }
+  } else
+    ShowUsage(parent);
+}
+
+/*!
+ \brief Commit the writes queued by "batch begin".
+
+ The batch is committed by CommitWrapper. If nothing is written, the batch
+ stays open, so it can be aborted. Otherwise the batch is closed.
+*/
+void Console::BatchCommit() noexcept {
+  size_t writes{write_batch_.Size()};
+  uint8_t result{CommitWrapper(write_batch_, true)};
+  if (result == 1)
+    return;
+  if (result == 0)
+    std::cout << writes << " writes committed as " << write_batch_.Size()
+              << " ranges, " << write_batch_.Bytes() << " bytes verified."
+              << std::endl;
+  write_batch_.Clear();
+  batch_open_ = false;
+}
+
+/*!
+ \brief Commit a batch of writes and print messages in case of errors.
+ \param [in,out] batch The batch.
+ \param [in] record true to record the batch to the journal if it is on.
+ \return Return code, 0 is success, 1 means that nothing is written, 2 means
+ that a write failed and the old data was written back (or could not be).
+
+ Writes are coalesced and checked against segments of the process first. If a
+ write is outside of segments or in a segment that is not readable, or the old
+ data cannot be read, nothing is written. Otherwise the batch is committed by
+ WriteBatch::Commit, which records it to the journal as one write first (a
+ batch that cannot be recorded is not written). If the old data is written
+ back, the record is dropped.
+*/
+uint8_t Console::CommitWrapper(WriteBatch &batch, bool record) noexcept {
+  if (CheckPidWrapper() != 0 || ParseMapsWrapper() != 0)
+    return 1;
+
+  size_t entry{0};
+  WriteBatch::Problem problem{WriteBatch::Problem::kNone};
+  try {
+    batch.Coalesce();
+    problem = batch.Validate(memory_accessor_.segment_infos_, entry);
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to coalesce the writes." << std::endl;
+    return 1;
+  }
+  if (problem != WriteBatch::Problem::kNone) {
+    const WriteBatch::Entry &range{batch.Entries()[entry]};
+    std::cerr << "Range at 0x" << std::hex << range.address << std::dec
+              << " of " << range.length << " bytes "
+              << (problem == WriteBatch::Problem::kNotMapped
+                      ? "is not inside segments"
+                      : "is in a segment that is not readable")
+              << ", nothing is written." << std::endl;
+    return 1;
+  }
+
+  try {
+    memory_accessor_.OpenSharedMem();
+  } catch (const MemoryAccessor::MemFileEx &ex) {
+    PrintError0Arg(Error0Arg::kPrintErrOpenMem);
+    return 1;
+  }
+  record = record && journal_on_;
+  uint8_t result{1};
+  try {
+    result = batch.Commit(memory_accessor_, record ? &journal_ : nullptr);
+  } catch (const WriteJournal::JournalFileEx &ex) {
+    PrintError0Arg(Error0Arg::kPrintJournalFail);
+    memory_accessor_.CloseSharedMem();
+    return 1;
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to save the old data." << std::endl;
+  }
+  memory_accessor_.CloseSharedMem();
+
+  if (result == 1) {
+    std::cerr << "Couldn't read the old data, nothing is written." << std::endl;
+    return 1;
+  }
+  if (result == 2 && record) {
+    try {
+      journal_.Drop(1);
+    } catch (const WriteJournal::JournalFileEx &ex) {
+      // undoing the kept record writes the same old data again
+    }
+  }
+  if (result != 0) {
+    const WriteBatch::Entry &range{batch.Entries()[batch.Failed()]};
+    std::cerr << "Range at 0x" << std::hex << range.address << std::dec
+              << " was not written, "
+              << (result == 2 ? "the old data is restored."
+                              : "the old data could not be restored.")
+              << std::endl;
+    return 2;
+  }
+  return 0;
+}
+
+/*!
+ \brief Record a batch of writes to the journal if it is on and print messages
+ in case of errors.
+ \param [in,out] batch The batch.
+ \param [in] continued true if the batch is a piece of the previous write.
+ \return Return code, 0 is success (or the journal is off), 1 means that the
+ batch is not recorded and must not be written.
+
+ The batch is recorded by WriteBatch::Journal, /proc/PID/mem has to be opened
+ by OpenSharedMem.
+*/
+uint8_t Console::JournalBatch(WriteBatch &batch, bool continued) noexcept {
+  if (!journal_on_)
+    return 0;
+  try {
+    if (batch.Journal(memory_accessor_, journal_, continued) != 0) {
+      PrintError0Arg(Error0Arg::kPrintSegNoAccess);
+      return 1;
+    }
+  } catch (const WriteJournal::JournalFileEx &ex) {
+    PrintError0Arg(Error0Arg::kPrintJournalFail);
+    return 1;
+  } catch (const std::bad_alloc &ex) {
+    PrintError0Arg(Error0Arg::kPrintJournalFail);
+    return 1;
+  }
+  return 0;
+}
+
+/*!
+ \brief Handle command "journal".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ "journal on" starts recording writes in memory, "journal on file" appends
+ them to the file (loading the writes recorded in it before), "journal off"
+ stops recording and drops the records, "journal" without arguments prints the
+ state and the latest kJournalListed writes. Print usage in case of usage
+ errors.
+
+ Writes of "write", "batch commit", replacements of "diff" and "snapshot
+ restore" are recorded, each command (or pass of diff) as one write. Writes of
+ frozen values and the writes of undo itself are not recorded.
+*/
+void Console::CommandJournal(const Command &parent,
+                             const std::vector<std::string> &args) noexcept {
+  std::vector<std::string> values;
+  for (const std::string &arg : args)
+    if (!arg.empty())
+      values.push_back(arg);
+  if (values.size() > 2 || (values.size() == 2 && values[0] != "on")) {
+    ShowUsage(parent);
+    return;
+  }
+
+  if (values.empty()) {
+    if (!journal_on_) {
+      std::cout << "Journal is off." << std::endl;
+      return;
+    }
+    std::cout << "Journal "
+              << (journal_.Path().empty() ? "in memory"
+                                          : "in " + journal_.Path())
+              << ": " << journal_.Writes() << " writes, "
+              << journal_.RawSize() << " bytes recorded, "
+              << journal_.StoredSize() << " bytes stored." << std::endl;
+    const std::vector<WriteJournal::Record> &records{journal_.Records()};
+    size_t listed{0};
+    for (size_t num{records.size()}; num > 0 && listed < kJournalListed;
+         num--) {
+      const WriteJournal::RecordHeader &header{records[num - 1].header};
+      std::cout << "PID " << header.pid << " 0x" << std::hex << header.address
+                << std::dec << ' ' << header.length
+                << ((header.flags & WriteJournal::kContinued) ? " (continued)"
+                                                              : "")
+                << std::endl;
+      if (!(header.flags & WriteJournal::kContinued))
+        listed++;
+    }
+  } else if (values[0] == "on") {
+    if (journal_on_) {
+      std::cerr << "Journal is already on." << std::endl;
+      return;
+    }
+    if (values.size() == 2) {
+      try {
+        journal_.Open(values[1]);
+      } catch (const WriteJournal::JournalFileEx &ex) {
+        std::cerr << values[1] << ": not a journal or could not be opened"
+                  << std::endl;
+        return;
+      } catch (const std::bad_alloc &ex) {
+        std::cerr << "Not enough memory to load the journal." << std::endl;
+        return;
+      }
+    }
+    memory_accessor_.SetJournal(&journal_);
+    journal_on_ = true;
+    std::cout << "Journal is on";
+    if (values.size() == 2)
+      std::cout << ", " << journal_.Writes() << " writes loaded";
+    std::cout << '.' << std::endl;
+  } else if (values[0] == "off") {
+    memory_accessor_.SetJournal(nullptr);
+    journal_.Close();
+    journal_on_ = false;
+    std::cout << "Journal is off." << std::endl;
+  } else
+    ShowUsage(parent);
+}
+
+/*!
+ \brief Handle command "undo".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Undo the amount of the latest writes of the journal provided as the 1st
+ argument (default is 1) by Undo. Print usage in case of usage errors.
+*/
+void Console::CommandUndo(const Command &parent,
+                          const std::vector<std::string> &args) noexcept {
+  std::vector<std::string> values;
+  for (const std::string &arg : args)
+    if (!arg.empty())
+      values.push_back(arg);
+  if (values.size() > 1) {
+    ShowUsage(parent);
+    return;
+  }
+
+  uint64_t writes{1};
+  if (!values.empty() && StoullWrapper(values[0], writes, "count") != 0)
+    return;
+  Undo(writes);
+}
+
+/*!
+ \brief Handle command "revert-all".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Undo all writes of the journal by Undo. Print usage in case of usage errors.
+*/
+void Console::CommandRevertAll(const Command &parent,
+                               const std::vector<std::string> &args) noexcept {
+  for (const std::string &arg : args)
+    if (!arg.empty()) {
+      ShowUsage(parent);
+      return;
+    }
+  Undo(SIZE_MAX);
+}
+
+/*!
+ \brief Undo the latest writes of the journal.
+ \param [in] writes Amount of writes.
+
+ Old bytes of the writes are queued from the latest write to the oldest one
+ and committed at once by CommitWrapper (overlapping writes are coalesced, so
+ the oldest bytes win). Only writes to the current process are undone: undoing
+ stops at a write to another one. Undone writes are dropped from the journal
+ only if all of them are written back.
+*/
+void Console::Undo(size_t writes) noexcept {
+  if (!journal_on_) {
+    std::cerr << "Journal is off, turn it on with \"journal on\" before "
+                 "writing."
+              << std::endl;
+    return;
+  }
+  if (CheckPidWrapper() != 0)
+    return;
+
+  WriteBatch batch;
+  size_t queued{0};
+  try {
+    queued = journal_.Inverse(writes, memory_accessor_.GetPid(), batch);
+  } catch (const WriteJournal::JournalFileEx &ex) {
+    std::cerr << journal_.Path() << ": could not read the journal"
+              << std::endl;
+    return;
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to read the journal." << std::endl;
+    return;
+  }
+  if (!queued) {
+    std::cout << (journal_.Writes() ? "The latest write was done to another "
+                                      "process, nothing is undone."
+                                    : "No writes to undo.")
+              << std::endl;
+    return;
+  }
+
+  if (CommitWrapper(batch, false) != 0)
+    return;
+  try {
+    journal_.Drop(queued);
+  } catch (const WriteJournal::JournalFileEx &ex) {
+    std::cerr << journal_.Path()
+              << ": could not record the undo, the writes are still listed"
+              << std::endl;
+  }
+  std::cout << queued << " writes undone, " << batch.Bytes()
+            << " bytes restored." << std::endl;
+  if (queued < writes && journal_.Writes())
+    std::cout << "Older writes were done to another process." << std::endl;
+}
+
+/*!
+ \brief Handle command "freeze".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Freeze the value (the 3rd argument) of the type (the 2nd argument) at the
+ address (the 1st argument) by ValueFreezer. The period in us (the 4th
+ argument, default is kFreezePeriod) applies to all frozen values. The value
+ has to be inside segments of the process. Writes of frozen values are not
+ recorded to the journal, a notice is printed if it is on. Without arguments,
+ frozen values are listed by FreezeList. Print usage in case of usage errors.
+*/
+void Console::CommandFreeze(const Command &parent,
+                            const std::vector<std::string> &args) noexcept {
+  std::vector<std::string> values;
+  for (const std::string &arg : args)
+    if (!arg.empty())
+      values.push_back(arg);
+  if (values.empty()) {
+    FreezeList();
+    return;
+  }
+  if (values.size() < 3 || values.size() > 4) {
+    ShowUsage(parent);
+    return;
+  }
+
+  size_t address{0};
+  DiffScanner::ValueType type{DiffScanner::ValueType::kRaw};
+  uint64_t int_value{0}, period{kFreezePeriod};
+  double float_value{0};
+  if (ParseAddress(values[0], address) != 0 ||
+      ParseTypeWrapper(values[1], type) != 0 ||
+      DiffParseValue(values[2], type, int_value, float_value) != 0 ||
+      (values.size() == 4 && StoullWrapper(values[3], period, "period") != 0))
+    return;
+  if (period > UINT64_MAX / 1000) {
+    std::cerr << "Specified period is too big: " << values[3] << std::endl;
+    return;
+  }
+  if (period * 1000 < ValueFreezer::kMinPeriod) {
+    std::cerr << "Period must be at least "
+              << ValueFreezer::kMinPeriod / 1000 << " us." << std::endl;
+    return;
+  }
+
+  if (CheckPidWrapper() != 0 || ParseMapsWrapper() != 0)
+    return;
+  size_t size{DiffScanner::TypeSize(type)};
+  try {
+    if (memory_accessor_.ContiguousSize(address, size) != size)
+      throw MemoryAccessor::AddressNotInSegmentEx();
+  } catch (const MemoryAccessor::SegmentEx &ex) {
+    std::cerr << "Value at 0x" << std::hex << address << std::dec
+              << " is not inside segments." << std::endl;
+    return;
+  }
+
+  pid_t pid{memory_accessor_.GetPid()};
+  if (freezer_.Active() && freezer_.Pid() != pid)
+    std::cout << "Values of PID " << freezer_.Pid() << " are unfrozen."
+              << std::endl;
+  try {
+    if (!freezer_.Freeze(pid, address, ValueBytes(type, int_value, float_value),
+                         values[1] + ' ' + values[2], period * 1000)) {
+      std::cerr << "Maximum amount of values (" << ValueFreezer::kMaxValues
+                << ") is frozen already." << std::endl;
+      return;
+    }
+  } catch (const ValueFreezer::TimerEx &ex) {
+    std::cerr << "Couldn't create the timer of frozen values." << std::endl;
+    return;
+  } catch (const std::system_error &ex) {
+    std::cerr << "Couldn't start threads: " << ex.what() << std::endl;
+    return;
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to freeze the value." << std::endl;
+    return;
+  }
+  std::cout << "Frozen 0x" << std::hex << address << std::dec << ", "
+            << freezer_.Size() << " values are written every "
+            << freezer_.Period() / 1000 << " us." << std::endl;
+  if (journal_on_)
+    std::cout << "Writes of frozen values are not recorded to the journal."
+              << std::endl;
+}
+
+/*!
+ \brief Print frozen values and statistics of ticks (related to freeze).
+
+ The jitter is the delay between the scheduled time of a tick and the time
+ the timer thread woke up: its mean, maximum and the latest one are printed.
+*/
+void Console::FreezeList() const noexcept {
+  if (!freezer_.Active()) {
+    std::cout << "No values are frozen." << std::endl;
+    return;
+  }
+  bool exited{false};
+  ValueFreezer::Stats stats{freezer_.GetStats(exited)};
+  try {
+    std::vector<ValueFreezer::Value> values{freezer_.Values()};
+    std::cout << values.size() << " values of PID " << freezer_.Pid()
+              << " are written every " << freezer_.Period() / 1000 << " us."
+              << std::endl;
+    for (const ValueFreezer::Value &value : values)
+      std::cout << "0x" << std::hex << value.address << std::dec << ' '
+                << value.text << std::endl;
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to list the values." << std::endl;
+    return;
+  }
+  std::cout << "Ticks: " << stats.ticks << ", missed: " << stats.missed
+            << ", failed: " << stats.failed << ", jitter: mean "
+            << std::fixed << std::setprecision(1)
+            << (stats.ticks ? static_cast<double>(stats.jitter_sum) /
+                                  static_cast<double>(stats.ticks) / 1000
+                            : 0.0)
+            << " us, max " << static_cast<double>(stats.jitter_max) / 1000
+            << " us, last " << static_cast<double>(stats.jitter_last) / 1000
+            << " us." << std::defaultfloat << std::endl;
+  if (exited)
+    std::cout << "The process exited, values are not written anymore."
+              << std::endl;
+}
+
+/*!
+ \brief Handle command "unfreeze".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Unfreeze the value at the address provided as the 1st argument, or all values
+ if it is "all". Print usage in case of usage errors.
+*/
+void Console::CommandUnfreeze(const Command &parent,
+                              const std::vector<std::string> &args) noexcept {
+  std::vector<std::string> values;
+  for (const std::string &arg : args)
+    if (!arg.empty())
+      values.push_back(arg);
+  if (values.size() != 1) {
+    ShowUsage(parent);
+    return;
+  }
+
+  if (values[0] == "all") {
+    size_t count{freezer_.Size()};
+    freezer_.Stop();
+    std::cout << count << " values unfrozen." << std::endl;
+    return;
+  }
+
+  size_t address{0};
+  if (ParseAddress(values[0], address) != 0)
+    return;
+  if (freezer_.Unfreeze(address))
+    std::cout << "Unfrozen 0x" << std::hex << address << std::dec << '.'
+              << std::endl;
+  else
+    std::cerr << "Value at 0x" << std::hex << address << std::dec
+              << " is not frozen." << std::endl;
+}
+
+/*!
+ \brief Handle command "diff".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Find differences in memory states by length provided as the 1st argument and
+ replace to string provided as the 2nd argument (optional). Keys available:
+ "-p" - keep hashes of pages instead of full copies, "-j threads" - amount of
+ threads that read and compare memory (default is the number of CPUs), "-a" -
+ read blocks that do not change less often, "-i interval" - minimum interval
+ between passes in ms, "-b budget" - maximum average reading speed in MiB/s,
+ "-c budget" - maximum average CPU usage in percent of one CPU, "-s filter" -
+ compare only memory selected by the filter, "-o file" - write events as
+ NDJSON to the file, "-q" - do not print events, "-t type" - find changed
+ values of the type instead of runs of bytes (the length is not given then,
+ and the replacement is a value of the type), "-m predicate" - report only
+ typed changes that meet the predicate, "-r" - find changed ranges of any
+ length (the length is not given then), "-g gap" - maximum amount of equal
+ bytes inside a range, "-l limit" - maximum size of copies in RAM in MiB, the
+ rest is spilled to scratch files, "-d dir" - directory for scratch files.
+ Keys are only accepted before the length (or the replacement in typed and
+ range modes; in typed mode it may be negative), so the replacement may start
+ with '-'. Print usage in case of usage errors. The status is printed every
+ kDiffStatusPeriod and at the end, the summary of events is printed when
+ SIGUSR1 is received and at the end.
+*/
+void Console::CommandDiff(const Command &parent,
+                          const std::vector<std::string> &args) noexcept {
+  bool hash_mode{false}, adaptive{false}, quiet{false}, ranges{false};
+  std::string length_str, replacement, threads_str, interval_str,
+      byte_budget_str, cpu_budget_str, filter_str, events_path, type_str,
+      predicate_str, gap_str, limit_str, scratch_dir;
+
+  uint32_t par_amount{static_cast<uint32_t>(args.size())};
+  for (uint32_t par_num{0}; par_num < par_amount; par_num++) {
+    if (args[par_num].empty())
+      continue;
+
+    if (args[par_num][0] == '-' && args[par_num].length() > 1 &&
+        length_str.empty() &&
+        (type_str.empty() ||
+         !std::isdigit(static_cast<unsigned char>(args[par_num][1])))) {
+      for (uint32_t ch_num{1}; ch_num < args[par_num].length(); ch_num++) {
+        std::string *value{nullptr};
+        if (args[par_num][ch_num] == 'p')
+          hash_mode = true;
+        else if (args[par_num][ch_num] == 'a')
+          adaptive = true;
+        else if (args[par_num][ch_num] == 'q')
+          quiet = true;
+        else if (args[par_num][ch_num] == 'r')
+          ranges = true;
+        else if (args[par_num][ch_num] == 'j')
+          value = &threads_str;
+        else if (args[par_num][ch_num] == 'i')
+          value = &interval_str;
+        else if (args[par_num][ch_num] == 'b')
+          value = &byte_budget_str;
+        else if (args[par_num][ch_num] == 'c')
+          value = &cpu_budget_str;
+        else if (args[par_num][ch_num] == 's')
+          value = &filter_str;
+        else if (args[par_num][ch_num] == 'o')
+          value = &events_path;
+        else if (args[par_num][ch_num] == 't')
+          value = &type_str;
+        else if (args[par_num][ch_num] == 'm')
+          value = &predicate_str;
+        else if (args[par_num][ch_num] == 'g')
+          value = &gap_str;
+        else if (args[par_num][ch_num] == 'l')
+          value = &limit_str;
+        else if (args[par_num][ch_num] == 'd')
+          value = &scratch_dir;
+
+        if (value) {
+          if (par_num != par_amount - 1 && value->empty()) {
             par_num++;
-            file_path = args[par_num];
+            *value = args[par_num];
+            break;
           } else {
-            ShowUsage(parent);
+            ShowUsage(parent); // no value of the key specified
             return;
           }
-          break;
         }
       }
     } else {
-      if (segment.empty())
-        segment = args[par_num];
+      if (length_str.empty())
+        length_str = args[par_num];
+      else if (replacement.empty())
+        replacement = args[par_num];
+    }
+  }
+
+  DiffScanner::Query query;
+  if (DiffParseQuery(type_str, predicate_str, query) != 0)
+    return;
+
+  if (!gap_str.empty() && !ranges) {
+    std::cerr << "Gap needs key -r." << std::endl;
+    return;
+  }
+  if (ranges && query.type != DiffScanner::ValueType::kRaw) {
+    std::cerr << "Ranges cannot be typed." << std::endl;
+    return;
+  }
+
+  size_t length{DiffScanner::TypeSize(query.type)};
+  if (ranges) {
+    // the 1st argument is the replacement
+    replacement = length_str;
+    length = DiffScanner::kPreviewSize;
+    query.ranges = true;
+    query.gap = kDiffRangeGap;
+    if (!gap_str.empty())
+      if (StoullWrapper(gap_str, query.gap, "gap") != 0)
+        return;
+  } else if (query.type != DiffScanner::ValueType::kRaw) {
+    // the 1st argument is the replacement value
+    replacement.clear();
+    if (!length_str.empty()) {
+      uint64_t int_value{0};
+      double float_value{0};
+      if (DiffParseValue(length_str, query.type, int_value, float_value) != 0)
+        return;
+      replacement = ValueBytes(query.type, int_value, float_value);
+    }
+  } else {
+    if (length_str.empty()) {
+      ShowUsage(parent);
+      return;
+    }
+    if (StoullWrapper(length_str, length, "length") != 0)
+      return;
+    if (!length) {
+      std::cerr << "Length must be greater than 0." << std::endl;
+      return;
+    }
+  }
+
+  uint64_t threads{std::thread::hardware_concurrency()};
+  if (!threads_str.empty())
+    if (StoullWrapper(threads_str, threads, "amount of threads") != 0)
+      return;
+  DiffState state;
+  if (!interval_str.empty())
+    if (StoullWrapper(interval_str, state.interval, "interval") != 0)
+      return;
+  if (!byte_budget_str.empty()) {
+    if (StoullWrapper(byte_budget_str, state.byte_budget, "budget") != 0)
+      return;
+    if (state.byte_budget > UINT64_MAX / 0x100000) {
+      std::cerr << "Budget is too big." << std::endl;
+      return;
     }
+    state.byte_budget *= 0x100000;
   }
-
-  if (segment.empty()) {
-    ShowUsage(parent);
-    return;
-  }
-
-  if (CheckPidWrapper() != 0)
-    return;
-
-  size_t num{0}, segment_infos_size{memory_accessor_.segment_infos_.size()};
-  try {
-    num = std::stoull(segment);
-    if (num >= segment_infos_size) {
-      PrintError0Arg(Error0Arg::kPrintSegNotExist);
+  if (!cpu_budget_str.empty())
+    if (StoullWrapper(cpu_budget_str, state.cpu_budget, "budget") != 0)
+      return;
+  uint64_t limit{0};
+  if (!limit_str.empty()) {
+    if (hash_mode) {
+      std::cerr << "Limit cannot be used with key -p." << std::endl;
       return;
     }
-  } catch (const std::invalid_argument &ex) {
-    size_t i{0};
-
-    for (; i < segment_infos_size; i++) {
-      if (memory_accessor_.segment_infos_[i].path == segment) {
-        num = i;
-        break;
-      }
+    if (StoullWrapper(limit_str, limit, "limit") != 0)
+      return;
+    if (!limit) {
+      std::cerr << "Limit must be greater than 0." << std::endl;
+      return;
     }
-
-    if (i >= segment_infos_size) {
-      PrintError0Arg(Error0Arg::kPrintSegNotExist);
+    if (limit > SIZE_MAX / 0x100000) {
+      std::cerr << "Limit is too big." << std::endl;
       return;
     }
-  } catch (const std::out_of_range &ex) {
-    std::cerr << "Specified segment number is too big: " << segment
-              << std::endl;
+    limit *= 0x100000;
+  }
+  if (!scratch_dir.empty() && !limit) {
+    std::cerr << "Scratch directory needs key -l." << std::endl;
     return;
   }
-
-  std::ostream *stream_p{nullptr};
-  std::ofstream file;
-  if (!file_path.empty()) {
-    file.open(file_path, std::ios::out | std::ios::binary);
-    stream_p = &file;
-  } else {
-    stream_p = &std::cout;
+  if (scratch_dir.empty()) {
+    const char *tmpdir{std::getenv("TMPDIR")};
+    scratch_dir = tmpdir && *tmpdir ? tmpdir : "/var/tmp";
   }
-
-  if (CheckSegNumWrapper(num) != 0)
+  if (ParseFilterWrapper(filter_str, state.filter) != 0)
     return;
+  if (!events_path.empty()) {
+    state.events_file.open(events_path, std::ios::out | std::ios::trunc);
+    if (!state.events_file.good()) {
+      PrintFileNotOpened(events_path);
+      return;
+    }
+    state.events.SetJsonStream(&state.events_file);
+  }
+  if (!quiet)
+    state.events.SetConsumer([this](const DiffEvents::Event &event) {
+      DiffPrintEvent(event);
+    });
+
+  diff_scanner_.SetThreads(
+      static_cast<unsigned>(std::min<uint64_t>(threads, kMaxDiffThreads)));
+  diff_scanner_.SetAdaptive(adaptive);
+  diff_scanner_.SetQuery(query);
+  diff_store_.SetHashMode(hash_mode);
+  diff_store_.SetBudget(limit, scratch_dir);
+
+  state.length = length;
+  state.replacement = replacement;
+  state.ranges = query.ranges;
+  state.gap = query.gap;
+  state.run_old = std::make_unique<char[]>(length);
+  state.run_new = std::make_unique<char[]>(length);
 
-  size_t size{memory_accessor_.segment_infos_[num].end -
-              memory_accessor_.segment_infos_[num].start},
-      done_size{0};
-  auto buf{std::make_unique<char[]>(buffer_size_)};
-  uint8_t last_wrapper_exit_code{0};
+  seg_not_exist_msg_enabled_ = seg_no_access_msg_enabled_ = false;
 
-  if (raw) {
-    for (; size >= buffer_size_; size -= buffer_size_) {
-      if (ctrl_c_pressed) {
-        ctrl_c_pressed = false;
-        break;
-      }
+  struct sigaction summary_sigact, old_summary_sigact;
+  summary_sigact.sa_handler = memoryaccessor_console_src::DiffSummaryRequest;
+  sigemptyset(&summary_sigact.sa_mask);
+  summary_sigact.sa_flags = 0;
+  memoryaccessor_console_src::diff_summary_requested = 0;
+  sigaction(SIGUSR1, &summary_sigact, &old_summary_sigact);
 
-      last_wrapper_exit_code =
-          ReadSegWrapper(buf.get(), num, done_size, buffer_size_);
-      if (last_wrapper_exit_code != 0)
-        break;
+  // 1st run before the loop: parsing maps and dumping all segments
 
-      stream_p->write(buf.get(), buffer_size_);
-      done_size += buffer_size_;
-    }
-    if (size && last_wrapper_exit_code == 0) {
-      last_wrapper_exit_code = ReadSegWrapper(buf.get(), num, done_size);
-      if (last_wrapper_exit_code == 0)
-        stream_p->write(buf.get(), buffer_size_);
-    }
-  } else {
-    for (; size >= buffer_size_; size -= buffer_size_) {
-      if (ctrl_c_pressed) {
-        ctrl_c_pressed = false;
-        break;
-      }
+  if (ParseMapsWrapper() != 0)
+    goto diff_return;
 
-      last_wrapper_exit_code =
-          ReadSegWrapper(buf.get(), num, done_size, buffer_size_);
-      if (last_wrapper_exit_code != 0)
-        break;
+  try {
+    memory_accessor_.OpenSharedMem();
+  } catch (const MemoryAccessor::MemFileEx &ex) {
+    PrintError0Arg(Error0Arg::kPrintErrOpenMem);
+    goto diff_return;
+  }
 
-      hex_viewer_.PrintHex(
-          stream_p, buf.get(), buffer_size_,
-          memory_accessor_.segment_infos_[num].start + done_size, hex);
-      done_size += buffer_size_;
-    }
-    if (size && last_wrapper_exit_code == 0) {
-      last_wrapper_exit_code = ReadSegWrapper(buf.get(), num, done_size);
-      if (last_wrapper_exit_code == 0)
-        hex_viewer_.PrintHex(
-            stream_p, buf.get(), buffer_size_,
-            memory_accessor_.segment_infos_[num].start + done_size, hex);
-    }
+  state.begin = state.pass_begin = state.status_time =
+      std::chrono::steady_clock::now();
+  state.pass_cpu_begin = std::clock();
+  if (DiffUpdate(state) != 0)
+    goto diff_return;
+
+  // Segments are stored in diff_store_ by address ranges. On every iteration
+  // maps are parsed again, then the copies of segments that have not moved are
+  // updated in place, and new segments are read to new buffers while being
+  // compared to the old ones they overlap. Reading and comparing are done by
+  // diff_scanner_ in worker threads. Between passes, diff sleeps to keep the
+  // interval and the budgets; in adaptive mode, blocks that have not changed
+  // are skipped by some passes.
+
+  for (;;) {
+    if (DiffPause(state) != 0) // Ctrl-C is checked here
+      break;
+
+    state.pass_begin = std::chrono::steady_clock::now();
+    state.pass_cpu_begin = std::clock();
+    if (ParseMapsWrapper() != 0 || DiffUpdate(state) != 0)
+      break;
   }
 
-  if (raw && stream_p == &std::cout)
-    std::cout << std::endl;
+diff_return:
+  sigaction(SIGUSR1, &old_summary_sigact, nullptr);
+  if (state.iteration) {
+    DiffPrintSummary(state);
+    DiffPrintStatus(state);
+  }
+  memory_accessor_.CloseSharedMem();
+  diff_store_.Reset();
+  seg_not_exist_msg_enabled_ = seg_no_access_msg_enabled_ = true;
 }
 
 /*!
- \brief Handle command "read".
+ \brief Handle command "xref".
  \param [in] parent Related Command object.
  \param [in] args Arguments for the command.
 
- Read an amount of bytes provided as the 2nd argument starting from an address
- provided as the 1st argument. Keys available: "-h" - show hex (if no "-r"
- specified), "-r" - print raw data, "-f file" write output to file "file". Print
- usage in case of usage errors.
+ List locations that hold pointers into the range that starts at the address
+ provided as the 1st argument and has length provided as the 2nd argument
+ (optional, default is 1). Maps are parsed again and the reverse pointer index
+ is rebuilt if the layout of memory has changed. Keys available: "-u" - rebuild
+ the index anyway, "-s filter" - index only pointers in memory selected by the
+ filter (the index is rebuilt if the filter differs from the one it was built
+ with). Print usage in case of usage errors.
 */
-void Console::CommandRead(const Command &parent,
+void Console::CommandXref(const Command &parent,
                           const std::vector<std::string> &args) noexcept {
-  bool raw{false}, hex{false};
-
-  std::string file_path, addr_str, amount_str;
+  bool update{false};
+  std::string addr_str, length_str, filter_str;
 
   uint32_t par_amount{static_cast<uint32_t>(args.size())};
   for (uint32_t par_num{0}; par_num < par_amount; par_num++) {
@@ -1417,26 +4225,18 @@ void Console::CommandRead(const Command &parent,
       continue;
 
     if (args[par_num][0] == '-') {
-      if (args[par_num].length() == 1)
-        continue;
-
       for (uint32_t ch_num{1}; ch_num < args[par_num].length(); ch_num++) {
-        switch (args[par_num][ch_num]) {
-        case 'r':
-          raw = true;
-          break;
-        case 'h':
-          hex = true;
-          break;
-        case 'f':
-          if (par_num != par_amount - 1 && file_path.empty()) {
+        if (args[par_num][ch_num] == 'u')
+          update = true;
+        else if (args[par_num][ch_num] == 's') {
+          if (par_num != par_amount - 1 && filter_str.empty()) {
             par_num++;
-            file_path = args[par_num];
+            filter_str = args[par_num];
+            break;
           } else {
-            ShowUsage(parent);
+            ShowUsage(parent); // no filter specified
             return;
           }
-          break;
         }
       }
     } else {
@@ -1444,14 +4244,14 @@ void Console::CommandRead(const Command &parent,
         addr_str = args[par_num];
         continue;
       }
-      if (amount_str.empty()) {
-        amount_str = args[par_num];
+      if (length_str.empty()) {
+        length_str = args[par_num];
         continue;
       }
     }
   }
 
-  if (addr_str.empty() || amount_str.empty()) {
+  if (addr_str.empty()) {
     ShowUsage(parent);
     return;
   }
@@ -1460,410 +4260,786 @@ void Console::CommandRead(const Command &parent,
   if (ParseAddress(addr_str, address))
     return;
 
-  size_t amount{0};
-  if (StoullWrapper(amount_str, amount, "amount") != 0)
-    return;
+  size_t length{1};
+  if (!length_str.empty())
+    if (StoullWrapper(length_str, length, "length") != 0)
+      return;
+
+  if (filter_str != xref_filter_.Expression()) {
+    RegionFilter filter;
+    if (ParseFilterWrapper(filter_str, filter) != 0)
+      return;
+    std::swap(xref_filter_, filter);
+    update = true;
+  }
 
   if (CheckPidWrapper() != 0)
     return;
 
-  std::ostream *stream_p{nullptr};
-  std::ofstream file;
-  if (!file_path.empty()) {
-    file.open(file_path, std::ios::out | std::ios::binary);
-    stream_p = &file;
-  } else {
-    stream_p = &std::cout;
+  if (ParseMapsWrapper() != 0) {
+    pointer_index_.Reset();
+    return;
   }
 
-  auto buf{std::make_unique<char[]>(buffer_size_)};
-  size_t done_amount{0}, temp_done_amount{0};
-  uint8_t last_wrapper_exit_code{0};
-  if (raw) {
-    for (; amount >= buffer_size_; amount -= buffer_size_) {
-      if (ctrl_c_pressed) {
-        ctrl_c_pressed = false;
-        break;
-      }
+  if (update || !pointer_index_.IsValid(memory_accessor_.GetPid(),
+                                        memory_accessor_.GetMapsVersion())) {
+    std::cout << "Building pointer index..." << std::endl;
+    switch (XrefBuild()) {
+    case 1:
+      return;
+    case 2:
+      std::cout << "Interrupted." << std::endl;
+      return;
+    }
+    std::cout << "Indexed " << pointer_index_.Size() << " pointers."
+              << std::endl;
+  }
 
-      last_wrapper_exit_code =
-          ReadWrapper(buf.get(), address, buffer_size_, temp_done_amount);
-      if (last_wrapper_exit_code != 0)
-        break;
-      stream_p->write(buf.get(), temp_done_amount);
-      done_amount += temp_done_amount;
-      address += temp_done_amount;
+  auto [first, last] = pointer_index_.Find(address, length);
+  size_t found{0};
+  for (auto it{first}; it != last; it++, found++) {
+    if (ctrl_c_pressed) {
+      ctrl_c_pressed = false;
+      break;
     }
-    if (amount && last_wrapper_exit_code == 0) {
-      last_wrapper_exit_code =
-          ReadWrapper(buf.get(), address, amount, temp_done_amount);
-      if (last_wrapper_exit_code == 0) {
-        stream_p->write(buf.get(), temp_done_amount);
-        done_amount += temp_done_amount;
-        address += temp_done_amount;
-      }
+
+    std::cout << std::hex << it->location << " -> " << it->target << std::dec;
+    try {
+      std::cout << "  "
+                << memory_accessor_
+                       .segment_infos_[memory_accessor_.AddressInSegment(
+                           it->location)]
+                       .path;
+    } catch (const MemoryAccessor::AddressNotInSegmentEx &ex) {
     }
-  } else {
-    for (; amount >= buffer_size_; amount -= buffer_size_) {
-      if (ctrl_c_pressed) {
-        ctrl_c_pressed = false;
-        break;
+    std::cout << '\n';
+  }
+
+  std::cout << found << (found == 1 ? " reference" : " references")
+            << " found." << std::endl;
+}
+
+/*!
+ \brief Take a sample of writes to pages (related to heatmap).
+ \param [in] filter Filter of tracked memory.
+ \param [in,out] read_bytes Sum of bytes read, the sample adds to it.
+ \return Return code, 0 is success, 1 is an error (the error is printed).
+
+ Parse maps again, update the layout of heatmap_ with writable segments
+ selected by the filter and sample them.
+*/
+uint8_t Console::HeatmapSample(RegionFilter &filter,
+                               uint64_t &read_bytes) noexcept {
+  if (ParseMapsWrapper() != 0)
+    return 1;
+
+  try {
+    std::vector<SegmentInfo> segments;
+    if (filter.Empty())
+      segments = memory_accessor_.segment_infos_;
+    else
+      for (const RegionFilter::Interval &interval :
+           filter.Compile(memory_accessor_.segment_infos_)) {
+        segments.push_back(memory_accessor_.segment_infos_[interval.num]);
+        segments.back().start = interval.start;
+        segments.back().end = interval.end;
       }
+    std::erase_if(segments, [](const SegmentInfo &segment_info) {
+      return !(segment_info.mode & 0b0100); // not writable
+    });
+
+    heatmap_.Update(segments);
+    read_bytes += heatmap_.Sample(memory_accessor_, tools_);
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to store counters." << std::endl;
+    return 1;
+  }
+  return 0;
+}
 
-      last_wrapper_exit_code =
-          ReadWrapper(buf.get(), address, buffer_size_, temp_done_amount);
-      if (last_wrapper_exit_code != 0)
-        break;
-      hex_viewer_.PrintHex(stream_p, buf.get(), temp_done_amount, address, hex);
-      done_amount += temp_done_amount;
-      address += temp_done_amount;
-    }
-    if (amount && last_wrapper_exit_code == 0) {
-      last_wrapper_exit_code =
-          ReadWrapper(buf.get(), address, amount, temp_done_amount);
-      if (last_wrapper_exit_code == 0) {
-        hex_viewer_.PrintHex(stream_p, buf.get(), temp_done_amount, address,
-                             hex);
-        done_amount += temp_done_amount;
-        address += temp_done_amount;
+/*!
+ \brief Print the report of heatmap.
+ \param [in] seconds Time between the first and the last sample.
+ \param [in] samples Amount of samples that counted writes.
+ \param [in] top Amount of the hottest segments and pages to print.
+
+ Print the dirty rate (bytes of written pages per second) of the most written
+ segments, the most written pages and the histogram of writes per page.
+*/
+void Console::HeatmapReport(double seconds, uint64_t samples,
+                            size_t top) const noexcept {
+  constexpr size_t kPageSize{PageHeatmap::kPageSize};
+  std::ostringstream report;
+  report << std::fixed << std::setprecision(1) << "Sampled " << samples
+         << " time(s) in " << seconds << " s by "
+         << (heatmap_.SoftDirty() ? "soft-dirty bits" : "page hashes")
+         << ".\n";
+  if (!samples || seconds <= 0) {
+    std::cout << report.str() << std::flush;
+    return;
+  }
+
+  try {
+    std::vector<std::pair<uint64_t, const PageHeatmap::Region *>> segments;
+    for (const std::vector<PageHeatmap::Region> *regions :
+         {&heatmap_.Regions(), &heatmap_.Retired()})
+      for (const PageHeatmap::Region &region : *regions)
+        if (uint64_t writes{PageHeatmap::Writes(region)})
+          segments.push_back({writes, &region});
+    std::sort(segments.begin(), segments.end(),
+              [](const auto &a, const auto &b) { return a.first > b.first; });
+    if (segments.size() > top)
+      segments.resize(top);
+
+    report << "Dirty rate by segment:\n";
+    for (const auto &[writes, region] : segments)
+      report << "  " << std::hex << region->start << '-' << region->end
+             << std::dec << "  "
+             << static_cast<double>(writes * kPageSize) / seconds / 0x400
+             << " KiB/s  " << region->path << '\n';
+
+    report << "Hottest pages:\n";
+    for (const PageHeatmap::Page &page : heatmap_.Top(top))
+      report << "  " << std::hex << page.address << std::dec << "  "
+             << page.count << "  " << page.region->path << '\n';
+
+    report << "Writes per page:\n";
+    std::array<uint64_t, PageHeatmap::kHistogramSize> histogram{
+        heatmap_.Histogram()};
+    for (size_t i{0}; i < histogram.size(); i++)
+      if (histogram[i]) {
+        report << "  " << (uint64_t{1} << i);
+        if (i)
+          report << '-' << (uint64_t{2} << i) - 1;
+        report << ": " << histogram[i] << " page(s)\n";
+      }
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to make the report." << std::endl;
+  }
+  std::cout << report.str() << std::flush;
+}
+
+/*!
+ \brief Handle command "heatmap".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
+
+ Sample writes to pages of writable segments every interval for duration
+ seconds provided as the 1st argument, or until Ctrl-C is pressed, then print
+ the report. Written pages are found by soft-dirty bits if the kernel supports
+ them and /proc/PID/clear_refs can be written, otherwise by hashes of pages.
+ Keys available: "-p" - use hashes anyway, "-i interval" - interval between
+ samples in ms (default is kHeatmapInterval), "-s filter" - track only memory
+ selected by the filter, "-n amount" - amount of the hottest segments and
+ pages to print (default is kHeatmapTop), "-o file" - write counters as CSV to
+ the file. Print usage in case of usage errors.
+*/
+void Console::CommandHeatmap(const Command &parent,
+                             const std::vector<std::string> &args) noexcept {
+  using Seconds = std::chrono::duration<double>;
+  bool hashes{false};
+  std::string duration_str, interval_str, filter_str, top_str, csv_path;
+
+  uint32_t par_amount{static_cast<uint32_t>(args.size())};
+  for (uint32_t par_num{0}; par_num < par_amount; par_num++) {
+    if (args[par_num].empty())
+      continue;
+
+    if (args[par_num][0] == '-' && args[par_num].length() > 1) {
+      for (uint32_t ch_num{1}; ch_num < args[par_num].length(); ch_num++) {
+        std::string *value{nullptr};
+        if (args[par_num][ch_num] == 'p')
+          hashes = true;
+        else if (args[par_num][ch_num] == 'i')
+          value = &interval_str;
+        else if (args[par_num][ch_num] == 's')
+          value = &filter_str;
+        else if (args[par_num][ch_num] == 'n')
+          value = &top_str;
+        else if (args[par_num][ch_num] == 'o')
+          value = &csv_path;
+
+        if (value) {
+          if (par_num != par_amount - 1 && value->empty()) {
+            par_num++;
+            *value = args[par_num];
+            break;
+          } else {
+            ShowUsage(parent); // no value of the key specified
+            return;
+          }
+        }
       }
+    } else if (duration_str.empty())
+      duration_str = args[par_num];
+  }
+
+  if (duration_str.empty()) {
+    ShowUsage(parent);
+    return;
+  }
+
+  uint64_t duration{0}, interval{kHeatmapInterval}, top{kHeatmapTop};
+  if (StoullWrapper(duration_str, duration, "duration") != 0)
+    return;
+  if (!duration) {
+    std::cerr << "Duration must be greater than 0." << std::endl;
+    return;
+  }
+  if (!interval_str.empty())
+    if (StoullWrapper(interval_str, interval, "interval") != 0)
+      return;
+  if (!top_str.empty())
+    if (StoullWrapper(top_str, top, "amount") != 0)
+      return;
+  RegionFilter filter;
+  if (ParseFilterWrapper(filter_str, filter) != 0)
+    return;
+  std::ofstream csv_file;
+  if (!csv_path.empty()) {
+    csv_file.open(csv_path, std::ios::out | std::ios::trunc);
+    if (!csv_file.good()) {
+      PrintFileNotOpened(csv_path);
+      return;
     }
   }
 
-  if (last_wrapper_exit_code == 2) {
-    if (raw)
-      stream_p->write(buf.get(), temp_done_amount);
-    else
-      hex_viewer_.PrintHex(stream_p, buf.get(), temp_done_amount, address, hex);
-    done_amount += temp_done_amount;
+  if (CheckPidWrapper() != 0 || ParseMapsWrapper() != 0)
+    return;
+
+  bool soft_dirty{!hashes};
+  try {
+    memory_accessor_.OpenSharedMem();
+    if (soft_dirty)
+      memory_accessor_.OpenPagemap();
+  } catch (const MemoryAccessor::MemFileEx &ex) {
+    PrintError0Arg(Error0Arg::kPrintErrOpenMem);
+    return;
+  } catch (const MemoryAccessor::PagemapFileEx &ex) {
+    soft_dirty = false;
+  }
+  heatmap_.SetSoftDirty(soft_dirty);
+  seg_not_exist_msg_enabled_ = seg_no_access_msg_enabled_ = false;
+
+  std::cout << "Sampling writes of PID " << memory_accessor_.GetPid()
+            << " for " << duration << " s. Press Ctrl-C to stop." << std::endl;
+
+  // The 1st sample only initializes counters (and shows if soft-dirty bits
+  // are supported: they are set on all pages that were not cleared), every
+  // next one counts pages written since the previous one.
+
+  uint64_t samples{0}, read_bytes{0};
+  bool initialized{false};
+  std::chrono::steady_clock::time_point begin, sample_begin;
+  for (;;) {
+    sample_begin = std::chrono::steady_clock::now();
+    if (HeatmapSample(filter, read_bytes) != 0)
+      break;
+
+    if (heatmap_.SoftDirty() &&
+        ((!initialized && !heatmap_.SoftDirtySeen()) ||
+         !memory_accessor_.ClearSoftDirty())) {
+      std::cout << "Soft-dirty bits are not available, using page hashes."
+                << std::endl;
+      heatmap_.SetSoftDirty(false);
+      initialized = false;
+      samples = 0;
+      continue;
+    }
+    if (initialized)
+      samples++;
+    else {
+      begin = sample_begin;
+      initialized = true;
+    }
+
+    if (sample_begin - begin >= std::chrono::seconds(duration))
+      break;
+    auto until{std::min(sample_begin + std::chrono::milliseconds(interval),
+                        begin + std::chrono::seconds(duration))};
+    for (auto now{std::chrono::steady_clock::now()};
+         now < until && !ctrl_c_pressed; now = std::chrono::steady_clock::now())
+      std::this_thread::sleep_for(
+          std::min<std::chrono::steady_clock::duration>(until - now,
+                                                        kDiffSleepStep));
+    if (ctrl_c_pressed) {
+      ctrl_c_pressed = false;
+      break;
+    }
   }
 
-  if (raw && stream_p == &std::cout)
-    std::cout << std::endl;
-
-  if (last_wrapper_exit_code != 1)
-    std::cout << done_amount << " bytes read." << std::endl;
+  HeatmapReport(initialized ? Seconds(sample_begin - begin).count() : 0,
+                samples, top);
+  if (!heatmap_.SoftDirty())
+    std::cout << "Read " << std::fixed << std::setprecision(1)
+              << static_cast<double>(read_bytes) / 0x100000 << " MiB."
+              << std::defaultfloat << std::endl;
+  if (csv_file.is_open())
+    heatmap_.WriteCsv(csv_file);
+
+  memory_accessor_.CloseSharedMem();
+  memory_accessor_.ClosePagemap();
+  heatmap_.Reset();
+  seg_not_exist_msg_enabled_ = seg_no_access_msg_enabled_ = true;
 }
 
 /*!
- \brief Handle command "write".
+ \brief Handle command "core".
  \param [in] parent Related Command object.
  \param [in] args Arguments for the command.
 
- Write to memory an amount of bytes provided as the 2nd argument starting from
- an address provided as the 1st argument. Data is taken either from the string
- provided as the 3rd argument or the file specified in type "-f file". Print
+ Write an ELF core file of the process to the path provided as the 1st
+ argument. Threads are stopped by ptrace to read their registers, maps are
+ parsed while they are stopped, and they are resumed before memory is read,
+ unless "-k" is given. Keys available: "-k" - keep threads stopped until the
+ file is written, "-j threads" - amount of threads that read memory (default
+ is the number of CPUs). Ctrl-C stops writing and deletes the file. Print
  usage in case of usage errors.
 */
-void Console::CommandWrite(const Command &parent,
-                           const std::vector<std::string> &args) noexcept {
-  std::string file_path, addr_str, amount_str;
-  const std::string *str_p{nullptr};
-  std::ifstream file;
+void Console::CommandCore(const Command &parent,
+                          const std::vector<std::string> &args) noexcept {
+  bool keep_stopped{false};
+  std::string path, threads_str;
 
   uint32_t par_amount{static_cast<uint32_t>(args.size())};
   for (uint32_t par_num{0}; par_num < par_amount; par_num++) {
     if (args[par_num].empty())
       continue;
 
-    if (args[par_num][0] == '-') {
-      if (args[par_num].length() == 1)
-        continue;
-
+    if (args[par_num][0] == '-' && args[par_num].length() > 1) {
       for (uint32_t ch_num{1}; ch_num < args[par_num].length(); ch_num++) {
-        if (args[par_num][ch_num] == 'f') {
-          if (par_num != par_amount - 1 && file_path.empty()) {
+        std::string *value{nullptr};
+        if (args[par_num][ch_num] == 'k')
+          keep_stopped = true;
+        else if (args[par_num][ch_num] == 'j')
+          value = &threads_str;
+
+        if (value) {
+          if (par_num != par_amount - 1 && value->empty()) {
             par_num++;
-            file_path = args[par_num];
+            *value = args[par_num];
+            break;
           } else {
-            ShowUsage(parent);
+            ShowUsage(parent); // no value of the key specified
             return;
           }
         }
       }
-    } else {
-      if (addr_str.empty()) {
-        addr_str = args[par_num];
-        continue;
-      }
-      if (amount_str.empty()) {
-        amount_str = args[par_num];
-        continue;
-      }
-      if (!str_p) {
-        str_p = &args[par_num];
-        continue;
-      }
-    }
+    } else if (path.empty())
+      path = args[par_num];
   }
 
-  if (addr_str.empty() || amount_str.empty() || (!str_p && file_path.empty())) {
+  if (path.empty()) {
     ShowUsage(parent);
     return;
   }
-
-  size_t address{0};
-  if (ParseAddress(addr_str, address))
+  uint64_t threads{std::thread::hardware_concurrency()};
+  if (!threads_str.empty())
+    if (StoullWrapper(threads_str, threads, "amount of threads") != 0)
+      return;
+  if (CheckPidWrapper() != 0)
     return;
 
-  size_t amount{0};
-  if (StoullWrapper(amount_str, amount, "amount") != 0)
+  pid_t pid{memory_accessor_.GetPid()};
+  bool pagemap{true};
+  try {
+    memory_accessor_.OpenSharedMem();
+    memory_accessor_.OpenPagemap();
+  } catch (const MemoryAccessor::MemFileEx &ex) {
+    PrintError0Arg(Error0Arg::kPrintErrOpenMem);
     return;
-
-  if (str_p && str_p->length() < amount) {
-    std::cout << "String length is less than amount, setting amount to length."
-              << std::endl;
-    amount = str_p->length();
+  } catch (const MemoryAccessor::PagemapFileEx &ex) {
+    pagemap = false;
   }
+  core_writer_.SetThreads(
+      static_cast<unsigned>(std::min<uint64_t>(threads, kMaxDiffThreads)));
 
-  if (!file_path.empty()) {
-    file.open(file_path, std::ios::in | std::ios::binary);
-    if (!file.good()) {
-      PrintFileNotOpened(file_path);
-      return;
+  std::cout << "Writing core of PID " << pid << " to " << path
+            << ". Press Ctrl-C to stop." << std::endl;
+  auto begin{std::chrono::steady_clock::now()};
+  uint8_t result{1};
+  try {
+    core_writer_.Attach(pid);
+    if (ParseMapsWrapper() == 0) {
+      core_writer_.Plan(pid, memory_accessor_.segment_infos_, memory_accessor_,
+                        pagemap);
+      if (!keep_stopped)
+        core_writer_.Detach();
+      result = core_writer_.Write(path, memory_accessor_,
+                                  [] { return ctrl_c_pressed; });
     }
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to write the core file." << std::endl;
+  } catch (const CoreWriter::CoreFileEx &ex) {
+    std::cerr << path << ": could not write the core file" << std::endl;
+  } catch (const std::system_error &ex) {
+    std::cerr << "Couldn't start threads: " << ex.what() << std::endl;
   }
+  core_writer_.Detach();
+  memory_accessor_.ClosePagemap();
+  memory_accessor_.CloseSharedMem();
 
-  if (CheckPidWrapper() != 0)
+  if (result == 2) {
+    ctrl_c_pressed = false;
+    std::cout << "Stopped, the core file is deleted." << std::endl;
     return;
-
-  auto buf{std::make_unique<char[]>(buffer_size_)};
-  size_t done_amount{0}, temp_done_amount{0}, gcount{0};
-  uint8_t last_wrapper_exit_code{0};
-  if (file.is_open()) {
-    for (; amount >= buffer_size_;
-         amount -= buffer_size_, address += buffer_size_) {
-      file.read(buf.get(), buffer_size_);
-      if (file.fail()) {
-        PrintFileFail(file_path);
-        break;
-      }
-      if ((gcount = file.gcount()) != buffer_size_) {
-        last_wrapper_exit_code =
-            WriteWrapper(buf.get(), address, gcount, temp_done_amount);
-        if (last_wrapper_exit_code == 0)
-          done_amount += temp_done_amount;
-        break;
-      }
-      last_wrapper_exit_code =
-          WriteWrapper(buf.get(), address, buffer_size_, temp_done_amount);
-      if (last_wrapper_exit_code != 0)
-        break;
-      done_amount += temp_done_amount;
-    }
-    if (amount && file.good() && last_wrapper_exit_code == 0) {
-      file.read(buf.get(), amount);
-      if (file.fail())
-        PrintFileFail(file_path);
-      else {
-        if ((gcount = file.gcount()) != buffer_size_)
-          last_wrapper_exit_code =
-              WriteWrapper(buf.get(), address, gcount, temp_done_amount);
-        else
-          last_wrapper_exit_code =
-              WriteWrapper(buf.get(), address, amount, temp_done_amount);
-        if (last_wrapper_exit_code == 0)
-          done_amount += temp_done_amount;
-      }
-    }
-  } else {
-    for (; amount >= buffer_size_;
-         amount -= buffer_size_, address += buffer_size_) {
-      str_p->copy(buf.get(), buffer_size_, done_amount);
-      last_wrapper_exit_code =
-          WriteWrapper(buf.get(), address, buffer_size_, temp_done_amount);
-      if (last_wrapper_exit_code != 0)
-        break;
-
-      done_amount += temp_done_amount;
-    }
-    if (amount && last_wrapper_exit_code == 0) {
-      str_p->copy(buf.get(), amount, done_amount);
-      last_wrapper_exit_code =
-          WriteWrapper(buf.get(), address, amount, temp_done_amount);
-      if (last_wrapper_exit_code == 0)
-        done_amount += temp_done_amount;
-    }
   }
+  if (result != 0)
+    return;
 
-  if (last_wrapper_exit_code != 1)
-    std::cout << done_amount << " bytes written." << std::endl;
+  size_t with_regs{static_cast<size_t>(std::count_if(
+      core_writer_.Threads().begin(), core_writer_.Threads().end(),
+      [](const CoreWriter::Thread &thread) { return thread.has_regs; }))};
+  double seconds{std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - begin)
+                     .count()};
+  std::cout << "Wrote " << core_writer_.Loads().size() << " segment(s), "
+            << core_writer_.Threads().size() << " thread(s) (" << with_regs
+            << " with registers), " << std::fixed << std::setprecision(1)
+            << static_cast<double>(core_writer_.WrittenBytes()) / 0x100000
+            << " MiB of memory in " << seconds << " s." << std::defaultfloat
+            << std::endl;
+  if (!with_regs)
+    std::cout << "Threads could not be stopped, registers are not saved. "
+              << kCheckSudoStr << std::endl;
 }
 
 /*!
- \brief Handle command "diff".
+ \brief Handle command "snapshot".
  \param [in] parent Related Command object.
  \param [in] args Arguments for the command.
 
- Find differences in memory states by length provided as the 1st argument and
- replace to string provided as the 2nd argument (optional). Print usage in case
- of usage errors.
+ With "save" as the 1st argument, save memory of the process to the snapshot
+ file provided as the 2nd argument, keys available: "-s filter" - save only
+ memory selected by the filter, "-z" - compress pages. With "diff", print
+ changes of segments and changed ranges between the snapshot files provided as
+ the 2nd and the 3rd arguments (the 3rd may be "live" to compare to memory of
+ the process), keys available: "-g gap" - maximum amount of equal bytes inside
+ a range, "-q" - do not print changes, "-o file" - write changes as NDJSON to
+ the file. With "restore", write pages of writable segments of the snapshot file
+ provided as the 2nd argument that differ from memory of the process back, keys
+ available: "-k" - stop threads of the process while memory is restored. Print
+ usage in case of usage errors.
 */
-void Console::CommandDiff(const Command &parent,
-                          const std::vector<std::string> &args) noexcept {
-  if (args.size() < 1) {
+void Console::CommandSnapshot(const Command &parent,
+                              const std::vector<std::string> &args) noexcept {
+  bool quiet{false}, keep_stopped{false}, compress{false};
+  std::string action, old_path, new_path, filter_str, gap_str, events_path;
+
+  uint32_t par_amount{static_cast<uint32_t>(args.size())};
+  for (uint32_t par_num{0}; par_num < par_amount; par_num++) {
+    if (args[par_num].empty())
+      continue;
+
+    if (args[par_num][0] == '-' && args[par_num].length() > 1) {
+      for (uint32_t ch_num{1}; ch_num < args[par_num].length(); ch_num++) {
+        std::string *value{nullptr};
+        if (args[par_num][ch_num] == 'q')
+          quiet = true;
+        else if (args[par_num][ch_num] == 'k')
+          keep_stopped = true;
+        else if (args[par_num][ch_num] == 'z')
+          compress = true;
+        else if (args[par_num][ch_num] == 's')
+          value = &filter_str;
+        else if (args[par_num][ch_num] == 'g')
+          value = &gap_str;
+        else if (args[par_num][ch_num] == 'o')
+          value = &events_path;
+
+        if (value) {
+          if (par_num != par_amount - 1 && value->empty()) {
+            par_num++;
+            *value = args[par_num];
+            break;
+          } else {
+            ShowUsage(parent); // no value of the key specified
+            return;
+          }
+        }
+      }
+    } else if (action.empty())
+      action = args[par_num];
+    else if (old_path.empty())
+      old_path = args[par_num];
+    else if (new_path.empty())
+      new_path = args[par_num];
+  }
+
+  bool save{action == "save"}, diff{action == "diff"},
+      restore{action == "restore"};
+  if (old_path.empty() || (!save && !diff && !restore) ||
+      (diff == new_path.empty())) {
     ShowUsage(parent);
     return;
   }
-
-  size_t length{0};
-  if (StoullWrapper(args[0], length, "length") != 0)
+  if (!diff && (quiet || !gap_str.empty() || !events_path.empty())) {
+    std::cerr << "Keys -q, -g and -o are used only by \"snapshot diff\"."
+              << std::endl;
+    return;
+  }
+  if (!save && (!filter_str.empty() || compress)) {
+    std::cerr << "Keys -s and -z are used only by \"snapshot save\"."
+              << std::endl;
+    return;
+  }
+  if (!restore && keep_stopped) {
+    std::cerr << "Key -k is used only by \"snapshot restore\"." << std::endl;
     return;
+  }
 
-  std::string replacement;
-  if (args.size() > 1)
-    replacement = args[1];
+  if (save)
+    SnapshotSave(old_path, filter_str, compress);
+  else if (diff)
+    SnapshotDiff(old_path, new_path, gap_str, events_path, quiet);
+  else
+    SnapshotRestore(old_path, keep_stopped);
+}
 
-  uint8_t last_exit_code{0};
-  size_t num{0};     // used in for loops
-  size_t i{0}, j{0}; // i - old, j - new
-  size_t old_segments_amount{memory_accessor_.segment_infos_.size()};
-  std::vector<SegmentInfo> old_segment_infos;
-  size_t o_offs{0}, n_offs{0}, amount{0};
-  std::unique_ptr<char[]> mem_dump;
-  std::vector<std::unique_ptr<char[]>> full_dump;
-  std::vector<std::unique_ptr<char[]>>::iterator it;
+/*!
+ \brief Handle command "repo".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
 
-  seg_not_exist_msg_enabled_ = seg_no_access_msg_enabled_ = false;
+ Work with the page repository in the directory provided as the 2nd argument,
+ the 1st argument is the action: "save" - add a snapshot of the process (the
+ repository is created if needed), keys available: "-s filter" - save only
+ memory selected by the filter, "-i interval" - add a snapshot every interval
+ seconds until Ctrl-C; "list" - list snapshots; "read" - print amount bytes
+ (provided as the 4th argument, default is 16) at the address provided as the
+ 3rd argument, keys available: "-t time" - read the latest snapshot taken not
+ later than time (seconds since the epoch, default is the latest snapshot);
+ "changed" - print when the range at the address last changed. Print usage in
+ case of usage errors.
+*/
+void Console::CommandRepo(const Command &parent,
+                          const std::vector<std::string> &args) noexcept {
+  std::string action, dir, addr_str, amount_str, filter_str, interval_str,
+      time_str;
 
-  // 1st run before the loop: parsing maps and dumping all segments
+  uint32_t par_amount{static_cast<uint32_t>(args.size())};
+  for (uint32_t par_num{0}; par_num < par_amount; par_num++) {
+    if (args[par_num].empty())
+      continue;
 
-  if (ParseMapsWrapper() != 0)
-    goto diff_return;
+    if (args[par_num][0] == '-' && args[par_num].length() > 1) {
+      for (uint32_t ch_num{1}; ch_num < args[par_num].length(); ch_num++) {
+        std::string *value{nullptr};
+        if (args[par_num][ch_num] == 's')
+          value = &filter_str;
+        else if (args[par_num][ch_num] == 'i')
+          value = &interval_str;
+        else if (args[par_num][ch_num] == 't')
+          value = &time_str;
+
+        if (value) {
+          if (par_num != par_amount - 1 && value->empty()) {
+            par_num++;
+            *value = args[par_num];
+            break;
+          } else {
+            ShowUsage(parent); // no value of the key specified
+            return;
+          }
+        }
+      }
+    } else if (action.empty())
+      action = args[par_num];
+    else if (dir.empty())
+      dir = args[par_num];
+    else if (addr_str.empty())
+      addr_str = args[par_num];
+    else if (amount_str.empty())
+      amount_str = args[par_num];
+  }
 
-  for (num = 0; num < old_segments_amount; num++) {
-    if (ctrl_c_pressed) { // Ctrl-C check
-      ctrl_c_pressed = false;
-      goto diff_return;
+  bool save{action == "save"}, list{action == "list"}, read{action == "read"},
+      changed{action == "changed"};
+  if (dir.empty() || (!save && !list && !read && !changed) ||
+      ((save || list) && !addr_str.empty()) ||
+      ((read || changed) && addr_str.empty())) {
+    ShowUsage(parent);
+    return;
+  }
+  if (!save && (!filter_str.empty() || !interval_str.empty())) {
+    std::cerr << "Keys -s and -i are used only by \"repo save\"." << std::endl;
+    return;
+  }
+  if (!read && !time_str.empty()) {
+    std::cerr << "Key -t is used only by \"repo read\"." << std::endl;
+    return;
+  }
+
+  size_t address{0};
+  uint64_t amount{kRepoReadAmount}, interval{0}, time{UINT64_MAX};
+  if (!addr_str.empty() && ParseAddress(addr_str, address) != 0)
+    return;
+  if (!amount_str.empty()) {
+    if (StoullWrapper(amount_str, amount, "amount") != 0)
+      return;
+    if (!amount) {
+      std::cerr << "Amount must be greater than 0." << std::endl;
+      return;
+    }
+    if (amount > SIZE_MAX - address) {
+      std::cerr << "Range is too big." << std::endl;
+      return;
     }
+  }
+  if (!interval_str.empty()) {
+    if (StoullWrapper(interval_str, interval, "interval") != 0)
+      return;
+    if (!interval) {
+      std::cerr << "Interval must be greater than 0." << std::endl;
+      return;
+    }
+  }
+  if (!time_str.empty())
+    if (StoullWrapper(time_str, time, "time") != 0)
+      return;
 
-    if (DiffReadSeg(mem_dump, num))
-      goto diff_return;
-    full_dump.push_back(std::move(mem_dump));
+  PageRepository repository;
+  try {
+    repository.Open(dir, save, tools_);
+  } catch (const PageRepository::RepositoryEx &ex) {
+    std::cerr << dir << ": not a page repository or could not be opened"
+              << std::endl;
+    return;
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to open the repository." << std::endl;
+    return;
   }
 
-  // Have 2 variables (i, j) - representing numbers of old and new segments to
-  // examine. When a segment comes to an end, the corresponding number is
-  // incremented. Also, only 3 situations exist: in a taken address can be no
-  // segments, only one or both. Only the last case is not skipped. Old segments
-  // are dumped in full_dump.
+  if (save) {
+    RepoSave(repository, filter_str, interval);
+    return;
+  }
 
-  // loop
-  for (;;) {
-    if (ctrl_c_pressed) { // Ctrl-C check
-      ctrl_c_pressed = false;
-      goto diff_return;
+  using memoryaccessor_console_src::FormatTime;
+  const std::vector<PageRepository::Header> &headers{repository.Headers()};
+  try {
+    if (list) {
+      for (size_t num{0}; num < headers.size(); num++)
+        std::cout << std::setw(6) << std::left << num
+                  << FormatTime(headers[num].time) << "  PID " << std::setw(8)
+                  << headers[num].pid << std::right << headers[num].pages
+                  << " page(s), " << headers[num].new_pages << " new\n";
+      std::cout << "Snapshots: " << headers.size() << ", distinct pages: "
+                << repository.PagesCount() << " (" << std::fixed
+                << std::setprecision(1)
+                << static_cast<double>(repository.PagesCount() *
+                                       PageRepository::kPageSize) /
+                       0x100000
+                << " MiB)." << std::defaultfloat << std::endl;
+    } else if (read) {
+      size_t num{repository.Find(time)};
+      if (num == PageRepository::kNone) {
+        std::cerr << "No snapshot was taken by this time." << std::endl;
+        return;
+      }
+      PageRepository::Snapshot snapshot;
+      repository.Load(num, snapshot);
+      auto buf{std::make_unique<char[]>(amount)};
+      size_t done{repository.Read(snapshot, address, buf.get(), amount)};
+      std::cout << "Snapshot " << num << " at "
+                << FormatTime(snapshot.header.time) << ":" << std::endl;
+      hex_viewer_.PrintHex(&std::cout, buf.get(), done, address, true);
+      if (done < amount)
+        std::cout << "Read " << done << " of " << amount
+                  << " bytes, the rest is not in the snapshot." << std::endl;
+    } else {
+      size_t checked{0},
+          num{repository.LastChange(address, amount, checked)};
+      if (num == PageRepository::kNone)
+        std::cout << "Not changed in " << checked << " snapshot(s)."
+                  << std::endl;
+      else
+        std::cout << "Last changed between snapshot " << num - 1 << " at "
+                  << FormatTime(headers[num - 1].time) << " and snapshot "
+                  << num << " at " << FormatTime(headers[num].time) << '.'
+                  << std::endl;
     }
+  } catch (const PageRepository::RepositoryEx &ex) {
+    std::cerr << dir << ": could not read the repository" << std::endl;
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to read the repository." << std::endl;
+  }
+}
 
-    old_segments_amount = memory_accessor_.segment_infos_.size();
-    old_segment_infos = memory_accessor_.segment_infos_;
-
-    if (ParseMapsWrapper() != 0)
-      break;
+/*!
+ \brief Handle command "unpack".
+ \param [in] parent Related Command object.
+ \param [in] args Arguments for the command.
 
-    // Now have:
-    // Maps - old_segment_infos and new memory_accessor_.segment_infos_
-    // Segment amounts - old_segments_amount and new
-    // memory_accessor_.segment_infos_.size() Old segments dumped - full_dump
+ Decompress the block file provided as the 1st argument (written by "view -z"
+ or "read -z") to the file provided as the 2nd argument. If an offset (the 3rd
+ argument) and an amount (the 4th argument) are provided, only the blocks that
+ contain the range are read. Print usage in case of usage errors.
+*/
+void Console::CommandUnpack(const Command &parent,
+                            const std::vector<std::string> &args) noexcept {
+  std::vector<std::string> values;
+  for (const std::string &arg : args)
+    if (!arg.empty())
+      values.push_back(arg);
+  if (values.size() < 2 || values.size() > 4) {
+    ShowUsage(parent);
+    return;
+  }
 
-    if (!old_segments_amount || !memory_accessor_.segment_infos_.size())
-      continue;
+  uint64_t offset{0}, amount{UINT64_MAX};
+  if ((values.size() > 2 && StoullWrapper(values[2], offset, "offset") != 0) ||
+      (values.size() > 3 && StoullWrapper(values[3], amount, "amount") != 0))
+    return;
 
-    // It makes no sense checking anything below the first (0th) old segment
-    it = full_dump.begin();
-    i = j = 0;
-    o_offs = n_offs = amount = 0;
+  BlockReader reader;
+  try {
+    reader.Open(values[0]);
+  } catch (const BlockReader::BlockFileEx &ex) {
+    std::cerr << values[0] << ": not a compressed file or could not be read"
+              << std::endl;
+    return;
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to read the compressed file." << std::endl;
+    return;
+  }
+  if (offset > reader.Size()) {
+    std::cerr << "Offset is beyond the data (" << reader.Size() << " bytes)."
+              << std::endl;
+    return;
+  }
+  amount = std::min(amount, reader.Size() - offset);
 
-    // Dump 0th new segment
-    if (DiffReadSeg(mem_dump, j))
-      goto diff_return;
+  std::ofstream file(values[1], std::ios::out | std::ios::binary);
+  if (!file) {
+    PrintFileNotOpened(values[1]);
+    return;
+  }
 
-    // Will dump new segment as early as possible, but replace old one by it in
-    // full_dump only when it is fully proceeded
-    for (;;) {
-      if (ctrl_c_pressed) { // Ctrl-C check
+  uint64_t done{0};
+  try {
+    auto buf{std::make_unique_for_overwrite<char[]>(kScanChunkSize)};
+    while (done < amount && file) {
+      if (ctrl_c_pressed) {
         ctrl_c_pressed = false;
-        goto diff_return;
-      }
-
-      // Either one segment is fully below the other or they have a "collision"
-
-      // Old segment is below the new -> erase old, i++, continue
-      if (old_segment_infos[i].end <=
-          memory_accessor_.segment_infos_[j].start) {
-        if (DiffOldNext(i, old_segments_amount, it, full_dump))
-          break;
-        continue;
-      }
-
-      // New segment is below the old -> push new, j++, continue
-      if (memory_accessor_.segment_infos_[j].end <=
-          old_segment_infos[i].start) {
-        last_exit_code = DiffNewNext(j, it, mem_dump, full_dump);
-        if (last_exit_code == 0)
-          continue;
-        else if (last_exit_code == 1)
-          break;
-        else
-          goto diff_return;
-      }
-
-      // The beginning of "collision" - max start of 2 segments. In other
-      // segment adding offset is needed.
-      if (memory_accessor_.segment_infos_[j].start <=
-          old_segment_infos[i].start) {
-        n_offs = old_segment_infos[i].start -
-                 memory_accessor_.segment_infos_[j].start;
-      } else {
-        o_offs = memory_accessor_.segment_infos_[j].start -
-                 old_segment_infos[i].start;
-      }
-
-      // The end of "collision" - min end of 2 segments.
-      // Therefore, amount = (min end) - (related offset).
-      // The segment, in which the end is reached, is replaced by a new one.
-      if (memory_accessor_.segment_infos_[j].end <= old_segment_infos[i].end) {
-        amount = memory_accessor_.segment_infos_[j].end -
-                 memory_accessor_.segment_infos_[j].start - n_offs;
-        DiffCompare(it->get(), mem_dump.get(), o_offs, n_offs, amount,
-                    old_segment_infos[i].start + o_offs, length, replacement);
-        last_exit_code = DiffNewNext(j, it, mem_dump, full_dump);
-        if (last_exit_code == 0)
-          continue;
-        else if (last_exit_code == 1)
-          break;
-        else
-          goto diff_return;
-        // If ends are the same, both segments are updated
-        if (memory_accessor_.segment_infos_[j].end ==
-            old_segment_infos[i].end) {
-          if (DiffOldNext(i, old_segments_amount, it, full_dump))
-            break;
-        }
-      } else {
-        amount = old_segment_infos[i].end - old_segment_infos[i].start - o_offs;
-        DiffCompare(it->get(), mem_dump.get(), o_offs, n_offs, amount,
-                    old_segment_infos[i].start + o_offs, length, replacement);
-        if (DiffOldNext(i, old_segments_amount, it, full_dump))
-          break;
+        break;
       }
+      size_t size{reader.Read(offset + done, buf.get(),
+                              std::min<uint64_t>(kScanChunkSize,
+                                                 amount - done))};
+      file.write(buf.get(), static_cast<std::streamsize>(size));
+      done += size;
     }
-
-    // Proceeding remaining segments
-    while (i < old_segments_amount)
-      DiffOldNext(i, old_segments_amount, it, full_dump);
-    if (j < memory_accessor_.segment_infos_.size())
-      for (;;) {
-        last_exit_code = DiffNewNext(j, it, mem_dump, full_dump);
-        if (last_exit_code == 1)
-          break;
-        else if (last_exit_code == 2)
-          goto diff_return;
-      }
+  } catch (const BlockReader::BlockFileEx &ex) {
+    std::cerr << values[0] << ": a block is damaged at offset "
+              << offset + done << std::endl;
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory to read the compressed file." << std::endl;
   }
-
-diff_return:
-  seg_not_exist_msg_enabled_ = seg_no_access_msg_enabled_ = true;
+  file.flush();
+  if (!file)
+    std::cerr << values[1] << ": could not write the file" << std::endl;
+  std::cout << done << " bytes unpacked." << std::endl;
 }
 
 /*!
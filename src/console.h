@@ -26,15 +26,34 @@
 #define MEMORYACCESSOR_SRC_CONSOLE_H_
 
 #include <array>
+#include <chrono>
 #include <cstdint>
+#include <ctime>
 #include <exception>
+#include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "blockwriter.h"
+#include "corewriter.h"
+#include "diffevents.h"
+#include "diffscanner.h"
 #include "hexviewer.h"
+#include "mapsdelta.h"
 #include "memoryaccessor.h"
+#include "pageheatmap.h"
+#include "pagerepository.h"
+#include "pointerindex.h"
+#include "regionfilter.h"
 #include "segmentinfo.h"
+#include "snapshotfile.h"
+#include "snapshotstore.h"
 #include "tools.h"
+#include "valuefreezer.h"
+#include "watchpoint.h"
+#include "writebatch.h"
+#include "writejournal.h"
 
 class Console;
 
@@ -68,7 +87,7 @@ struct Command {
 class Console {
 public:
   constexpr static int kCommandsNumber{
-      9}; //!< Number of the commands available.
+      23}; //!< Number of the commands available.
 
   explicit Console(MemoryAccessor &memory_accessor, HexViewer &hex_viewer,
                    Tools &tools) noexcept(false);
@@ -148,37 +167,192 @@ public:
       {"maps",
        &Console::CommandMaps,
        {{"maps", "List memory segments found by parsing /proc/PID/maps."}}},
+      {"mapwatch",
+       &Console::CommandMapwatch,
+       {{"mapwatch [interval]", "Print changes of memory segments (mmap, "
+                                "munmap, mprotect, resize)"},
+        {"", "with timestamps, checking /proc/PID/maps every interval ms"},
+        {"", "(default is 100)."}}},
+      {"watch",
+       &Console::CommandWatch,
+       {{"watch address length [rw]",
+         "Print instructions and threads that write (or read,"},
+        {"", "with \"rw\") length (1, 2, 4 or 8) bytes at address, caught by"},
+        {"", "hardware breakpoints, until Ctrl-C."}}},
       {"view",
        &Console::CommandView,
        {{"view SEGMENT", "Print data of memory segment, where SEGMENT is its "
                          "\"maps\" number, or first"},
         {"", "with matching name."},
+        {"view -s filter", "Print data of memory selected by filter (see "
+                           "below)."},
         {"-h", "show hex (if no -r specified)"},
         {"-r", "print raw data"},
-        {"-f file", "output to file"}}},
+        {"-f file", "output to file"},
+        {"-z", "compress the file by blocks (see unpack)"}}},
       {"read",
        &Console::CommandRead,
        {{"read address amount", "Read amount bytes starting from address."},
         {"-h", "show hex (if no -r specified)"},
         {"-r", "print raw data"},
-        {"-f file", "output to file"}}},
+        {"-f file", "output to file"},
+        {"-z", "compress the file by blocks (see unpack)"}}},
       {"write",
        &Console::CommandWrite,
        {{"write address amount string",
          "Write amount bytes of string to memory starting from address."},
         {"or", ""},
         {"write address amount -f file",
-         "Write amount bytes from file to memory starting from address."}}},
+         "Write amount bytes from file to memory starting from address."},
+        {"", "Inside \"batch begin\", a string write is only queued."}}},
+      {"batch",
+       &Console::CommandBatch,
+       {{"batch begin", "Start queuing writes of \"write\"."},
+        {"batch commit", "Check queued writes against segments, apply them, "
+                         "read them back and"},
+        {"", "restore the old data if any of them failed."},
+        {"batch abort", "Drop queued writes."},
+        {"batch", "List queued writes."}}},
+      {"journal",
+       &Console::CommandJournal,
+       {{"journal on [file]", "Record old and new bytes of every write in "
+                              "memory, or append them to"},
+        {"", "file (writes recorded in it before are loaded)."},
+        {"journal off", "Stop recording and drop the records."},
+        {"journal", "Show the state of the journal and the latest writes."}}},
+      {"undo",
+       &Console::CommandUndo,
+       {{"undo [count]", "Write back old bytes of count (default is 1) "
+                         "latest writes of the journal."}}},
+      {"revert-all",
+       &Console::CommandRevertAll,
+       {{"revert-all", "Write back old bytes of all writes of the journal."}}},
+      {"freeze",
+       &Console::CommandFreeze,
+       {{"freeze address type value [period]",
+         "Write the value of type (i16, i32, i64, u16, u32,"},
+        {"", "u64, f32, f64) at address every period us (default is 1000, "
+             "for"},
+        {"", "all values) by a timer thread until \"unfreeze\"."},
+        {"freeze", "List frozen values with the jitter of ticks."}}},
+      {"unfreeze",
+       &Console::CommandUnfreeze,
+       {{"unfreeze address", "Stop writing the value at address."},
+        {"unfreeze all", "Stop writing all values."}}},
       {"diff",
        &Console::CommandDiff,
        {{"diff length [replacement]",
          "Find difference in memory states by length and replace to string, if "
-         "specified."}}},
+         "specified."},
+        {"diff -t type [replacement]",
+         "Find changed values of type (i16, i32, i64, u16, u32, u64, f32,"},
+        {"", "f64) and replace to value, if specified."},
+        {"-m predicate", "report only changes that meet predicate: any "
+                         "(default), +N, -N,"},
+        {"", "inc, dec, ~E (|new - old| < E), needs -t"},
+        {"diff -r [replacement]",
+         "Find changed ranges of any length and replace to string, if "
+         "specified."},
+        {"-g gap", "merge ranges separated by at most gap equal bytes "
+                   "(default is 8)"},
+        {"-p", "keep hashes of pages instead of full copies, differences are"},
+        {"", "found on pages that changed recently"},
+        {"-j threads", "amount of threads (default is the number of CPUs)"},
+        {"-a", "read blocks that do not change less often"},
+        {"-i interval", "minimum interval between passes in ms"},
+        {"-b budget", "maximum average reading speed in MiB/s"},
+        {"-c budget", "maximum average CPU usage in percent of one CPU"},
+        {"-s filter", "compare only memory selected by filter (see below)"},
+        {"-l limit", "keep at most limit MiB of copies in RAM, spill the rest "
+                     "to"},
+        {"", "scratch files (not with -p)"},
+        {"-d dir", "directory for scratch files (default is $TMPDIR or "
+                   "/var/tmp)"},
+        {"-o file", "write events as NDJSON to file (or pipe)"},
+        {"-q", "do not print events, only the summary"},
+        {"", "Repeated changes are collapsed, send SIGUSR1 to print the "
+             "summary."}}},
+      {"xref",
+       &Console::CommandXref,
+       {{"xref address [len]", "List locations that hold pointers into len "
+                               "bytes (default is 1) starting"},
+        {"", "from address. The index is rebuilt when maps change."},
+        {"-u", "rebuild the index anyway"},
+        {"-s filter", "index only pointers in memory selected by filter"}}},
+      {"heatmap",
+       &Console::CommandHeatmap,
+       {{"heatmap duration", "Count writes to pages of writable segments for "
+                             "duration seconds (or"},
+        {"", "until Ctrl-C), then print dirty rates of segments, the hottest "
+             "pages"},
+        {"", "and a histogram of writes per page."},
+        {"-p", "compare hashes of pages instead of using soft-dirty bits"},
+        {"-i interval", "interval between samples in ms (default is 1000)"},
+        {"-s filter", "track only memory selected by filter"},
+        {"-n amount", "amount of the hottest pages and segments (default is "
+                      "10)"},
+        {"-o file", "write counters of written pages as CSV to file"}}},
+      {"core",
+       &Console::CommandCore,
+       {{"core file", "Write an ELF core file of the process to file, to be "
+                      "loaded by gdb."},
+        {"", "Threads are stopped only while their registers are read."},
+        {"-k", "keep threads stopped until memory is written"},
+        {"-j threads", "amount of threads (default is the number of CPUs)"}}},
+      {"snapshot",
+       &Console::CommandSnapshot,
+       {{"snapshot save file", "Save memory of the process to a snapshot "
+                               "file."},
+        {"snapshot diff a b", "Print changes of segments and changed ranges "
+                              "between snapshot files a"},
+        {"", "and b (b may be \"live\" to compare to memory of the process)."},
+        {"snapshot restore file", "Write pages of writable segments that "
+                                  "differ from the snapshot file"},
+        {"", "back to memory of the process."},
+        {"-s filter", "save only memory selected by filter"},
+        {"-z", "compress pages"},
+        {"-g gap", "maximum amount of equal bytes inside a range (default is "
+                   "8)"},
+        {"-q", "do not print changes"},
+        {"-o file", "write changes as NDJSON to file"},
+        {"-k", "stop threads of the process while memory is restored"}}},
+      {"repo",
+       &Console::CommandRepo,
+       {{"repo save dir", "Add a snapshot of the process to the page "
+                          "repository in dir, storing"},
+        {"", "every distinct page once."},
+        {"repo list dir", "List snapshots of the repository."},
+        {"repo read dir address [amount]", "Print amount bytes (default is "
+                                           "16) at address."},
+        {"repo changed dir address [amount]", "Print when the range last "
+                                              "changed."},
+        {"-s filter", "save only memory selected by filter"},
+        {"-i interval", "add a snapshot every interval seconds until Ctrl-C"},
+        {"-t time", "read the latest snapshot taken by time (seconds since "
+                    "the epoch)"}}},
+      {"unpack",
+       &Console::CommandUnpack,
+       {{"unpack file out [offset [amount]]",
+         "Decompress a file written with -z to out, or only"},
+        {"", "amount bytes from offset (the default is the rest of data)."}}},
       {"await",
        &Console::CommandAwait,
        {{"await process_name", "Wait for the process with matching name."},
         {"await -p pid", "Wait for the process with PID."}}},
   }; //!< Definitions of commands.
+  const Command kFilterDescription{
+      "",
+      nullptr,
+      {{"filter", "Terms separated by ',', all of them must match:"},
+       {"perm=rwxsp", "has all listed permissions (s - shared, p - private)"},
+       {"name=pattern", "path matches pattern, '*' and '?' are wildcards"},
+       {"anon", "anonymous segment"},
+       {"file", "segment backed by a file"},
+       {"size>N", "size is greater than N (N may end with K, M or G)"},
+       {"size<N", "size is less than N"},
+       {"addr=start-end", "hex address range, ranges are united and segments "
+                          "are cut to them"},
+       {"!term", "negate a term (except addr)"}}}; //!< Description of filters.
 private:
   /*!
    \brief 0 arguments error enumeration.
@@ -196,6 +370,7 @@ private:
     kPrintErrOpenMem,         //!< Error while opening /proc/PID/mem.
     kPrintSegNotExist,        //!< Error: the segment does not exist.
     kPrintSegNoAccess,        //!< Error: no access to the segment.
+    kPrintJournalFail,        //!< Error: a write cannot be recorded.
   };
 
   /*!
@@ -228,6 +403,51 @@ private:
     }
   };
 
+  /*!
+   \brief State of the command "diff".
+
+   Parameters of the search, a run of different bytes that has not ended
+   yet at the end of the previously merged block, limits of the pace of passes
+   and statistics.
+  */
+  struct DiffState {
+    size_t length{0};                //!< Length of differences to find.
+    std::string replacement;         //!< String to replace differences to.
+    DiffScanner::Piece piece;        //!< Result of comparing hot pages.
+    size_t run_address{0};           //!< Address of the unfinished run.
+    size_t run_length{0};            //!< Length of the unfinished run.
+    std::unique_ptr<char[]> run_old; //!< Old bytes of the unfinished run.
+    std::unique_ptr<char[]> run_new; //!< New bytes of the unfinished run.
+
+    bool ranges{false};       //!< If changed ranges of any length are found.
+    size_t gap{0};            //!< Maximum equal bytes inside a range.
+    DiffScanner::Range range; //!< Unfinished range (range mode).
+    size_t merged_end{0};     //!< End of the previously merged block.
+
+    uint64_t iteration{0};   //!< Number of the current iteration.
+    uint64_t interval{0};    //!< Minimum interval between passes in ms.
+    uint64_t byte_budget{0}; //!< Maximum reading speed in bytes/s (0 is none).
+    uint64_t cpu_budget{0};  //!< Maximum CPU usage in percent (0 is none).
+
+    std::chrono::steady_clock::time_point begin;       //!< Start of diff.
+    std::chrono::steady_clock::time_point pass_begin;  //!< Start of the pass.
+    std::chrono::steady_clock::time_point status_time; //!< Time the status
+                                                       //!< was printed last.
+
+    std::clock_t pass_cpu_begin{0}; //!< CPU time at the start of the pass.
+    uint64_t read_bytes{0};         //!< Sum of bytes read by all passes.
+    uint64_t total_bytes{0};        //!< Sum of bytes stored during all passes.
+
+    WriteBatch writes;         //!< Replacements of differences of the pass.
+    RegionFilter filter;       //!< Filter of compared memory.
+    DiffEvents events;         //!< Stream of found differences.
+    std::ofstream events_file; //!< File for NDJSON.
+
+    std::vector<SegmentInfo> segments; //!< Parts of segments selected by filter
+                                       //!< (or segments of the old snapshot of
+                                       //!< "snapshot diff").
+  };
+
   void PrintDescription(const Command &command, uint32_t left = 2,
                         uint32_t middle = 0) const noexcept;
   void ShowUsage(const Command &command) const noexcept;
@@ -256,21 +476,74 @@ private:
   uint8_t ReadWrapper(char *dst, size_t address, size_t amount,
                       size_t &done_amount) const noexcept;
   uint8_t WriteWrapper(char *src, size_t address, size_t amount,
-                       size_t &done_amount) const noexcept;
-
-  uint8_t DiffReadSeg(std::unique_ptr<char[]> &mem_dump,
-                      const size_t &num) noexcept;
-  void DiffCompare(const char *old_dump, const char *new_dump,
-                   const size_t &o_offs, const size_t &n_offs, size_t amount,
-                   size_t start_addr, const size_t &length,
-                   const std::string &replacement) noexcept;
-  uint8_t DiffOldNext(size_t &i, const size_t &old_segments_amount,
-                      std::vector<std::unique_ptr<char[]>>::iterator &it,
-                      std::vector<std::unique_ptr<char[]>> &full_dump) noexcept;
-  uint8_t DiffNewNext(size_t &j,
-                      std::vector<std::unique_ptr<char[]>>::iterator &it,
-                      std::unique_ptr<char[]> &mem_dump,
-                      std::vector<std::unique_ptr<char[]>> &full_dump) noexcept;
+                       size_t &done_amount, bool continued) const noexcept;
+  uint8_t ParseFilterWrapper(const std::string &expression,
+                             RegionFilter &filter) const noexcept;
+
+  uint8_t DiffParseValue(const std::string &s, DiffScanner::ValueType type,
+                         uint64_t &int_value,
+                         double &float_value) const noexcept;
+  uint8_t ParseTypeWrapper(const std::string &type_str,
+                           DiffScanner::ValueType &type) const noexcept;
+  static std::string ValueBytes(DiffScanner::ValueType type, uint64_t int_value,
+                                double float_value) noexcept(false);
+  uint8_t DiffParseQuery(const std::string &type_str,
+                         const std::string &predicate_str,
+                         DiffScanner::Query &query) const noexcept;
+
+  uint8_t ViewInterval(std::ostream *stream_p, char *buf, size_t num,
+                       size_t start, size_t size, bool raw, bool hex) noexcept;
+  uint8_t JournalMapped(size_t address, const char *data, size_t size,
+                        bool continued,
+                        std::unique_ptr<char[]> &old_data) noexcept;
+  void WriteMapped(int fd, size_t file_size, const std::string &path,
+                   size_t address, size_t amount) noexcept;
+  uint8_t CompressWrapper(std::ostream &file,
+                          std::unique_ptr<BlockWriter> &writer) const noexcept;
+  void FinishCompression(BlockWriter &writer,
+                         const std::string &path) const noexcept;
+
+  void DiffReport(const char *old_bytes, const char *new_bytes,
+                  size_t address, size_t length, size_t size,
+                  DiffState &state) noexcept;
+  void DiffApplyWrites(DiffState &state) noexcept;
+  void DiffFlush(DiffState &state) noexcept;
+  void DiffCompare(DiffState &state, const char *old_dump,
+                   const char *new_dump, size_t amount,
+                   size_t start_addr) noexcept;
+  void DiffMergeRanges(DiffState &state,
+                       const DiffScanner::Piece &piece) noexcept;
+  void DiffMergePiece(DiffState &state,
+                      const DiffScanner::Piece &piece) noexcept;
+  void DiffMergeResult(DiffState &state,
+                       const DiffScanner::Result &result) noexcept;
+  uint8_t DiffUpdate(DiffState &state) noexcept;
+  uint8_t DiffPause(DiffState &state) noexcept;
+  void DiffPrintStatus(const DiffState &state) const noexcept;
+  void DiffPrintEvent(const DiffEvents::Event &event) noexcept;
+  void DiffPrintSummary(DiffState &state) noexcept;
+
+  uint8_t XrefBuild() noexcept;
+  uint8_t HeatmapSample(RegionFilter &filter,
+                        uint64_t &read_bytes) noexcept;
+  void HeatmapReport(double seconds, uint64_t samples,
+                     size_t top) const noexcept;
+  void PrintMapsDelta(const MapsDelta &maps_delta,
+                      const std::vector<SegmentInfo> &old_infos,
+                      const std::vector<SegmentInfo> &new_infos,
+                      double seconds) const noexcept;
+  uint8_t SnapshotCompare(DiffState &state, const SnapshotFile &old_file,
+                          const SnapshotFile *new_file,
+                          const MapsDelta &maps_delta,
+                          uint64_t &compared_bytes) noexcept;
+  void SnapshotSave(const std::string &path, const std::string &filter_str,
+                    bool compress) noexcept;
+  void SnapshotDiff(const std::string &old_path, const std::string &new_path,
+                    const std::string &gap_str, const std::string &events_path,
+                    bool quiet) noexcept;
+  void SnapshotRestore(const std::string &path, bool keep_stopped) noexcept;
+  void RepoSave(PageRepository &repository, const std::string &filter_str,
+                uint64_t interval) noexcept;
 
   void CommandHelp(const Command &parent,
                    const std::vector<std::string> &args) noexcept;
@@ -280,14 +553,49 @@ private:
                   const std::vector<std::string> &args) noexcept;
   void CommandMaps(const Command &parent,
                    const std::vector<std::string> &args) noexcept;
+  void CommandMapwatch(const Command &parent,
+                       const std::vector<std::string> &args) noexcept;
+  void CommandWatch(const Command &parent,
+                    const std::vector<std::string> &args) noexcept;
+  void WatchLoop(Watchpoint &watchpoint) noexcept(false);
+  std::string ModuleOffset(size_t address) const noexcept(false);
   void CommandView(const Command &parent,
                    const std::vector<std::string> &args) noexcept;
   void CommandRead(const Command &parent,
                    const std::vector<std::string> &args) noexcept;
   void CommandWrite(const Command &parent,
                     const std::vector<std::string> &args) noexcept;
+  void CommandBatch(const Command &parent,
+                    const std::vector<std::string> &args) noexcept;
+  void BatchCommit() noexcept;
+  uint8_t CommitWrapper(WriteBatch &batch, bool record) noexcept;
+  uint8_t JournalBatch(WriteBatch &batch, bool continued) noexcept;
+  void CommandJournal(const Command &parent,
+                      const std::vector<std::string> &args) noexcept;
+  void CommandUndo(const Command &parent,
+                   const std::vector<std::string> &args) noexcept;
+  void CommandRevertAll(const Command &parent,
+                        const std::vector<std::string> &args) noexcept;
+  void Undo(size_t writes) noexcept;
+  void CommandFreeze(const Command &parent,
+                     const std::vector<std::string> &args) noexcept;
+  void CommandUnfreeze(const Command &parent,
+                       const std::vector<std::string> &args) noexcept;
+  void FreezeList() const noexcept;
   void CommandDiff(const Command &parent,
                    const std::vector<std::string> &args) noexcept;
+  void CommandXref(const Command &parent,
+                   const std::vector<std::string> &args) noexcept;
+  void CommandHeatmap(const Command &parent,
+                      const std::vector<std::string> &args) noexcept;
+  void CommandCore(const Command &parent,
+                   const std::vector<std::string> &args) noexcept;
+  void CommandSnapshot(const Command &parent,
+                       const std::vector<std::string> &args) noexcept;
+  void CommandRepo(const Command &parent,
+                   const std::vector<std::string> &args) noexcept;
+  void CommandUnpack(const Command &parent,
+                     const std::vector<std::string> &args) noexcept;
   void CommandAwait(const Command &parent,
                     const std::vector<std::string> &args) noexcept;
 
@@ -301,6 +609,54 @@ private:
 
   size_t buffer_size_{
       0x1000}; //!< Size of buffers used (less than 128 may cause bugs).
+  constexpr static size_t kScanChunkSize{
+      0x100000}; //!< Size of chunks in which large areas of memory are read.
+  constexpr static size_t kWriteChunkSize{
+      0x1000000}; //!< Maximum size of one write of "write -f".
+  constexpr static std::chrono::seconds kWriteStatusPeriod{
+      1}; //!< Period of printing the progress of "write -f".
+  constexpr static uint64_t kFreezePeriod{
+      1000}; //!< Default period of "freeze" in us.
+  constexpr static std::chrono::milliseconds kWatchSleepStep{
+      100}; //!< Maximum time "watch" waits between Ctrl-C checks.
+  constexpr static std::chrono::seconds kWatchRescanPeriod{
+      1}; //!< Period of looking for new threads by "watch".
+  constexpr static size_t kWatchListed{
+      20}; //!< Amount of the most frequent instructions listed by "watch".
+  constexpr static size_t kJournalListed{
+      10}; //!< Amount of the latest writes listed by "journal".
+  constexpr static uint64_t kMaxDiffThreads{
+      256}; //!< Maximum amount of threads of "diff".
+  constexpr static uint64_t kHotPageAge{
+      8}; //!< Amount of iterations of "diff -p" a page stays hot without
+          //!< changes.
+  constexpr static uint64_t kDiffRebalancePeriod{
+      16}; //!< Amount of passes of "diff -l" between rebalancing of copies.
+  constexpr static size_t kDiffRangeGap{
+      8}; //!< Default maximum gap inside ranges of "diff -r".
+  constexpr static uint64_t kHeatmapInterval{
+      1000}; //!< Default interval between samples of "heatmap" in ms.
+  constexpr static uint64_t kRepoReadAmount{
+      16}; //!< Default amount of bytes printed by "repo read".
+  constexpr static uint64_t kHeatmapTop{
+      10}; //!< Default amount of the hottest pages printed by "heatmap".
+  constexpr static std::chrono::seconds kDiffStatusPeriod{
+      60}; //!< Period of printing the status of "diff".
+  constexpr static std::chrono::milliseconds kDiffSleepStep{
+      50}; //!< Maximum time "diff" sleeps between Ctrl-C checks.
+
+  PointerIndex pointer_index_; //!< Reverse pointer index used by "xref".
+  RegionFilter xref_filter_;   //!< Filter the pointer index was built with.
+  SnapshotStore diff_store_;   //!< Copies of segments used by "diff".
+  DiffScanner diff_scanner_;   //!< Parallel reader of "diff".
+  PageHeatmap heatmap_;        //!< Counters of writes of "heatmap".
+  WriteBatch write_batch_;     //!< Writes queued by "batch begin".
+  bool batch_open_{false};     //!< If "write" queues writes.
+  WriteJournal journal_;       //!< Journal of writes of "journal on".
+  bool journal_on_{false};     //!< If writes are recorded to journal_.
+  ValueFreezer freezer_;       //!< Timer thread of "freeze".
+  CoreWriter core_writer_; //!< Writer of core files of "core" (also stops
+                           //!< threads for "snapshot restore -k").
 
   bool seg_not_exist_msg_enabled_{
       true}; //!< To print messages that segment not exist or not.
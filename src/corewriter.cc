@@ -0,0 +1,548 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief CoreWriter source
+
+  A source that contains the realization of CoreWriter class.
+*/
+
+#include "corewriter.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/procfs.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "bufferallocator.h"
+#include "memoryaccessor.h"
+#include "segmentinfo.h"
+#include "tools.h"
+
+namespace memoryaccessor_corewriter_src {
+
+#if defined(__x86_64__)
+constexpr uint16_t kMachine{EM_X86_64}; //!< Machine of the core file.
+#elif defined(__aarch64__)
+constexpr uint16_t kMachine{EM_AARCH64}; //!< Machine of the core file.
+#elif defined(__riscv)
+constexpr uint16_t kMachine{EM_RISCV}; //!< Machine of the core file.
+#else
+constexpr uint16_t kMachine{EM_NONE}; //!< Machine of the core file.
+#endif
+
+constexpr char kZeroPage[CoreWriter::kPageSize]{}; //!< A page of zeros.
+
+/*!
+ \brief Append a note to the contents of PT_NOTE.
+ \param [in,out] notes Contents of PT_NOTE.
+ \param [in] type Type of the note.
+ \param [in] desc Descriptor of the note.
+ \param [in] size Size of the descriptor.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ The name is "CORE", the name and the descriptor are padded to 4 bytes.
+*/
+void AddNote(std::string &notes, uint32_t type, const void *desc,
+             size_t size) noexcept(false) {
+  constexpr char kName[]{"CORE"};
+  Elf64_Nhdr header{sizeof(kName), static_cast<Elf64_Word>(size), type};
+  notes.append(reinterpret_cast<const char *>(&header), sizeof(header));
+  notes.append(kName, sizeof(kName));
+  notes.append((4 - sizeof(kName) % 4) % 4, '\0');
+  notes.append(static_cast<const char *>(desc), size);
+  notes.append((4 - size % 4) % 4, '\0');
+}
+
+/*!
+ \brief Read a whole file of /proc.
+ \param [in] path Path of the file.
+ \return Contents, empty if the file cannot be read.
+ \throw std::bad_alloc If memory cannot be allocated.
+*/
+std::string ReadProcFile(const std::string &path) noexcept(false) {
+  std::ifstream file{path, std::ios::binary};
+  return std::string(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+}
+
+} // namespace memoryaccessor_corewriter_src
+
+/*!
+ \brief Stop all threads of a process and get their registers.
+ \param [in] pid PID of the process.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Every thread of /proc/PID/task is seized and interrupted by ptrace, so it
+ stays stopped until Detach. Threads that cannot be stopped are kept without
+ registers. The main thread is the first one.
+*/
+void CoreWriter::Attach(pid_t pid) noexcept(false) {
+  Detach();
+  threads_info_.clear();
+  std::vector<pid_t> tids;
+  std::error_code error;
+  for (const auto &entry : std::filesystem::directory_iterator(
+           "/proc/" + std::to_string(pid) + "/task", error)) {
+    try {
+      tids.push_back(
+          static_cast<pid_t>(std::stol(entry.path().filename().string())));
+    } catch (const std::logic_error &ex) {
+    }
+  }
+  std::sort(tids.begin(), tids.end(), [pid](pid_t a, pid_t b) {
+    return (a == pid) != (b == pid) ? a == pid : a < b;
+  });
+  if (tids.empty() || tids[0] != pid)
+    tids.insert(tids.begin(), pid);
+
+  for (pid_t tid : tids) {
+    threads_info_.push_back({tid});
+    Thread &thread{threads_info_.back()};
+    if (ptrace(PTRACE_SEIZE, tid, nullptr, nullptr) != 0)
+      continue;
+    thread.attached = true;
+
+    int status{0};
+    if (ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr) != 0 ||
+        waitpid(tid, &status, __WALL) != tid)
+      continue;
+    iovec regs{&thread.regs, sizeof(thread.regs)},
+        fpregs{&thread.fpregs, sizeof(thread.fpregs)};
+    thread.has_regs = ptrace(PTRACE_GETREGSET, tid, NT_PRSTATUS, &regs) == 0;
+    thread.has_fpregs =
+        ptrace(PTRACE_GETREGSET, tid, NT_PRFPREG, &fpregs) == 0;
+  }
+}
+
+/*!
+ \brief Let the threads stopped by Attach run.
+
+ Their registers are kept for the notes.
+*/
+void CoreWriter::Detach() noexcept {
+  for (Thread &thread : threads_info_)
+    if (thread.attached) {
+      ptrace(PTRACE_DETACH, thread.tid, nullptr, nullptr);
+      thread.attached = false;
+    }
+}
+
+/*!
+ \brief Check if a segment is mapped from a file.
+ \param [in] segment_info The segment.
+ \return true if its path is absolute (deleted files too).
+*/
+bool CoreWriter::FileBacked(const SegmentInfo &segment_info) noexcept {
+  return !segment_info.path.empty() && segment_info.path[0] == '/';
+}
+
+/*!
+ \brief Plan the layout of the core file.
+ \param [in] pid PID of the process.
+ \param [in] segment_infos Segments of the process.
+ \param [in] memory_accessor MemoryAccessor with /proc/PID/pagemap opened if
+ pagemap is true.
+ \param [in] pagemap Skip pages of anonymous segments that were never touched.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Build the notes (with the threads found by Attach), a PT_LOAD segment for
+ every segment and tasks that copy its data. Segments that are not readable
+ and [vvar] and [vsyscall] have no data. File-backed read-only segments only
+ have the first page of the file (with the ELF header), unless the file is
+ deleted. Data of loads is aligned to pages.
+*/
+void CoreWriter::Plan(pid_t pid, const std::vector<SegmentInfo> &segment_infos,
+                      const MemoryAccessor &memory_accessor,
+                      bool pagemap) noexcept(false) {
+  loads_.clear();
+  tasks_.clear();
+  files_.clear();
+  for (const SegmentInfo &segment_info : segment_infos)
+    if (FileBacked(segment_info))
+      files_.push_back(segment_info);
+  if (threads_info_.empty())
+    threads_info_.push_back({pid});
+  notes_ = Notes(pid);
+
+  loads_.reserve(segment_infos.size());
+  for (const SegmentInfo &segment_info : segment_infos)
+    loads_.push_back({segment_info.start, segment_info.end,
+                      static_cast<uint32_t>(
+                          (segment_info.mode & 0b1000 ? PF_R : 0) |
+                          (segment_info.mode & 0b0100 ? PF_W : 0) |
+                          (segment_info.mode & 0b0010 ? PF_X : 0))});
+
+  size_t offset{(Headers().size() + kPageSize - 1) / kPageSize * kPageSize};
+  for (size_t i{0}; i < segment_infos.size(); i++) {
+    const SegmentInfo &segment_info{segment_infos[i]};
+    Load &load{loads_[i]};
+    size_t size{segment_info.end - segment_info.start};
+    load.file_offset = offset;
+
+    const std::string &path{segment_info.path};
+    if (!(segment_info.mode & 0b1000) || path == "[vvar]" ||
+        path == "[vvar_vclock]" || path == "[vsyscall]")
+      continue;
+    if (FileBacked(segment_info) && !(segment_info.mode & 0b0100) &&
+        !path.ends_with(" (deleted)")) {
+      if (segment_info.offset)
+        continue;
+      load.file_size = std::min(kPageSize, size);
+      tasks_.push_back({load.start, load.file_size, offset});
+    } else {
+      load.file_size = size;
+      AddTasks(segment_info, offset, memory_accessor, pagemap);
+    }
+    offset += (load.file_size + kPageSize - 1) / kPageSize * kPageSize;
+  }
+  file_size_ = offset;
+}
+
+/*!
+ \brief Add tasks that copy a segment.
+ \param [in] segment_info The segment.
+ \param [in] file_offset Offset of its data in the file.
+ \param [in] memory_accessor MemoryAccessor with /proc/PID/pagemap opened if
+ pagemap is true.
+ \param [in] pagemap Skip pages that were never touched.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Pages are skipped only in private anonymous segments (including [heap] and
+ [stack]), where a page that is neither present nor swapped reads as zeros.
+ Pages with unknown state are copied.
+*/
+void CoreWriter::AddTasks(const SegmentInfo &segment_info, size_t file_offset,
+                          const MemoryAccessor &memory_accessor,
+                          bool pagemap) noexcept(false) {
+  size_t size{segment_info.end - segment_info.start};
+  bool anonymous{segment_info.path.empty() || segment_info.path[0] == '['};
+  if (!pagemap || !anonymous || segment_info.mode & 0b0001) {
+    for (size_t done{0}; done < size; done += kChunkSize)
+      tasks_.push_back({segment_info.start + done,
+                        std::min(kChunkSize, size - done), file_offset + done});
+    return;
+  }
+
+  constexpr size_t kEntries{kChunkSize / kPageSize};
+  uint64_t entries[kEntries];
+  size_t pages{(size + kPageSize - 1) / kPageSize}, run_start{0},
+      run_pages{0};
+  for (size_t page{0}; page < pages; page += kEntries) {
+    size_t amount{std::min(kEntries, pages - page)};
+    size_t read{memory_accessor.ReadPagemap(
+        entries, segment_info.start + page * kPageSize, amount)};
+    for (size_t i{0}; i < amount; i++) {
+      bool populated{i >= read || entries[i] & kPopulatedBits};
+      if (populated) {
+        if (!run_pages)
+          run_start = page + i;
+        run_pages++;
+      }
+      if (run_pages && (!populated || run_pages == kEntries)) {
+        tasks_.push_back({segment_info.start + run_start * kPageSize,
+                          run_pages * kPageSize,
+                          file_offset + run_start * kPageSize});
+        run_pages = 0;
+      }
+    }
+  }
+  if (run_pages)
+    tasks_.push_back({segment_info.start + run_start * kPageSize,
+                      std::min(run_pages * kPageSize,
+                               size - run_start * kPageSize),
+                      file_offset + run_start * kPageSize});
+}
+
+/*!
+ \brief Build the contents of PT_NOTE.
+ \param [in] pid PID of the process.
+ \return Notes in the order the kernel writes them.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ NT_PRSTATUS of the main thread, NT_PRPSINFO (from /proc/PID/stat and
+ /proc/PID/cmdline), NT_AUXV (from /proc/PID/auxv), NT_FILE and NT_FPREGSET of
+ the main thread go first, then NT_PRSTATUS and NT_FPREGSET of other threads.
+*/
+std::string CoreWriter::Notes(pid_t pid) const noexcept(false) {
+  using memoryaccessor_corewriter_src::AddNote;
+  using memoryaccessor_corewriter_src::ReadProcFile;
+  std::string proc{"/proc/" + std::to_string(pid)};
+
+  elf_prpsinfo psinfo{};
+  psinfo.pr_pid = pid;
+  std::string stat{ReadProcFile(proc + "/stat")};
+  size_t open{stat.find('(')}, close{stat.rfind(')')};
+  if (open != std::string::npos && close != std::string::npos &&
+      open < close) {
+    std::string comm{stat.substr(open + 1, close - open - 1)};
+    std::strncpy(psinfo.pr_fname, comm.c_str(), sizeof(psinfo.pr_fname) - 1);
+    std::istringstream fields{stat.substr(close + 1)};
+    char state{'R'};
+    int ppid{0}, pgrp{0}, sid{0};
+    fields >> state >> ppid >> pgrp >> sid;
+    psinfo.pr_sname = state;
+    psinfo.pr_state = static_cast<char>(
+        std::string("RSDTZW").find(state) == std::string::npos
+            ? 0
+            : std::string("RSDTZW").find(state));
+    psinfo.pr_zomb = state == 'Z';
+    psinfo.pr_ppid = ppid;
+    psinfo.pr_pgrp = pgrp;
+    psinfo.pr_sid = sid;
+  }
+  struct stat proc_stat;
+  if (::stat(proc.c_str(), &proc_stat) == 0) {
+    psinfo.pr_uid = proc_stat.st_uid;
+    psinfo.pr_gid = proc_stat.st_gid;
+  }
+  std::string args{ReadProcFile(proc + "/cmdline")};
+  args.resize(std::min(args.size(), sizeof(psinfo.pr_psargs) - 1));
+  std::replace(args.begin(), args.end(), '\0', ' ');
+  while (!args.empty() && args.back() == ' ')
+    args.pop_back();
+  std::memcpy(psinfo.pr_psargs, args.c_str(), args.size());
+
+  std::vector<uint64_t> file_entries{files_.size(), kPageSize};
+  std::string file_names;
+  for (const SegmentInfo &file : files_) {
+    file_entries.insert(file_entries.end(),
+                        {file.start, file.end, file.offset / kPageSize});
+    file_names.append(file.path.c_str(), file.path.size() + 1);
+  }
+  std::string file_desc{reinterpret_cast<const char *>(file_entries.data()),
+                        file_entries.size() * sizeof(uint64_t)};
+  file_desc += file_names;
+
+  std::string notes;
+  for (size_t i{0}; i < threads_info_.size(); i++) {
+    const Thread &thread{threads_info_[i]};
+    elf_prstatus status{};
+    status.pr_pid = thread.tid;
+    status.pr_ppid = psinfo.pr_ppid;
+    status.pr_pgrp = psinfo.pr_pgrp;
+    status.pr_sid = psinfo.pr_sid;
+    std::memcpy(status.pr_reg, thread.regs, sizeof(status.pr_reg));
+    AddNote(notes, NT_PRSTATUS, &status, sizeof(status));
+
+    if (!i) {
+      AddNote(notes, NT_PRPSINFO, &psinfo, sizeof(psinfo));
+      std::string auxv{ReadProcFile(proc + "/auxv")};
+      if (!auxv.empty())
+        AddNote(notes, NT_AUXV, auxv.data(), auxv.size());
+      AddNote(notes, NT_FILE, file_desc.data(), file_desc.size());
+    }
+    if (thread.has_fpregs)
+      AddNote(notes, NT_FPREGSET, &thread.fpregs, sizeof(thread.fpregs));
+  }
+  return notes;
+}
+
+/*!
+ \brief Build the ELF header, program headers and notes.
+ \return Everything that precedes data of loads.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ If there are PN_XNUM or more program headers, their amount is kept in
+ sh_info of the only section header, as in cores written by the kernel.
+*/
+std::string CoreWriter::Headers() const noexcept(false) {
+  size_t phnum{loads_.size() + 1};
+  bool extended{phnum >= PN_XNUM};
+  size_t phoff{sizeof(Elf64_Ehdr)}, shoff{phoff + phnum * sizeof(Elf64_Phdr)},
+      notes_offset{shoff + (extended ? sizeof(Elf64_Shdr) : 0)};
+
+  Elf64_Ehdr ehdr{};
+  std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+  ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr.e_ident[EI_DATA] =
+      std::endian::native == std::endian::little ? ELFDATA2LSB : ELFDATA2MSB;
+  ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr.e_ident[EI_OSABI] = ELFOSABI_NONE;
+  ehdr.e_type = ET_CORE;
+  ehdr.e_machine = memoryaccessor_corewriter_src::kMachine;
+  ehdr.e_version = EV_CURRENT;
+  ehdr.e_phoff = phoff;
+  ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+  ehdr.e_phentsize = sizeof(Elf64_Phdr);
+  ehdr.e_phnum = static_cast<Elf64_Half>(extended ? PN_XNUM : phnum);
+  if (extended) {
+    ehdr.e_shoff = shoff;
+    ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    ehdr.e_shnum = 1;
+  }
+
+  std::string headers{reinterpret_cast<const char *>(&ehdr), sizeof(ehdr)};
+  Elf64_Phdr phdr{};
+  phdr.p_type = PT_NOTE;
+  phdr.p_offset = notes_offset;
+  phdr.p_filesz = notes_.size();
+  phdr.p_align = 4;
+  headers.append(reinterpret_cast<const char *>(&phdr), sizeof(phdr));
+  for (const Load &load : loads_) {
+    phdr = {};
+    phdr.p_type = PT_LOAD;
+    phdr.p_flags = load.flags;
+    phdr.p_offset = load.file_offset;
+    phdr.p_vaddr = load.start;
+    phdr.p_filesz = load.file_size;
+    phdr.p_memsz = load.end - load.start;
+    phdr.p_align = kPageSize;
+    headers.append(reinterpret_cast<const char *>(&phdr), sizeof(phdr));
+  }
+  if (extended) {
+    Elf64_Shdr shdr{};
+    shdr.sh_info = static_cast<Elf64_Word>(phnum);
+    headers.append(reinterpret_cast<const char *>(&shdr), sizeof(shdr));
+  }
+  return headers + notes_;
+}
+
+/*!
+ \brief Write the planned core file.
+ \param [in] path Path of the file, it is truncated or created with mode 600.
+ \param [in] memory_accessor MemoryAccessor with /proc/PID/mem opened by
+ OpenSharedMem.
+ \param [in] stop Function that returns true if writing should be stopped.
+ \return Return code, 0 is success, 2 means that it was stopped (the file is
+ deleted then).
+ \throw CoreFileEx If the file cannot be created or written (it is deleted
+ then).
+ \throw std::bad_alloc If memory cannot be allocated.
+ \throw std::system_error If a thread cannot be started.
+
+ Headers and notes are written first, then the file is extended to its full
+ size, so parts that are not written are holes that read as zeros.
+*/
+uint8_t CoreWriter::Write(const std::string &path,
+                          const MemoryAccessor &memory_accessor,
+                          const std::function<bool()> &stop) noexcept(false) {
+  int fd{open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)};
+  if (fd < 0)
+    throw CoreFileEx();
+
+  written_bytes_ = 0;
+  failed_ = stopped_ = false;
+  try {
+    std::string headers{Headers()};
+    if (!Tools::PwriteAll(fd, headers.data(), headers.size(), 0) ||
+        ftruncate(fd, static_cast<off_t>(file_size_)) != 0)
+      failed_ = true;
+    else
+      Copy(fd, memory_accessor, stop);
+  } catch (...) {
+    close(fd);
+    unlink(path.c_str());
+    throw;
+  }
+
+  if (close(fd) != 0)
+    failed_ = true;
+  if (failed_ || stopped_)
+    unlink(path.c_str());
+  if (failed_)
+    throw CoreFileEx();
+  return stopped_ ? 2 : 0;
+}
+
+/*!
+ \brief Copy data of all tasks to the file.
+ \param [in] fd File descriptor of the core file.
+ \param [in] memory_accessor MemoryAccessor with /proc/PID/mem opened by
+ OpenSharedMem.
+ \param [in] stop Function that returns true if copying should be stopped.
+ \throw std::bad_alloc If memory for buffers cannot be allocated.
+ \throw std::system_error If a thread cannot be started.
+
+ Threads take tasks in order. Every task is read to the buffer of its thread,
+ and runs of pages that are not zero are written. Parts that cannot be read
+ are left as holes.
+*/
+void CoreWriter::Copy(int fd, const MemoryAccessor &memory_accessor,
+                      const std::function<bool()> &stop) noexcept(false) {
+  unsigned threads{static_cast<unsigned>(
+      std::max<size_t>(std::min<size_t>(threads_, tasks_.size()), 1))};
+  std::vector<BufferAllocator::Buffer> buffers;
+  for (unsigned i{0}; i < threads; i++)
+    buffers.push_back(BufferAllocator::Allocate(kChunkSize));
+
+  next_task_ = 0;
+  auto work{[this, fd, &memory_accessor, &stop](char *buffer) {
+    using memoryaccessor_corewriter_src::kZeroPage;
+    for (size_t num{next_task_++}; num < tasks_.size(); num = next_task_++) {
+      if (failed_ || stopped_)
+        return;
+      if (stop()) {
+        stopped_ = true;
+        return;
+      }
+
+      const Task &task{tasks_[num]};
+      size_t amount{memory_accessor.ReadShared(buffer, task.address,
+                                               task.amount)};
+      for (size_t page{0}; page < amount;) {
+        size_t run{page};
+        while (run < amount &&
+               std::memcmp(buffer + run, kZeroPage,
+                           std::min(kPageSize, amount - run)) != 0)
+          run += std::min(kPageSize, amount - run);
+        if (run > page) {
+          if (!Tools::PwriteAll(fd, buffer + page, run - page,
+                                task.file_offset + page)) {
+            failed_ = true;
+            return;
+          }
+          written_bytes_ += run - page;
+        }
+        page = run + std::min(kPageSize, amount - run);
+      }
+    }
+  }};
+
+  std::vector<std::thread> workers;
+  try {
+    for (unsigned i{1}; i < threads; i++)
+      workers.emplace_back(work, buffers[i].get());
+  } catch (...) {
+    stopped_ = true;
+    for (std::thread &worker : workers)
+      worker.join();
+    throw;
+  }
+  work(buffers[0].get());
+  for (std::thread &worker : workers)
+    worker.join();
+}
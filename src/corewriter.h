@@ -0,0 +1,177 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief CoreWriter header
+
+ A header that contains the definition of CoreWriter class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_COREWRITER_H_
+#define MEMORYACCESSOR_SRC_COREWRITER_H_
+
+#include <sys/procfs.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "memoryaccessor.h"
+#include "segmentinfo.h"
+
+/*!
+ \brief A class that writes ELF core files of a process.
+
+ A core file has a PT_NOTE segment and a PT_LOAD segment for every memory
+ segment. The notes are NT_PRSTATUS and NT_FPREGSET of every thread (registers
+ are got by stopping threads with ptrace for a moment), NT_PRPSINFO, NT_AUXV
+ and NT_FILE with all file mappings. Like the kernel does, file-backed
+ read-only segments are not written (only the first page of a file, where its
+ ELF header is), so debuggers take them from the files. Pages of anonymous
+ segments that were never touched (by /proc/PID/pagemap) and zero pages are
+ left as holes of a sparse file.
+
+ Data is read by /proc/PID/mem in tasks of kChunkSize bytes by several
+ threads, and every task is written by pwrite at its place in the file, so
+ memory is streamed to the file without being kept.
+*/
+class CoreWriter {
+public:
+  constexpr static size_t kPageSize{0x1000}; //!< Size of a page.
+  constexpr static size_t kChunkSize{
+      0x400000}; //!< Maximum amount of bytes read and written by one task.
+  constexpr static uint64_t kPopulatedBits{
+      uint64_t{3} << 62}; //!< "Present" and "swapped" bits of pagemap entries.
+
+  /*!
+   \brief Ex: Writing the core file failed
+
+   This exception is thrown when the core file cannot be created or written.
+  */
+  class CoreFileEx : public std::exception {
+    /*!
+     \brief "what" function of the exception.
+     \return C-string descripting the exception.
+    */
+    virtual const char *what() const noexcept override {
+      return "Error in writing a core file";
+    }
+  };
+
+  /*!
+   \brief A struct that represents a thread of the process.
+  */
+  struct Thread {
+    pid_t tid;                 //!< ID of the thread.
+    bool attached{false};      //!< If the thread is stopped by ptrace.
+    bool has_regs{false};      //!< If the registers were got.
+    elf_gregset_t regs{};      //!< General registers.
+    bool has_fpregs{false};    //!< If the FP registers were got.
+    elf_fpregset_t fpregs{};   //!< FP registers.
+  };
+
+  /*!
+   \brief A struct that represents a PT_LOAD segment.
+  */
+  struct Load {
+    size_t start;          //!< Start address.
+    size_t end;            //!< End address.
+    uint32_t flags;        //!< PF_R, PF_W and PF_X.
+    size_t file_size{0};   //!< Amount of bytes stored in the file.
+    size_t file_offset{0}; //!< Offset of the data in the file.
+  };
+
+  /*!
+   \brief A struct that represents a part of memory to copy.
+  */
+  struct Task {
+    size_t address;     //!< Address of the part.
+    size_t amount;      //!< Size of the part.
+    size_t file_offset; //!< Offset of the part in the file.
+  };
+
+  /*!
+   \brief Set amount of threads that read memory.
+   \param [in] threads Amount of threads, 0 is treated as 1.
+  */
+  void SetThreads(unsigned threads) noexcept {
+    threads_ = threads ? threads : 1;
+  }
+
+  void Attach(pid_t pid) noexcept(false);
+  void Detach() noexcept;
+
+  /*!
+   \brief Get threads of the process.
+   \return A reference to std::vector of threads found by Attach.
+  */
+  const std::vector<Thread> &Threads() const noexcept { return threads_info_; }
+
+  void Plan(pid_t pid, const std::vector<SegmentInfo> &segment_infos,
+            const MemoryAccessor &memory_accessor,
+            bool pagemap) noexcept(false);
+
+  /*!
+   \brief Get planned PT_LOAD segments.
+   \return A reference to std::vector of loads sorted by address.
+  */
+  const std::vector<Load> &Loads() const noexcept { return loads_; }
+
+  /*!
+   \brief Get size of the planned core file.
+   \return Size in bytes (including holes).
+  */
+  size_t FileSize() const noexcept { return file_size_; }
+
+  /*!
+   \brief Get amount of bytes of memory written by the latest Write.
+   \return Amount of bytes (zero pages are not counted).
+  */
+  size_t WrittenBytes() const noexcept { return written_bytes_; }
+
+  uint8_t Write(const std::string &path, const MemoryAccessor &memory_accessor,
+                const std::function<bool()> &stop) noexcept(false);
+
+  static bool FileBacked(const SegmentInfo &segment_info) noexcept;
+
+private:
+  std::string Notes(pid_t pid) const noexcept(false);
+  std::string Headers() const noexcept(false);
+  void AddTasks(const SegmentInfo &segment_info, size_t file_offset,
+                const MemoryAccessor &memory_accessor,
+                bool pagemap) noexcept(false);
+  void Copy(int fd, const MemoryAccessor &memory_accessor,
+            const std::function<bool()> &stop) noexcept(false);
+
+  unsigned threads_{1};              //!< Amount of threads that read memory.
+  std::vector<Thread> threads_info_; //!< Threads of the process.
+  std::vector<SegmentInfo> files_;   //!< File mappings for NT_FILE.
+  std::vector<Load> loads_;          //!< Planned PT_LOAD segments.
+  std::vector<Task> tasks_;          //!< Planned parts of memory to copy.
+  std::string notes_;                //!< Contents of the PT_NOTE segment.
+  size_t file_size_{0};              //!< Size of the planned core file.
+  std::atomic<size_t> next_task_{0}; //!< Number of the next task to take.
+  std::atomic<size_t> written_bytes_{0}; //!< Bytes written by tasks.
+  std::atomic<bool> failed_{false};  //!< If a write to the file failed.
+  std::atomic<bool> stopped_{false}; //!< If copying was stopped.
+};
+
+#endif // MEMORYACCESSOR_SRC_COREWRITER_H_
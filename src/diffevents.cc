@@ -0,0 +1,231 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief DiffEvents source
+
+  A source that contains the realization of DiffEvents class.
+*/
+
+#include "diffevents.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip> // setfill, setw, setprecision
+#include <ios>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*!
+ \brief Record a change.
+ \param [in] address Address of the change.
+ \param [in] old_bytes Bytes before the change.
+ \param [in] new_bytes Bytes after the change.
+ \param [in] length Length of old_bytes and new_bytes.
+ \param [in] size Size of the change, may be greater than length if the bytes
+ are a preview.
+ \param [in] segment Path of the segment of the address.
+ \param [in] time Unix time in seconds.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Emit a "change" event if the address is new (or cannot be tracked), or count
+ the change to emit it by Flush.
+*/
+void DiffEvents::Record(size_t address, const char *old_bytes,
+                        const char *new_bytes, size_t length, size_t size,
+                        const std::string &segment,
+                        double time) noexcept(false) {
+  changes_++;
+  auto it{entries_.find(address)};
+  if (it != entries_.end()) {
+    Entry &entry{it->second};
+    entry.old_bytes.assign(old_bytes, length);
+    entry.new_bytes.assign(new_bytes, length);
+    entry.size = size;
+    entry.total++;
+    if (!entry.pending++)
+      pending_.push_back(address);
+    return;
+  }
+
+  if (entries_.size() >= kMaxAddresses) {
+    std::string old_str(old_bytes, length), new_str(new_bytes, length);
+    Emit({EventType::kChange, time, address, segment, old_str, new_str, 1, 1,
+          size});
+    return;
+  }
+
+  Entry &entry{entries_[address]};
+  entry.segment = segment;
+  entry.old_bytes.assign(old_bytes, length);
+  entry.new_bytes.assign(new_bytes, length);
+  entry.size = size;
+  entry.total = 1;
+  Emit({EventType::kChange, time, address, entry.segment, entry.old_bytes,
+        entry.new_bytes, 1, 1, size});
+}
+
+/*!
+ \brief Emit "repeat" events.
+ \param [in] time Unix time in seconds.
+ \param [in] force Emit even if kRepeatPeriod has not passed since the
+ previous flush.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Emit a "repeat" event for every address with changes that were not emitted,
+ in order of addresses, and flush the stream for NDJSON.
+*/
+void DiffEvents::Flush(double time, bool force) noexcept(false) {
+  if (!force && time - last_flush_ < kRepeatPeriod)
+    return;
+  last_flush_ = time;
+
+  std::sort(pending_.begin(), pending_.end());
+  for (size_t address : pending_) {
+    Entry &entry{entries_[address]};
+    Emit({EventType::kRepeat, time, address, entry.segment, entry.old_bytes,
+          entry.new_bytes, entry.pending, entry.total, entry.size});
+    entry.pending = 0;
+  }
+  pending_.clear();
+  if (json_stream_)
+    json_stream_->flush();
+}
+
+/*!
+ \brief Get the most changed addresses.
+ \return Up to kSummaryTop pairs of an address and its entry, sorted by the
+ amount of changes (descending).
+ \throw std::bad_alloc If memory cannot be allocated.
+*/
+std::vector<std::pair<size_t, const DiffEvents::Entry *>>
+DiffEvents::Top() const noexcept(false) {
+  std::vector<std::pair<size_t, const Entry *>> result;
+  result.reserve(entries_.size());
+  for (const auto &[address, entry] : entries_)
+    result.push_back({address, &entry});
+
+  size_t count{std::min(kSummaryTop, result.size())};
+  std::partial_sort(result.begin(), result.begin() + count, result.end(),
+                    [](const auto &a, const auto &b) {
+                      return a.second->total != b.second->total
+                                 ? a.second->total > b.second->total
+                                 : a.first < b.first;
+                    });
+  result.resize(count);
+  return result;
+}
+
+/*!
+ \brief Write a summary as one JSON object.
+ \param [out] stream Stream to write to.
+ \param [in] time Unix time in seconds.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Write the amount of changes, the amount of tracked addresses and the most
+ changed addresses.
+*/
+void DiffEvents::WriteSummary(std::ostream &stream,
+                              double time) const noexcept(false) {
+  std::vector<std::pair<size_t, const Entry *>> top{Top()};
+  stream << R"({"type":"summary","time":)" << std::fixed
+         << std::setprecision(6) << time << std::defaultfloat
+         << R"(,"changes":)" << std::dec << changes_ << R"(,"addresses":)"
+         << entries_.size() << R"(,"top":[)";
+  for (size_t i{0}; i < top.size(); i++) {
+    stream << (i ? "," : "") << R"({"address":"0x)" << std::hex
+           << top[i].first << std::dec << R"(","segment":)";
+    WriteJsonString(stream, top[i].second->segment);
+    stream << R"(,"total":)" << top[i].second->total << '}';
+  }
+  stream << "]}" << std::endl;
+}
+
+/*!
+ \brief Forget all addresses and counters.
+*/
+void DiffEvents::Reset() noexcept {
+  entries_.clear();
+  pending_.clear();
+  last_flush_ = 0;
+  changes_ = 0;
+}
+
+/*!
+ \brief Write an event as one JSON object.
+ \param [out] stream Stream to write to.
+ \param [in] event The event.
+
+ Bytes are written as hex strings, the address as a hex string with "0x".
+*/
+void DiffEvents::WriteJson(std::ostream &stream, const Event &event) noexcept {
+  auto write_bytes{[&stream](const std::string &bytes) {
+    stream << '"' << std::hex << std::setfill('0');
+    for (char c : bytes)
+      stream << std::setw(2) << static_cast<unsigned>(static_cast<uint8_t>(c));
+    stream << std::dec << std::setfill(' ') << '"';
+  }};
+
+  stream << R"({"type":")"
+         << (event.type == EventType::kChange ? "change" : "repeat")
+         << R"(","time":)" << std::fixed << std::setprecision(6) << event.time
+         << std::defaultfloat << R"(,"address":"0x)" << std::hex
+         << event.address << std::dec << R"(","segment":)";
+  WriteJsonString(stream, event.segment);
+  stream << R"(,"old":)";
+  write_bytes(event.old_bytes);
+  stream << R"(,"new":)";
+  write_bytes(event.new_bytes);
+  stream << R"(,"size":)" << event.size << R"(,"count":)" << event.count
+         << R"(,"total":)" << event.total << "}\n";
+}
+
+/*!
+ \brief Write a string as a JSON string.
+ \param [out] stream Stream to write to.
+ \param [in] str The string.
+
+ Quotes, backslashes and control characters are escaped.
+*/
+void DiffEvents::WriteJsonString(std::ostream &stream,
+                                 const std::string &str) noexcept {
+  stream << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\')
+      stream << '\\' << c;
+    else if (static_cast<uint8_t>(c) < 0x20)
+      stream << "\\u" << std::hex << std::setfill('0') << std::setw(4)
+             << static_cast<unsigned>(c) << std::dec << std::setfill(' ');
+    else
+      stream << c;
+  }
+  stream << '"';
+}
+
+/*!
+ \brief Pass an event to the consumer and the stream for NDJSON.
+ \param [in] event The event.
+*/
+void DiffEvents::Emit(const Event &event) noexcept(false) {
+  if (consumer_)
+    consumer_(event);
+  if (json_stream_)
+    WriteJson(*json_stream_, event);
+}
@@ -0,0 +1,147 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief DiffEvents header
+
+ A header that contains the definition of DiffEvents class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_DIFFEVENTS_H_
+#define MEMORYACCESSOR_SRC_DIFFEVENTS_H_
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*!
+ \brief A class that turns differences found by "diff" to a stream of events.
+
+ The first change at an address is emitted at once as a "change" event.
+ Further changes at the same address are counted, and every kRepeatPeriod
+ seconds one "repeat" event with the amount of new changes and the latest
+ bytes is emitted for every such address. Up to kMaxAddresses addresses are
+ tracked; changes at other addresses are emitted as "change" events every
+ time.
+
+ Events are passed to a consumer function (e.g., printing to the terminal)
+ and written as NDJSON (one JSON object per line) to a stream, both are
+ optional.
+*/
+class DiffEvents {
+public:
+  constexpr static size_t kMaxAddresses{
+      0x10000}; //!< Maximum amount of tracked addresses.
+  constexpr static double kRepeatPeriod{
+      1}; //!< Minimum time between "repeat" events in seconds.
+  constexpr static size_t kSummaryTop{
+      10}; //!< Amount of most changed addresses in a summary.
+
+  /*!
+   \brief Type of an event.
+  */
+  enum class EventType : uint8_t {
+    kChange, //!< First change at an address.
+    kRepeat, //!< More changes at an address.
+  };
+
+  /*!
+   \brief A struct that represents an event.
+  */
+  struct Event {
+    EventType type;               //!< Type of the event.
+    double time;                  //!< Unix time in seconds.
+    size_t address;               //!< Address of the change.
+    const std::string &segment;   //!< Path of the segment.
+    const std::string &old_bytes; //!< Bytes before the latest change.
+    const std::string &new_bytes; //!< Bytes after the latest change.
+    uint64_t count;               //!< Changes since the previous event.
+    uint64_t total;               //!< Changes since the start.
+    size_t size; //!< Size of the latest change, bytes may be a shorter preview.
+  };
+
+  /*!
+   \brief A struct that represents a tracked address.
+  */
+  struct Entry {
+    std::string segment;   //!< Path of the segment.
+    std::string old_bytes; //!< Bytes before the latest change.
+    std::string new_bytes; //!< Bytes after the latest change.
+    uint64_t pending{0};   //!< Changes that are not emitted yet.
+    uint64_t total{0};     //!< Changes since the start.
+    size_t size{0};        //!< Size of the latest change.
+  };
+
+  using Consumer =
+      std::function<void(const Event &)>; //!< Type of a consumer of events.
+
+  /*!
+   \brief Set the consumer of events.
+   \param [in] consumer Function called for every event, may be empty.
+  */
+  void SetConsumer(Consumer consumer) noexcept {
+    consumer_ = std::move(consumer);
+  }
+
+  /*!
+   \brief Set the stream for NDJSON.
+   \param [in] json_stream Stream to write events to, or nullptr.
+  */
+  void SetJsonStream(std::ostream *json_stream) noexcept {
+    json_stream_ = json_stream;
+  }
+
+  void Record(size_t address, const char *old_bytes, const char *new_bytes,
+              size_t length, size_t size, const std::string &segment,
+              double time) noexcept(false);
+  void Flush(double time, bool force) noexcept(false);
+  std::vector<std::pair<size_t, const Entry *>> Top() const noexcept(false);
+  void WriteSummary(std::ostream &stream, double time) const noexcept(false);
+  void Reset() noexcept;
+
+  /*!
+   \brief Get amount of changes recorded.
+   \return Sum of changes at all addresses.
+  */
+  uint64_t Changes() const noexcept { return changes_; }
+
+  /*!
+   \brief Get amount of tracked addresses.
+   \return Number of addresses with counters.
+  */
+  size_t Addresses() const noexcept { return entries_.size(); }
+
+  static void WriteJson(std::ostream &stream, const Event &event) noexcept;
+  static void WriteJsonString(std::ostream &stream,
+                              const std::string &str) noexcept;
+
+private:
+  void Emit(const Event &event) noexcept(false);
+
+  std::unordered_map<size_t, Entry> entries_; //!< Tracked addresses.
+  std::vector<size_t> pending_; //!< Addresses with changes not emitted yet.
+  Consumer consumer_;           //!< Consumer of events.
+  std::ostream *json_stream_{nullptr}; //!< Stream for NDJSON.
+  double last_flush_{0};               //!< Time of the latest flush.
+  uint64_t changes_{0};                //!< Sum of changes at all addresses.
+};
+
+#endif // MEMORYACCESSOR_SRC_DIFFEVENTS_H_
@@ -0,0 +1,664 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief DiffScanner source
+
+  A source that contains the realization of DiffScanner class.
+*/
+
+#include "diffscanner.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "bufferallocator.h"
+#include "memoryaccessor.h"
+#include "snapshotstore.h"
+#include "tools.h"
+
+/*!
+ \brief Find runs of different bytes in a block.
+ \param [in] old_data Pointer to the old data.
+ \param [in] new_data Pointer to the new data.
+ \param [in] amount Size of the block.
+ \param [in] address Address of the block in victim process.
+ \param [in] length Length of differences to find.
+ \param [out] piece Result of comparing.
+
+ Measure the runs at the start and at the end of the block, then find runs of
+ the given length between them. Equal parts are skipped by 8-byte words.
+*/
+void DiffScanner::ScanPiece(const char *old_data, const char *new_data,
+                            size_t amount, size_t address, size_t length,
+                            Piece &piece) noexcept {
+  piece.address = address;
+  piece.amount = amount;
+  piece.head.length = piece.tail.length = 0;
+  piece.found.clear();
+  piece.ranges.clear();
+  piece.changed = false;
+
+  auto fill{[&](Run &run, size_t pos, size_t run_length) {
+    run.address = address + pos;
+    run.length = run_length;
+    run.old_bytes.assign(old_data + pos, std::min(run_length, length));
+    run.new_bytes.assign(new_data + pos, std::min(run_length, length));
+  }};
+
+  size_t pos{0};
+  while (pos < amount && old_data[pos] != new_data[pos])
+    pos++;
+  if (pos) {
+    fill(piece.head, 0, pos);
+    piece.changed = true;
+  }
+  if (pos == amount)
+    return;
+
+  size_t tail{amount};
+  while (old_data[tail - 1] != new_data[tail - 1])
+    tail--;
+  if (tail < amount) {
+    fill(piece.tail, tail, amount - tail);
+    piece.changed = true;
+  }
+
+  // Every run between pos and tail is followed by an equal byte
+  while (pos < tail) {
+    uint64_t old_word, new_word;
+    while (pos + sizeof(uint64_t) <= tail) {
+      std::memcpy(&old_word, old_data + pos, sizeof(uint64_t));
+      std::memcpy(&new_word, new_data + pos, sizeof(uint64_t));
+      if (old_word != new_word)
+        break;
+      pos += sizeof(uint64_t);
+    }
+
+    for (; pos < tail && old_data[pos] == new_data[pos]; pos++)
+      ;
+    if (pos == tail)
+      break;
+    piece.changed = true;
+
+    size_t end{pos};
+    while (old_data[end] != new_data[end])
+      end++;
+    if (end - pos == length) {
+      piece.found.emplace_back();
+      fill(piece.found.back(), pos, length);
+    }
+    pos = end;
+  }
+}
+
+namespace {
+
+/*!
+ \brief Check if a change of a value meets the condition of a query.
+ \param [in] old_value Old value.
+ \param [in] new_value New value, differs from the old one.
+ \param [in] query The query.
+ \return true if the change meets the condition.
+*/
+template <typename T>
+bool MatchTyped(T old_value, T new_value,
+                const DiffScanner::Query &query) noexcept {
+  using Predicate = DiffScanner::Predicate;
+  if constexpr (std::is_floating_point_v<T>) {
+    switch (query.predicate) {
+    case Predicate::kAny:
+      return true;
+    case Predicate::kAdd:
+      return new_value - old_value == static_cast<T>(query.float_value);
+    case Predicate::kSub:
+      return old_value - new_value == static_cast<T>(query.float_value);
+    case Predicate::kIncreased:
+      return new_value > old_value;
+    case Predicate::kDecreased:
+      return new_value < old_value;
+    case Predicate::kNear:
+      return std::fabs(static_cast<double>(new_value) -
+                       static_cast<double>(old_value)) < query.float_value;
+    }
+  } else {
+    using Unsigned = std::make_unsigned_t<T>;
+    Unsigned old_bits{static_cast<Unsigned>(old_value)},
+        new_bits{static_cast<Unsigned>(new_value)};
+    switch (query.predicate) {
+    case Predicate::kAny:
+      return true;
+    case Predicate::kAdd:
+      return static_cast<Unsigned>(new_bits - old_bits) ==
+             static_cast<Unsigned>(query.int_value);
+    case Predicate::kSub:
+      return static_cast<Unsigned>(old_bits - new_bits) ==
+             static_cast<Unsigned>(query.int_value);
+    case Predicate::kIncreased:
+      return new_value > old_value;
+    case Predicate::kDecreased:
+      return new_value < old_value;
+    case Predicate::kNear:
+      return static_cast<Unsigned>(new_value > old_value
+                                       ? new_bits - old_bits
+                                       : old_bits - new_bits) <
+             query.int_value;
+    }
+  }
+  return false;
+}
+
+/*!
+ \brief Find changed values of type T in a block.
+ \param [in] old_data Pointer to the old data.
+ \param [in] new_data Pointer to the new data.
+ \param [in] amount Size of the block.
+ \param [in] address Address of the block in victim process.
+ \param [in] query The query.
+ \param [out] piece Result of comparing, runs are in "found".
+
+ Values are aligned by their size in victim process. Equal parts are skipped
+ by kStride bytes, compared by memcmp of constant size, which is vectorized by
+ the compiler; values are only loaded in strides that differ.
+*/
+template <typename T>
+void ScanTypedValues(const char *old_data, const char *new_data, size_t amount,
+                     size_t address, const DiffScanner::Query &query,
+                     DiffScanner::Piece &piece) noexcept {
+  constexpr size_t kStride{64};
+  size_t pos{(sizeof(T) - address % sizeof(T)) % sizeof(T)};
+  while (pos + sizeof(T) <= amount) {
+    if (pos + kStride <= amount &&
+        !std::memcmp(old_data + pos, new_data + pos, kStride)) {
+      pos += kStride;
+      continue;
+    }
+
+    size_t end{std::min(amount, pos + kStride)};
+    for (; pos + sizeof(T) <= end; pos += sizeof(T)) {
+      if (!std::memcmp(old_data + pos, new_data + pos, sizeof(T)))
+        continue;
+      piece.changed = true;
+
+      T old_value, new_value;
+      std::memcpy(&old_value, old_data + pos, sizeof(T));
+      std::memcpy(&new_value, new_data + pos, sizeof(T));
+      if (!MatchTyped(old_value, new_value, query))
+        continue;
+
+      piece.found.emplace_back();
+      DiffScanner::Run &run{piece.found.back()};
+      run.address = address + pos;
+      run.length = sizeof(T);
+      run.old_bytes.assign(old_data + pos, sizeof(T));
+      run.new_bytes.assign(new_data + pos, sizeof(T));
+    }
+  }
+}
+
+} // namespace
+
+/*!
+ \brief Find changed values that meet the condition of a query in a block.
+ \param [in] old_data Pointer to the old data.
+ \param [in] new_data Pointer to the new data.
+ \param [in] amount Size of the block.
+ \param [in] address Address of the block in victim process.
+ \param [in] query The query, its type must not be kRaw.
+ \param [out] piece Result of comparing.
+
+ Values never continue to neighbouring blocks (they are aligned, and blocks
+ are split on page boundaries), so only "found" is filled.
+*/
+void DiffScanner::ScanTyped(const char *old_data, const char *new_data,
+                            size_t amount, size_t address, const Query &query,
+                            Piece &piece) noexcept {
+  piece.address = address;
+  piece.amount = amount;
+  piece.head.length = piece.tail.length = 0;
+  piece.found.clear();
+  piece.ranges.clear();
+  piece.changed = false;
+
+  switch (query.type) {
+  case ValueType::kRaw:
+    break;
+  case ValueType::kInt16:
+    ScanTypedValues<int16_t>(old_data, new_data, amount, address, query, piece);
+    break;
+  case ValueType::kInt32:
+    ScanTypedValues<int32_t>(old_data, new_data, amount, address, query, piece);
+    break;
+  case ValueType::kInt64:
+    ScanTypedValues<int64_t>(old_data, new_data, amount, address, query, piece);
+    break;
+  case ValueType::kUint16:
+    ScanTypedValues<uint16_t>(old_data, new_data, amount, address, query,
+                              piece);
+    break;
+  case ValueType::kUint32:
+    ScanTypedValues<uint32_t>(old_data, new_data, amount, address, query,
+                              piece);
+    break;
+  case ValueType::kUint64:
+    ScanTypedValues<uint64_t>(old_data, new_data, amount, address, query,
+                              piece);
+    break;
+  case ValueType::kFloat:
+    ScanTypedValues<float>(old_data, new_data, amount, address, query, piece);
+    break;
+  case ValueType::kDouble:
+    ScanTypedValues<double>(old_data, new_data, amount, address, query, piece);
+    break;
+  }
+}
+
+/*!
+ \brief Find changed ranges of any length in a block.
+ \param [in] old_data Pointer to the old data.
+ \param [in] new_data Pointer to the new data.
+ \param [in] amount Size of the block.
+ \param [in] address Address of the block in victim process.
+ \param [in] gap Maximum amount of equal bytes inside a range.
+ \param [out] piece Result of comparing, ranges are in "ranges".
+
+ Runs of different bytes are found by masks of mismatching bytes of 8-byte
+ words and merged if they are separated by at most gap equal bytes. Every range
+ keeps up to kPreviewSize bytes from its start (not further than the end of the
+ block). Ranges are not cut on boundaries of blocks, they are merged by the
+ caller.
+*/
+void DiffScanner::ScanRanges(const char *old_data, const char *new_data,
+                             size_t amount, size_t address, size_t gap,
+                             Piece &piece) noexcept {
+  constexpr size_t kStride{32};
+  constexpr uint64_t kLowBits{0x0101010101010101},
+      kHighBits{0x8080808080808080};
+  piece.address = address;
+  piece.amount = amount;
+  piece.head.length = piece.tail.length = 0;
+  piece.found.clear();
+  piece.ranges.clear();
+
+  auto mismatch_mask{[old_data, new_data](size_t pos) {
+    uint64_t old_word, new_word;
+    std::memcpy(&old_word, old_data + pos, sizeof(uint64_t));
+    std::memcpy(&new_word, new_data + pos, sizeof(uint64_t));
+    return old_word ^ new_word; // little-endian: byte i is bits 8i..8i+7
+  }};
+
+  size_t pos{0};
+  for (;;) {
+    // First different byte
+    while (pos + kStride <= amount &&
+           !std::memcmp(old_data + pos, new_data + pos, kStride))
+      pos += kStride;
+    for (; pos + sizeof(uint64_t) <= amount; pos += sizeof(uint64_t))
+      if (uint64_t mask{mismatch_mask(pos)}) {
+        pos += std::countr_zero(mask) / 8;
+        break;
+      }
+    for (; pos < amount && old_data[pos] == new_data[pos]; pos++)
+      ;
+    if (pos == amount)
+      break;
+
+    // First equal byte after it: the lowest zero byte of the mask is exact
+    size_t end{pos};
+    for (; end + sizeof(uint64_t) <= amount; end += sizeof(uint64_t)) {
+      uint64_t mask{mismatch_mask(end)};
+      if (uint64_t zero{(mask - kLowBits) & ~mask & kHighBits}) {
+        end += std::countr_zero(zero) / 8;
+        break;
+      }
+    }
+    for (; end < amount && old_data[end] != new_data[end]; end++)
+      ;
+
+    if (!piece.ranges.empty() &&
+        address + pos - piece.ranges.back().address -
+                piece.ranges.back().length <=
+            gap)
+      piece.ranges.back().length = address + end - piece.ranges.back().address;
+    else {
+      piece.ranges.emplace_back();
+      Range &range{piece.ranges.back()};
+      range.address = address + pos;
+      range.length = end - pos;
+      range.preview = std::min(kPreviewSize, amount - pos);
+      std::memcpy(range.old_bytes.data(), old_data + pos, range.preview);
+      std::memcpy(range.new_bytes.data(), new_data + pos, range.preview);
+    }
+    pos = end;
+  }
+  piece.changed = !piece.ranges.empty();
+}
+
+/*!
+ \brief Get the size of a type.
+ \param [in] type The type.
+ \return Size in bytes, 0 for kRaw.
+*/
+size_t DiffScanner::TypeSize(ValueType type) noexcept {
+  switch (type) {
+  case ValueType::kRaw:
+    return 0;
+  case ValueType::kInt16:
+  case ValueType::kUint16:
+    return sizeof(int16_t);
+  case ValueType::kInt32:
+  case ValueType::kUint32:
+  case ValueType::kFloat:
+    return sizeof(int32_t);
+  case ValueType::kInt64:
+  case ValueType::kUint64:
+  case ValueType::kDouble:
+    return sizeof(int64_t);
+  }
+  return 0;
+}
+
+/*!
+ \brief Compare a block by the query set by SetQuery.
+ \param [in] old_data Pointer to the old data.
+ \param [in] new_data Pointer to the new data.
+ \param [in] amount Size of the block.
+ \param [in] address Address of the block in victim process.
+ \param [in] length Length of differences to find (not typed mode).
+ \param [out] piece Result of comparing.
+
+ Call ScanTyped in typed mode, ScanRanges in range mode, ScanPiece otherwise.
+*/
+void DiffScanner::Compare(const char *old_data, const char *new_data,
+                          size_t amount, size_t address, size_t length,
+                          Piece &piece) const noexcept {
+  if (query_.type == ValueType::kRaw && query_.ranges)
+    ScanRanges(old_data, new_data, amount, address, query_.gap, piece);
+  else if (query_.type == ValueType::kRaw)
+    ScanPiece(old_data, new_data, amount, address, length, piece);
+  else
+    ScanTyped(old_data, new_data, amount, address, query_, piece);
+}
+
+/*!
+ \brief Make one pass over all regions of the store.
+ \param [in] memory_accessor MemoryAccessor with /proc/PID/mem opened by
+ OpenSharedMem.
+ \param [in,out] store Store with the layout updated for this pass.
+ \param [in] tools Tools used for hashing.
+ \param [in] length Length of differences to find.
+ \param [in] pass Number of the pass, used to schedule blocks.
+ \param [in] merge Function called with results in order of tasks.
+ \param [in] stop Function that returns true if the pass should be stopped.
+ \return Return code, 0 is success, 2 means that the pass was stopped.
+ \throw std::bad_alloc If memory for buffers cannot be allocated.
+ \throw std::system_error If a thread cannot be started.
+
+ Split regions to tasks (skipping blocks that are not scheduled for this pass
+ in adaptive mode), process them by worker threads and merge the results in
+ order. After the pass, a region is valid if all data of its tasks was read.
+*/
+uint8_t DiffScanner::Scan(const MemoryAccessor &memory_accessor,
+                          SnapshotStore &store, const Tools &tools,
+                          size_t length, uint64_t pass, const MergeFunc &merge,
+                          const StopFunc &stop) noexcept(false) {
+  memory_accessor_ = &memory_accessor;
+  store_ = &store;
+  tools_ = &tools;
+  length_ = length;
+  pass_ = pass;
+
+  std::vector<SnapshotStore::Region> &regions{store.Regions()};
+  tasks_.clear();
+  scanned_bytes_ = total_bytes_ = 0;
+  for (size_t num{0}; num < regions.size(); num++) {
+    const SnapshotStore::Region &region{regions[num]};
+    size_t size{region.end - region.start};
+    total_bytes_ += size;
+
+    for (size_t offset{0}; offset < size; offset += kTaskSize) {
+      if (adaptive_ && !region.fresh && region.valid &&
+          region.blocks[offset / kTaskSize].next_pass > pass)
+        continue;
+      tasks_.push_back({num, offset, std::min(kTaskSize, size - offset)});
+      scanned_bytes_ += tasks_.back().amount;
+    }
+  }
+  std::vector<bool> read(regions.size(), true);
+
+  slots_.resize(threads_ > 1 ? 2 * threads_ : 1);
+  for (Slot &slot : slots_) {
+    if (!slot.buffer)
+      slot.buffer = BufferAllocator::Allocate(kTaskSize);
+    slot.ready = false;
+  }
+  next_task_ = merged_ = 0;
+  stop_ = false;
+
+  uint8_t result{0};
+  if (threads_ == 1) {
+    for (const Task &task : tasks_) {
+      if (stop()) {
+        result = 2;
+        break;
+      }
+      Process(task, slots_[0]);
+      if (!slots_[0].result.read)
+        read[task.region] = false;
+      merge(slots_[0].result);
+    }
+  } else {
+    std::vector<std::thread> workers;
+    try {
+      for (unsigned i{0}; i < threads_; i++)
+        workers.emplace_back(&DiffScanner::Work, this);
+    } catch (...) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      free_cv_.notify_all();
+      for (std::thread &worker : workers)
+        worker.join();
+      throw;
+    }
+
+    for (size_t index{0}; index < tasks_.size(); index++) {
+      Slot &slot{slots_[index % slots_.size()]};
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!slot.ready && !stop_) {
+        if (stop())
+          stop_ = true;
+        else
+          ready_cv_.wait_for(lock, std::chrono::milliseconds(50));
+      }
+      if (stop_) {
+        result = 2;
+        break;
+      }
+      lock.unlock();
+
+      if (!slot.result.read)
+        read[tasks_[index].region] = false;
+      merge(slot.result);
+
+      lock.lock();
+      slot.ready = false;
+      merged_ = index + 1;
+      lock.unlock();
+      free_cv_.notify_all();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    free_cv_.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+  }
+
+  if (result == 0)
+    for (size_t num{0}; num < regions.size(); num++) {
+      regions[num].valid = read[num];
+      if (read[num])
+        regions[num].valid_end = regions[num].end;
+    }
+  return result;
+}
+
+/*!
+ \brief Process one task.
+ \param [in] task Task to process.
+ \param [in,out] slot Slot for the result.
+
+ Read new data of the task. In hash mode, hash every page, compare the hash to
+ the old one and store it. Otherwise, compare new data to the old copy and
+ update the copy (kept regions, only data below valid_end of a grown one is
+ compared), or compare new data to the parts of retired regions it overlaps
+ (fresh regions). Then schedule the next read of the
+ block. Tasks never share data they write.
+*/
+void DiffScanner::Process(const Task &task, Slot &slot) noexcept {
+  constexpr size_t kPageSize{SnapshotStore::kPageSize};
+  SnapshotStore::Region &region{store_->Regions()[task.region]};
+  const std::vector<SnapshotStore::Region> &retired{store_->Retired()};
+  Result &result{slot.result};
+  size_t address{region.start + task.offset};
+
+  result.region = task.region;
+  result.address = address;
+  result.amount = task.amount;
+  result.pieces.clear();
+  result.pages.clear();
+  result.data = nullptr;
+
+  char *new_data{region.fresh && !store_->HashMode()
+                     ? region.data.get() + task.offset
+                     : slot.buffer.get()};
+  result.read = memory_accessor_->ReadShared(new_data, address, task.amount) ==
+                task.amount;
+  if (!result.read)
+    return;
+  bool changed{region.fresh};
+
+  // First retired region that ends after the task
+  auto retired_it{std::partition_point(
+      retired.begin(), retired.end(),
+      [address](const SnapshotStore::Region &old_region) {
+        return old_region.end <= address;
+      })};
+
+  if (store_->HashMode()) {
+    result.data = new_data;
+    for (size_t page{0}; page < task.amount; page += kPageSize) {
+      size_t page_address{address + page};
+      uint64_t &hash{region.hashes[(task.offset + page) / kPageSize]};
+      const uint64_t *old_hash{nullptr};
+
+      if (!region.fresh) {
+        if (region.valid && page_address < region.valid_end)
+          old_hash = &hash;
+      } else {
+        while (retired_it != retired.end() && retired_it->end <= page_address)
+          retired_it++;
+        if (retired_it != retired.end() && retired_it->start <= page_address &&
+            retired_it->valid)
+          old_hash = &retired_it->hashes[(page_address - retired_it->start) /
+                                         kPageSize];
+      }
+
+      uint64_t new_hash{tools_->HashBlock(
+          new_data + page, std::min(kPageSize, task.amount - page))};
+      result.pages.push_back(!old_hash              ? PageState::kUnknown
+                             : *old_hash == new_hash ? PageState::kSame
+                                                     : PageState::kChanged);
+      if (result.pages.back() == PageState::kChanged)
+        changed = true;
+      hash = new_hash;
+    }
+  } else if (!region.fresh) {
+    char *old_data{region.data.get() + task.offset};
+    if (region.valid && address < region.valid_end) {
+      result.pieces.emplace_back();
+      Compare(old_data, new_data,
+              std::min(task.amount, region.valid_end - address), address,
+              length_, result.pieces.back());
+      changed = result.pieces.back().changed;
+    }
+    std::memcpy(old_data, new_data, task.amount);
+  } else {
+    size_t end{address + task.amount};
+    for (; retired_it != retired.end() && retired_it->start < end;
+         retired_it++) {
+      if (!retired_it->valid)
+        continue;
+      size_t from{std::max(retired_it->start, address)},
+          to{std::min(retired_it->end, end)};
+      result.pieces.emplace_back();
+      Compare(retired_it->data.get() + from - retired_it->start,
+              new_data + from - address, to - from, from, length_,
+              result.pieces.back());
+    }
+  }
+
+  SnapshotStore::Block &block{region.blocks[task.offset / kTaskSize]};
+  block.period = changed ? 1 : std::min(block.period * 2, kMaxPeriod);
+  block.next_pass = pass_ + block.period;
+}
+
+/*!
+ \brief Loop of a worker thread.
+
+ Take tasks in order while there is a free slot for the result, process them
+ and mark the results as ready. Stop when there are no tasks left or stop_ is
+ set.
+*/
+void DiffScanner::Work() noexcept {
+  for (;;) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    free_cv_.wait(lock, [this] {
+      return stop_ || next_task_ >= tasks_.size() ||
+             next_task_ < merged_ + slots_.size();
+    });
+    if (stop_ || next_task_ >= tasks_.size())
+      return;
+    size_t index{next_task_++};
+    lock.unlock();
+
+    Slot &slot{slots_[index % slots_.size()]};
+    Process(tasks_[index], slot);
+
+    lock.lock();
+    slot.ready = true;
+    lock.unlock();
+    ready_cv_.notify_all();
+  }
+}
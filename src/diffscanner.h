@@ -0,0 +1,268 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief DiffScanner header
+
+ A header that contains the definition of DiffScanner class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_DIFFSCANNER_H_
+#define MEMORYACCESSOR_SRC_DIFFSCANNER_H_
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "bufferallocator.h"
+#include "memoryaccessor.h"
+#include "snapshotstore.h"
+#include "tools.h"
+
+/*!
+ \brief A class that reads and compares regions of "diff" in parallel.
+
+ One pass of "diff" is split into tasks of kTaskSize bytes (the last task of a
+ region may be shorter). Worker threads take tasks in order, read new data with
+ MemoryAccessor::ReadShared and compare it to the old data (or hash its pages
+ in hash mode), while the calling thread merges the results strictly in order
+ of tasks, so findings are printed in order of addresses. At most
+ 2 * threads results wait for merging, each owns a buffer of kTaskSize bytes,
+ so reading of the next tasks overlaps comparing and merging of the current
+ ones. With 1 thread, tasks are processed by the calling thread.
+
+ In adaptive mode, blocks that have not changed are read less often: every
+ read of an unchanged block doubles the amount of passes until its next read
+ (up to kMaxPeriod), and a change makes it read on every pass again. Fresh
+ regions and regions that were not fully read are always read.
+*/
+class DiffScanner {
+public:
+  constexpr static size_t kTaskSize{
+      SnapshotStore::kBlockSize}; //!< Maximum amount of bytes processed by one
+                                  //!< task.
+  constexpr static uint32_t kMaxPeriod{
+      64}; //!< Maximum amount of passes between reads of a block.
+  constexpr static size_t kPreviewSize{
+      16}; //!< Maximum amount of bytes kept for a changed range.
+
+  /*!
+   \brief A struct that represents a run of different bytes.
+  */
+  struct Run {
+    size_t address{0};     //!< Address of the run.
+    size_t length{0};      //!< Length of the run, 0 if there is no run.
+    std::string old_bytes; //!< Old bytes, at most the searched length.
+    std::string new_bytes; //!< New bytes, at most the searched length.
+  };
+
+  /*!
+   \brief A struct that represents a changed range of any length.
+
+   Gaps of equal bytes inside the range are not longer than the gap of the
+   query. Bytes are kept in place, so ranges are stored without allocations.
+  */
+  struct Range {
+    size_t address{0}; //!< Address of the range.
+    size_t length{0};  //!< Length of the range, 0 if there is no range.
+    size_t preview{0}; //!< Amount of bytes kept (may exceed the length).
+    std::array<char, kPreviewSize> old_bytes; //!< Old bytes from the start.
+    std::array<char, kPreviewSize> new_bytes; //!< New bytes from the start.
+  };
+
+  /*!
+   \brief A struct that represents the result of comparing a block.
+
+   Runs that touch the start or the end of the block may continue in the
+   neighbouring blocks, so they are kept separately with their full length.
+   Other runs are only kept if their length is equal to the searched one.
+  */
+  struct Piece {
+    size_t address{0};     //!< Address of the block.
+    size_t amount{0};      //!< Size of the block.
+    Run head;              //!< Run at the start of the block.
+    std::vector<Run> found; //!< Runs of the searched length inside the block.
+    Run tail; //!< Run at the end of the block (if it is not the head).
+    std::vector<Range> ranges; //!< Changed ranges (range mode).
+    bool changed{false}; //!< If there is any difference in the block.
+  };
+
+  /*!
+   \brief Type of values compared in typed mode.
+  */
+  enum class ValueType : uint8_t {
+    kRaw,    //!< Runs of different bytes (not typed).
+    kInt16,  //!< int16_t.
+    kInt32,  //!< int32_t.
+    kInt64,  //!< int64_t.
+    kUint16, //!< uint16_t.
+    kUint32, //!< uint32_t.
+    kUint64, //!< uint64_t.
+    kFloat,  //!< float.
+    kDouble, //!< double.
+  };
+
+  /*!
+   \brief Condition a changed value has to meet in typed mode.
+  */
+  enum class Predicate : uint8_t {
+    kAny,       //!< Any change.
+    kAdd,       //!< New value is old value + N.
+    kSub,       //!< New value is old value - N.
+    kIncreased, //!< New value is greater.
+    kDecreased, //!< New value is less.
+    kNear,      //!< |new - old| < epsilon.
+  };
+
+  /*!
+   \brief A struct that represents what differences to find.
+  */
+  struct Query {
+    ValueType type{ValueType::kRaw};     //!< Type of values.
+    Predicate predicate{Predicate::kAny}; //!< Condition of a change.
+    uint64_t int_value{0}; //!< N or epsilon for integer types (bits of N).
+    double float_value{0}; //!< N or epsilon for floating point types.
+    bool ranges{false}; //!< If changed ranges of any length are found (kRaw).
+    size_t gap{0}; //!< Maximum amount of equal bytes inside a range.
+  };
+
+  /*!
+   \brief State of a page in hash mode.
+  */
+  enum class PageState : uint8_t {
+    kUnknown, //!< Old hash is not known.
+    kSame,    //!< Hash has not changed.
+    kChanged, //!< Hash has changed.
+  };
+
+  /*!
+   \brief A struct that represents the result of one task.
+  */
+  struct Result {
+    size_t region{0};              //!< Number of the region in the store.
+    size_t address{0};             //!< Address of the task.
+    size_t amount{0};              //!< Size of the task.
+    bool read{false};              //!< If all data of the task was read.
+    std::vector<Piece> pieces;     //!< Compared blocks (copy mode).
+    std::vector<PageState> pages;  //!< States of pages (hash mode).
+    const char *data{nullptr};     //!< New data of the task (hash mode).
+  };
+
+  using MergeFunc =
+      std::function<void(const Result &)>; //!< Type of merging function.
+  using StopFunc = std::function<bool()>;  //!< Type of stop check function.
+
+  static void ScanPiece(const char *old_data, const char *new_data,
+                        size_t amount, size_t address, size_t length,
+                        Piece &piece) noexcept;
+  static void ScanTyped(const char *old_data, const char *new_data,
+                        size_t amount, size_t address, const Query &query,
+                        Piece &piece) noexcept;
+  static void ScanRanges(const char *old_data, const char *new_data,
+                         size_t amount, size_t address, size_t gap,
+                         Piece &piece) noexcept;
+  static size_t TypeSize(ValueType type) noexcept;
+  void Compare(const char *old_data, const char *new_data, size_t amount,
+               size_t address, size_t length, Piece &piece) const noexcept;
+
+  /*!
+   \brief Set what differences to find.
+   \param [in] query Query, typed mode is off if its type is kRaw.
+  */
+  void SetQuery(const Query &query) noexcept { query_ = query; }
+
+  /*!
+   \brief Set amount of threads.
+   \param [in] threads Amount of worker threads, 0 is treated as 1.
+  */
+  void SetThreads(unsigned threads) noexcept {
+    threads_ = threads ? threads : 1;
+  }
+
+  /*!
+   \brief Turn adaptive mode on or off.
+   \param [in] adaptive true to read unchanged blocks less often.
+  */
+  void SetAdaptive(bool adaptive) noexcept { adaptive_ = adaptive; }
+
+  /*!
+   \brief Get amount of bytes read by the latest pass.
+   \return Sum of sizes of tasks of the latest pass.
+  */
+  size_t ScannedBytes() const noexcept { return scanned_bytes_; }
+
+  /*!
+   \brief Get amount of bytes stored during the latest pass.
+   \return Sum of sizes of regions of the latest pass.
+  */
+  size_t TotalBytes() const noexcept { return total_bytes_; }
+
+  uint8_t Scan(const MemoryAccessor &memory_accessor, SnapshotStore &store,
+               const Tools &tools, size_t length, uint64_t pass,
+               const MergeFunc &merge, const StopFunc &stop) noexcept(false);
+
+private:
+  /*!
+   \brief A struct that represents one task.
+  */
+  struct Task {
+    size_t region; //!< Number of the region in the store.
+    size_t offset; //!< Offset from the start of the region.
+    size_t amount; //!< Amount of bytes.
+  };
+
+  /*!
+   \brief A struct that represents a place for the result of a task.
+  */
+  struct Slot {
+    Result result;                  //!< Result of the task.
+    BufferAllocator::Buffer buffer; //!< Buffer for new data.
+    bool ready{false};              //!< If the result can be merged.
+  };
+
+  void Process(const Task &task, Slot &slot) noexcept;
+  void Work() noexcept;
+
+  unsigned threads_{1};   //!< Amount of worker threads.
+  bool adaptive_{false};   //!< If unchanged blocks are read less often.
+  Query query_;            //!< What differences to find.
+  size_t scanned_bytes_{0}; //!< Bytes read by the latest pass.
+  size_t total_bytes_{0};   //!< Bytes stored during the latest pass.
+
+  const MemoryAccessor *memory_accessor_{nullptr}; //!< Source of data.
+  SnapshotStore *store_{nullptr}; //!< Store being updated.
+  const Tools *tools_{nullptr};   //!< Tools used for hashing.
+  size_t length_{0};              //!< Length of differences to find.
+  uint64_t pass_{0};              //!< Number of the current pass.
+
+  std::vector<Task> tasks_; //!< Tasks of the current pass.
+  std::vector<Slot> slots_; //!< Ring of results.
+  std::mutex mutex_;        //!< Mutex guarding the fields below.
+  std::condition_variable
+      ready_cv_; //!< Notified when a result becomes ready.
+  std::condition_variable free_cv_; //!< Notified when a slot becomes free.
+  size_t next_task_{0}; //!< Number of the next task to take.
+  size_t merged_{0};    //!< Amount of merged tasks.
+  bool stop_{false};    //!< If workers should stop.
+};
+
+#endif // MEMORYACCESSOR_SRC_DIFFSCANNER_H_
@@ -0,0 +1,90 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief MapsDelta source
+
+  A source that contains the realization of MapsDelta class.
+*/
+
+#include "mapsdelta.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "segmentinfo.h"
+
+/*!
+ \brief Find differences between two layouts.
+ \param [in] old_infos Segments of the old maps.
+ \param [in] new_infos Segments of the new maps.
+
+ Walk both layouts in order of start addresses. Segments with the same start or
+ the same end are paired (unchanged, changed permissions or resized), others
+ are added or removed. Then walk them again to collect the parts of address
+ space that belong to both an old and a new segment.
+*/
+void MapsDelta::Compute(const std::vector<SegmentInfo> &old_infos,
+                        const std::vector<SegmentInfo> &new_infos) noexcept {
+  changes_.clear();
+  overlaps_.clear();
+
+  size_t i{0}, j{0};
+  while (i < old_infos.size() || j < new_infos.size()) {
+    if (i < old_infos.size() && j < new_infos.size() &&
+        (old_infos[i].start == new_infos[j].start ||
+         old_infos[i].end == new_infos[j].end)) {
+      ChangeType type{ChangeType::kUnchanged};
+      if (old_infos[i].start != new_infos[j].start ||
+          old_infos[i].end != new_infos[j].end)
+        type = ChangeType::kResized;
+      else if (old_infos[i].mode != new_infos[j].mode)
+        type = ChangeType::kProtection;
+      changes_.push_back({type, i++, j++});
+    } else if (j == new_infos.size() ||
+               (i < old_infos.size() &&
+                old_infos[i].start < new_infos[j].start))
+      changes_.push_back({ChangeType::kRemoved, i++, kNone});
+    else
+      changes_.push_back({ChangeType::kAdded, kNone, j++});
+  }
+
+  i = j = 0;
+  while (i < old_infos.size() && j < new_infos.size()) {
+    size_t from{std::max(old_infos[i].start, new_infos[j].start)},
+        to{std::min(old_infos[i].end, new_infos[j].end)};
+    if (from < to)
+      overlaps_.push_back({i, j, from, to});
+
+    if (old_infos[i].end < new_infos[j].end)
+      i++;
+    else
+      j++;
+  }
+}
+
+/*!
+ \brief Check if the layout has not changed.
+ \return true if all changes found by the latest Compute are kUnchanged.
+*/
+bool MapsDelta::Empty() const noexcept {
+  return std::all_of(changes_.begin(), changes_.end(),
+                     [](const Change &change) {
+                       return change.type == ChangeType::kUnchanged;
+                     });
+}
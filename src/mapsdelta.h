@@ -0,0 +1,96 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief MapsDelta header
+
+ A header that contains the definition of MapsDelta class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_MAPSDELTA_H_
+#define MEMORYACCESSOR_SRC_MAPSDELTA_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "segmentinfo.h"
+
+/*!
+ \brief A class that finds differences between two layouts of segments.
+
+ The instance takes two parsed maps (both sorted by start address, as they are
+ in /proc/PID/maps) and walks them at the same time, so the work is linear in
+ the number of segments. The result is a list of changes of segments in order
+ of addresses and a list of overlapping parts of old and new segments. Vectors
+ are kept between calls to avoid allocations.
+*/
+class MapsDelta {
+public:
+  constexpr static size_t kNone{SIZE_MAX}; //!< Number of an absent segment.
+
+  /*!
+   \brief Type of change of a segment.
+  */
+  enum class ChangeType : uint8_t {
+    kUnchanged,  //!< Same boundaries and permissions.
+    kAdded,      //!< New segment (e.g., mmap).
+    kRemoved,    //!< Segment disappeared (e.g., munmap).
+    kResized,    //!< Same start or end, but different size.
+    kProtection, //!< Same boundaries, but different permissions (mprotect).
+  };
+
+  /*!
+   \brief A struct that represents a change of one segment.
+  */
+  struct Change {
+    ChangeType type; //!< Type of the change.
+    size_t old_num;  //!< Number of the old segment or kNone.
+    size_t new_num;  //!< Number of the new segment or kNone.
+  };
+
+  /*!
+   \brief A struct that represents a common part of an old and a new segment.
+  */
+  struct Overlap {
+    size_t old_num; //!< Number of the old segment.
+    size_t new_num; //!< Number of the new segment.
+    size_t start;   //!< Start address of the common part.
+    size_t end;     //!< End address of the common part.
+  };
+
+  void Compute(const std::vector<SegmentInfo> &old_infos,
+               const std::vector<SegmentInfo> &new_infos) noexcept;
+  bool Empty() const noexcept;
+
+  /*!
+   \brief Get changes found by the latest Compute.
+   \return A reference to std::vector of changes sorted by address.
+  */
+  const std::vector<Change> &Changes() const noexcept { return changes_; }
+
+  /*!
+   \brief Get overlaps found by the latest Compute.
+   \return A reference to std::vector of overlaps sorted by address.
+  */
+  const std::vector<Overlap> &Overlaps() const noexcept { return overlaps_; }
+
+private:
+  std::vector<Change> changes_;   //!< Changes of segments.
+  std::vector<Overlap> overlaps_; //!< Common parts of old and new segments.
+};
+
+#endif // MEMORYACCESSOR_SRC_MAPSDELTA_H_
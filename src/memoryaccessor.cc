@@ -23,11 +23,17 @@
 
 #include "memoryaccessor.h"
 
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdint>
 #include <fstream>
 #include <map>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <unordered_set>
@@ -35,6 +41,7 @@
 
 #include "segmentinfo.h"
 #include "tools.h"
+#include "writejournal.h"
 
 bool MemoryAccessor::one_instance_created_{false};
 
@@ -60,7 +67,11 @@ MemoryAccessor::MemoryAccessor(Tools &tools) noexcept(false) : tools_(tools) {
 
  Sets one_instance_created_ to false.
 */
-MemoryAccessor::~MemoryAccessor() noexcept { one_instance_created_ = false; }
+MemoryAccessor::~MemoryAccessor() noexcept {
+  CloseSharedMem();
+  ClosePagemap();
+  one_instance_created_ = false;
+}
 
 /*!
  \brief Get PID.
@@ -115,8 +126,11 @@ void MemoryAccessor::CheckPid() const noexcept(false) {
  \throw MapsFileEx If an error in opening /proc/PID/maps file occured.
  \throw PidNotSetEx If PID is not set.
 
- Open and parse /proc/PID/maps file saving data in segment_infos_ and
- special_segment_found_.
+ Read /proc/PID/maps file at once and parse it saving data in segment_infos_
+ and special_segment_found_. If the text of the file is the same as on the
+ previous call, nothing is parsed. Otherwise the previous segments are kept in
+ previous_segment_infos_, and if their layout differs from the new one,
+ maps_version_ is incremented.
 */
 void MemoryAccessor::ParseMaps() noexcept(false) {
   CheckPid();
@@ -129,15 +143,31 @@ void MemoryAccessor::ParseMaps() noexcept(false) {
     throw MapsFileEx();
   }
 
-  ResetSegments();
+  // The file is generated by the kernel on every read, so it is read at once
+  // and compared to the previous text to skip parsing if nothing changed
+  next_maps_text_.clear();
+  char buf[kMapsReadSize];
+  while (maps.read(buf, kMapsReadSize) || maps.gcount())
+    next_maps_text_.append(buf, maps.gcount());
+  maps.close();
+
+  if (next_maps_text_ == maps_text_ && !maps_text_.empty())
+    return;
+  maps_text_.swap(next_maps_text_);
+
+  previous_segment_infos_.swap(segment_infos_);
+  segment_infos_.clear();
+  special_segment_found_.clear();
 
+  std::istringstream text(maps_text_);
   std::string line;
   SegmentInfo segmentInfo;
   char trash{0}; // skip 1 char
   std::string permissions;
 
-  while (std::getline(maps, line)) {
+  while (std::getline(text, line)) {
     std::istringstream iss(line);
+    segmentInfo.path.clear();
 
     iss >> std::hex >> segmentInfo.start >> trash >> segmentInfo.end >>
         permissions >> segmentInfo.offset >> segmentInfo.major_id >> trash >>
@@ -147,6 +177,7 @@ void MemoryAccessor::ParseMaps() noexcept(false) {
 
     if (iss.fail() || iss.bad() || segmentInfo.mode == 255) {
       ResetSegments();
+      maps_version_++; // the previous layout is lost anyway
       throw BadMapsEx();
     }
 
@@ -167,6 +198,34 @@ void MemoryAccessor::ParseMaps() noexcept(false) {
       special_segment_found_[segmentInfo.path] = &segment_infos_.back();
     }
   }
+
+  if (!SameLayout(previous_segment_infos_))
+    maps_version_++;
+}
+
+/*!
+ \brief Get segments of the previous parse.
+ \return A reference to std::vector of SegmentInfo got by the parse of
+ /proc/PID/maps that was made before the latest one.
+
+ Get the previous layout of segments, so it can be compared to the current one
+ after maps_version_ is changed.
+*/
+const std::vector<SegmentInfo> &
+MemoryAccessor::GetPreviousSegmentInfos() const noexcept {
+  return previous_segment_infos_;
+}
+
+/*!
+ \brief Get version of the maps.
+ \return Current value of maps_version_.
+
+ Get a number that is changed every time the layout of memory segments
+ (boundaries or permissions) changes, so objects that depend on the layout can
+ check whether they are outdated.
+*/
+uint64_t MemoryAccessor::GetMapsVersion() const noexcept {
+  return maps_version_;
 }
 
 /*!
@@ -208,6 +267,33 @@ size_t MemoryAccessor::AddressInSegment(const size_t &address) const
   throw AddressNotInSegmentEx();
 }
 
+/*!
+ \brief Get the amount of bytes at an address that lie in adjacent segments.
+ \param [in] address Address to start from.
+ \param [in] amount Maximum amount of bytes.
+ \return Amount of bytes from address to the first gap between segments, at
+ most amount.
+ \throw AddressNotInSegmentEx If the address does not belong to any segment.
+ \throw PidNotSetEx If PID is not set.
+
+ A range of this size can be accessed by one call of ReadShared or WriteShared,
+ even if it crosses boundaries of segments.
+*/
+size_t MemoryAccessor::ContiguousSize(size_t address, size_t amount) const
+    noexcept(false) {
+  CheckPid();
+
+  size_t num{AddressInSegment(address)};
+  if (segment_infos_[num].start > address)
+    throw AddressNotInSegmentEx();
+  size_t end{segment_infos_[num].end};
+  for (num++; num < segment_infos_.size() && end - address < amount &&
+              segment_infos_[num].start == end;
+       num++)
+    end = segment_infos_[num].end;
+  return std::min(amount, end - address);
+}
+
 /*!
  \brief Check if a segment with the given number exists.
  \param [in] num Number of the memory segment starting from 0.
@@ -228,10 +314,15 @@ void MemoryAccessor::CheckSegNum(const size_t &num) const noexcept(false) {
  \brief Delete all data related to found segments.
 
  Clear/delete all variables which conatin information about found segments.
+ If there were any segments, maps_version_ is incremented.
 */
 void MemoryAccessor::ResetSegments() noexcept {
+  if (!segment_infos_.empty())
+    maps_version_++;
   segment_infos_.clear();
+  previous_segment_infos_.clear();
   special_segment_found_.clear();
+  maps_text_.clear();
 }
 
 /*!
@@ -245,6 +336,8 @@ void MemoryAccessor::Reset() noexcept {
   ResetSegments();
   if (mem_.is_open())
     mem_.close();
+  CloseSharedMem();
+  ClosePagemap();
 }
 
 /*!
@@ -286,21 +379,18 @@ size_t MemoryAccessor::ReadSegment(char *dst, const size_t &num, size_t start,
  \throw PidNotSetEx If PID is not set.
  \throw SegmentAccessDeniedEx If access to the segment is denied by an operating
  system. \throw SegmentNotExistEx If a segment with a number "num" does not
- exist.
+ exist. \throw WriteJournal::JournalFileEx If the write cannot be recorded to
+ the journal file. \throw std::bad_alloc If memory for old bytes cannot be
+ allocated.
 
  Write data to memory segment from a source "src" and return how many bytes were
- written.
+ written. If a journal is set, the write is recorded first (see
+ WriteSegmentPiece).
 */
 size_t MemoryAccessor::WriteSegment(const char *src, const size_t &num,
                                     size_t start,
                                     size_t amount) noexcept(false) {
-  PrepareMemSegment(num, start, amount);
-  mem_.write(src, amount);
-  mem_.seekg(0); // if the access is denied, it doesn't block at first, but
-                 // blocks after the next seekg operation.
-  if (!mem_.good())
-    throw SegmentAccessDeniedEx();
-  return amount;
+  return WriteSegmentPiece(src, num, start, amount, false);
 }
 
 /*!
@@ -352,18 +442,25 @@ void MemoryAccessor::Read(char *dst, size_t address, size_t amount,
  \param [in] address Address to start from.
  \param [in] amount Number of bytes to write.
  \param [out] done_amount How much data were written.
+ \param [in] continued true if it is a piece of the previous write, default is
+ false.
  \throw AddressNotInSegmentEx If an address reached that does not belong to any
  segment. \throw MemFileEx If an error in opening /proc/PID/mem file occured.
  \throw PidNotSetEx If PID is not set.
  \throw SegmentAccessDeniedEx If a segment is reached, access to which is denied
  by an operating system. \throw SegmentNotExistEx Must not be thrown normally,
- but appears in called methods.
+ but appears in called methods. \throw WriteJournal::JournalFileEx If the write
+ cannot be recorded to the journal file. \throw std::bad_alloc If memory for
+ old bytes cannot be allocated.
 
  Write data to /proc/PID/mem from a source "src", modifying done_amount by how
- many bytes were written.
+ many bytes were written. If a journal is set, pieces of the write in
+ different segments are recorded as one write, and so are the writes of one
+ command done by parts with continued set for all parts but the first.
 */
 void MemoryAccessor::Write(const char *src, size_t address, size_t amount,
-                           size_t &done_amount) noexcept(false) {
+                           size_t &done_amount,
+                           bool continued) noexcept(false) {
   CheckPid();
 
   size_t cur_segment_num{AddressInSegment(address)},
@@ -372,7 +469,8 @@ void MemoryAccessor::Write(const char *src, size_t address, size_t amount,
 
   address -= segment_infos_[cur_segment_num].start;
 
-  ret_size = WriteSegment(src, cur_segment_num, address, amount);
+  ret_size =
+      WriteSegmentPiece(src, cur_segment_num, address, amount, continued);
   amount -= ret_size;
   done_amount += ret_size;
 
@@ -383,12 +481,211 @@ void MemoryAccessor::Write(const char *src, size_t address, size_t amount,
     if (segment_infos_[cur_segment_num - 1].end !=
         segment_infos_[cur_segment_num].start)
       throw AddressNotInSegmentEx();
-    ret_size = WriteSegment(src + done_amount, cur_segment_num, 0, amount);
+    ret_size = WriteSegmentPiece(src + done_amount, cur_segment_num, 0, amount,
+                                 true);
     amount -= ret_size;
     done_amount += ret_size;
   }
 }
 
+/*!
+ \brief Open /proc/PID/mem for reading from multiple threads.
+ \throw MemFileEx If an error in opening file occured.
+ \throw PidNotSetEx If PID is not set.
+
+ Open /proc/PID/mem as a file descriptor for ReadShared and WriteShared. If
+ the file cannot be opened for writing, it is opened for reading only. If it is
+ opened already, it is reopened.
+*/
+void MemoryAccessor::OpenSharedMem() noexcept(false) {
+  CheckPid();
+  CloseSharedMem();
+
+  std::string path{"/proc/" + std::to_string(pid_) + "/mem"};
+  shared_mem_fd_ = open(path.c_str(), O_RDWR);
+  if (shared_mem_fd_ < 0)
+    shared_mem_fd_ = open(path.c_str(), O_RDONLY);
+  if (shared_mem_fd_ < 0)
+    throw MemFileEx();
+}
+
+/*!
+ \brief Close /proc/PID/mem opened for reading from multiple threads.
+*/
+void MemoryAccessor::CloseSharedMem() noexcept {
+  if (shared_mem_fd_ >= 0)
+    close(shared_mem_fd_);
+  shared_mem_fd_ = -1;
+}
+
+/*!
+ \brief Read data from /proc/PID/mem, may be called from multiple threads.
+ \param [out] dst Destination to which data will be copied.
+ \param [in] address Address to start from.
+ \param [in] amount Number of bytes to read.
+ \return Amount of bytes read, less than amount if an error occured.
+
+ Read data by pread from the descriptor opened by OpenSharedMem. Segments are
+ not checked, so this function does not depend on segment_infos_ and can be
+ used while other threads read it.
+*/
+size_t MemoryAccessor::ReadShared(char *dst, size_t address,
+                                  size_t amount) const noexcept {
+  size_t done_amount{0};
+  while (done_amount < amount) {
+    ssize_t ret_size{pread(shared_mem_fd_, dst + done_amount,
+                           amount - done_amount,
+                           static_cast<off_t>(address + done_amount))};
+    if (ret_size < 0 && errno == EINTR)
+      continue;
+    if (ret_size <= 0)
+      break;
+    done_amount += ret_size;
+  }
+  return done_amount;
+}
+
+/*!
+ \brief Write data to /proc/PID/mem by the descriptor opened by OpenSharedMem.
+ \param [in] src Source from which data will be copied.
+ \param [in] address Address to start from.
+ \param [in] amount Number of bytes to write.
+ \return Amount of bytes written, less than amount if an error occured (e.g.,
+ the file is opened for reading only).
+
+ Write data by pwrite. Like ReadShared, segments are not checked. Writing to
+ /proc/PID/mem succeeds even for pages that are not writable by the process.
+*/
+size_t MemoryAccessor::WriteShared(const char *src, size_t address,
+                                   size_t amount) const noexcept {
+  size_t done_amount{0};
+  while (done_amount < amount) {
+    ssize_t ret_size{pwrite(shared_mem_fd_, src + done_amount,
+                            amount - done_amount,
+                            static_cast<off_t>(address + done_amount))};
+    if (ret_size < 0 && errno == EINTR)
+      continue;
+    if (ret_size <= 0)
+      break;
+    done_amount += ret_size;
+  }
+  return done_amount;
+}
+
+/*!
+ \brief Read several blocks of memory of the process at once.
+ \param [in] local Array of blocks to read to.
+ \param [in] remote Array of blocks of memory of the process to read from, of
+ the same sizes as local ones.
+ \param [in] count Amount of blocks, no more than IOV_MAX.
+ \return Amount of bytes read. Blocks are read in order, so the first block
+ that is not fully read is the one that failed.
+
+ Read data by one call of process_vm_readv. PID must be set.
+*/
+size_t MemoryAccessor::ReadVector(const iovec *local,
+                                  const iovec *remote,
+                                  size_t count) const noexcept {
+  ssize_t ret_size{process_vm_readv(pid_, local, count, remote, count, 0)};
+  return ret_size < 0 ? 0 : static_cast<size_t>(ret_size);
+}
+
+/*!
+ \brief Write several blocks of data to several addresses at once.
+ \param [in] local Array of blocks of data to write.
+ \param [in] remote Array of blocks of memory of the process to write to, of
+ the same sizes as local ones.
+ \param [in] count Amount of blocks, no more than IOV_MAX.
+ \return Amount of bytes written. Blocks are written in order, so the first
+ block that is not fully written is the one that failed.
+
+ Write data by one call of process_vm_writev. Unlike /proc/PID/mem, it fails
+ on pages that are not writable by the process. PID must be set.
+*/
+size_t MemoryAccessor::WriteVector(const iovec *local,
+                                   const iovec *remote,
+                                   size_t count) const noexcept {
+  ssize_t ret_size{process_vm_writev(pid_, local, count, remote, count, 0)};
+  return ret_size < 0 ? 0 : static_cast<size_t>(ret_size);
+}
+
+/*!
+ \brief Open /proc/PID/pagemap for ReadPagemap.
+ \throw PagemapFileEx If an error in opening file occured.
+ \throw PidNotSetEx If PID is not set.
+
+ If it is opened already, it is reopened.
+*/
+void MemoryAccessor::OpenPagemap() noexcept(false) {
+  CheckPid();
+  ClosePagemap();
+
+  std::string path{"/proc/" + std::to_string(pid_) + "/pagemap"};
+  pagemap_fd_ = open(path.c_str(), O_RDONLY);
+  if (pagemap_fd_ < 0)
+    throw PagemapFileEx();
+}
+
+/*!
+ \brief Close /proc/PID/pagemap opened by OpenPagemap.
+*/
+void MemoryAccessor::ClosePagemap() noexcept {
+  if (pagemap_fd_ >= 0)
+    close(pagemap_fd_);
+  pagemap_fd_ = -1;
+}
+
+/*!
+ \brief Read entries of /proc/PID/pagemap, may be called from multiple
+ threads.
+ \param [out] dst Destination for 64-bit entries.
+ \param [in] address Address of the first page.
+ \param [in] pages Amount of pages.
+ \return Amount of entries read, less than pages if an error occured.
+
+ Read entries by pread from the descriptor opened by OpenPagemap. Bit 55 of an
+ entry is the soft-dirty bit, bit 63 means the page is present.
+*/
+size_t MemoryAccessor::ReadPagemap(uint64_t *dst, size_t address,
+                                   size_t pages) const noexcept {
+  constexpr size_t kPageSize{0x1000};
+  char *dst_bytes{reinterpret_cast<char *>(dst)};
+  size_t amount{pages * sizeof(uint64_t)}, done_amount{0};
+  while (done_amount < amount) {
+    ssize_t ret_size{
+        pread(pagemap_fd_, dst_bytes + done_amount, amount - done_amount,
+              static_cast<off_t>(address / kPageSize * sizeof(uint64_t) +
+                                 done_amount))};
+    if (ret_size < 0 && errno == EINTR)
+      continue;
+    if (ret_size <= 0)
+      break;
+    done_amount += ret_size;
+  }
+  return done_amount / sizeof(uint64_t);
+}
+
+/*!
+ \brief Clear soft-dirty bits of all pages of the process.
+ \return true on success, false if /proc/PID/clear_refs cannot be written
+ (e.g., because of permissions) or PID is not set.
+
+ Write "4" to /proc/PID/clear_refs. Pages written after it get the soft-dirty
+ bit in /proc/PID/pagemap, if the kernel supports it.
+*/
+bool MemoryAccessor::ClearSoftDirty() const noexcept {
+  if (!pid_set_)
+    return false;
+
+  std::string path{"/proc/" + std::to_string(pid_) + "/clear_refs"};
+  int fd{open(path.c_str(), O_WRONLY)};
+  if (fd < 0)
+    return false;
+  bool result{write(fd, "4", 1) == 1};
+  close(fd);
+  return result;
+}
+
 /*!
  \brief Open /proc/PID/mem file.
  \throw MemFileEx If an error in opening file occured.
@@ -470,3 +767,60 @@ void MemoryAccessor::PrepareMemSegment(const size_t &num, const size_t &start,
   CheckSegBoundaries(num, start, amount);
   mem_.seekg(segment_infos_[num].start + start);
 }
+
+/*!
+ \brief Write data to memory segment recording it to the journal.
+ \param [in] src Source from which data will be copied.
+ \param [in] num Number of the memory segment starting from 0.
+ \param [in] start Offset relative to the start of the segment.
+ \param [in] amount Number of bytes to write, cut to the end of the segment.
+ \param [in] continued true if it is a piece of the previous write.
+ \return Amount of bytes written.
+ \throw Same as WriteSegment.
+
+ If a journal is set, the old bytes are read and the write is recorded before
+ it is done, so a write that cannot be recorded is not done, and a recorded
+ write that fails is undone harmlessly.
+*/
+size_t MemoryAccessor::WriteSegmentPiece(const char *src, const size_t &num,
+                                         size_t start, size_t amount,
+                                         bool continued) noexcept(false) {
+  PrepareMemSegment(num, start, amount);
+  if (journal_) {
+    auto old_data{std::make_unique_for_overwrite<char[]>(amount)};
+    mem_.read(old_data.get(), amount);
+    if (!mem_.good())
+      throw SegmentAccessDeniedEx();
+    journal_->Add(pid_, segment_infos_[num].start + start, old_data.get(), src,
+                  amount, continued);
+    mem_.seekg(segment_infos_[num].start + start);
+  }
+  mem_.write(src, amount);
+  mem_.seekg(0); // if the access is denied, it doesn't block at first, but
+                 // blocks after the next seekg operation.
+  if (!mem_.good())
+    throw SegmentAccessDeniedEx();
+  return amount;
+}
+
+/*!
+ \brief Check if the layout of segments is the same as the given one.
+ \param [in] old_infos SegmentInfo objects to compare segment_infos_ with.
+ \return true if boundaries and permissions of all segments are equal.
+
+ Compare boundaries and permissions of segments in segment_infos_ with the
+ given ones.
+*/
+bool MemoryAccessor::SameLayout(
+    const std::vector<SegmentInfo> &old_infos) const noexcept {
+  if (old_infos.size() != segment_infos_.size())
+    return false;
+
+  for (size_t i{0}; i < old_infos.size(); i++)
+    if (old_infos[i].start != segment_infos_[i].start ||
+        old_infos[i].end != segment_infos_[i].end ||
+        old_infos[i].mode != segment_infos_[i].mode)
+      return false;
+
+  return true;
+}
@@ -26,6 +26,7 @@
 #define MEMORYACCESSOR_SRC_MEMORYACCESSOR_H_
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <cstdint>
 #include <exception>
@@ -38,6 +39,8 @@
 #include "segmentinfo.h"
 #include "tools.h"
 
+class WriteJournal;
+
 /*!
  \brief A class to perform the main operations with memory
 
@@ -170,6 +173,24 @@ public:
     }
   };
 
+  /*!
+   \brief Ex: Opening /proc/PID/pagemap failed
+
+   This exception is thrown when there is an error in opening
+   /proc/PID/pagemap.
+  */
+  class PagemapFileEx : public FileEx {
+    /*!
+     \brief "what" function of the exception.
+     \return C-string descripting the exception.
+
+     Prints message to stdout when the exception is thrown.
+    */
+    virtual const char *what() const noexcept override {
+      return "Error in opening current /proc/PID/pagemap";
+    }
+  };
+
   /*!
    \brief Ex: Opening /proc/PID/maps failed
 
@@ -316,8 +337,11 @@ public:
   void SetPid(const pid_t &pid) noexcept(false);
   void CheckPid() const noexcept(false);
   void ParseMaps() noexcept(false);
+  uint64_t GetMapsVersion() const noexcept;
+  const std::vector<SegmentInfo> &GetPreviousSegmentInfos() const noexcept;
   std::unordered_set<std::string> GetAllSegmentNames() const noexcept;
   size_t AddressInSegment(const size_t &address) const noexcept(false);
+  size_t ContiguousSize(size_t address, size_t amount) const noexcept(false);
   void CheckSegNum(const size_t &num) const noexcept(false);
   void ResetSegments() noexcept;
   void Reset() noexcept;
@@ -328,7 +352,30 @@ public:
   void Read(char *dst, size_t address, size_t amount,
             size_t &done_amount) noexcept(false);
   void Write(const char *src, size_t address, size_t amount,
-             size_t &done_amount) noexcept(false);
+             size_t &done_amount, bool continued = false) noexcept(false);
+
+  /*!
+   \brief Set the journal writes are recorded to.
+   \param [in] journal The journal, or nullptr to stop recording.
+
+   Only writes of WriteSegment and Write are recorded.
+  */
+  void SetJournal(WriteJournal *journal) noexcept { journal_ = journal; }
+
+  void OpenSharedMem() noexcept(false);
+  void CloseSharedMem() noexcept;
+  size_t ReadShared(char *dst, size_t address, size_t amount) const noexcept;
+  size_t WriteShared(const char *src, size_t address,
+                     size_t amount) const noexcept;
+  size_t ReadVector(const iovec *local, const iovec *remote,
+                    size_t count) const noexcept;
+  size_t WriteVector(const iovec *local, const iovec *remote,
+                     size_t count) const noexcept;
+  void OpenPagemap() noexcept(false);
+  void ClosePagemap() noexcept;
+  size_t ReadPagemap(uint64_t *dst, size_t address,
+                     size_t pages) const noexcept;
+  bool ClearSoftDirty() const noexcept;
 
   Tools &tools_; //!< A reference to a Tools class instance
 
@@ -347,17 +394,36 @@ private:
                           size_t &amount) const noexcept(false);
   void PrepareMemSegment(const size_t &num, const size_t &start,
                          size_t &amount) noexcept(false);
+  size_t WriteSegmentPiece(const char *src, const size_t &num, size_t start,
+                           size_t amount, bool continued) noexcept(false);
+  bool SameLayout(const std::vector<SegmentInfo> &old_infos) const noexcept;
+
+  constexpr static size_t kMapsReadSize{
+      0x4000}; //!< Size of blocks /proc/PID/maps is read by.
 
   static bool one_instance_created_; //!< A static variable that is true when
                                      //!< one instance of class exists.
 
   std::fstream mem_; //!< File stream that represents /proc/PID/mem.
+  int shared_mem_fd_{-1}; //!< Descriptor of /proc/PID/mem for reading from
+                          //!< multiple threads (and writing, if allowed), -1
+                          //!< if it is not opened.
+  int pagemap_fd_{-1}; //!< Descriptor of /proc/PID/pagemap, -1 if it is not
+                       //!< opened.
+  WriteJournal *journal_{nullptr}; //!< Journal of writes, nullptr if writes
+                                   //!< are not recorded.
 
   pid_t pid_{0}; //!< Current PID in use. Value doesn't matter if pid_set is
                  //!< false. It is not meant to write to this variable directly,
                  //!< set_pid function is dedicated for this purpose.
   bool pid_set_{
       false}; //!< This variable shows if PID was set and is ready to be used.
+  uint64_t maps_version_{0}; //!< Incremented every time the layout of memory
+                             //!< segments (boundaries or permissions) changes.
+  std::vector<SegmentInfo>
+      previous_segment_infos_; //!< Segments got by the previous parse.
+  std::string maps_text_;      //!< Text of /proc/PID/maps parsed last time.
+  std::string next_maps_text_; //!< Buffer for the new text of /proc/PID/maps.
 };
 
 #endif // MEMORYACCESSOR_SRC_MEMORYACCESSOR_H_
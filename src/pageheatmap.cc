@@ -0,0 +1,300 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief PageHeatmap source
+
+  A source that contains the realization of PageHeatmap class.
+*/
+
+#include "pageheatmap.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "bufferallocator.h"
+#include "memoryaccessor.h"
+#include "segmentinfo.h"
+#include "tools.h"
+
+/*!
+ \brief Update the layout of regions.
+ \param [in] segment_infos Segments to track.
+ \throw std::bad_alloc If memory for a new region cannot be allocated. In this
+ case the heatmap is reset.
+
+ Walk old regions and new segments at the same time. A region with the same
+ boundaries as a segment keeps its counters, a segment without such region
+ gets a new region with zero counters (and an array of hashes if soft-dirty
+ bits are not used), and old regions that are passed by are retired.
+*/
+void PageHeatmap::Update(
+    const std::vector<SegmentInfo> &segment_infos) noexcept(false) {
+  std::vector<Region> old_regions;
+  old_regions.swap(regions_);
+  regions_.reserve(segment_infos.size());
+
+  try {
+    size_t i{0};
+    for (const SegmentInfo &segment_info : segment_infos) {
+      while (i < old_regions.size() &&
+             old_regions[i].start < segment_info.start)
+        retired_.push_back(std::move(old_regions[i++]));
+
+      if (i < old_regions.size() &&
+          old_regions[i].start == segment_info.start &&
+          old_regions[i].end == segment_info.end) {
+        regions_.push_back(std::move(old_regions[i++]));
+        continue;
+      }
+
+      size_t pages{(segment_info.end - segment_info.start + kPageSize - 1) /
+                   kPageSize};
+      Region &region{regions_.emplace_back()};
+      region.start = segment_info.start;
+      region.end = segment_info.end;
+      region.path = segment_info.path;
+      region.counts = std::make_unique<uint16_t[]>(pages);
+      if (!soft_dirty_)
+        region.hashes = std::make_unique_for_overwrite<uint64_t[]>(pages);
+    }
+
+    for (; i < old_regions.size(); i++)
+      retired_.push_back(std::move(old_regions[i]));
+  } catch (...) {
+    Reset();
+    throw;
+  }
+}
+
+/*!
+ \brief Free all memory.
+
+ Delete all regions, both current and retired, and the buffer.
+*/
+void PageHeatmap::Reset() noexcept {
+  regions_.clear();
+  regions_.shrink_to_fit();
+  retired_.clear();
+  retired_.shrink_to_fit();
+  buffer_.reset();
+  soft_dirty_seen_ = false;
+}
+
+/*!
+ \brief Choose how written pages are found.
+ \param [in] soft_dirty true to use soft-dirty bits, false to use hashes.
+
+ If the method is changed, the heatmap is reset.
+*/
+void PageHeatmap::SetSoftDirty(bool soft_dirty) noexcept {
+  if (soft_dirty != soft_dirty_)
+    Reset();
+  soft_dirty_ = soft_dirty;
+}
+
+/*!
+ \brief Find pages written since the previous sample.
+ \param [in] memory_accessor MemoryAccessor with /proc/PID/pagemap opened (with
+ soft-dirty bits) or /proc/PID/mem opened by OpenSharedMem (with hashes).
+ \param [in] tools Tools used for hashing.
+ \return Amount of bytes read from memory of the process.
+ \throw std::bad_alloc If memory for the buffer cannot be allocated.
+
+ Increment counters of written pages of every region that was sampled before,
+ and mark regions as sampled. With soft-dirty bits, the bits have to be cleared
+ after the sample.
+*/
+size_t PageHeatmap::Sample(const MemoryAccessor &memory_accessor,
+                           Tools &tools) noexcept(false) {
+  if (!buffer_)
+    buffer_ = BufferAllocator::Allocate(kChunkSize);
+
+  size_t read_bytes{0};
+  for (Region &region : regions_) {
+    if (soft_dirty_) {
+      SampleSoftDirty(region, memory_accessor);
+      region.valid = true;
+    } else
+      read_bytes += SampleHashes(region, memory_accessor, tools);
+  }
+  return read_bytes;
+}
+
+/*!
+ \brief Count pages with soft-dirty bits of a region.
+ \param [in,out] region The region.
+ \param [in] memory_accessor MemoryAccessor with /proc/PID/pagemap opened.
+
+ Pagemap is read by kChunkSize bytes of entries. Pages of a region that was not
+ sampled are not counted: new mappings are marked soft-dirty as a whole.
+*/
+void PageHeatmap::SampleSoftDirty(
+    Region &region, const MemoryAccessor &memory_accessor) noexcept {
+  constexpr size_t kEntries{kChunkSize / sizeof(uint64_t)};
+  uint64_t *entries{reinterpret_cast<uint64_t *>(buffer_.get())};
+  size_t pages{(region.end - region.start + kPageSize - 1) / kPageSize};
+
+  for (size_t page{0}; page < pages; page += kEntries) {
+    size_t amount{memory_accessor.ReadPagemap(
+        entries, region.start + page * kPageSize,
+        std::min(kEntries, pages - page))};
+    for (size_t i{0}; i < amount; i++) {
+      if (!(entries[i] & kSoftDirtyBit))
+        continue;
+      soft_dirty_seen_ = true;
+      uint16_t &count{region.counts[page + i]};
+      if (region.valid && count != UINT16_MAX)
+        count++;
+    }
+  }
+}
+
+/*!
+ \brief Count pages of a region with changed hashes.
+ \param [in,out] region The region.
+ \param [in] memory_accessor MemoryAccessor with /proc/PID/mem opened by
+ OpenSharedMem.
+ \param [in] tools Tools used for hashing.
+ \return Amount of bytes read.
+
+ Memory is read by kChunkSize bytes. Hashes of chunks that cannot be read are
+ kept. The region is marked as sampled only if it is fully read.
+*/
+size_t PageHeatmap::SampleHashes(Region &region,
+                                 const MemoryAccessor &memory_accessor,
+                                 Tools &tools) noexcept {
+  size_t read_bytes{0};
+  bool complete{true};
+  for (size_t offset{0}; offset < region.end - region.start;
+       offset += kChunkSize) {
+    size_t amount{std::min(kChunkSize, region.end - region.start - offset)};
+    if (memory_accessor.ReadShared(buffer_.get(), region.start + offset,
+                                   amount) != amount) {
+      complete = false;
+      continue;
+    }
+    read_bytes += amount;
+
+    for (size_t page{0}; page < amount; page += kPageSize) {
+      size_t num{(offset + page) / kPageSize};
+      uint64_t hash{tools.HashBlock(buffer_.get() + page,
+                                    std::min(kPageSize, amount - page))};
+      if (region.valid && region.hashes[num] != hash &&
+          region.counts[num] != UINT16_MAX)
+        region.counts[num]++;
+      region.hashes[num] = hash;
+    }
+  }
+  if (complete)
+    region.valid = true;
+  return read_bytes;
+}
+
+/*!
+ \brief Get amount of writes to a region.
+ \param [in] region The region.
+ \return Sum of counters of its pages.
+*/
+uint64_t PageHeatmap::Writes(const Region &region) noexcept {
+  uint64_t result{0};
+  size_t pages{(region.end - region.start + kPageSize - 1) / kPageSize};
+  for (size_t i{0}; i < pages; i++)
+    result += region.counts[i];
+  return result;
+}
+
+/*!
+ \brief Get the most written pages.
+ \param [in] count Maximum amount of pages.
+ \return Written pages of current and retired regions sorted by the amount of
+ writes (descending), then by address.
+ \throw std::bad_alloc If memory cannot be allocated.
+*/
+std::vector<PageHeatmap::Page>
+PageHeatmap::Top(size_t count) const noexcept(false) {
+  std::vector<Page> result;
+  for (const std::vector<Region> *regions : {&regions_, &retired_})
+    for (const Region &region : *regions) {
+      size_t pages{(region.end - region.start + kPageSize - 1) / kPageSize};
+      for (size_t i{0}; i < pages; i++)
+        if (region.counts[i])
+          result.push_back(
+              {region.start + i * kPageSize, region.counts[i], &region});
+    }
+
+  count = std::min(count, result.size());
+  std::partial_sort(result.begin(), result.begin() + count, result.end(),
+                    [](const Page &a, const Page &b) {
+                      return a.count != b.count ? a.count > b.count
+                                                : a.address < b.address;
+                    });
+  result.resize(count);
+  return result;
+}
+
+/*!
+ \brief Get the histogram of writes.
+ \return Amount of written pages by buckets: bucket i has pages with 2^i to
+ 2^(i+1) - 1 writes.
+*/
+std::array<uint64_t, PageHeatmap::kHistogramSize>
+PageHeatmap::Histogram() const noexcept {
+  std::array<uint64_t, kHistogramSize> result{};
+  for (const std::vector<Region> *regions : {&regions_, &retired_})
+    for (const Region &region : *regions) {
+      size_t pages{(region.end - region.start + kPageSize - 1) / kPageSize};
+      for (size_t i{0}; i < pages; i++)
+        if (region.counts[i])
+          result[std::bit_width(region.counts[i]) - 1]++;
+    }
+  return result;
+}
+
+/*!
+ \brief Write counters as CSV.
+ \param [out] stream Stream to write to.
+
+ Write a header and a line with the address, the path of the segment and the
+ amount of writes for every written page of current and retired regions.
+ Paths are quoted.
+*/
+void PageHeatmap::WriteCsv(std::ostream &stream) const noexcept {
+  stream << "address,segment,writes\n";
+  for (const std::vector<Region> *regions : {&regions_, &retired_})
+    for (const Region &region : *regions) {
+      size_t pages{(region.end - region.start + kPageSize - 1) / kPageSize};
+      for (size_t i{0}; i < pages; i++) {
+        if (!region.counts[i])
+          continue;
+        stream << "0x" << std::hex << region.start + i * kPageSize << std::dec
+               << ",\"";
+        for (char c : region.path)
+          stream << (c == '"' ? "\"\"" : std::string_view(&c, 1));
+        stream << "\"," << region.counts[i] << '\n';
+      }
+    }
+  stream.flush();
+}
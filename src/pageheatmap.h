@@ -0,0 +1,136 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief PageHeatmap header
+
+ A header that contains the definition of PageHeatmap class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_PAGEHEATMAP_H_
+#define MEMORYACCESSOR_SRC_PAGEHEATMAP_H_
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "bufferallocator.h"
+#include "memoryaccessor.h"
+#include "segmentinfo.h"
+#include "tools.h"
+
+/*!
+ \brief A class that counts writes to pages of a process.
+
+ Every tracked segment has a 16-bit saturating counter per page. A sample finds
+ pages written since the previous sample and increments their counters. With
+ soft-dirty bits, written pages are found by /proc/PID/pagemap (the bits are
+ cleared by MemoryAccessor::ClearSoftDirty after every sample), so memory is
+ not read. Otherwise, a 64-bit hash of every page is kept and compared to the
+ hash of its new data. The first sample of a region only initializes it.
+
+ Regions are kept by address ranges like in SnapshotStore: a region with the
+ same range keeps its counters, regions that disappeared are kept as retired
+ ones until Reset, so they are still reported.
+*/
+class PageHeatmap {
+public:
+  constexpr static size_t kPageSize{0x1000}; //!< Size of a page.
+  constexpr static size_t kHistogramSize{
+      16}; //!< Amount of buckets of a histogram (powers of 2 up to 65535).
+  constexpr static uint64_t kSoftDirtyBit{
+      uint64_t{1} << 55}; //!< Soft-dirty bit of a pagemap entry.
+  constexpr static size_t kChunkSize{
+      0x100000}; //!< Size of chunks memory and pagemap are read by.
+
+  /*!
+   \brief A struct that represents a tracked segment.
+  */
+  struct Region {
+    size_t start{0};                     //!< Start address.
+    size_t end{0};                       //!< End address.
+    std::string path;                    //!< Path of the segment.
+    bool valid{false};                   //!< If the region was sampled.
+    std::unique_ptr<uint16_t[]> counts;  //!< Writes per page.
+    std::unique_ptr<uint64_t[]> hashes;  //!< Hashes of pages (hash method).
+  };
+
+  /*!
+   \brief A struct that represents a written page.
+  */
+  struct Page {
+    size_t address;       //!< Address of the page.
+    uint16_t count;       //!< Amount of samples the page was written in.
+    const Region *region; //!< Region of the page.
+  };
+
+  void Update(const std::vector<SegmentInfo> &segment_infos) noexcept(false);
+  void Reset() noexcept;
+  void SetSoftDirty(bool soft_dirty) noexcept;
+
+  /*!
+   \brief Check if soft-dirty bits are used.
+   \return true if pages are found by soft-dirty bits, false if by hashes.
+  */
+  bool SoftDirty() const noexcept { return soft_dirty_; }
+
+  /*!
+   \brief Check if a soft-dirty bit was seen.
+   \return true if any pagemap entry read had the soft-dirty bit.
+
+   The kernel marks new mappings soft-dirty, so if no bit is ever seen, the
+   kernel does not support soft-dirty bits.
+  */
+  bool SoftDirtySeen() const noexcept { return soft_dirty_seen_; }
+
+  size_t Sample(const MemoryAccessor &memory_accessor,
+                Tools &tools) noexcept(false);
+
+  /*!
+   \brief Get regions in the latest layout.
+   \return A reference to std::vector of regions sorted by start address.
+  */
+  const std::vector<Region> &Regions() const noexcept { return regions_; }
+
+  /*!
+   \brief Get regions that disappeared.
+   \return A reference to std::vector of regions in order they disappeared.
+  */
+  const std::vector<Region> &Retired() const noexcept { return retired_; }
+
+  static uint64_t Writes(const Region &region) noexcept;
+  std::vector<Page> Top(size_t count) const noexcept(false);
+  std::array<uint64_t, kHistogramSize> Histogram() const noexcept;
+  void WriteCsv(std::ostream &stream) const noexcept;
+
+private:
+  void SampleSoftDirty(Region &region,
+                       const MemoryAccessor &memory_accessor) noexcept;
+  size_t SampleHashes(Region &region, const MemoryAccessor &memory_accessor,
+                      Tools &tools) noexcept;
+
+  std::vector<Region> regions_; //!< Regions in the latest layout.
+  std::vector<Region> retired_; //!< Regions that are not in the layout anymore.
+  BufferAllocator::Buffer buffer_; //!< Buffer for chunks of data or pagemap.
+  bool soft_dirty_{false};         //!< If soft-dirty bits are used.
+  bool soft_dirty_seen_{false};    //!< If a soft-dirty bit was seen.
+};
+
+#endif // MEMORYACCESSOR_SRC_PAGEHEATMAP_H_
@@ -0,0 +1,599 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief PageRepository source
+
+  A source that contains the realization of PageRepository class.
+*/
+
+#include "pagerepository.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bufferallocator.h"
+#include "memoryaccessor.h"
+#include "segmentinfo.h"
+#include "snapshotfile.h"
+#include "tools.h"
+
+namespace memoryaccessor_pagerepository_src {
+
+/*!
+ \brief Find the bytes of a snapshot at an address.
+ \param [in] snapshot The snapshot.
+ \param [in] address The address.
+ \param [out] ref Reference to the page that holds the address.
+ \param [out] offset Offset of the address in the page.
+ \param [out] available Amount of bytes to the end of the page, or to the next
+ segment if the address is not in a segment (SIZE_MAX if there is none).
+ \return true if the address is in a segment of the snapshot.
+*/
+bool Locate(const PageRepository::Snapshot &snapshot, size_t address,
+            uint64_t &ref, size_t &offset, size_t &available) noexcept {
+  constexpr size_t kPageSize{PageRepository::kPageSize};
+  const std::vector<SegmentInfo> &segment_infos{snapshot.segment_infos};
+  auto segment_it{std::partition_point(
+      segment_infos.begin(), segment_infos.end(),
+      [address](const SegmentInfo &info) { return info.end <= address; })};
+  if (segment_it == segment_infos.end() || segment_it->start > address) {
+    available = segment_it == segment_infos.end() ? SIZE_MAX
+                                                  : segment_it->start - address;
+    return false;
+  }
+
+  size_t page_offset{address - segment_it->start};
+  ref = snapshot.refs[snapshot.first_pages[static_cast<size_t>(
+                          segment_it - segment_infos.begin())] +
+                      page_offset / kPageSize];
+  offset = page_offset % kPageSize;
+  available = std::min(kPageSize - offset, segment_it->end - address);
+  return true;
+}
+
+} // namespace memoryaccessor_pagerepository_src
+
+/*!
+ \brief Destroy the object, closing the opened repository.
+*/
+PageRepository::~PageRepository() noexcept { Close(); }
+
+/*!
+ \brief Open a repository.
+ \param [in] dir Directory of the repository.
+ \param [in] create Create the repository if it does not exist.
+ \param [in] tools Tools used for hashing.
+ \throw RepositoryEx If files of the repository cannot be opened or created,
+ or a table of a snapshot is not valid.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ The previously opened repository is closed. A partly written page at the end
+ of "pages" is cut off, missing hashes are computed again, and the index of
+ pages by hashes is built. Headers of snapshots are read in order until a
+ table is missing.
+*/
+void PageRepository::Open(const std::string &dir, bool create,
+                          Tools &tools) noexcept(false) {
+
+  Close();
+  if (create && ((mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) ||
+                 (mkdir((dir + "/snapshots").c_str(), 0700) != 0 &&
+                  errno != EEXIST)))
+    throw RepositoryEx();
+
+  int flags{O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0)};
+  pages_fd_ = open((dir + "/pages").c_str(), flags, 0600);
+  hashes_fd_ = open((dir + "/hashes").c_str(), flags, 0600);
+  struct stat pages_stat, hashes_stat;
+  if (pages_fd_ < 0 || hashes_fd_ < 0 || fstat(pages_fd_, &pages_stat) != 0 ||
+      fstat(hashes_fd_, &hashes_stat) != 0) {
+    Close();
+    throw RepositoryEx();
+  }
+  dir_ = dir;
+  pages_count_ = static_cast<uint64_t>(pages_stat.st_size) / kPageSize;
+
+  try {
+    std::vector<uint64_t> hashes(static_cast<size_t>(std::min<uint64_t>(
+        pages_count_, static_cast<uint64_t>(hashes_stat.st_size) /
+                          sizeof(uint64_t))));
+    if (!Tools::PreadAll(hashes_fd_, reinterpret_cast<char *>(hashes.data()),
+                         hashes.size() * sizeof(uint64_t), 0))
+      throw RepositoryEx();
+    if (hashes.size() < pages_count_) {
+      auto page{std::make_unique<char[]>(kPageSize)};
+      for (size_t i{hashes.size()}; i < pages_count_; i++) {
+        if (!Tools::PreadAll(pages_fd_, page.get(), kPageSize, i * kPageSize))
+          throw RepositoryEx();
+        hashes.push_back(tools.HashBlock(page.get(), kPageSize));
+      }
+      if (!Tools::PwriteAll(hashes_fd_,
+                            reinterpret_cast<const char *>(hashes.data()),
+                            hashes.size() * sizeof(uint64_t), 0))
+        throw RepositoryEx();
+    }
+    if (ftruncate(pages_fd_, static_cast<off_t>(pages_count_ * kPageSize)) !=
+            0 ||
+        ftruncate(hashes_fd_,
+                  static_cast<off_t>(pages_count_ * sizeof(uint64_t))) != 0)
+      throw RepositoryEx();
+
+    index_.reserve(hashes.size());
+    for (size_t i{0}; i < hashes.size(); i++)
+      index_.emplace(hashes[i], i);
+
+    for (;;) {
+      int fd{open((dir_ + "/snapshots/" + std::to_string(headers_.size()))
+                      .c_str(),
+                  O_RDONLY | O_CLOEXEC)};
+      if (fd < 0)
+        break;
+      Header header;
+      bool read{Tools::PreadAll(fd, reinterpret_cast<char *>(&header),
+                                sizeof(header), 0)};
+      close(fd);
+      if (!read || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+          header.version != kVersion || header.page_size != kPageSize)
+        throw RepositoryEx();
+      headers_.push_back(header);
+    }
+  } catch (...) {
+    Close();
+    throw;
+  }
+}
+
+/*!
+ \brief Close the opened repository.
+*/
+void PageRepository::Close() noexcept {
+  if (pages_fd_ >= 0)
+    close(pages_fd_);
+  if (hashes_fd_ >= 0)
+    close(hashes_fd_);
+  pages_fd_ = hashes_fd_ = -1;
+  dir_.clear();
+  pages_count_ = 0;
+  headers_.clear();
+  index_.clear();
+}
+
+/*!
+ \brief Add a snapshot of memory of a process.
+ \param [in] pid PID of the process.
+ \param [in] segment_infos Segments to save, sorted by start address.
+ \param [in] memory_accessor MemoryAccessor with /proc/PID/mem opened by
+ OpenSharedMem.
+ \param [in] tools Tools used for hashing.
+ \param [in] stop Function that returns true if adding should be stopped.
+ \param [out] stats Statistics of adding.
+ \return Return code, 0 is success, 2 means that it was stopped (the snapshot
+ is not added, stored pages are kept).
+ \throw RepositoryEx If files of the repository cannot be written.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Memory is read by kChunkSize bytes, every page that is not zero is stored by
+ Store (a page at the end of a segment that is not a multiple of kPageSize is
+ padded with zeros). New pages of a chunk are staged and written to "pages"
+ and "hashes" once per chunk. Pages of segments that are not readable and
+ pages that cannot be read are referenced as missing. The table is written to
+ a temporary file which is renamed at last.
+*/
+uint8_t PageRepository::Add(pid_t pid,
+                            const std::vector<SegmentInfo> &segment_infos,
+                            const MemoryAccessor &memory_accessor, Tools &tools,
+                            const std::function<bool()> &stop,
+                            AddStats &stats) noexcept(false) {
+
+  stats = {};
+  uint64_t pages_count{pages_count_};
+  std::vector<SnapshotFile::SegmentRecord> records;
+  std::string strings;
+  for (const SegmentInfo &segment_info : segment_infos) {
+    auto live_it{std::partition_point(
+        memory_accessor.segment_infos_.begin(),
+        memory_accessor.segment_infos_.end(),
+        [&segment_info](const SegmentInfo &info) {
+          return info.start < segment_info.start;
+        })};
+    bool part{live_it == memory_accessor.segment_infos_.end() ||
+              live_it->start != segment_info.start ||
+              live_it->end != segment_info.end};
+    SnapshotFile::SegmentRecord &record{records.emplace_back()};
+    record.start = segment_info.start;
+    record.end = segment_info.end;
+    record.offset = segment_info.offset;
+    record.inode_id = segment_info.inode_id;
+    record.major_id = segment_info.major_id;
+    record.minor_id = segment_info.minor_id;
+    record.mode = segment_info.mode;
+    record.flags = part ? SnapshotFile::kSegmentPart : 0;
+    record.path_size = static_cast<uint32_t>(segment_info.path.size());
+    record.path_offset = strings.size();
+    record.first_page = stats.pages;
+    strings += segment_info.path;
+    stats.pages += (segment_info.end - segment_info.start + kPageSize - 1) /
+                   kPageSize;
+  }
+  std::vector<uint64_t> refs(stats.pages, kRefMissing);
+
+  auto buffer{BufferAllocator::Allocate(kChunkSize)};
+  auto padded{std::make_unique<char[]>(kPageSize)};
+  staged_pages_.reserve(kChunkSize);
+  staged_hashes_.reserve(kChunkSize / kPageSize);
+  size_t page_num{0};
+  for (const SegmentInfo &segment_info : segment_infos) {
+    size_t size{segment_info.end - segment_info.start};
+    for (size_t done{0}; done < size; done += kChunkSize) {
+      if (stop())
+        return 2;
+      size_t amount{std::min(kChunkSize, size - done)}, read{0};
+      if (segment_info.mode & 0b1000)
+        read = memory_accessor.ReadShared(buffer.get(),
+                                          segment_info.start + done, amount);
+
+      try {
+        for (size_t page{0}; page < amount; page += kPageSize, page_num++) {
+          size_t page_size{std::min(kPageSize, amount - page)};
+          const char *data{buffer.get() + page};
+          if (page + page_size > read) {
+            stats.missing_pages++;
+            continue;
+          }
+          if (page_size < kPageSize) {
+            std::memset(padded.get(), 0, kPageSize);
+            std::memcpy(padded.get(), data, page_size);
+            data = padded.get();
+          }
+          if (std::all_of(data, data + kPageSize,
+                          [](char c) { return !c; })) {
+            refs[page_num] = kRefZero;
+            stats.zero_pages++;
+          } else
+            refs[page_num] = Store(data, tools);
+        }
+      } catch (...) {
+        DropStaged();
+        throw;
+      }
+      WriteStaged();
+    }
+  }
+  stats.new_pages = pages_count_ - pages_count;
+
+  Header header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.page_size = kPageSize;
+  header.pid = static_cast<uint64_t>(pid);
+  header.time = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+  header.segments = records.size();
+  header.pages = refs.size();
+  header.strings_size = strings.size();
+  header.new_pages = stats.new_pages;
+
+  std::string table{reinterpret_cast<const char *>(&header), sizeof(header)};
+  table.append(reinterpret_cast<const char *>(records.data()),
+               records.size() * sizeof(SnapshotFile::SegmentRecord));
+  table.append(reinterpret_cast<const char *>(refs.data()),
+               refs.size() * sizeof(uint64_t));
+  table += strings;
+
+  std::string path{dir_ + "/snapshots/" + std::to_string(headers_.size())},
+      tmp_path{path + ".tmp"};
+  int fd{open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+              0600)};
+  if (fd < 0)
+    throw RepositoryEx();
+  bool written{Tools::PwriteAll(fd, table.data(), table.size(), 0)};
+  if (close(fd) != 0 || !written ||
+      rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    throw RepositoryEx();
+  }
+  headers_.push_back(header);
+  return 0;
+}
+
+/*!
+ \brief Find the number of a stored page with the same data or stage it.
+ \param [in] data Data of the page, kPageSize bytes.
+ \param [in] tools Tools used for hashing.
+ \return Number of the page in "pages".
+ \throw RepositoryEx If files of the repository cannot be read.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Pages with the same hash are read (or taken from the staged pages) and
+ compared to the data, so a collision of hashes does not merge different
+ pages. A new page gets its number at once, but it is written only by
+ WriteStaged.
+*/
+uint64_t PageRepository::Store(const char *data,
+                               Tools &tools) noexcept(false) {
+
+  uint64_t hash{tools.HashBlock(data, kPageSize)};
+  uint64_t first_staged{pages_count_ - staged_hashes_.size()};
+  char stored[kPageSize];
+  auto [begin, end] = index_.equal_range(hash);
+  for (auto it{begin}; it != end; ++it) {
+    const char *page{stored};
+    if (it->second >= first_staged)
+      page = staged_pages_.data() + (it->second - first_staged) * kPageSize;
+    else
+      ReadPage(it->second, stored);
+    if (std::memcmp(page, data, kPageSize) == 0)
+      return it->second;
+  }
+
+  index_.emplace(hash, pages_count_);
+  staged_pages_.append(data, kPageSize);
+  staged_hashes_.push_back(hash);
+  return pages_count_++;
+}
+
+/*!
+ \brief Write the staged pages and their hashes.
+ \throw RepositoryEx If the files of the repository cannot be written (the
+ staged pages are dropped then).
+
+ Each of "pages" and "hashes" is written by one call.
+*/
+void PageRepository::WriteStaged() noexcept(false) {
+  uint64_t first{pages_count_ - staged_hashes_.size()};
+  if (!Tools::PwriteAll(pages_fd_, staged_pages_.data(), staged_pages_.size(),
+                        first * kPageSize) ||
+      !Tools::PwriteAll(
+          hashes_fd_, reinterpret_cast<const char *>(staged_hashes_.data()),
+          staged_hashes_.size() * sizeof(uint64_t), first * sizeof(uint64_t))) {
+    DropStaged();
+    throw RepositoryEx();
+  }
+  staged_pages_.clear();
+  staged_hashes_.clear();
+}
+
+/*!
+ \brief Forget the staged pages, as if they were never stored.
+*/
+void PageRepository::DropStaged() noexcept {
+  uint64_t first{pages_count_ - staged_hashes_.size()};
+  for (uint64_t hash : staged_hashes_) {
+    auto [begin, end] = index_.equal_range(hash);
+    for (auto it{begin}; it != end;)
+      it = it->second >= first ? index_.erase(it) : std::next(it);
+  }
+  pages_count_ = first;
+  staged_pages_.clear();
+  staged_hashes_.clear();
+}
+
+/*!
+ \brief Read a stored page.
+ \param [in] ref Reference to the page (not kRefMissing).
+ \param [out] dst Buffer of kPageSize bytes.
+ \throw RepositoryEx If the page cannot be read.
+*/
+void PageRepository::ReadPage(uint64_t ref, char *dst) const noexcept(false) {
+  if (ref == kRefZero) {
+    std::memset(dst, 0, kPageSize);
+    return;
+  }
+  if (!Tools::PreadAll(pages_fd_, dst, kPageSize, ref * kPageSize))
+    throw RepositoryEx();
+}
+
+/*!
+ \brief Find the snapshot at a time.
+ \param [in] time Seconds since the epoch.
+ \return Number of the latest snapshot taken not later than time, or kNone.
+*/
+size_t PageRepository::Find(uint64_t time) const noexcept {
+  auto it{std::partition_point(
+      headers_.begin(), headers_.end(),
+      [time](const Header &header) { return header.time <= time; })};
+  return it == headers_.begin()
+             ? kNone
+             : static_cast<size_t>(it - headers_.begin()) - 1;
+}
+
+/*!
+ \brief Load the table of a snapshot.
+ \param [in] num Number of the snapshot.
+ \param [out] snapshot The loaded snapshot.
+ \throw RepositoryEx If the table cannot be read or it is not valid.
+ \throw std::bad_alloc If memory cannot be allocated.
+*/
+void PageRepository::Load(size_t num, Snapshot &snapshot) const
+    noexcept(false) {
+  using SegmentRecord = SnapshotFile::SegmentRecord;
+
+  int fd{open((dir_ + "/snapshots/" + std::to_string(num)).c_str(),
+              O_RDONLY | O_CLOEXEC)};
+  if (fd < 0)
+    throw RepositoryEx();
+  struct stat file_stat;
+  std::string table;
+  bool read{fstat(fd, &file_stat) == 0};
+  if (read) {
+    table.resize(static_cast<size_t>(file_stat.st_size));
+    read = Tools::PreadAll(fd, table.data(), table.size(), 0);
+  }
+  close(fd);
+  if (!read || table.size() < sizeof(Header))
+    throw RepositoryEx();
+
+  std::memcpy(&snapshot.header, table.data(), sizeof(Header));
+  const Header &header{snapshot.header};
+  if (header.segments > table.size() / sizeof(SegmentRecord) ||
+      header.pages > table.size() / sizeof(uint64_t) ||
+      sizeof(Header) + header.segments * sizeof(SegmentRecord) +
+              header.pages * sizeof(uint64_t) + header.strings_size !=
+          table.size())
+    throw RepositoryEx();
+
+  std::vector<SegmentRecord> records(header.segments);
+  std::memcpy(records.data(), table.data() + sizeof(Header),
+              records.size() * sizeof(SegmentRecord));
+  snapshot.refs.resize(header.pages);
+  std::memcpy(snapshot.refs.data(),
+              table.data() + sizeof(Header) +
+                  records.size() * sizeof(SegmentRecord),
+              snapshot.refs.size() * sizeof(uint64_t));
+  const char *strings{table.data() + table.size() - header.strings_size};
+
+  snapshot.segment_infos.clear();
+  snapshot.first_pages.clear();
+  uint64_t next_page{0};
+  for (const SegmentRecord &record : records) {
+    uint64_t pages{(record.end - record.start + kPageSize - 1) / kPageSize};
+    if (record.end < record.start || record.first_page != next_page ||
+        pages > header.pages - next_page ||
+        record.path_offset > header.strings_size ||
+        record.path_size > header.strings_size - record.path_offset)
+      throw RepositoryEx();
+    next_page += pages;
+    snapshot.segment_infos.push_back(
+        {record.start, record.end, record.offset, record.mode, record.major_id,
+         record.minor_id, record.inode_id,
+         std::string(strings + record.path_offset, record.path_size)});
+    snapshot.first_pages.push_back(record.first_page);
+  }
+  for (uint64_t ref : snapshot.refs)
+    if (ref >= pages_count_ && ref != kRefZero && ref != kRefMissing)
+      throw RepositoryEx();
+}
+
+/*!
+ \brief Read memory of a snapshot.
+ \param [in] snapshot The snapshot.
+ \param [in] address Address to read from.
+ \param [out] dst Buffer of size bytes.
+ \param [in] size Amount of bytes to read.
+ \return Amount of bytes read, reading stops at an address that is not in a
+ segment or at a page that could not be read.
+ \throw RepositoryEx If a page cannot be read.
+*/
+size_t PageRepository::Read(const Snapshot &snapshot, size_t address,
+                            char *dst, size_t size) const noexcept(false) {
+  char page[kPageSize];
+  size_t done{0};
+  while (done < size) {
+    uint64_t ref{0};
+    size_t offset{0}, available{0};
+    if (!memoryaccessor_pagerepository_src::Locate(snapshot, address + done,
+                                                   ref, offset, available) ||
+        ref == kRefMissing)
+      break;
+    size_t amount{std::min(available, size - done)};
+    ReadPage(ref, page);
+    std::memcpy(dst + done, page + offset, amount);
+    done += amount;
+  }
+  return done;
+}
+
+/*!
+ \brief Check if a range of memory is the same in two snapshots.
+ \param [in] old_snapshot The older snapshot.
+ \param [in] new_snapshot The newer snapshot.
+ \param [in] address Start address of the range.
+ \param [in] size Size of the range.
+ \return true if the range is the same.
+ \throw RepositoryEx If a page cannot be read.
+
+ A part that is in a segment of only one snapshot is a change. Pages with the
+ same references are the same, as pages are stored once; pages with
+ different references are read and compared only in the range. Pages that
+ could not be read are considered the same.
+*/
+bool PageRepository::Same(const Snapshot &old_snapshot,
+                          const Snapshot &new_snapshot, size_t address,
+                          size_t size) const noexcept(false) {
+  using memoryaccessor_pagerepository_src::Locate;
+
+  char old_page[kPageSize], new_page[kPageSize];
+  for (size_t done{0}, step{0}; done < size; done += step) {
+    uint64_t old_ref{0}, new_ref{0};
+    size_t old_offset{0}, new_offset{0}, old_available{0}, new_available{0};
+    bool old_found{Locate(old_snapshot, address + done, old_ref, old_offset,
+                          old_available)},
+        new_found{Locate(new_snapshot, address + done, new_ref, new_offset,
+                         new_available)};
+    if (old_found != new_found)
+      return false;
+    step = std::min({size - done, old_available, new_available});
+    if (!old_found || old_ref == kRefMissing || new_ref == kRefMissing ||
+        (old_ref == new_ref && old_offset == new_offset))
+      continue;
+
+    ReadPage(old_ref, old_page);
+    ReadPage(new_ref, new_page);
+    if (std::memcmp(old_page + old_offset, new_page + new_offset, step) != 0)
+      return false;
+  }
+  return true;
+}
+
+/*!
+ \brief Find when a range of memory changed last time.
+ \param [in] address Start address of the range.
+ \param [in] size Size of the range.
+ \param [out] checked Amount of snapshots loaded.
+ \return Number of the snapshot where the range differs from the previous
+ snapshot for the last time, or kNone if it is the same in all snapshots.
+ \throw RepositoryEx If a table or a page cannot be read.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Snapshots are compared from the latest one back, so the search stops at the
+ first change found.
+*/
+size_t PageRepository::LastChange(size_t address, size_t size,
+                                  size_t &checked) const noexcept(false) {
+  checked = 0;
+  if (headers_.size() < 2)
+    return kNone;
+
+  Snapshot new_snapshot, old_snapshot;
+  Load(headers_.size() - 1, new_snapshot);
+  checked++;
+  for (size_t num{headers_.size() - 1}; num > 0; num--) {
+    Load(num - 1, old_snapshot);
+    checked++;
+    if (!Same(old_snapshot, new_snapshot, address, size))
+      return num;
+    std::swap(old_snapshot, new_snapshot);
+  }
+  return kNone;
+}
@@ -0,0 +1,187 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief PageRepository header
+
+ A header that contains the definition of PageRepository class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_PAGEREPOSITORY_H_
+#define MEMORYACCESSOR_SRC_PAGEREPOSITORY_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "memoryaccessor.h"
+#include "segmentinfo.h"
+#include "snapshotfile.h"
+#include "tools.h"
+
+/*!
+ \brief A class that keeps a series of snapshots of a process storing every
+ distinct page once.
+
+ A repository is a directory with:
+ - "pages": data of distinct pages, page N at offset N * kPageSize;
+ - "hashes": 64-bit hash of every page of "pages" (by Tools::HashBlock);
+ - "snapshots/N": the table of snapshot N: Header, SnapshotFile::SegmentRecord
+   for every segment, a reference (number of a page in "pages", kRefZero or
+   kRefMissing) for every page of every segment, and the string table.
+
+ A page is looked up by its hash and compared to the stored one before it is
+ reused, so a snapshot adds only pages that have not been seen before. Pages
+ and hashes are written before the table of a snapshot, which is renamed to
+ its place at last, so an interrupted snapshot leaves only unused pages.
+*/
+class PageRepository {
+public:
+  constexpr static char kMagic[8]{'M', 'A', 'R', 'E',
+                                  'P', 'O', '\r', '\n'}; //!< Table magic.
+  constexpr static uint32_t kVersion{1};     //!< Version of the format.
+  constexpr static size_t kPageSize{0x1000}; //!< Size of a page.
+  constexpr static size_t kChunkSize{
+      0x100000}; //!< Size of chunks memory is read by.
+  constexpr static uint64_t kRefZero{UINT64_MAX}; //!< Reference to zero page.
+  constexpr static uint64_t kRefMissing{
+      UINT64_MAX - 1}; //!< Reference to a page that could not be read.
+  constexpr static size_t kNone{SIZE_MAX}; //!< No snapshot.
+
+  /*!
+   \brief Ex: A repository cannot be written or read
+
+   This exception is thrown when files of a repository cannot be created,
+   written or read, or they are not valid.
+  */
+  class RepositoryEx : public std::exception {
+    /*!
+     \brief "what" function of the exception.
+     \return C-string descripting the exception.
+    */
+    virtual const char *what() const noexcept override {
+      return "Error in writing or reading a page repository";
+    }
+  };
+
+  /*!
+   \brief Header of the table of a snapshot.
+  */
+  struct Header {
+    char magic[8];         //!< kMagic.
+    uint32_t version;      //!< kVersion.
+    uint32_t page_size;    //!< kPageSize.
+    uint64_t pid;          //!< PID of the process.
+    uint64_t time;         //!< Time of the snapshot, seconds since the epoch.
+    uint64_t segments;     //!< Amount of segment records.
+    uint64_t pages;        //!< Amount of page references.
+    uint64_t strings_size; //!< Size of the string table.
+    uint64_t new_pages;    //!< Amount of pages added by the snapshot.
+  };
+
+  /*!
+   \brief A struct that represents a loaded snapshot.
+  */
+  struct Snapshot {
+    Header header{};                        //!< Header of the table.
+    std::vector<SegmentInfo> segment_infos; //!< Segments sorted by address.
+    std::vector<uint64_t> first_pages; //!< First reference of every segment.
+    std::vector<uint64_t> refs;        //!< References of all pages.
+  };
+
+  /*!
+   \brief A struct with statistics of adding a snapshot.
+  */
+  struct AddStats {
+    size_t pages{0};         //!< Amount of pages.
+    size_t new_pages{0};     //!< Amount of pages that were not stored.
+    size_t zero_pages{0};    //!< Amount of zero pages.
+    size_t missing_pages{0}; //!< Amount of pages that could not be read.
+  };
+
+  PageRepository() noexcept = default;
+
+  /*!
+   \brief Copy constructor (deleted).
+   \param [in] origin PageRepository instance to copy from.
+
+   Create a new object by copying an old one. Prohibited.
+  */
+  PageRepository(const PageRepository &origin) = delete;
+
+  /*!
+   \brief Copy-assignment operator (deleted).
+   \param [in] origin PageRepository instance to copy from.
+
+   Assign an object by copying other object. Prohibited.
+  */
+  PageRepository &operator=(const PageRepository &origin) = delete;
+
+  ~PageRepository() noexcept;
+
+  void Open(const std::string &dir, bool create, Tools &tools) noexcept(false);
+  void Close() noexcept;
+
+  uint8_t Add(pid_t pid, const std::vector<SegmentInfo> &segment_infos,
+              const MemoryAccessor &memory_accessor, Tools &tools,
+              const std::function<bool()> &stop,
+              AddStats &stats) noexcept(false);
+
+  /*!
+   \brief Get headers of snapshots.
+   \return A reference to std::vector of headers in order of snapshots.
+  */
+  const std::vector<Header> &Headers() const noexcept { return headers_; }
+
+  /*!
+   \brief Get the amount of distinct pages.
+   \return Amount of pages stored in the repository.
+  */
+  uint64_t PagesCount() const noexcept { return pages_count_; }
+
+  size_t Find(uint64_t time) const noexcept;
+  void Load(size_t num, Snapshot &snapshot) const noexcept(false);
+  size_t Read(const Snapshot &snapshot, size_t address, char *dst,
+              size_t size) const noexcept(false);
+  size_t LastChange(size_t address, size_t size,
+                    size_t &checked) const noexcept(false);
+
+private:
+  uint64_t Store(const char *data, Tools &tools) noexcept(false);
+  void WriteStaged() noexcept(false);
+  void DropStaged() noexcept;
+  void ReadPage(uint64_t ref, char *dst) const noexcept(false);
+  bool Same(const Snapshot &old_snapshot, const Snapshot &new_snapshot,
+            size_t address, size_t size) const noexcept(false);
+
+  std::string dir_;   //!< Directory of the opened repository.
+  int pages_fd_{-1};  //!< File descriptor of "pages".
+  int hashes_fd_{-1}; //!< File descriptor of "hashes".
+  uint64_t pages_count_{0};          //!< Amount of stored pages.
+  std::vector<Header> headers_;      //!< Headers of snapshots.
+  std::unordered_multimap<uint64_t, uint64_t>
+      index_; //!< Numbers of stored pages by their hashes.
+  std::string staged_pages_;            //!< New pages not written yet.
+  std::vector<uint64_t> staged_hashes_; //!< Hashes of staged pages.
+};
+
+#endif // MEMORYACCESSOR_SRC_PAGEREPOSITORY_H_
@@ -0,0 +1,182 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief PointerIndex source
+
+  A source that contains the realization of PointerIndex class.
+*/
+
+#include "pointerindex.h"
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "segmentinfo.h"
+
+/*!
+ \brief Start building the index.
+ \param [in] segment_infos Segments, pointers into which should be recorded.
+ \param [in] pid PID the index is built for.
+ \param [in] maps_version Maps version the index is built for.
+
+ Clear old entries and remember address ranges of the given segments, merging
+ adjacent ones. The index is not valid until FinishBuild is called.
+*/
+void PointerIndex::BeginBuild(const std::vector<SegmentInfo> &segment_infos,
+                              pid_t pid, uint64_t maps_version) noexcept {
+  Reset();
+  pid_ = pid;
+  maps_version_ = maps_version;
+
+  for (const SegmentInfo &segment_info : segment_infos) {
+    if (!range_ends_.empty() && range_ends_.back() == segment_info.start)
+      range_ends_.back() = segment_info.end;
+    else {
+      range_starts_.push_back(segment_info.start);
+      range_ends_.push_back(segment_info.end);
+    }
+  }
+
+  if (!range_starts_.empty()) {
+    lowest_ = range_starts_.front();
+    highest_ = range_ends_.back();
+  }
+}
+
+/*!
+ \brief Record pointers found in a block of memory.
+ \param [in] data Copy of the memory block.
+ \param [in] size Size of the block.
+ \param [in] address Address of the block in the examined process.
+
+ Check every aligned word of the block. Words are first filtered in groups of
+ kFilterBlock against the lowest and the highest bound with a branchless loop
+ that the compiler turns into SIMD code, then the rare candidates are checked
+ against the sorted ranges with binary search.
+*/
+void PointerIndex::AddBlock(const char *data, size_t size,
+                            size_t address) noexcept {
+  if (range_starts_.empty())
+    return;
+
+  size_t misalign{address % sizeof(size_t)};
+  if (misalign) {
+    misalign = sizeof(size_t) - misalign;
+    if (size <= misalign)
+      return;
+    data += misalign;
+    size -= misalign;
+    address += misalign;
+  }
+
+  const size_t span{highest_ - lowest_};
+  size_t words[kFilterBlock];
+  uint8_t candidate[kFilterBlock];
+
+  for (size_t count{size / sizeof(size_t)}; count;) {
+    size_t block{std::min(count, kFilterBlock)};
+    std::memcpy(words, data, block * sizeof(size_t));
+
+    for (size_t k{0}; k < block; k++)
+      candidate[k] = words[k] - lowest_ < span;
+
+    for (size_t k{0}; k < block; k++) {
+      if (!candidate[k])
+        continue;
+
+      auto it{std::upper_bound(range_starts_.begin(), range_starts_.end(),
+                               words[k])};
+      if (words[k] < range_ends_[it - range_starts_.begin() - 1])
+        entries_.push_back({words[k], address + k * sizeof(size_t)});
+    }
+
+    data += block * sizeof(size_t);
+    address += block * sizeof(size_t);
+    count -= block;
+  }
+}
+
+/*!
+ \brief Finish building the index.
+
+ Sort entries by target (and by location for equal targets) and mark the index
+ as valid.
+*/
+void PointerIndex::FinishBuild() noexcept {
+  std::sort(entries_.begin(), entries_.end(),
+            [](const Entry &a, const Entry &b) {
+              return a.target < b.target ||
+                     (a.target == b.target && a.location < b.location);
+            });
+  built_ = true;
+}
+
+/*!
+ \brief Delete all data of the index.
+
+ Clear entries and ranges and mark the index as not valid.
+*/
+void PointerIndex::Reset() noexcept {
+  entries_.clear();
+  entries_.shrink_to_fit();
+  range_starts_.clear();
+  range_ends_.clear();
+  lowest_ = highest_ = 0;
+  built_ = false;
+}
+
+/*!
+ \brief Check if the index can be used.
+ \param [in] pid Current PID.
+ \param [in] maps_version Current maps version.
+ \return true if the index is built for the same PID and maps version.
+
+ Check if the index is fully built and the layout of memory has not changed
+ since.
+*/
+bool PointerIndex::IsValid(pid_t pid, uint64_t maps_version) const noexcept {
+  return built_ && pid_ == pid && maps_version_ == maps_version;
+}
+
+/*!
+ \brief Find pointers into the given range.
+ \param [in] address Start of the range.
+ \param [in] length Length of the range, 0 is treated as 1.
+ \return Pair of iterators: the first found entry and the one after the last.
+
+ Find all entries, the target of which is inside [address, address + length).
+*/
+std::pair<PointerIndex::EntryIt, PointerIndex::EntryIt>
+PointerIndex::Find(size_t address, size_t length) const noexcept {
+  if (!length)
+    length = 1;
+  size_t end{address + length < address ? SIZE_MAX : address + length};
+
+  auto first{std::lower_bound(
+      entries_.begin(), entries_.end(), address,
+      [](const Entry &entry, size_t value) { return entry.target < value; })};
+  auto last{std::lower_bound(
+      first, entries_.end(), end,
+      [](const Entry &entry, size_t value) { return entry.target < value; })};
+  return {first, last};
+}
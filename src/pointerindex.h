@@ -0,0 +1,88 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief PointerIndex header
+
+ A header that contains the definition of PointerIndex class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_POINTERINDEX_H_
+#define MEMORYACCESSOR_SRC_POINTERINDEX_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "segmentinfo.h"
+
+/*!
+ \brief A class that stores a reverse pointer index of a process.
+
+ The index answers the question "which locations hold a pointer into this
+ range". While building, blocks of memory are fed to the instance one by one,
+ and every aligned word whose value falls inside any of the known segments is
+ recorded. After the build is finished, entries are sorted by target, so
+ lookups take O(log n). The index remembers PID and maps version it was built
+ for to find out when it becomes outdated.
+*/
+class PointerIndex {
+public:
+  /*!
+   \brief A struct that represents one found pointer.
+  */
+  struct Entry {
+    size_t target;   //!< Value of the word (address pointed to).
+    size_t location; //!< Address of the word itself.
+  };
+
+  using EntryIt =
+      std::vector<Entry>::const_iterator; //!< Type of iterator to entries.
+
+  void BeginBuild(const std::vector<SegmentInfo> &segment_infos, pid_t pid,
+                  uint64_t maps_version) noexcept;
+  void AddBlock(const char *data, size_t size, size_t address) noexcept;
+  void FinishBuild() noexcept;
+  void Reset() noexcept;
+
+  bool IsValid(pid_t pid, uint64_t maps_version) const noexcept;
+  std::pair<EntryIt, EntryIt> Find(size_t address,
+                                   size_t length) const noexcept;
+
+  /*!
+   \brief Get amount of entries.
+   \return Number of pointers stored in the index.
+  */
+  size_t Size() const noexcept { return entries_.size(); }
+
+private:
+  constexpr static size_t kFilterBlock{
+      64}; //!< Amount of words checked against the bounds at once.
+
+  std::vector<Entry> entries_;       //!< Found pointers.
+  std::vector<size_t> range_starts_; //!< Starts of merged address ranges.
+  std::vector<size_t> range_ends_;   //!< Ends of merged address ranges.
+  size_t lowest_{0};                 //!< Lowest address that may be pointed to.
+  size_t highest_{0};                //!< First address above all ranges.
+  pid_t pid_{0};                     //!< PID the index was built for.
+  uint64_t maps_version_{0};         //!< Maps version the index was built for.
+  bool built_{false};                //!< If the index is complete.
+};
+
+#endif // MEMORYACCESSOR_SRC_POINTERINDEX_H_
@@ -0,0 +1,293 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief RegionFilter source
+
+  A source that contains the realization of RegionFilter class.
+*/
+
+#include "regionfilter.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "segmentinfo.h"
+
+/*!
+ \brief Parse a filter expression.
+ \param [in] expression The expression, see RegionFilter.
+ \throw ParseEx If a term is invalid. In this case the filter is reset.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Split the expression by ',' and turn every term to a Term or an address
+ range. Address ranges are sorted and merged. Empty terms are skipped, so an
+ empty expression selects everything.
+*/
+void RegionFilter::Parse(const std::string &expression) noexcept(false) {
+  Reset();
+  try {
+    std::istringstream iss(expression);
+    std::string term;
+    while (std::getline(iss, term, ',')) {
+      if (term.empty())
+        continue;
+
+      Term result;
+      std::string body{term};
+      if (body[0] == '!') {
+        result.negated = true;
+        body.erase(0, 1);
+      }
+
+      if (body.starts_with("perm=")) {
+        result.type = TermType::kPerm;
+        for (size_t i{5}; i < body.length(); i++) {
+          switch (body[i]) {
+          case 'r':
+            result.mode |= 0b1000;
+            break;
+          case 'w':
+            result.mode |= 0b0100;
+            break;
+          case 'x':
+            result.mode |= 0b0010;
+            break;
+          case 's':
+            result.mode |= 0b0001;
+            break;
+          case 'p':
+            result.mode |= 0b10000; // not stored, checked as no 's'
+            break;
+          default:
+            throw ParseEx(term);
+          }
+        }
+        if (!result.mode)
+          throw ParseEx(term);
+      } else if (body.starts_with("name=")) {
+        result.type = TermType::kName;
+        result.pattern = body.substr(5);
+      } else if (body == "anon") {
+        result.type = TermType::kAnon;
+      } else if (body == "file") {
+        result.type = TermType::kFile;
+      } else if (body.starts_with("size>") || body.starts_with("size<")) {
+        result.type = body[4] == '>' ? TermType::kMinSize : TermType::kMaxSize;
+        result.size = ParseSize(body.substr(5), term);
+      } else if (body.starts_with("addr=") && !result.negated) {
+        size_t dash{body.find('-', 5)};
+        if (dash == std::string::npos)
+          throw ParseEx(term);
+        std::istringstream start_iss(body.substr(5, dash - 5)),
+            end_iss(body.substr(dash + 1));
+        size_t start{0}, end{0};
+        start_iss >> std::hex >> start;
+        end_iss >> std::hex >> end;
+        if (start_iss.fail() || !start_iss.eof() || end_iss.fail() ||
+            !end_iss.eof() || start >= end)
+          throw ParseEx(term);
+        ranges_.push_back({start, end});
+        continue;
+      } else {
+        throw ParseEx(term);
+      }
+      terms_.push_back(std::move(result));
+    }
+  } catch (...) {
+    Reset();
+    throw;
+  }
+
+  std::sort(ranges_.begin(), ranges_.end());
+  size_t merged{0};
+  for (size_t i{1}; i < ranges_.size(); i++) {
+    if (ranges_[i].first <= ranges_[merged].second)
+      ranges_[merged].second =
+          std::max(ranges_[merged].second, ranges_[i].second);
+    else
+      ranges_[++merged] = ranges_[i];
+  }
+  if (!ranges_.empty())
+    ranges_.resize(merged + 1);
+  expression_ = expression;
+}
+
+/*!
+ \brief Forget the expression, so everything is selected.
+*/
+void RegionFilter::Reset() noexcept {
+  expression_.clear();
+  terms_.clear();
+  ranges_.clear();
+}
+
+/*!
+ \brief Check if a segment matches all terms except address ranges.
+ \param [in] segment_info The segment.
+ \return true if the segment matches.
+*/
+bool RegionFilter::Match(const SegmentInfo &segment_info) const noexcept {
+  size_t size{segment_info.end - segment_info.start};
+  for (const Term &term : terms_) {
+    bool match{false};
+    switch (term.type) {
+    case TermType::kPerm:
+      match =
+          (segment_info.mode & term.mode & 0b1111) == (term.mode & 0b1111) &&
+          (!(term.mode & 0b10000) || !(segment_info.mode & 0b0001));
+      break;
+    case TermType::kName:
+      match = Glob(term.pattern, segment_info.path);
+      break;
+    case TermType::kAnon:
+      match = !segment_info.inode_id;
+      break;
+    case TermType::kFile:
+      match = segment_info.inode_id;
+      break;
+    case TermType::kMinSize:
+      match = size > term.size;
+      break;
+    case TermType::kMaxSize:
+      match = size < term.size;
+      break;
+    }
+    if (match == term.negated)
+      return false;
+  }
+  return true;
+}
+
+/*!
+ \brief Turn the filter to intervals of memory.
+ \param [in] segment_infos Segments sorted by start address.
+ \return A reference to std::vector of intervals sorted by start address, valid
+ until the next call.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Select segments that match the terms and cut them to the address ranges,
+ walking segments and ranges at the same time. Memory is not read.
+*/
+const std::vector<RegionFilter::Interval> &
+RegionFilter::Compile(const std::vector<SegmentInfo> &segment_infos) noexcept(
+    false) {
+  intervals_.clear();
+  size_t range{0};
+  for (size_t num{0}; num < segment_infos.size(); num++) {
+    const SegmentInfo &segment_info{segment_infos[num]};
+    if (!Match(segment_info))
+      continue;
+
+    if (ranges_.empty()) {
+      intervals_.push_back({segment_info.start, segment_info.end, num});
+      continue;
+    }
+
+    while (range < ranges_.size() &&
+           ranges_[range].second <= segment_info.start)
+      range++;
+    for (size_t i{range};
+         i < ranges_.size() && ranges_[i].first < segment_info.end; i++)
+      intervals_.push_back({std::max(segment_info.start, ranges_[i].first),
+                            std::min(segment_info.end, ranges_[i].second),
+                            num});
+  }
+  return intervals_;
+}
+
+/*!
+ \brief Match a string to a pattern.
+ \param [in] pattern The pattern, where '*' is any string and '?' is any
+ character.
+ \param [in] str The string.
+ \return true if the whole string matches.
+
+ Other characters (including '[' and ']' of names like "[heap]") match
+ themselves.
+*/
+bool RegionFilter::Glob(const std::string &pattern,
+                        const std::string &str) noexcept {
+  size_t p{0}, s{0}, star{std::string::npos}, star_s{0};
+  while (s < str.length()) {
+    if (p < pattern.length() && (pattern[p] == '?' || pattern[p] == str[s])) {
+      p++;
+      s++;
+    } else if (p < pattern.length() && pattern[p] == '*') {
+      star = p++;
+      star_s = s;
+    } else if (star != std::string::npos) {
+      p = star + 1;
+      s = ++star_s;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.length() && pattern[p] == '*')
+    p++;
+  return p == pattern.length();
+}
+
+/*!
+ \brief Parse a size with an optional suffix.
+ \param [in] str The size, decimal or hex with "0x", may end with 'K', 'M' or
+ 'G'.
+ \param [in] term The term for the exception.
+ \return The size in bytes.
+ \throw ParseEx If the size is invalid.
+*/
+size_t RegionFilter::ParseSize(const std::string &str,
+                               const std::string &term) noexcept(false) {
+  size_t pos{0}, result{0};
+  if (str.empty() || str[0] < '0' || str[0] > '9')
+    throw ParseEx(term);
+  try {
+    result = std::stoull(str, &pos, 0);
+  } catch (const std::exception &ex) {
+    throw ParseEx(term);
+  }
+
+  unsigned shift{0};
+  if (pos + 1 == str.length()) {
+    switch (str[pos]) {
+    case 'K':
+    case 'k':
+      shift = 10;
+      break;
+    case 'M':
+    case 'm':
+      shift = 20;
+      break;
+    case 'G':
+    case 'g':
+      shift = 30;
+      break;
+    default:
+      throw ParseEx(term);
+    }
+  } else if (pos != str.length()) {
+    throw ParseEx(term);
+  }
+
+  if (result > SIZE_MAX >> shift)
+    throw ParseEx(term);
+  return result << shift;
+}
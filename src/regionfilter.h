@@ -0,0 +1,142 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief RegionFilter header
+
+ A header that contains the definition of RegionFilter class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_REGIONFILTER_H_
+#define MEMORYACCESSOR_SRC_REGIONFILTER_H_
+
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "segmentinfo.h"
+
+/*!
+ \brief A class that selects parts of memory by a filter expression.
+
+ An expression is a list of terms separated by ','. A segment is selected if
+ it matches all terms except address ranges; address ranges are united, and
+ selected segments are cut to them. Terms:
+ - "perm=rwxsp" - the segment has all listed permissions ('s' is shared, 'p'
+ is private);
+ - "name=pattern" - the path matches the pattern, where '*' is any string and
+ '?' is any character;
+ - "anon" or "file" - the segment is anonymous or backed by a file (by inode);
+ - "size>N" or "size<N" - the size is greater or less than N, which may end
+ with 'K', 'M' or 'G';
+ - "addr=start-end" - hex address range, the end is not included.
+ Any term except an address range may start with '!' to negate it.
+
+ The expression is parsed once; Compile turns it into a sorted set of
+ intervals for the given segments without reading memory.
+*/
+class RegionFilter {
+public:
+  /*!
+   \brief A struct that represents a selected part of a segment.
+  */
+  struct Interval {
+    size_t start; //!< Start address.
+    size_t end;   //!< End address.
+    size_t num;   //!< Number of the segment.
+  };
+
+  /*!
+   \brief Ex: Invalid term of an expression
+  */
+  class ParseEx : public std::exception {
+  public:
+    /*!
+     \brief Constructor.
+     \param [in] _term The invalid term.
+    */
+    explicit ParseEx(const std::string &_term) : term(_term) {}
+
+    /*!
+     \brief "what" function of the exception.
+     \return C-string descripting the exception.
+    */
+    virtual const char *what() const noexcept override {
+      return "Invalid filter term";
+    }
+
+    std::string term; //!< The invalid term.
+  };
+
+  void Parse(const std::string &expression) noexcept(false);
+  void Reset() noexcept;
+  bool Match(const SegmentInfo &segment_info) const noexcept;
+  const std::vector<Interval> &
+  Compile(const std::vector<SegmentInfo> &segment_infos) noexcept(false);
+
+  /*!
+   \brief Check if the filter selects everything.
+   \return true if there are no terms.
+  */
+  bool Empty() const noexcept { return terms_.empty() && ranges_.empty(); }
+
+  /*!
+   \brief Get the parsed expression.
+   \return A reference to the expression given to Parse.
+  */
+  const std::string &Expression() const noexcept { return expression_; }
+
+  static bool Glob(const std::string &pattern,
+                   const std::string &str) noexcept;
+
+private:
+  /*!
+   \brief Type of a term.
+  */
+  enum class TermType : uint8_t {
+    kPerm,    //!< Has permissions.
+    kName,    //!< Path matches a pattern.
+    kAnon,    //!< Anonymous.
+    kFile,    //!< Backed by a file.
+    kMinSize, //!< Greater than a size.
+    kMaxSize, //!< Less than a size.
+  };
+
+  /*!
+   \brief A struct that represents a term except address ranges.
+  */
+  struct Term {
+    TermType type;       //!< Type of the term.
+    bool negated{false}; //!< If the result is inverted.
+    uint8_t mode{0};     //!< Permissions (kPerm).
+    std::string pattern; //!< Pattern (kName).
+    size_t size{0};      //!< Size (kMinSize, kMaxSize).
+  };
+
+  static size_t ParseSize(const std::string &str,
+                          const std::string &term) noexcept(false);
+
+  std::string expression_; //!< The parsed expression.
+  std::vector<Term> terms_; //!< Terms except address ranges.
+  std::vector<std::pair<size_t, size_t>>
+      ranges_; //!< Address ranges, sorted and merged.
+  std::vector<Interval> intervals_; //!< Result of the latest Compile.
+};
+
+#endif // MEMORYACCESSOR_SRC_REGIONFILTER_H_
@@ -0,0 +1,368 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief SnapshotFile source
+
+  A source that contains the realization of SnapshotFile class.
+*/
+
+#include "snapshotfile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "blockcodec.h"
+#include "bufferallocator.h"
+#include "memoryaccessor.h"
+#include "segmentinfo.h"
+#include "tools.h"
+
+namespace memoryaccessor_snapshotfile_src {
+
+constexpr char kZeroPage[SnapshotFile::kPageSize]{}; //!< A page of zeros.
+
+} // namespace memoryaccessor_snapshotfile_src
+
+/*!
+ \brief Destroy the object, unmapping the opened file.
+*/
+SnapshotFile::~SnapshotFile() noexcept { Close(); }
+
+/*!
+ \brief Save memory of a process to a snapshot file.
+ \param [in] path Path of the file, it is truncated or created with mode 600.
+ \param [in] pid PID of the process.
+ \param [in] segment_infos Segments to save, sorted by start address.
+ \param [in] memory_accessor MemoryAccessor with /proc/PID/mem opened by
+ OpenSharedMem. A segment that is not one of its segments is marked as a part
+ (kSegmentPart).
+ \param [in] codec Codec of pages (kStored to save pages uncompressed).
+ \param [in] threads Amount of threads that compress pages.
+ \param [in] stop Function that returns true if saving should be stopped.
+ \param [out] stats Statistics of saving.
+ \return Return code, 0 is success, 2 means that it was stopped (the file is
+ deleted then).
+ \throw SnapshotFileEx If the file cannot be created or written (it is deleted
+ then).
+ \throw std::bad_alloc If memory cannot be allocated.
+ \throw std::system_error If a thread cannot be started (the file is deleted
+ then).
+
+ Memory is read by kChunkSize bytes, pages of a chunk that are not zero are
+ compressed by BlockCodec as one batch (a page that does not become smaller is
+ stored as is) and appended to the data by one call. Pages of segments that
+ are not readable and pages that cannot be read are marked missing. The tables
+ are written last.
+*/
+uint8_t SnapshotFile::Save(const std::string &path, pid_t pid,
+                           const std::vector<SegmentInfo> &segment_infos,
+                           const MemoryAccessor &memory_accessor,
+                           BlockCodec::Codec codec, unsigned threads,
+                           const std::function<bool()> &stop,
+                           SaveStats &stats) noexcept(false) {
+  using memoryaccessor_snapshotfile_src::kZeroPage;
+
+  stats = {};
+  std::vector<SegmentRecord> records;
+  std::string strings;
+  for (const SegmentInfo &segment_info : segment_infos) {
+    auto live_it{std::partition_point(
+        memory_accessor.segment_infos_.begin(),
+        memory_accessor.segment_infos_.end(),
+        [&segment_info](const SegmentInfo &info) {
+          return info.start < segment_info.start;
+        })};
+    bool part{live_it == memory_accessor.segment_infos_.end() ||
+              live_it->start != segment_info.start ||
+              live_it->end != segment_info.end};
+    SegmentRecord &record{records.emplace_back()};
+    record.start = segment_info.start;
+    record.end = segment_info.end;
+    record.offset = segment_info.offset;
+    record.inode_id = segment_info.inode_id;
+    record.major_id = segment_info.major_id;
+    record.minor_id = segment_info.minor_id;
+    record.mode = segment_info.mode;
+    record.flags = part ? kSegmentPart : 0;
+    record.path_size = static_cast<uint32_t>(segment_info.path.size());
+    record.path_offset = strings.size();
+    record.first_page = stats.pages;
+    strings += segment_info.path;
+    stats.pages += (segment_info.end - segment_info.start + kPageSize - 1) /
+                   kPageSize;
+  }
+  std::vector<PageEntry> entries(stats.pages);
+
+  Header header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.page_size = kPageSize;
+  header.pid = static_cast<uint64_t>(pid);
+  header.time = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+  header.segments = records.size();
+  header.pages = entries.size();
+  header.strings_size = strings.size();
+  size_t tables_size{sizeof(Header) + records.size() * sizeof(SegmentRecord) +
+                     entries.size() * sizeof(PageEntry) + strings.size()};
+  header.data_offset = (tables_size + kPageSize - 1) / kPageSize * kPageSize;
+
+  int fd{open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)};
+  if (fd < 0)
+    throw SnapshotFileEx();
+
+  bool failed{false}, stopped{false};
+  try {
+    auto buffer{BufferAllocator::Allocate(kChunkSize)};
+    std::vector<BlockCodec::Block> blocks(kChunkSize / kPageSize);
+    std::vector<PageEntry *> stored_entries(blocks.size());
+    std::vector<iovec> iov;
+    size_t offset{header.data_offset}, page_num{0};
+    for (size_t i{0}; i < segment_infos.size() && !failed && !stopped; i++) {
+      const SegmentInfo &segment_info{segment_infos[i]};
+      size_t size{segment_info.end - segment_info.start};
+      for (size_t done{0}; done < size && !failed; done += kChunkSize) {
+        if (stop()) {
+          stopped = true;
+          break;
+        }
+        size_t amount{std::min(kChunkSize, size - done)}, read{0};
+        if (segment_info.mode & 0b1000)
+          read = memory_accessor.ReadShared(buffer.get(),
+                                            segment_info.start + done, amount);
+
+        size_t stored{0};
+        for (size_t page{0}; page < amount; page += kPageSize, page_num++) {
+          PageEntry &entry{entries[page_num]};
+          size_t page_size{std::min(kPageSize, amount - page)};
+          if (page + page_size > read) {
+            entry.flags = kPageMissing;
+            stats.missing_pages++;
+          } else if (std::memcmp(buffer.get() + page, kZeroPage, page_size) ==
+                     0) {
+            entry.flags = kPageZero;
+            stats.zero_pages++;
+          } else {
+            blocks[stored].data = buffer.get() + page;
+            blocks[stored].size = page_size;
+            blocks[stored].codec = BlockCodec::Codec::kStored;
+            stored_entries[stored++] = &entry;
+          }
+        }
+        if (!stored)
+          continue;
+        if (codec != BlockCodec::Codec::kStored)
+          BlockCodec::CompressBatch(codec, {blocks.data(), stored}, threads);
+
+        // adjacent uncompressed pages are written as one buffer
+        iov.clear();
+        size_t written{0};
+        for (size_t j{0}; j < stored; j++) {
+          const BlockCodec::Block &block{blocks[j]};
+          PageEntry &entry{*stored_entries[j]};
+          entry.offset = offset + written;
+          entry.size = static_cast<uint32_t>(block.StoredSize());
+          if (block.codec != BlockCodec::Codec::kStored) {
+            entry.flags =
+                block.codec == BlockCodec::Codec::kRle ? kPageRle : kPageLz4;
+            stats.compressed_pages++;
+          }
+          written += block.StoredSize();
+          char *data{const_cast<char *>(block.Stored())};
+          if (!iov.empty() &&
+              static_cast<char *>(iov.back().iov_base) + iov.back().iov_len ==
+                  data)
+            iov.back().iov_len += block.StoredSize();
+          else
+            iov.push_back({data, block.StoredSize()});
+        }
+        if (!Tools::PwritevAll(fd, iov, offset)) {
+          failed = true;
+          break;
+        }
+        offset += written;
+      }
+    }
+    stats.file_size = offset;
+
+    if (!failed && !stopped) {
+      std::string tables{reinterpret_cast<const char *>(&header),
+                         sizeof(header)};
+      tables.append(reinterpret_cast<const char *>(records.data()),
+                    records.size() * sizeof(SegmentRecord));
+      tables.append(reinterpret_cast<const char *>(entries.data()),
+                    entries.size() * sizeof(PageEntry));
+      tables += strings;
+      failed = !Tools::PwriteAll(fd, tables.data(), tables.size(), 0) ||
+               ftruncate(fd, static_cast<off_t>(stats.file_size)) != 0;
+    }
+  } catch (...) {
+    close(fd);
+    unlink(path.c_str());
+    throw;
+  }
+
+  if (close(fd) != 0)
+    failed = true;
+  if (failed || stopped)
+    unlink(path.c_str());
+  if (failed)
+    throw SnapshotFileEx();
+  return stopped ? 2 : 0;
+}
+
+/*!
+ \brief Map a snapshot file for reading.
+ \param [in] path Path of the file.
+ \throw SnapshotFileEx If the file cannot be opened or mapped, or it is not a
+ valid snapshot.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ The previously opened file is closed. The header and all tables are checked
+ to lie inside the file, and page tables of segments to be in order. Pages of
+ segments are checked to lie inside the file, and stored pages that are not
+ compressed to have the size of their part of the segment, since Page returns
+ them straight from the mapping.
+*/
+void SnapshotFile::Open(const std::string &path) noexcept(false) {
+  Close();
+  int fd{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+  if (fd < 0)
+    throw SnapshotFileEx();
+  struct stat file_stat;
+  void *mapping{MAP_FAILED};
+  if (fstat(fd, &file_stat) == 0 &&
+      static_cast<size_t>(file_stat.st_size) >= sizeof(Header))
+    mapping = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ,
+                   MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    throw SnapshotFileEx();
+  mapping_ = static_cast<char *>(mapping);
+  mapping_size_ = static_cast<size_t>(file_stat.st_size);
+  madvise(mapping_, mapping_size_, MADV_SEQUENTIAL);
+
+  header_ = reinterpret_cast<const Header *>(mapping_);
+  size_t records_size{header_->segments * sizeof(SegmentRecord)},
+      entries_size{header_->pages * sizeof(PageEntry)};
+  if (std::memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0 ||
+      !header_->version || header_->version > kVersion ||
+      header_->page_size != kPageSize ||
+      header_->segments > mapping_size_ / sizeof(SegmentRecord) ||
+      header_->pages > mapping_size_ / sizeof(PageEntry) ||
+      sizeof(Header) + records_size + entries_size + header_->strings_size >
+          mapping_size_) {
+    Close();
+    throw SnapshotFileEx();
+  }
+  records_ = reinterpret_cast<const SegmentRecord *>(mapping_ + sizeof(Header));
+  entries_ = reinterpret_cast<const PageEntry *>(mapping_ + sizeof(Header) +
+                                                 records_size);
+  const char *strings{mapping_ + sizeof(Header) + records_size + entries_size};
+
+  try {
+    uint64_t next_page{0};
+    for (size_t i{0}; i < header_->segments; i++) {
+      const SegmentRecord &record{records_[i]};
+      uint64_t pages{(record.end - record.start + kPageSize - 1) / kPageSize};
+      if (record.end < record.start || record.first_page != next_page ||
+          pages > header_->pages - next_page ||
+          record.path_offset > header_->strings_size ||
+          record.path_size > header_->strings_size - record.path_offset)
+        throw SnapshotFileEx();
+      for (uint64_t page{0}; page < pages; page++) {
+        const PageEntry &entry{entries_[record.first_page + page]};
+        size_t page_size{std::min<size_t>(
+            kPageSize, record.end - record.start - page * kPageSize)};
+        if (!(entry.flags & (kPageMissing | kPageZero)) &&
+            (entry.offset > mapping_size_ ||
+             entry.size > mapping_size_ - entry.offset ||
+             (entry.flags & (kPageRle | kPageLz4) ? entry.size > kPageSize
+                                                  : entry.size != page_size)))
+          throw SnapshotFileEx();
+      }
+      next_page += pages;
+      segment_infos_.push_back(
+          {record.start, record.end, record.offset, record.mode,
+           record.major_id, record.minor_id, record.inode_id,
+           std::string(strings + record.path_offset, record.path_size)});
+    }
+  } catch (...) {
+    Close();
+    throw;
+  }
+}
+
+/*!
+ \brief Unmap the opened file.
+*/
+void SnapshotFile::Close() noexcept {
+  if (mapping_)
+    munmap(mapping_, mapping_size_);
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+  header_ = nullptr;
+  records_ = nullptr;
+  entries_ = nullptr;
+  segment_infos_.clear();
+}
+
+/*!
+ \brief Get data of a page.
+ \param [in] num Number of the segment.
+ \param [in] page Number of the page in the segment.
+ \param [out] buffer Buffer of kPageSize bytes for a compressed page.
+ \return Pointer to kPageSize bytes (or less at the end of a segment): to the
+ mapping, to buffer if the page is compressed, to a page of zeros for zero
+ pages; nullptr if the page is missing or cannot be decompressed.
+*/
+const char *SnapshotFile::Page(size_t num, size_t page,
+                               char *buffer) const noexcept {
+  const SegmentRecord &record{records_[num]};
+  const PageEntry &entry{entries_[record.first_page + page]};
+  if (entry.flags & kPageMissing)
+    return nullptr;
+  if (entry.flags & kPageZero)
+    return memoryaccessor_snapshotfile_src::kZeroPage;
+  if (!(entry.flags & (kPageRle | kPageLz4)))
+    return mapping_ + entry.offset;
+
+  size_t page_size{std::min<size_t>(kPageSize, record.end - record.start -
+                                                   page * kPageSize)};
+  return BlockCodec::Decompress(entry.flags & kPageRle
+                                    ? BlockCodec::Codec::kRle
+                                    : BlockCodec::Codec::kLz4,
+                                mapping_ + entry.offset, entry.size, buffer,
+                                page_size)
+             ? buffer
+             : nullptr;
+}
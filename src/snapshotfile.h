@@ -0,0 +1,218 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief SnapshotFile header
+
+ A header that contains the definition of SnapshotFile class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_SNAPSHOTFILE_H_
+#define MEMORYACCESSOR_SRC_SNAPSHOTFILE_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "blockcodec.h"
+#include "memoryaccessor.h"
+#include "segmentinfo.h"
+
+/*!
+ \brief A class that saves memory of a process to a snapshot file and maps
+ snapshot files for reading.
+
+ A snapshot file consists of:
+ - Header: magic, version, page size, PID, time and sizes of the tables;
+ - SegmentRecord for every segment (fields of SegmentInfo, the path is in the
+   string table) with the number of its first page in the page table;
+ - PageEntry for every page of every segment: offset and size of its data
+   with the codec it is compressed by, or a flag that the page is zero or could
+   not be read;
+ - the string table with paths;
+ - data of pages, starting at a page boundary.
+
+ All fields are little-endian (native). Without compression stored pages are
+ aligned, so a mapped file gives pointers to pages without copying; compressed
+ pages are decompressed to a buffer of the caller. Zero pages and pages that
+ cannot be read take no space. Files of version 1 have no compressed pages.
+*/
+class SnapshotFile {
+public:
+  constexpr static char kMagic[8]{'M', 'A', 'S', 'N',
+                                  'A', 'P', '\r', '\n'}; //!< File magic.
+  constexpr static uint32_t kVersion{2};     //!< Version of the format.
+  constexpr static size_t kPageSize{0x1000}; //!< Size of a page.
+  constexpr static size_t kChunkSize{
+      0x100000}; //!< Size of chunks memory is read by.
+
+  /*!
+   \brief Ex: A snapshot file cannot be written or read
+
+   This exception is thrown when a snapshot file cannot be created, written,
+   opened or mapped, or it is not a valid snapshot.
+  */
+  class SnapshotFileEx : public std::exception {
+    /*!
+     \brief "what" function of the exception.
+     \return C-string descripting the exception.
+    */
+    virtual const char *what() const noexcept override {
+      return "Error in writing or reading a snapshot file";
+    }
+  };
+
+  /*!
+   \brief Flags of a page entry.
+  */
+  enum PageFlags : uint32_t {
+    kPageMissing = 1, //!< The page could not be read.
+    kPageZero = 2,    //!< The page is filled with zeros.
+    kPageRle = 4,     //!< The page is compressed by BlockCodec::Codec::kRle.
+    kPageLz4 = 8,     //!< The page is compressed by BlockCodec::Codec::kLz4.
+  };
+
+  /*!
+   \brief Flags of a segment record.
+  */
+  enum SegmentFlags : uint8_t {
+    kSegmentPart = 1, //!< The record is a part of a segment (cut by a filter).
+  };
+
+  /*!
+   \brief Header of a snapshot file.
+  */
+  struct Header {
+    char magic[8];         //!< kMagic.
+    uint32_t version;      //!< kVersion.
+    uint32_t page_size;    //!< kPageSize.
+    uint64_t pid;          //!< PID of the process.
+    uint64_t time;         //!< Time of saving, seconds since the epoch.
+    uint64_t segments;     //!< Amount of segment records.
+    uint64_t pages;        //!< Amount of page entries.
+    uint64_t strings_size; //!< Size of the string table.
+    uint64_t data_offset;  //!< Offset of data of pages.
+  };
+
+  /*!
+   \brief Record of a segment in a snapshot file.
+  */
+  struct SegmentRecord {
+    uint64_t start;       //!< Start address.
+    uint64_t end;         //!< End address.
+    uint64_t offset;      //!< Offset in the mapped file.
+    uint64_t inode_id;    //!< Inode ID.
+    uint32_t major_id;    //!< Major ID.
+    uint32_t minor_id;    //!< Minor ID.
+    uint8_t mode;         //!< Permissions as in SegmentInfo.
+    uint8_t flags;        //!< SegmentFlags (zeros in older files).
+    uint8_t reserved[2];  //!< Zeros.
+    uint32_t path_size;   //!< Length of the path.
+    uint64_t path_offset; //!< Offset of the path in the string table.
+    uint64_t first_page;  //!< Number of the first page in the page table.
+  };
+
+  /*!
+   \brief Entry of the page table.
+  */
+  struct PageEntry {
+    uint64_t offset; //!< Offset of the data in the file (0 if not stored).
+    uint32_t size;   //!< Size of the stored data.
+    uint32_t flags;  //!< PageFlags.
+  };
+
+  /*!
+   \brief A struct with statistics of saving.
+  */
+  struct SaveStats {
+    size_t pages{0};         //!< Amount of pages.
+    size_t zero_pages{0};    //!< Amount of zero pages.
+    size_t missing_pages{0}; //!< Amount of pages that could not be read.
+    size_t compressed_pages{0}; //!< Amount of compressed pages.
+    size_t file_size{0};     //!< Size of the file.
+  };
+
+  SnapshotFile() noexcept = default;
+
+  /*!
+   \brief Copy constructor (deleted).
+   \param [in] origin SnapshotFile instance to copy from.
+
+   Create a new object by copying an old one. Prohibited.
+  */
+  SnapshotFile(const SnapshotFile &origin) = delete;
+
+  /*!
+   \brief Copy-assignment operator (deleted).
+   \param [in] origin SnapshotFile instance to copy from.
+
+   Assign an object by copying other object. Prohibited.
+  */
+  SnapshotFile &operator=(const SnapshotFile &origin) = delete;
+
+  ~SnapshotFile() noexcept;
+
+  static uint8_t Save(const std::string &path, pid_t pid,
+                      const std::vector<SegmentInfo> &segment_infos,
+                      const MemoryAccessor &memory_accessor,
+                      BlockCodec::Codec codec, unsigned threads,
+                      const std::function<bool()> &stop,
+                      SaveStats &stats) noexcept(false);
+
+  void Open(const std::string &path) noexcept(false);
+  void Close() noexcept;
+
+  /*!
+   \brief Get the header of the opened file.
+   \return A reference to the header.
+  */
+  const Header &GetHeader() const noexcept { return *header_; }
+
+  /*!
+   \brief Get segments of the opened file.
+   \return A reference to std::vector of segments sorted by start address.
+  */
+  const std::vector<SegmentInfo> &Segments() const noexcept {
+    return segment_infos_;
+  }
+
+  /*!
+   \brief Check if a segment was saved in part.
+   \param [in] num Number of the segment.
+   \return true if the boundaries of the segment were cut by a filter, so
+   they were not boundaries of a segment of the process.
+  */
+  bool Part(size_t num) const noexcept {
+    return records_[num].flags & kSegmentPart;
+  }
+
+  const char *Page(size_t num, size_t page, char *buffer) const noexcept;
+
+private:
+  char *mapping_{nullptr};        //!< Mapping of the opened file.
+  size_t mapping_size_{0};        //!< Size of the mapping.
+  const Header *header_{nullptr}; //!< Header in the mapping.
+  const SegmentRecord *records_{nullptr}; //!< Segment records in the mapping.
+  const PageEntry *entries_{nullptr};     //!< Page table in the mapping.
+  std::vector<SegmentInfo> segment_infos_; //!< Decoded segment records.
+};
+
+#endif // MEMORYACCESSOR_SRC_SNAPSHOTFILE_H_
@@ -0,0 +1,427 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief SnapshotStore source
+
+  A source that contains the realization of SnapshotStore class.
+*/
+
+#include "snapshotstore.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bufferallocator.h"
+#include "segmentinfo.h"
+
+/*!
+ \brief Update the layout of regions.
+ \param [in] segment_infos Segments got from the latest maps.
+ \throw std::bad_alloc If memory for a new region cannot be allocated. In this
+ case the store is reset.
+ \throw ScratchFileEx If a copy has to be spilled, but a scratch file cannot be
+ created. In this case the store is reset.
+
+ Walk old regions and new readable segments at the same time. A region with
+ the same boundaries as a segment is kept with its buffer, a region with the
+ same start as a segment that grew or shrank is resized in place (see Resize),
+ so a segment that grows by a page does not need a second copy of itself. A
+ segment without such region gets a new region with a buffer that is
+ allocated without initialization (or an array of page hashes in hash mode)
+ and a schedule of blocks, and old regions that are passed by are moved to the
+ retired ones. Retired regions of the previous update are released first. New
+ copies are placed in RAM while they fit in the budget, in scratch files
+ otherwise.
+*/
+void SnapshotStore::Update(
+    const std::vector<SegmentInfo> &segment_infos) noexcept(false) {
+  std::vector<Region> old_regions;
+  old_regions.swap(regions_);
+  retired_.clear();
+  regions_.reserve(old_regions.size());
+
+  size_t ram_bytes{0};
+  for (const Region &region : old_regions)
+    if (region.data && !region.spilled)
+      ram_bytes += region.end - region.start;
+
+  try {
+    size_t i{0};
+    for (size_t num{0}; num < segment_infos.size(); num++) {
+      const SegmentInfo &segment_info{segment_infos[num]};
+      if (!(segment_info.mode & 0b1000)) // not readable
+        continue;
+
+      while (i < old_regions.size() &&
+             old_regions[i].start < segment_info.start)
+        retired_.push_back(std::move(old_regions[i++]));
+
+      if (i < old_regions.size() &&
+          old_regions[i].start == segment_info.start) {
+        Region &region{regions_.emplace_back(std::move(old_regions[i++]))};
+        region.num = num;
+        region.fresh = false;
+        if (region.end != segment_info.end)
+          Resize(region, segment_info.end, ram_bytes);
+      } else {
+        size_t size{segment_info.end - segment_info.start};
+        Region &region{regions_.emplace_back()};
+        region.start = segment_info.start;
+        region.end = region.valid_end = segment_info.end;
+        region.num = num;
+        region.blocks.resize((size + kBlockSize - 1) / kBlockSize);
+        if (hash_mode_)
+          region.hashes = std::make_unique_for_overwrite<uint64_t[]>(
+              (size + kPageSize - 1) / kPageSize);
+        else
+          region.data = Allocate(size, ram_bytes, region.spilled);
+      }
+    }
+
+    for (; i < old_regions.size(); i++)
+      retired_.push_back(std::move(old_regions[i]));
+  } catch (...) {
+    Reset();
+    throw;
+  }
+}
+
+/*!
+ \brief Release retired regions.
+
+ Free buffers of the regions that disappeared in the latest update. Should be
+ called after the new data is compared to them.
+*/
+void SnapshotStore::ReleaseRetired() noexcept { retired_.clear(); }
+
+/*!
+ \brief Free all memory.
+
+ Delete all regions, both current and retired, and all hot pages.
+*/
+void SnapshotStore::Reset() noexcept {
+  regions_.clear();
+  regions_.shrink_to_fit();
+  retired_.clear();
+  retired_.shrink_to_fit();
+  hot_pages_.clear();
+}
+
+/*!
+ \brief Choose what is stored for regions.
+ \param [in] hash_mode true to store hashes of pages, false to store copies.
+
+ Switch the mode of the store. If the mode is changed, the store is reset.
+*/
+void SnapshotStore::SetHashMode(bool hash_mode) noexcept {
+  if (hash_mode != hash_mode_)
+    Reset();
+  hash_mode_ = hash_mode;
+}
+
+/*!
+ \brief Set the memory budget.
+ \param [in] budget Maximum size of copies in RAM in bytes, 0 is none.
+ \param [in] scratch_dir Directory for scratch files of copies that do not
+ fit in the budget.
+
+ The budget is applied to new copies and by Rebalance.
+*/
+void SnapshotStore::SetBudget(size_t budget,
+                              const std::string &scratch_dir) noexcept {
+  budget_ = budget;
+  scratch_dir_ = scratch_dir;
+}
+
+/*!
+ \brief Keep the hottest copies in RAM.
+ \throw std::bad_alloc If memory cannot be allocated.
+ \throw ScratchFileEx If a scratch file cannot be created.
+
+ Regions are ordered by heat: the average of 1 / period of their blocks, i.e.
+ how often they are read and changed. The hottest regions that fit in the
+ budget should be in RAM, the others in scratch files. Cold copies are
+ spilled first, then hot ones are moved to RAM, so the budget is not
+ exceeded while moving. Nothing is done in hash mode or without a budget.
+*/
+void SnapshotStore::Rebalance() noexcept(false) {
+  if (hash_mode_ || !budget_)
+    return;
+
+  std::vector<double> heat(regions_.size());
+  for (size_t i{0}; i < regions_.size(); i++) {
+    for (const Block &block : regions_[i].blocks)
+      heat[i] += 1.0 / block.period;
+    heat[i] /=
+        static_cast<double>(std::max<size_t>(regions_[i].blocks.size(), 1));
+  }
+  std::vector<size_t> order(regions_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&heat](size_t a, size_t b) { return heat[a] > heat[b]; });
+
+  std::vector<bool> to_ram(regions_.size());
+  size_t ram_bytes{0};
+  for (size_t i : order) {
+    size_t size{regions_[i].end - regions_[i].start};
+    if (ram_bytes + size <= budget_) {
+      to_ram[i] = true;
+      ram_bytes += size;
+    }
+  }
+
+  for (bool promote : {false, true})
+    for (size_t i{0}; i < regions_.size(); i++) {
+      Region &region{regions_[i]};
+      if (!region.data || to_ram[i] != promote || region.spilled != promote)
+        continue;
+
+      size_t size{region.end - region.start};
+      Buffer buffer{promote ? BufferAllocator::Allocate(size)
+                            : MapScratch(size)};
+      std::memcpy(buffer.get(), region.data.get(), size);
+      region.data = std::move(buffer);
+      region.spilled = !promote;
+    }
+}
+
+/*!
+ \brief Tell the kernel that spilled copies are cold.
+
+ Spilled copies are read once per pass, so after a pass their pages are the
+ first to be written back and reclaimed.
+*/
+void SnapshotStore::AdviseSpilled() const noexcept {
+#ifdef MADV_COLD
+  for (const Region &region : regions_)
+    if (region.spilled)
+      madvise(region.data.get(), region.data.get_deleter().mapped_size,
+              MADV_COLD);
+#endif
+}
+
+/*!
+ \brief Find a hot page.
+ \param [in] address Address of the page.
+ \return Pointer to the hot page or nullptr if the page is not hot.
+*/
+SnapshotStore::HotPage *SnapshotStore::FindHotPage(size_t address) noexcept {
+  auto it{hot_pages_.find(address)};
+  return it == hot_pages_.end() ? nullptr : &it->second;
+}
+
+/*!
+ \brief Make a page hot.
+ \param [in] address Address of the page.
+ \param [in] iteration Current iteration.
+ \return Pointer to the new hot page with uninitialized data, or nullptr if
+ there are kMaxHotPages already or memory cannot be allocated.
+*/
+SnapshotStore::HotPage *SnapshotStore::AddHotPage(size_t address,
+                                                  uint64_t iteration) noexcept {
+  if (hot_pages_.size() >= kMaxHotPages)
+    return nullptr;
+
+  try {
+    HotPage &hot_page{hot_pages_[address]};
+    hot_page.data = std::make_unique_for_overwrite<char[]>(kPageSize);
+    hot_page.last_change = iteration;
+    return &hot_page;
+  } catch (const std::bad_alloc &ex) {
+    hot_pages_.erase(address);
+    return nullptr;
+  }
+}
+
+/*!
+ \brief Forget pages that have not changed for a while.
+ \param [in] iteration Current iteration.
+ \param [in] max_age Amount of iterations a page stays hot without changes.
+
+ Delete hot pages that last changed max_age or more iterations ago. Pages that
+ disappeared from memory are deleted this way too.
+*/
+void SnapshotStore::AgeHotPages(uint64_t iteration, uint64_t max_age) noexcept {
+  std::erase_if(hot_pages_, [iteration, max_age](const auto &item) {
+    return iteration - item.second.last_change >= max_age;
+  });
+}
+
+/*!
+ \brief Get amount of stored data.
+ \return Size of copies or hashes of current and retired regions and of hot
+ pages in bytes.
+*/
+size_t SnapshotStore::StoredBytes() const noexcept {
+  size_t result{0};
+  for (const std::vector<Region> *regions : {&regions_, &retired_})
+    for (const Region &region : *regions)
+      result += hash_mode_ ? (region.end - region.start + kPageSize - 1) /
+                                 kPageSize * sizeof(uint64_t)
+                           : region.end - region.start;
+  return result + hot_pages_.size() * kPageSize;
+}
+
+/*!
+ \brief Get amount of spilled data.
+ \return Size of copies of current and retired regions in scratch files in
+ bytes.
+*/
+size_t SnapshotStore::SpilledBytes() const noexcept {
+  size_t result{0};
+  for (const std::vector<Region> *regions : {&regions_, &retired_})
+    for (const Region &region : *regions)
+      result += region.spilled ? region.data.get_deleter().mapped_size : 0;
+  return result;
+}
+
+/*!
+ \brief Allocate a buffer for a copy.
+ \param [in] size Size of the buffer.
+ \param [in,out] ram_bytes Size of copies in RAM, it is increased if the
+ buffer is allocated in RAM.
+ \param [out] spilled If the buffer is mapped from a scratch file.
+ \return The buffer, uninitialized.
+ \throw std::bad_alloc If memory cannot be allocated.
+ \throw ScratchFileEx If a scratch file cannot be created.
+
+ The buffer is allocated by BufferAllocator if it fits in the budget (or there
+ is no budget), and mapped from a scratch file otherwise.
+*/
+SnapshotStore::Buffer SnapshotStore::Allocate(size_t size, size_t &ram_bytes,
+                                              bool &spilled) const
+    noexcept(false) {
+  spilled = budget_ && ram_bytes + size > budget_;
+  if (spilled)
+    return MapScratch(size);
+  ram_bytes += size;
+  return BufferAllocator::Allocate(size);
+}
+
+/*!
+ \brief Map a buffer from a new scratch file.
+ \param [in] size Size of the buffer.
+ \return The buffer filled with zeros.
+ \throw ScratchFileEx If a scratch file cannot be created, resized or mapped.
+
+ The file is created in scratch_dir_ and unlinked at once, so it is deleted
+ when the buffer is unmapped (or the program exits). The mapping is advised to
+ be read sequentially, as copies are compared from start to end.
+*/
+SnapshotStore::Buffer
+SnapshotStore::MapScratch(size_t size) const noexcept(false) {
+  std::string path{scratch_dir_ + "/memoryaccessor-XXXXXX"};
+  int fd{mkstemp(path.data())};
+  if (fd < 0)
+    throw ScratchFileEx();
+  unlink(path.c_str());
+
+  void *buffer{MAP_FAILED};
+  if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+    buffer = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (buffer == MAP_FAILED)
+    throw ScratchFileEx();
+
+  madvise(buffer, size, MADV_SEQUENTIAL);
+  return Buffer(static_cast<char *>(buffer), BufferAllocator::Deleter{size});
+}
+
+/*!
+ \brief Change the end of a region, keeping the data of the common part.
+ \param [in,out] region The region.
+ \param [in] end New end address.
+ \param [in,out] ram_bytes Size of copies in RAM, updated by the change.
+ \throw std::bad_alloc If memory cannot be allocated.
+ \throw ScratchFileEx If a scratch file cannot be created.
+
+ A mapped copy is grown or truncated by mremap, so the kernel moves its pages
+ instead of copying them and the common part is never held twice; a copy that
+ grows within its mapping (rounded up to huge pages) is not touched at all.
+ A copy on the heap is small and is reallocated. A spilled copy that shrinks
+ is truncated by mremap; one that grows is moved to a new scratch file, since
+ the old file is already closed, so only disk space is needed twice for a
+ moment. If mremap fails (e.g. for hugetlb pages on old kernels), the copy is
+ reallocated.
+
+ Data up to the old end stays valid and is compared on the next pass; new
+ blocks and the block that contained the old end are read at once.
+*/
+void SnapshotStore::Resize(Region &region, size_t end,
+                           size_t &ram_bytes) noexcept(false) {
+  size_t old_size{region.end - region.start}, size{end - region.start},
+      common{std::min(old_size, size)};
+  region.end = end;
+  region.valid_end = std::min(region.valid_end, end);
+
+  size_t first_block{(region.valid_end - region.start) / kBlockSize};
+  region.blocks.resize((size + kBlockSize - 1) / kBlockSize);
+  for (size_t i{first_block}; i < region.blocks.size(); i++)
+    region.blocks[i] = Block();
+
+  if (hash_mode_) {
+    size_t pages{(size + kPageSize - 1) / kPageSize};
+    if ((old_size + kPageSize - 1) / kPageSize != pages) {
+      auto hashes{std::make_unique_for_overwrite<uint64_t[]>(pages)};
+      std::memcpy(hashes.get(), region.hashes.get(),
+                  common / kPageSize * sizeof(uint64_t));
+      region.hashes = std::move(hashes);
+    }
+    return;
+  }
+
+  if (!region.spilled)
+    ram_bytes = ram_bytes + size - old_size;
+  size_t mapped_size{region.data.get_deleter().mapped_size};
+  if (mapped_size && size <= mapped_size && !region.spilled)
+    return;
+
+  if (mapped_size && (!region.spilled || size < old_size)) {
+    size_t new_mapped_size{
+        region.spilled
+            ? size
+            : (size + BufferAllocator::kHugePageSize - 1) /
+                  BufferAllocator::kHugePageSize *
+                  BufferAllocator::kHugePageSize};
+    void *mapping{mremap(region.data.get(), mapped_size, new_mapped_size,
+                         MREMAP_MAYMOVE)};
+    if (mapping != MAP_FAILED) {
+      region.data.release();
+      region.data = Buffer(static_cast<char *>(mapping),
+                           BufferAllocator::Deleter{new_mapped_size});
+      return;
+    }
+  }
+
+  Buffer buffer{region.spilled ? MapScratch(size)
+                               : BufferAllocator::Allocate(size)};
+  std::memcpy(buffer.get(), region.data.get(), common);
+  region.data = std::move(buffer);
+}
@@ -0,0 +1,180 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief SnapshotStore header
+
+ A header that contains the definition of SnapshotStore class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_SNAPSHOTSTORE_H_
+#define MEMORYACCESSOR_SRC_SNAPSHOTSTORE_H_
+
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bufferallocator.h"
+#include "segmentinfo.h"
+
+/*!
+ \brief A class that stores copies of memory segments.
+
+ This class keeps the data of readable memory segments between iterations of
+ "diff". Copies are keyed by address range and sorted by start address. When
+ the maps change, the store is updated with one linear pass: regions with the
+ same range keep their buffers (and are updated in place), regions with the
+ same start and another end are resized in place, new ranges get new buffers,
+ and regions that disappeared are retired. Retired regions are kept
+ until the new data is compared to them and then released.
+
+ Copies are allocated by BufferAllocator, so big ones are backed by huge
+ pages when possible.
+
+ In hash mode, regions keep a 64-bit hash of every page instead of a copy.
+ Full copies are kept only for "hot" pages, which changed recently; their
+ number is limited by kMaxHotPages.
+
+ With a memory budget, copies that do not fit in it are mapped from unlinked
+ scratch files, so the kernel can write them back to disk instead of keeping
+ them in RAM. Rebalance keeps the hottest regions (by the schedule of their
+ blocks) in RAM and spills the coldest ones.
+*/
+class SnapshotStore {
+public:
+  constexpr static size_t kPageSize{0x1000}; //!< Size of a hashed page.
+  constexpr static size_t kBlockSize{
+      0x100000}; //!< Size of blocks that are scheduled for reading together.
+  constexpr static size_t kMaxHotPages{
+      0x1000}; //!< Maximum amount of hot pages in hash mode.
+
+  /*!
+   \brief Ex: A scratch file cannot be created
+
+   This exception is thrown when a copy has to be spilled, but a scratch file
+   cannot be created, resized or mapped.
+  */
+  class ScratchFileEx : public std::exception {
+    /*!
+     \brief "what" function of the exception.
+     \return C-string descripting the exception.
+    */
+    virtual const char *what() const noexcept override {
+      return "Error in creating a scratch file";
+    }
+  };
+
+  using Buffer = BufferAllocator::Buffer; //!< Copy of a segment.
+
+  /*!
+   \brief A struct that represents when a block of a region should be read.
+  */
+  struct Block {
+    uint64_t next_pass{0}; //!< Number of the pass to read the block on.
+    uint32_t period{1};    //!< Amount of passes between reads.
+  };
+
+  /*!
+   \brief A struct that represents a stored copy of one segment.
+  */
+  struct Region {
+    size_t start{0};       //!< Start address.
+    size_t end{0};         //!< End address.
+    size_t num{0};         //!< Number of the segment in the latest maps.
+    bool valid{false};     //!< If the data is fully read.
+    size_t valid_end{0};   //!< End of the valid data (less than end if grown).
+    bool fresh{true};      //!< If the buffer is new in this update.
+    Buffer data;           //!< Copy of the segment.
+    bool spilled{false};   //!< If the copy is in a scratch file.
+    std::unique_ptr<uint64_t[]> hashes; //!< Hashes of pages (hash mode).
+    std::vector<Block> blocks;          //!< Schedule of blocks of the region.
+  };
+
+  /*!
+   \brief A struct that represents a copy of a recently changed page.
+  */
+  struct HotPage {
+    std::unique_ptr<char[]> data; //!< Copy of the page.
+    uint64_t last_change;         //!< Iteration the page changed last time.
+  };
+
+  void Update(const std::vector<SegmentInfo> &segment_infos) noexcept(false);
+  void ReleaseRetired() noexcept;
+  void Reset() noexcept;
+
+  void SetHashMode(bool hash_mode) noexcept;
+  void SetBudget(size_t budget, const std::string &scratch_dir) noexcept;
+
+  /*!
+   \brief Get the directory for scratch files.
+   \return Path of the directory.
+  */
+  const std::string &ScratchDir() const noexcept { return scratch_dir_; }
+
+  void Rebalance() noexcept(false);
+  void AdviseSpilled() const noexcept;
+
+  /*!
+   \brief Check if hashes are stored instead of copies.
+   \return true if hash mode is on.
+  */
+  bool HashMode() const noexcept { return hash_mode_; }
+
+  HotPage *FindHotPage(size_t address) noexcept;
+  HotPage *AddHotPage(size_t address, uint64_t iteration) noexcept;
+  void AgeHotPages(uint64_t iteration, uint64_t max_age) noexcept;
+
+  /*!
+   \brief Get amount of hot pages.
+   \return Number of pages with full copies in hash mode.
+  */
+  size_t HotPagesCount() const noexcept { return hot_pages_.size(); }
+
+  /*!
+   \brief Get regions in the latest layout.
+   \return A reference to std::vector of regions sorted by start address.
+  */
+  std::vector<Region> &Regions() noexcept { return regions_; }
+
+  /*!
+   \brief Get regions that disappeared in the latest update.
+   \return A reference to std::vector of regions sorted by start address.
+  */
+  const std::vector<Region> &Retired() const noexcept { return retired_; }
+
+  size_t StoredBytes() const noexcept;
+  size_t SpilledBytes() const noexcept;
+
+private:
+  Buffer Allocate(size_t size, size_t &ram_bytes, bool &spilled) const
+      noexcept(false);
+  Buffer MapScratch(size_t size) const noexcept(false);
+  void Resize(Region &region, size_t end, size_t &ram_bytes) noexcept(false);
+
+  std::vector<Region> regions_; //!< Regions in the latest layout.
+  std::vector<Region> retired_; //!< Regions that are not in the layout anymore.
+  std::unordered_map<size_t, HotPage>
+      hot_pages_;          //!< Copies of hot pages by their addresses.
+  bool hash_mode_{false}; //!< If hashes are stored instead of copies.
+  size_t budget_{0};       //!< Maximum size of copies in RAM, 0 is none.
+  std::string scratch_dir_; //!< Directory for scratch files.
+};
+
+#endif // MEMORYACCESSOR_SRC_SNAPSHOTSTORE_H_
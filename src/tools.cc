@@ -24,14 +24,23 @@
 #include "tools.h"
 
 #include <signal.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 /*!
  \brief Attach handler to SIGINT signal.
@@ -304,3 +313,139 @@ Tools::FindDifferencesOfLen(const char *old_str, const char *new_str,
     return result;
   return {};
 }
+
+/*!
+ \brief Calculate a 64-bit hash of a block of memory.
+ \param [in] data Pointer to the block.
+ \param [in] size Size of the block.
+ \return Hash of the block.
+
+ The block is read by 8-byte words that are mixed into 4 independent lanes
+ (xor, multiplication and shift), so the work of the lanes overlaps in CPU.
+ Every step is reversible, so a change of one word always changes its lane.
+ The lanes are combined at the end. The hash is fast, but not cryptographic.
+*/
+uint64_t Tools::HashBlock(const char *data, size_t size) const noexcept {
+  constexpr uint64_t kMultiplier{0x9e3779b97f4a7c15};
+  uint64_t lanes[4]{size, size ^ 0x243f6a8885a308d3, size ^ 0x13198a2e03707344,
+                    size ^ 0xa4093822299f31d0};
+  uint64_t words[4];
+
+  size_t pos{0};
+  for (; pos + sizeof(words) <= size; pos += sizeof(words)) {
+    std::memcpy(words, data + pos, sizeof(words));
+    for (uint8_t k{0}; k < 4; k++) {
+      lanes[k] = (lanes[k] ^ words[k]) * kMultiplier;
+      lanes[k] ^= lanes[k] >> 32;
+    }
+  }
+
+  for (; pos < size; pos += sizeof(uint64_t)) {
+    words[0] = 0;
+    std::memcpy(words, data + pos, std::min(sizeof(uint64_t), size - pos));
+    lanes[0] = (lanes[0] ^ words[0]) * kMultiplier;
+    lanes[0] ^= lanes[0] >> 32;
+  }
+
+  uint64_t result{lanes[0]};
+  for (uint8_t k{1}; k < 4; k++) {
+    result = (result ^ lanes[k]) * kMultiplier;
+    result ^= result >> 29;
+  }
+  return result;
+}
+
+/*!
+ \brief Get the peak resident set size of the program.
+ \return Maximum amount of RAM used by the program in bytes, 0 on error.
+*/
+size_t Tools::PeakRss() const noexcept {
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return static_cast<size_t>(usage.ru_maxrss) * 0x400; // in KiB on Linux
+}
+
+/*!
+ \brief Read a whole buffer from a file at an offset.
+ \param [in] fd File descriptor.
+ \param [out] data The buffer.
+ \param [in] size Size of the buffer.
+ \param [in] offset Offset in the file.
+ \return true on success.
+
+ Reads that are interrupted by a signal or done in part are continued.
+*/
+bool Tools::PreadAll(int fd, char *data, size_t size,
+                     uint64_t offset) noexcept {
+  while (size) {
+    ssize_t ret_size{pread(fd, data, size, static_cast<off_t>(offset))};
+    if (ret_size < 0 && errno == EINTR)
+      continue;
+    if (ret_size <= 0)
+      return false;
+    data += ret_size;
+    size -= static_cast<size_t>(ret_size);
+    offset += static_cast<size_t>(ret_size);
+  }
+  return true;
+}
+
+/*!
+ \brief Write a whole buffer to a file at an offset.
+ \param [in] fd File descriptor.
+ \param [in] data The buffer.
+ \param [in] size Size of the buffer.
+ \param [in] offset Offset in the file.
+ \return true on success.
+
+ Writes that are interrupted by a signal or done in part are continued.
+*/
+bool Tools::PwriteAll(int fd, const char *data, size_t size,
+                      uint64_t offset) noexcept {
+  while (size) {
+    ssize_t ret_size{pwrite(fd, data, size, static_cast<off_t>(offset))};
+    if (ret_size < 0 && errno == EINTR)
+      continue;
+    if (ret_size <= 0)
+      return false;
+    data += ret_size;
+    size -= static_cast<size_t>(ret_size);
+    offset += static_cast<size_t>(ret_size);
+  }
+  return true;
+}
+
+/*!
+ \brief Write buffers to a file at an offset.
+ \param [in] fd File descriptor.
+ \param [in,out] iov Buffers (changed by partial writes).
+ \param [in] offset Offset in the file.
+ \return true on success.
+
+ The buffers are written by IOV_MAX at a time, so any amount of them can be
+ passed.
+*/
+bool Tools::PwritevAll(int fd, std::vector<iovec> &iov,
+                       uint64_t offset) noexcept {
+  for (size_t i{0}; i < iov.size();) {
+    ssize_t ret_size{pwritev(fd, iov.data() + i,
+                             static_cast<int>(std::min<size_t>(
+                                 iov.size() - i, IOV_MAX)),
+                             static_cast<off_t>(offset))};
+    if (ret_size < 0 && errno == EINTR)
+      continue;
+    if (ret_size <= 0)
+      return false;
+    offset += static_cast<size_t>(ret_size);
+    for (size_t left{static_cast<size_t>(ret_size)}; left;) {
+      size_t amount{std::min(left, iov[i].iov_len)};
+      iov[i].iov_base = static_cast<char *>(iov[i].iov_base) + amount;
+      iov[i].iov_len -= amount;
+      left -= amount;
+      if (!iov[i].iov_len)
+        i++;
+    }
+  }
+  return true;
+}
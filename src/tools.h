@@ -25,12 +25,15 @@
 #define MEMORYACCESSOR_SRC_TOOLS_H_
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <array>
+#include <cstdint>
 #include <cstdio>
 #include <memory>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 /*!
  \brief A struct with various tools that are independent or depend on operating
@@ -40,7 +43,8 @@
  project, but cannot be attributed to any existing category. These functions do
  not depend on any parts of the program. The struct includes such functionality
  as working with signals (SIGINT), getting terminal window size, making shell
- commands, comparing memory arrays and so on.
+ commands, comparing memory arrays, reading and writing whole buffers of files
+ and so on.
 */
 class Tools {
 public:
@@ -68,6 +72,15 @@ public:
   std::array<std::unique_ptr<char[]>, 2>
   FindDifferencesOfLen(const char *old_str, const char *new_str, size_t str_len,
                        size_t &done, const size_t &len) const noexcept;
+  uint64_t HashBlock(const char *data, size_t size) const noexcept;
+  size_t PeakRss() const noexcept;
+
+  static bool PreadAll(int fd, char *data, size_t size,
+                       uint64_t offset) noexcept;
+  static bool PwriteAll(int fd, const char *data, size_t size,
+                        uint64_t offset) noexcept;
+  static bool PwritevAll(int fd, std::vector<iovec> &iov,
+                         uint64_t offset) noexcept;
 
 private:
   const std::string kModes{"rwxs"}; //!< Permissions that give 1 while decoding
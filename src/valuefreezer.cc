@@ -0,0 +1,342 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+/*!
+ \file
+ \brief ValueFreezer source
+
+  A source that contains the realization of ValueFreezer class.
+*/
+
+#include "valuefreezer.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace memoryaccessor_valuefreezer_src {
+
+/*!
+ \brief Get the time of CLOCK_MONOTONIC.
+ \return The time in ns.
+*/
+uint64_t Now() noexcept {
+  timespec time{};
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return static_cast<uint64_t>(time.tv_sec) * 1000000000 +
+         static_cast<uint64_t>(time.tv_nsec);
+}
+
+/*!
+ \brief Convert ns to timespec.
+ \param [in] ns Time in ns.
+ \return The time as timespec.
+*/
+timespec ToTimespec(uint64_t ns) noexcept {
+  return {static_cast<time_t>(ns / 1000000000),
+          static_cast<long>(ns % 1000000000)};
+}
+
+} // namespace memoryaccessor_valuefreezer_src
+
+/*!
+ \brief Destroy the object, stopping the timer thread.
+*/
+ValueFreezer::~ValueFreezer() noexcept { Stop(); }
+
+/*!
+ \brief Freeze a value, or change the value at an address.
+ \param [in] pid PID of the process.
+ \param [in] address Address of the value.
+ \param [in] data Bytes to write on every tick.
+ \param [in] text Type and value to show in the list.
+ \param [in] period Period of ticks for all values in ns (at least
+ kMinPeriod).
+ \return true on success, false if kMaxValues values are frozen already.
+ \throw TimerEx If the timer thread is not started and a timerfd or an eventfd
+ cannot be created.
+ \throw std::bad_alloc If memory cannot be allocated.
+ \throw std::system_error If the thread cannot be started.
+
+ If values of another process are frozen, or the process exited, they are
+ unfrozen first. The timer is restarted if the period changes. /proc/PID/mem
+ is opened for values in pages that are not writable; if it cannot be opened,
+ such values fail.
+*/
+bool ValueFreezer::Freeze(pid_t pid, size_t address, const std::string &data,
+                          const std::string &text,
+                          uint64_t period) noexcept(false) {
+  period = std::max(period, kMinPeriod);
+  bool exited{false};
+  GetStats(exited);
+  if (Active() && (pid != pid_ || exited))
+    Stop();
+
+  if (!Active()) {
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    event_fd_ = eventfd(0, EFD_CLOEXEC);
+    if (timer_fd_ < 0 || event_fd_ < 0) {
+      Stop();
+      throw TimerEx();
+    }
+    mem_fd_ = open(("/proc/" + std::to_string(pid) + "/mem").c_str(),
+                   O_RDWR | O_CLOEXEC);
+    pid_ = pid;
+    period_ = 0;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it{std::lower_bound(
+        values_.begin(), values_.end(), address,
+        [](const Value &value, size_t address) {
+          return value.address < address;
+        })};
+    if (it != values_.end() && it->address == address) {
+      it->data = data;
+      it->text = text;
+    } else {
+      if (values_.size() >= kMaxValues)
+        return false;
+      values_.insert(it, {address, data, text});
+    }
+    Build();
+    if (period != period_) {
+      period_ = period;
+      Arm();
+    }
+  }
+
+  if (!thread_.joinable()) {
+    try {
+      thread_ = std::thread(&ValueFreezer::Run, this);
+    } catch (...) {
+      Stop();
+      throw;
+    }
+  }
+  return true;
+}
+
+/*!
+ \brief Unfreeze a value.
+ \param [in] address Address of the value.
+ \return true if the value was frozen.
+
+ If no values are left, the thread is stopped.
+*/
+bool ValueFreezer::Unfreeze(size_t address) noexcept {
+  bool empty{false};
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it{std::find_if(
+        values_.begin(), values_.end(),
+        [address](const Value &value) { return value.address == address; })};
+    if (it == values_.end())
+      return false;
+    values_.erase(it);
+    Build();
+    empty = values_.empty();
+  }
+  if (empty)
+    Stop();
+  return true;
+}
+
+/*!
+ \brief Unfreeze all values and stop the thread.
+
+ Statistics are reset.
+*/
+void ValueFreezer::Stop() noexcept {
+  if (thread_.joinable()) {
+    uint64_t one{1};
+    while (write(event_fd_, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+    thread_.join();
+  }
+  for (int *fd : {&timer_fd_, &event_fd_, &mem_fd_}) {
+    if (*fd >= 0)
+      close(*fd);
+    *fd = -1;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  values_.clear();
+  Build();
+  stats_ = Stats();
+  exited_ = false;
+}
+
+/*!
+ \brief Get frozen values.
+ \return Copies of values sorted by address.
+ \throw std::bad_alloc If memory cannot be allocated.
+*/
+std::vector<ValueFreezer::Value> ValueFreezer::Values() const noexcept(false) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return values_;
+}
+
+/*!
+ \brief Get the amount of frozen values.
+ \return Amount of values.
+*/
+size_t ValueFreezer::Size() const noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return values_.size();
+}
+
+/*!
+ \brief Get statistics of ticks.
+ \param [out] exited true if the process exited, so the thread ended.
+ \return A copy of the statistics.
+*/
+ValueFreezer::Stats ValueFreezer::GetStats(bool &exited) const noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  exited = exited_;
+  return stats_;
+}
+
+/*!
+ \brief Start the timer from now with the current period.
+
+ The 1st expiration is one period later, the timer is absolute. Has to be
+ called with the mutex locked.
+*/
+void ValueFreezer::Arm() noexcept {
+  using memoryaccessor_valuefreezer_src::Now;
+  using memoryaccessor_valuefreezer_src::ToTimespec;
+
+  start_ = Now() + period_;
+  expirations_ = 0;
+  itimerspec spec{ToTimespec(period_), ToTimespec(start_)};
+  timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+/*!
+ \brief Build blocks of process_vm_writev for the values.
+
+ Has to be called with the mutex locked.
+*/
+void ValueFreezer::Build() noexcept {
+  local_.resize(values_.size());
+  remote_.resize(values_.size());
+  size_ = 0;
+  for (size_t i{0}; i < values_.size(); i++) {
+    Value &value{values_[i]};
+    local_[i] = {value.data.data(), value.data.size()};
+    remote_[i] = {reinterpret_cast<void *>(value.address), value.data.size()};
+    size_ += value.data.size();
+  }
+}
+
+/*!
+ \brief Body of the timer thread.
+
+ Wait for expirations of the timer or the eventfd (to stop). On every wakeup,
+ the delay since the latest expiration is added to the statistics and all
+ values are written by Tick. The thread ends when the process exits.
+*/
+void ValueFreezer::Run() noexcept {
+  using memoryaccessor_valuefreezer_src::Now;
+
+  prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+  pollfd fds[2]{{timer_fd_, POLLIN, 0}, {event_fd_, POLLIN, 0}};
+  for (;;) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (fds[1].revents)
+      return;
+
+    uint64_t expirations{0};
+    if (read(timer_fd_, &expirations, sizeof(expirations)) !=
+            sizeof(expirations) ||
+        !expirations)
+      continue;
+    uint64_t now{Now()};
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    expirations_ += expirations;
+    uint64_t scheduled{start_ + (expirations_ - 1) * period_};
+    uint64_t jitter{now > scheduled ? now - scheduled : 0};
+    stats_.ticks++;
+    stats_.missed += expirations - 1;
+    stats_.jitter_sum += jitter;
+    stats_.jitter_max = std::max(stats_.jitter_max, jitter);
+    stats_.jitter_last = jitter;
+    if (!Tick())
+      stats_.failed++;
+    if (exited_)
+      return;
+  }
+}
+
+/*!
+ \brief Write all values.
+ \return true if all values are written.
+
+ Has to be called with the mutex locked. Values after the one that fails in
+ process_vm_writev are written through /proc/PID/mem one by one. If the
+ process does not exist, exited_ is set.
+*/
+bool ValueFreezer::Tick() noexcept {
+  if (values_.empty())
+    return true;
+  ssize_t ret_size{process_vm_writev(pid_, local_.data(), local_.size(),
+                                     remote_.data(), remote_.size(), 0)};
+  if (ret_size >= 0 && static_cast<size_t>(ret_size) == size_)
+    return true;
+  if (ret_size < 0 && errno == ESRCH) {
+    exited_ = true;
+    return false;
+  }
+
+  size_t done_amount{ret_size > 0 ? static_cast<size_t>(ret_size) : 0};
+  bool result{true};
+  for (const Value &value : values_) {
+    if (done_amount >= value.data.size()) {
+      done_amount -= value.data.size();
+      continue;
+    }
+    done_amount = 0;
+    if (mem_fd_ < 0 ||
+        pwrite(mem_fd_, value.data.data(), value.data.size(),
+               static_cast<off_t>(value.address)) !=
+            static_cast<ssize_t>(value.data.size()))
+      result = false;
+  }
+  return result;
+}
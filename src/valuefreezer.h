@@ -0,0 +1,168 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+/*!
+ \file
+ \brief ValueFreezer header
+
+ A header that contains the definition of ValueFreezer class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_VALUEFREEZER_H_
+#define MEMORYACCESSOR_SRC_VALUEFREEZER_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*!
+ \brief A class that holds values in memory of a process by a timer thread.
+
+ While any value is frozen, a thread waits for a periodic timerfd and on every
+ tick writes all values by one call of process_vm_writev (a value that fails
+ there, e.g. in a page that is not writable, is written through /proc/PID/mem).
+ The timer is absolute, so ticks do not drift, and the timer slack of the
+ thread is minimal. For every tick, the delay between the scheduled time and
+ the time the thread woke up is measured as jitter, and expirations that were
+ missed are counted.
+
+ The thread does not use MemoryAccessor: it has its own PID and descriptor of
+ /proc/PID/mem, so the console can change PID while values are frozen. The
+ values and statistics are guarded by a mutex.
+*/
+class ValueFreezer {
+public:
+  constexpr static size_t kMaxValues{
+      1024}; //!< Maximum amount of values (one call of process_vm_writev).
+  constexpr static uint64_t kMinPeriod{
+      10000}; //!< Minimum period of ticks in ns.
+
+  /*!
+   \brief Ex: The timer thread cannot be started
+
+   This exception is thrown when a timerfd or an eventfd cannot be created or
+   /proc/PID/mem cannot be opened.
+  */
+  class TimerEx : public std::exception {
+    /*!
+     \brief "what" function of the exception.
+     \return C-string descripting the exception.
+    */
+    virtual const char *what() const noexcept override {
+      return "Error in starting the timer of frozen values";
+    }
+  };
+
+  /*!
+   \brief A struct that represents a frozen value.
+  */
+  struct Value {
+    size_t address;   //!< Address of the value.
+    std::string data; //!< Bytes written on every tick.
+    std::string text; //!< Type and value as they were given.
+  };
+
+  /*!
+   \brief A struct with statistics of ticks.
+  */
+  struct Stats {
+    uint64_t ticks{0};       //!< Amount of ticks done.
+    uint64_t missed{0};      //!< Amount of expirations missed between ticks.
+    uint64_t failed{0};      //!< Amount of ticks with a failed write.
+    uint64_t jitter_sum{0};  //!< Sum of delays of ticks in ns.
+    uint64_t jitter_max{0};  //!< Maximum delay of a tick in ns.
+    uint64_t jitter_last{0}; //!< Delay of the latest tick in ns.
+  };
+
+  ValueFreezer() noexcept = default;
+
+  /*!
+   \brief Copy constructor (deleted).
+   \param [in] origin ValueFreezer instance to copy from.
+
+   Create a new object by copying an old one. Prohibited.
+  */
+  ValueFreezer(const ValueFreezer &origin) = delete;
+
+  /*!
+   \brief Copy-assignment operator (deleted).
+   \param [in] origin ValueFreezer instance to copy from.
+
+   Assign an object by copying other object. Prohibited.
+  */
+  ValueFreezer &operator=(const ValueFreezer &origin) = delete;
+
+  ~ValueFreezer() noexcept;
+
+  bool Freeze(pid_t pid, size_t address, const std::string &data,
+              const std::string &text, uint64_t period) noexcept(false);
+  bool Unfreeze(size_t address) noexcept;
+  void Stop() noexcept;
+
+  /*!
+   \brief Check if values are frozen.
+   \return true if the timer thread is started.
+  */
+  bool Active() const noexcept { return thread_.joinable(); }
+
+  /*!
+   \brief Get PID of the process values are frozen in.
+   \return The PID, valid if Active() is true.
+  */
+  pid_t Pid() const noexcept { return pid_; }
+
+  /*!
+   \brief Get the period of ticks.
+   \return The period in ns, valid if Active() is true.
+  */
+  uint64_t Period() const noexcept { return period_; }
+
+  std::vector<Value> Values() const noexcept(false);
+  size_t Size() const noexcept;
+  Stats GetStats(bool &exited) const noexcept;
+
+private:
+  void Arm() noexcept;
+  void Build() noexcept;
+  void Run() noexcept;
+  bool Tick() noexcept;
+
+  pid_t pid_{0};        //!< PID of the process.
+  uint64_t period_{0};  //!< Period of ticks in ns.
+  int timer_fd_{-1};    //!< Descriptor of the timerfd.
+  int event_fd_{-1};    //!< Descriptor of the eventfd that stops the thread.
+  int mem_fd_{-1};      //!< Descriptor of /proc/PID/mem.
+  std::thread thread_;  //!< The timer thread.
+
+  mutable std::mutex mutex_;  //!< Mutex guarding the fields below.
+  std::vector<Value> values_; //!< Frozen values sorted by address.
+  std::vector<iovec> local_;  //!< Local blocks of the values.
+  std::vector<iovec> remote_; //!< Remote blocks of the values.
+  size_t size_{0};            //!< Sum of sizes of the values.
+  uint64_t start_{0};   //!< Time of the 1st expiration (CLOCK_MONOTONIC, ns).
+  uint64_t expirations_{0}; //!< Expirations since start_.
+  Stats stats_;             //!< Statistics of ticks.
+  bool exited_{false};      //!< If the process exited and the thread ended.
+};
+
+#endif // MEMORYACCESSOR_SRC_VALUEFREEZER_H_
@@ -0,0 +1,302 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+/*!
+ \file
+ \brief Watchpoint source
+
+ A source that contains the realization of Watchpoint class.
+*/
+
+#include "watchpoint.h"
+
+#include <dirent.h>
+#include <linux/hw_breakpoint.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace memoryaccessor_watchpoint_src {
+
+/*!
+ \brief Get the size of a page.
+ \return The size in bytes.
+*/
+size_t PageSize() noexcept {
+  static const size_t page_size{static_cast<size_t>(sysconf(_SC_PAGESIZE))};
+  return page_size;
+}
+
+/*!
+ \brief Copy bytes from a ring buffer.
+ \param [out] dest Buffer to copy to.
+ \param [in] data Data of the ring buffer.
+ \param [in] size Size of the data (a power of 2).
+ \param [in] offset Offset of the bytes, may be bigger than size.
+ \param [in] amount Amount of bytes.
+
+ The bytes may wrap around the end of the data.
+*/
+void CopyRing(void *dest, const unsigned char *data, size_t size,
+              uint64_t offset, size_t amount) noexcept {
+  size_t start{static_cast<size_t>(offset & (size - 1))};
+  size_t first{std::min(amount, size - start)};
+  std::memcpy(dest, data + start, first);
+  std::memcpy(static_cast<unsigned char *>(dest) + first, data, amount - first);
+}
+
+} // namespace memoryaccessor_watchpoint_src
+
+/*!
+ \brief Destroy the object, removing breakpoints.
+*/
+Watchpoint::~Watchpoint() noexcept { Close(); }
+
+/*!
+ \brief Check if a range can be watched by a breakpoint.
+ \param [in] address Address of the range.
+ \param [in] length Length of the range.
+ \return true if length is 1, 2, 4 or 8 and address is aligned to it.
+*/
+bool Watchpoint::Valid(size_t address, size_t length) noexcept {
+  return (length == 1 || length == 2 || length == 4 || length == 8) &&
+         address % length == 0;
+}
+
+/*!
+ \brief Install breakpoints on all threads of a process.
+ \param [in] pid PID of the process.
+ \param [in] address Address of the range.
+ \param [in] length Length of the range (see Valid).
+ \param [in] read true to catch reads too, false to catch only writes.
+ \throw BreakpointEx If the range is not valid or no thread gets a breakpoint.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Previous breakpoints are removed. The CPU does not catch only reads, so reads
+ are caught with writes.
+*/
+void Watchpoint::Open(pid_t pid, size_t address, size_t length,
+                      bool read) noexcept(false) {
+  Close();
+  if (!Valid(address, length))
+    throw BreakpointEx();
+
+  pid_ = pid;
+  address_ = address;
+  length_ = length;
+  read_ = read;
+  if (!Rescan() || threads_.empty()) {
+    Close();
+    throw BreakpointEx();
+  }
+}
+
+/*!
+ \brief Install breakpoints on threads that appeared.
+ \return true on success, false if threads of the process cannot be listed
+ (e.g. the process exited).
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Threads are listed by /proc/PID/task. A thread that does not get a breakpoint
+ is skipped.
+*/
+bool Watchpoint::Rescan() noexcept(false) {
+  DIR *dir{opendir(("/proc/" + std::to_string(pid_) + "/task").c_str())};
+  if (!dir)
+    return false;
+
+  std::vector<pid_t> tids;
+  try {
+    while (dirent *entry{readdir(dir)}) {
+      pid_t tid{static_cast<pid_t>(std::atoi(entry->d_name))};
+      if (tid > 0)
+        tids.push_back(tid);
+    }
+  } catch (...) {
+    closedir(dir);
+    throw;
+  }
+  closedir(dir);
+
+  threads_.reserve(threads_.size() + tids.size());
+  for (pid_t tid : tids) {
+    auto it{std::lower_bound(
+        threads_.begin(), threads_.end(), tid,
+        [](const Thread &thread, pid_t tid) { return thread.tid < tid; })};
+    if (it == threads_.end() || it->tid != tid)
+      Add(tid);
+  }
+  return true;
+}
+
+/*!
+ \brief Remove all breakpoints.
+
+ Lost samples are reset.
+*/
+void Watchpoint::Close() noexcept {
+  while (!threads_.empty())
+    Remove(threads_.size() - 1);
+  lost_ = 0;
+}
+
+/*!
+ \brief Wait until samples are ready or a thread ends.
+ \param [in] timeout Maximum time to wait in ms, -1 to wait infinitely.
+ \return true if samples are ready or a thread ended, false on timeout or
+ when a signal is caught.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Threads that ended are marked, so Collect removes them.
+*/
+bool Watchpoint::Wait(int timeout) noexcept(false) {
+  std::vector<pollfd> fds(threads_.size());
+  for (size_t i{0}; i < threads_.size(); i++)
+    fds[i] = {threads_[i].fd, POLLIN, 0};
+  if (poll(fds.data(), fds.size(), timeout) <= 0)
+    return false;
+  for (size_t i{0}; i < threads_.size(); i++)
+    if (fds[i].revents & (POLLHUP | POLLERR))
+      threads_[i].ended = true;
+  return true;
+}
+
+/*!
+ \brief Collect samples of all threads.
+ \param [out] hits Vector to append accesses to, in order of threads.
+ \throw std::bad_alloc If memory cannot be allocated. Samples that are not
+ appended stay in ring buffers.
+
+ Ring buffers are emptied, and threads that ended are removed.
+*/
+void Watchpoint::Collect(std::vector<Hit> &hits) noexcept(false) {
+  for (size_t i{threads_.size()}; i > 0; i--) {
+    Drain(threads_[i - 1], hits);
+    if (threads_[i - 1].ended)
+      Remove(i - 1);
+  }
+}
+
+/*!
+ \brief Install a breakpoint on a thread.
+ \param [in] tid Thread ID.
+ \return true on success, false if the perf event cannot be created or its
+ ring buffer cannot be mapped.
+
+ Every access is sampled, the thread is woken up by every sample. Accesses in
+ the kernel are not caught.
+*/
+bool Watchpoint::Add(pid_t tid) noexcept {
+  using memoryaccessor_watchpoint_src::PageSize;
+
+  perf_event_attr attr{};
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_BREAKPOINT;
+  attr.bp_type = read_ ? HW_BREAKPOINT_RW : HW_BREAKPOINT_W;
+  attr.bp_addr = address_;
+  attr.bp_len = length_;
+  attr.sample_period = 1;
+  attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID;
+  attr.wakeup_events = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  int fd{static_cast<int>(syscall(SYS_perf_event_open, &attr, tid, -1, -1,
+                                  PERF_FLAG_FD_CLOEXEC))};
+  if (fd < 0)
+    return false;
+  void *ring{mmap(nullptr, (1 + kDataPages) * PageSize(),
+                  PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)};
+  if (ring == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  auto it{std::lower_bound(
+      threads_.begin(), threads_.end(), tid,
+      [](const Thread &thread, pid_t tid) { return thread.tid < tid; })};
+  threads_.insert(it, {tid, fd, static_cast<unsigned char *>(ring), false});
+  return true;
+}
+
+/*!
+ \brief Remove the breakpoint of a thread.
+ \param [in] num Number of the thread in threads_.
+*/
+void Watchpoint::Remove(size_t num) noexcept {
+  using memoryaccessor_watchpoint_src::PageSize;
+
+  munmap(threads_[num].ring, (1 + kDataPages) * PageSize());
+  close(threads_[num].fd);
+  threads_.erase(threads_.begin() + num);
+}
+
+/*!
+ \brief Read samples from the ring buffer of a thread.
+ \param [in,out] thread The thread.
+ \param [out] hits Vector to append accesses to.
+ \throw std::bad_alloc If memory cannot be allocated. Samples that are not
+ appended stay in the ring buffer.
+
+ The kernel writes records at data_head, the reader frees them by moving
+ data_tail. Records of lost samples are counted.
+*/
+void Watchpoint::Drain(Thread &thread, std::vector<Hit> &hits) noexcept(false) {
+  using memoryaccessor_watchpoint_src::CopyRing;
+  using memoryaccessor_watchpoint_src::PageSize;
+
+  perf_event_mmap_page *page{
+      reinterpret_cast<perf_event_mmap_page *>(thread.ring)};
+  const unsigned char *data{thread.ring + PageSize()};
+  size_t size{kDataPages * PageSize()};
+  uint64_t head{__atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE)};
+  uint64_t tail{page->data_tail};
+
+  struct {
+    perf_event_header header;
+    uint64_t first;  // IP of a sample, ID of a lost record
+    uint32_t second; // PID of a sample, low half of the amount of lost ones
+    uint32_t third;  // TID of a sample, high half of the amount of lost ones
+  } record;
+  while (tail < head) {
+    CopyRing(&record.header, data, size, tail, sizeof(record.header));
+    if (record.header.size < sizeof(record.header))
+      break;
+    size_t amount{std::min<size_t>(record.header.size, sizeof(record))};
+    CopyRing(&record, data, size, tail, amount);
+
+    if (record.header.type == PERF_RECORD_SAMPLE && amount == sizeof(record))
+      hits.push_back({record.first, static_cast<pid_t>(record.third)});
+    else if (record.header.type == PERF_RECORD_LOST &&
+             amount == sizeof(record))
+      lost_ += record.second | static_cast<uint64_t>(record.third) << 32;
+    tail += record.header.size;
+    __atomic_store_n(&page->data_tail, tail, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&page->data_tail, head, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,141 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+/*!
+ \file
+ \brief Watchpoint header
+
+ A header that contains the definition of Watchpoint class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_WATCHPOINT_H_
+#define MEMORYACCESSOR_SRC_WATCHPOINT_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+/*!
+ \brief A class that catches accesses to a range by hardware breakpoints.
+
+ Every thread of a process gets a perf event of type PERF_TYPE_BREAKPOINT
+ (a debug register of the CPU) that samples every access with the instruction
+ pointer and the thread ID into a ring buffer mapped to memory. Nothing is
+ done while the range is not accessed: the caller waits for the descriptors of
+ the events and collects samples when they are ready.
+
+ Events are per thread, since ring buffers of events inherited by new threads
+ cannot be mapped, so threads started after Open are added by Rescan. On x86
+ the CPU traps after the accessing instruction, so the instruction pointer is
+ the one of the next instruction.
+*/
+class Watchpoint {
+public:
+  constexpr static size_t kDataPages{
+      8}; //!< Pages of the ring buffer of a thread (a power of 2).
+
+  /*!
+   \brief Ex: Hardware breakpoints cannot be installed
+
+   This exception is thrown when the range is not valid for a breakpoint or no
+   thread of the process gets one (perf_event_open is not permitted or not
+   supported, or all debug registers are used).
+  */
+  class BreakpointEx : public std::exception {
+    /*!
+     \brief "what" function of the exception.
+     \return C-string descripting the exception.
+    */
+    virtual const char *what() const noexcept override {
+      return "Error in installing hardware breakpoints";
+    }
+  };
+
+  /*!
+   \brief A struct that represents an access to the range.
+  */
+  struct Hit {
+    uint64_t ip; //!< Instruction pointer of the thread.
+    pid_t tid;   //!< Thread ID.
+  };
+
+  Watchpoint() noexcept = default;
+
+  /*!
+   \brief Copy constructor (deleted).
+   \param [in] origin Watchpoint instance to copy from.
+
+   Create a new object by copying an old one. Prohibited.
+  */
+  Watchpoint(const Watchpoint &origin) = delete;
+
+  /*!
+   \brief Copy-assignment operator (deleted).
+   \param [in] origin Watchpoint instance to copy from.
+
+   Assign an object by copying other object. Prohibited.
+  */
+  Watchpoint &operator=(const Watchpoint &origin) = delete;
+
+  ~Watchpoint() noexcept;
+
+  static bool Valid(size_t address, size_t length) noexcept;
+  void Open(pid_t pid, size_t address, size_t length,
+            bool read) noexcept(false);
+  bool Rescan() noexcept(false);
+  void Close() noexcept;
+  bool Wait(int timeout) noexcept(false);
+  void Collect(std::vector<Hit> &hits) noexcept(false);
+
+  /*!
+   \brief Get the amount of watched threads.
+   \return Amount of threads with a breakpoint.
+  */
+  size_t Threads() const noexcept { return threads_.size(); }
+
+  /*!
+   \brief Get the amount of lost accesses.
+   \return Amount of samples dropped because a ring buffer was full.
+  */
+  uint64_t Lost() const noexcept { return lost_; }
+
+private:
+  /*!
+   \brief A struct that represents a watched thread.
+  */
+  struct Thread {
+    pid_t tid;            //!< Thread ID.
+    int fd;               //!< Descriptor of the perf event.
+    unsigned char *ring;  //!< Mapped ring buffer (a header page and data).
+    bool ended;           //!< If the thread ended.
+  };
+
+  bool Add(pid_t tid) noexcept;
+  void Remove(size_t num) noexcept;
+  void Drain(Thread &thread, std::vector<Hit> &hits) noexcept(false);
+
+  pid_t pid_{0};          //!< PID of the process.
+  size_t address_{0};     //!< Address of the range.
+  size_t length_{0};      //!< Length of the range.
+  bool read_{false};      //!< If reads are caught too.
+  std::vector<Thread> threads_; //!< Watched threads sorted by ID.
+  uint64_t lost_{0};            //!< Amount of lost samples.
+};
+
+#endif // MEMORYACCESSOR_SRC_WATCHPOINT_H_
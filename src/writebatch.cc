@@ -0,0 +1,334 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief WriteBatch source
+
+  A source that contains the realization of WriteBatch class.
+*/
+
+#include "writebatch.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+#include "memoryaccessor.h"
+#include "segmentinfo.h"
+#include "writejournal.h"
+
+/*!
+ \brief Queue a write.
+ \param [in] address Address to write to.
+ \param [in] src Data to write.
+ \param [in] length Length of the data.
+ \throw std::bad_alloc If memory for the data cannot be allocated.
+
+ Copy the data to the buffer of the batch. Empty writes are ignored.
+*/
+void WriteBatch::Add(size_t address, const char *src,
+                     size_t length) noexcept(false) {
+  if (!length)
+    return;
+  entries_.push_back({address, data_.size(), length});
+  try {
+    data_.insert(data_.end(), src, src + length);
+  } catch (...) {
+    entries_.pop_back();
+    throw;
+  }
+}
+
+/*!
+ \brief Write all queued data.
+ \param [in] memory_accessor MemoryAccessor with PID set and /proc/PID/mem
+ opened by OpenSharedMem.
+ \return Amount of writes that were fully done.
+
+ Pass writes to process_vm_writev by groups of up to kMaxVector. It stops on
+ the first write that fails, so that write is retried by
+ MemoryAccessor::WriteShared and the next group starts after it. The field
+ "done" of every entry is set. The batch is not cleared.
+*/
+size_t WriteBatch::Apply(const MemoryAccessor &memory_accessor) noexcept {
+  size_t result{0};
+  for (size_t first{0}; first < entries_.size();) {
+    size_t count{std::min(kMaxVector, entries_.size() - first)};
+    for (size_t i{0}; i < count; i++) {
+      const Entry &entry{entries_[first + i]};
+      local_[i] = {data_.data() + entry.offset, entry.length};
+      remote_[i] = {reinterpret_cast<void *>(entry.address), entry.length};
+    }
+
+    size_t done_amount{
+        memory_accessor.WriteVector(local_.data(), remote_.data(), count)};
+    size_t num{first};
+    for (; num < first + count && done_amount >= entries_[num].length; num++) {
+      done_amount -= entries_[num].length;
+      entries_[num].done = true;
+      result++;
+    }
+
+    if (num < first + count) { // the write that failed
+      Entry &entry{entries_[num]};
+      entry.done = memory_accessor.WriteShared(data_.data() + entry.offset,
+                                               entry.address,
+                                               entry.length) == entry.length;
+      if (entry.done)
+        result++;
+      num++;
+    }
+    first = num;
+  }
+  return result;
+}
+
+/*!
+ \brief Forget all queued writes.
+
+ The buffer keeps its capacity for the next writes.
+*/
+void WriteBatch::Clear() noexcept {
+  data_.clear();
+  entries_.clear();
+  failed_ = SIZE_MAX;
+}
+
+/*!
+ \brief Merge overlapping and adjacent writes.
+ \throw std::bad_alloc If memory for the new buffer cannot be allocated (the
+ batch is not changed then).
+
+ Entries become ranges sorted by address that neither overlap nor touch. Where
+ writes overlap, the data of the one added later is kept.
+*/
+void WriteBatch::Coalesce() noexcept(false) {
+  std::vector<size_t> order(entries_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+    return entries_[a].address < entries_[b].address;
+  });
+
+  std::vector<Entry> ranges;
+  size_t size{0};
+  for (size_t num : order) {
+    const Entry &entry{entries_[num]};
+    if (!ranges.empty() &&
+        entry.address <= ranges.back().address + ranges.back().length) {
+      Entry &range{ranges.back()};
+      size_t end{std::max(range.address + range.length,
+                          entry.address + entry.length)};
+      size += end - range.address - range.length;
+      range.length = end - range.address;
+    } else {
+      ranges.push_back({entry.address, size, entry.length});
+      size += entry.length;
+    }
+  }
+
+  // data is copied in order of adding, so later writes overwrite earlier ones
+  std::vector<char> data(size);
+  for (const Entry &entry : entries_) {
+    const Entry &range{*std::prev(std::upper_bound(
+        ranges.begin(), ranges.end(), entry.address,
+        [](size_t address, const Entry &range) {
+          return address < range.address;
+        }))};
+    std::memcpy(data.data() + range.offset + (entry.address - range.address),
+                data_.data() + entry.offset, entry.length);
+  }
+  data_.swap(data);
+  entries_.swap(ranges);
+}
+
+/*!
+ \brief Check that all writes can be committed.
+ \param [in] segment_infos Segments of the process sorted by start address.
+ \param [out] entry Number of the first entry with a problem.
+ \return The problem of the entry, or kNone if all writes are in readable
+ segments.
+
+ A range may cross boundaries of adjacent segments. Segments have to be
+ readable for pre-images and the read-back, but not writable: such pages are
+ written through /proc/PID/mem.
+*/
+WriteBatch::Problem
+WriteBatch::Validate(const std::vector<SegmentInfo> &segment_infos,
+                     size_t &entry) const noexcept {
+  for (entry = 0; entry < entries_.size(); entry++) {
+    size_t address{entries_[entry].address},
+        end{address + entries_[entry].length};
+    auto it{std::partition_point(
+        segment_infos.begin(), segment_infos.end(),
+        [address](const SegmentInfo &info) { return info.end <= address; })};
+    for (; address < end; address = it->end, it++) {
+      if (it == segment_infos.end() || it->start > address)
+        return Problem::kNotMapped;
+      if (!(it->mode & 0b1000))
+        return Problem::kNotReadable;
+    }
+  }
+  return Problem::kNone;
+}
+
+/*!
+ \brief Write all queued data as a transaction.
+ \param [in] memory_accessor MemoryAccessor with PID set and /proc/PID/mem
+ opened by OpenSharedMem.
+ \param [in,out] journal WriteJournal to record the batch to before it is
+ written, default is nullptr (not recorded).
+ \return Return code, 0 is success, 1 means that a pre-image could not be read
+ (nothing is written), 2 means that a write failed or its data was not read
+ back, and pre-images were restored (and read back), 3 means that restoring
+ failed too.
+ \throw WriteJournal::JournalFileEx If the batch cannot be recorded to the
+ journal file (nothing is written).
+ \throw std::bad_alloc If memory for pre-images cannot be allocated.
+
+ Pre-images and read-back data are read by groups of up to kMaxVector ranges,
+ like Apply writes them. Failed() gives the first entry that failed. The batch
+ should be coalesced, so that no write overwrites another one.
+*/
+uint8_t WriteBatch::Commit(const MemoryAccessor &memory_accessor,
+                           WriteJournal *journal) noexcept(false) {
+  failed_ = SIZE_MAX;
+  old_data_.resize(data_.size());
+  check_data_.resize(data_.size());
+  if (Read(memory_accessor, old_data_) != entries_.size())
+    return 1;
+  if (journal)
+    Record(memory_accessor.GetPid(), *journal, false);
+
+  Apply(memory_accessor);
+  if (std::all_of(entries_.begin(), entries_.end(),
+                  [](const Entry &entry) { return entry.done; }) &&
+      Read(memory_accessor, check_data_) == entries_.size() &&
+      check_data_ == data_)
+    return 0;
+
+  for (size_t num{0}; num < entries_.size() && failed_ == SIZE_MAX; num++) {
+    const Entry &entry{entries_[num]};
+    if (!entry.done || std::memcmp(check_data_.data() + entry.offset,
+                                   data_.data() + entry.offset,
+                                   entry.length) != 0)
+      failed_ = num;
+  }
+  // a range whose write failed may fail again, so the result is read back too
+  data_.swap(old_data_);
+  Apply(memory_accessor);
+  bool restored{Read(memory_accessor, check_data_) == entries_.size() &&
+                check_data_ == data_};
+  data_.swap(old_data_);
+  return restored ? 2 : 3;
+}
+
+/*!
+ \brief Record all queued writes to a journal before they are applied.
+ \param [in] memory_accessor MemoryAccessor with PID set and /proc/PID/mem
+ opened by OpenSharedMem.
+ \param [in,out] journal The journal.
+ \param [in] continued true if the batch is a piece of the previous write.
+ \return Return code, 0 is success, 1 means that old bytes could not be read
+ (nothing is recorded).
+ \throw WriteJournal::JournalFileEx If the batch cannot be recorded to the
+ journal file.
+ \throw std::bad_alloc If memory for old bytes cannot be allocated.
+
+ Old bytes are read like pre-images of Commit, and the writes are recorded in
+ order of adding as one write, so the batch should be applied right after.
+*/
+uint8_t WriteBatch::Journal(const MemoryAccessor &memory_accessor,
+                            WriteJournal &journal,
+                            bool continued) noexcept(false) {
+  old_data_.resize(data_.size());
+  if (Read(memory_accessor, old_data_) != entries_.size())
+    return 1;
+  Record(memory_accessor.GetPid(), journal, continued);
+  return 0;
+}
+
+/*!
+ \brief Read memory at all queued ranges.
+ \param [in] memory_accessor MemoryAccessor with PID set and /proc/PID/mem
+ opened by OpenSharedMem.
+ \param [out] data Buffer of Bytes() bytes, data of an entry is read at its
+ offset.
+ \return Amount of entries that were fully read.
+
+ Ranges are read by process_vm_readv like Apply writes them, a range that
+ fails there is read through /proc/PID/mem. For a failed entry, the field
+ "done" is reset.
+*/
+size_t WriteBatch::Read(const MemoryAccessor &memory_accessor,
+                        std::vector<char> &data) noexcept {
+  size_t result{0};
+  for (size_t first{0}; first < entries_.size();) {
+    size_t count{std::min(kMaxVector, entries_.size() - first)};
+    for (size_t i{0}; i < count; i++) {
+      const Entry &entry{entries_[first + i]};
+      local_[i] = {data.data() + entry.offset, entry.length};
+      remote_[i] = {reinterpret_cast<void *>(entry.address), entry.length};
+    }
+
+    size_t done_amount{
+        memory_accessor.ReadVector(local_.data(), remote_.data(), count)};
+    size_t num{first};
+    for (; num < first + count && done_amount >= entries_[num].length; num++) {
+      done_amount -= entries_[num].length;
+      result++;
+    }
+
+    if (num < first + count) { // the read that failed
+      Entry &entry{entries_[num]};
+      if (memory_accessor.ReadShared(data.data() + entry.offset, entry.address,
+                                     entry.length) == entry.length)
+        result++;
+      else
+        entry.done = false;
+      num++;
+    }
+    first = num;
+  }
+  return result;
+}
+
+/*!
+ \brief Record the queued writes with their pre-images to a journal.
+ \param [in] pid PID of the process.
+ \param [in,out] journal The journal.
+ \param [in] continued true if the first write is a piece of the previous
+ write.
+ \throw WriteJournal::JournalFileEx If a write cannot be recorded to the
+ journal file.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ All writes but the first are recorded as pieces of it.
+*/
+void WriteBatch::Record(pid_t pid, WriteJournal &journal,
+                        bool continued) const noexcept(false) {
+  for (size_t num{0}; num < entries_.size(); num++) {
+    const Entry &entry{entries_[num]};
+    journal.Add(pid, entry.address, old_data_.data() + entry.offset,
+                data_.data() + entry.offset, entry.length,
+                continued || num != 0);
+  }
+}
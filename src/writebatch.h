@@ -0,0 +1,135 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief WriteBatch header
+
+ A header that contains the definition of WriteBatch class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_WRITEBATCH_H_
+#define MEMORYACCESSOR_SRC_WRITEBATCH_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "memoryaccessor.h"
+#include "segmentinfo.h"
+
+class WriteJournal;
+
+/*!
+ \brief A class that collects writes to memory and applies them at once.
+
+ Data of all writes is kept in one buffer. On Apply, up to kMaxVector writes
+ are passed to one call of process_vm_writev. A write that fails there (e.g.,
+ because the page is not writable by the process) is retried through
+ /proc/PID/mem, and the vectored writing continues from the next one.
+
+ A batch can also be committed as a transaction: writes are coalesced into
+ ranges, validated against segments, pre-images of the ranges are saved by
+ vectored reads, and after Apply the ranges are read back the same way. If a
+ write fails or the read-back data differs, the pre-images are written back.
+
+ If a WriteJournal is given, pre-images are recorded to it as one write before
+ anything is written, so the batch can be undone like a "write".
+*/
+class WriteBatch {
+public:
+  constexpr static size_t kMaxVector{
+      1024}; //!< Maximum amount of writes in one call of process_vm_writev.
+
+  /*!
+   \brief A struct that represents one queued write.
+  */
+  struct Entry {
+    size_t address;   //!< Address to write to.
+    size_t offset;    //!< Offset of the data in the buffer.
+    size_t length;    //!< Length of the data.
+    bool done{false}; //!< If the data was fully written by the latest Apply.
+  };
+
+  /*!
+   \brief A problem of a write found by Validate.
+  */
+  enum class Problem : uint8_t {
+    kNone,        //!< The write can be done.
+    kNotMapped,   //!< A part of the range is not in any segment.
+    kNotReadable, //!< A part of the range is in a segment that is not readable.
+  };
+
+  void Add(size_t address, const char *src, size_t length) noexcept(false);
+  size_t Apply(const MemoryAccessor &memory_accessor) noexcept;
+  void Clear() noexcept;
+  void Coalesce() noexcept(false);
+  Problem Validate(const std::vector<SegmentInfo> &segment_infos,
+                   size_t &entry) const noexcept;
+  uint8_t Commit(const MemoryAccessor &memory_accessor,
+                 WriteJournal *journal = nullptr) noexcept(false);
+  uint8_t Journal(const MemoryAccessor &memory_accessor, WriteJournal &journal,
+                  bool continued) noexcept(false);
+
+  /*!
+   \brief Get the number of the entry that failed the latest Commit.
+   \return The number, or SIZE_MAX if no entry failed.
+  */
+  size_t Failed() const noexcept { return failed_; }
+
+  /*!
+   \brief Get amount of queued bytes.
+   \return Sum of lengths of entries.
+  */
+  size_t Bytes() const noexcept { return data_.size(); }
+
+  /*!
+   \brief Check if no writes are queued.
+   \return true if the batch is empty.
+  */
+  bool Empty() const noexcept { return entries_.empty(); }
+
+  /*!
+   \brief Get amount of queued writes.
+   \return Number of entries.
+  */
+  size_t Size() const noexcept { return entries_.size(); }
+
+  /*!
+   \brief Get queued writes.
+   \return A reference to std::vector of entries in order of adding.
+  */
+  const std::vector<Entry> &Entries() const noexcept { return entries_; }
+
+private:
+  size_t Read(const MemoryAccessor &memory_accessor,
+              std::vector<char> &data) noexcept;
+  void Record(pid_t pid, WriteJournal &journal,
+              bool continued) const noexcept(false);
+
+  std::vector<char> data_;               //!< Data of all writes.
+  std::vector<char> old_data_;           //!< Pre-images of Commit.
+  std::vector<char> check_data_;         //!< Read-back data of Commit.
+  size_t failed_{SIZE_MAX};              //!< Entry that failed Commit.
+  std::vector<Entry> entries_;           //!< Queued writes.
+  std::array<iovec, kMaxVector> local_;  //!< Local blocks of one call.
+  std::array<iovec, kMaxVector> remote_; //!< Remote blocks of one call.
+};
+
+#endif // MEMORYACCESSOR_SRC_WRITEBATCH_H_
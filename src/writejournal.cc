@@ -0,0 +1,335 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+/*!
+ \file
+ \brief WriteJournal source
+
+  A source that contains the realization of WriteJournal class.
+*/
+
+#include "writejournal.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "blockcodec.h"
+#include "writebatch.h"
+#include "tools.h"
+
+/*!
+ \brief Destroy the object, closing the journal file.
+*/
+WriteJournal::~WriteJournal() noexcept { Close(); }
+
+/*!
+ \brief Open a journal file, creating it if it does not exist.
+ \param [in] path Path of the file.
+ \throw JournalFileEx If the file cannot be opened, created or read, or it is
+ not a journal.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Records kept before are dropped. Records of the file are loaded, and writes
+ undone by undo records are dropped. A partly written record at the end of the
+ file is cut off.
+*/
+void WriteJournal::Open(const std::string &path) noexcept(false) {
+
+  Close();
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  struct stat file_stat;
+  if (fd_ < 0 || fstat(fd_, &file_stat) != 0) {
+    Close();
+    throw JournalFileEx();
+  }
+  path_ = path;
+
+  try {
+    Header header{};
+    uint64_t size{static_cast<uint64_t>(file_stat.st_size)};
+    if (size == 0) {
+      std::memcpy(header.magic, kMagic, sizeof(kMagic));
+      header.version = kVersion;
+      if (!Tools::PwriteAll(fd_, reinterpret_cast<const char *>(&header),
+                            sizeof(header), 0))
+        throw JournalFileEx();
+      size = sizeof(header);
+    } else if (size < sizeof(header) ||
+               !Tools::PreadAll(fd_, reinterpret_cast<char *>(&header),
+                                sizeof(header), 0) ||
+               std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+               header.version != kVersion)
+      throw JournalFileEx();
+
+    uint64_t offset{sizeof(header)};
+    Record record;
+    while (offset + sizeof(RecordHeader) <= size &&
+           Tools::PreadAll(fd_, reinterpret_cast<char *>(&record.header),
+                           sizeof(RecordHeader), offset)) {
+      uint64_t end{offset + sizeof(RecordHeader) + record.header.old_size +
+                   record.header.delta_size};
+      if (end > size || end < offset)
+        break;
+      if (record.header.flags & kUndo) {
+        for (uint64_t i{0}; i < record.header.length; i++)
+          PopWrite();
+      } else {
+        record.offset = offset + sizeof(RecordHeader);
+        records_.push_back(record);
+        if (!(record.header.flags & kContinued))
+          writes_++;
+        stored_size_ += record.header.old_size + record.header.delta_size;
+        raw_size_ += record.header.length;
+      }
+      offset = end;
+    }
+    if (offset != size && ftruncate(fd_, static_cast<off_t>(offset)) != 0)
+      throw JournalFileEx();
+    file_size_ = offset;
+  } catch (...) {
+    Close();
+    throw;
+  }
+}
+
+/*!
+ \brief Close the journal file and drop all records.
+*/
+void WriteJournal::Close() noexcept {
+  if (fd_ >= 0)
+    close(fd_);
+  fd_ = -1;
+  path_.clear();
+  file_size_ = 0;
+  data_.clear();
+  records_.clear();
+  writes_ = 0;
+  stored_size_ = raw_size_ = 0;
+}
+
+/*!
+ \brief Record a write before it is done.
+ \param [in] pid PID of the process.
+ \param [in] address Address of the write.
+ \param [in] old_data Bytes at the address before the write.
+ \param [in] new_data Bytes to write.
+ \param [in] length Length of the write.
+ \param [in] continued true if it is a piece of the previous write.
+ \throw JournalFileEx If the record cannot be written to the file (the file is
+ not changed then).
+ \throw std::bad_alloc If memory cannot be allocated.
+*/
+void WriteJournal::Add(pid_t pid, size_t address, const char *old_data,
+                       const char *new_data, size_t length,
+                       bool continued) noexcept(false) {
+
+  delta_.resize(length);
+  for (size_t i{0}; i < length; i++)
+    delta_[i] = static_cast<char>(old_data[i] ^ new_data[i]);
+
+  Record record{};
+  record.header.address = address;
+  record.header.length = length;
+  record.header.old_size = length;
+  record.header.delta_size = length;
+  record.header.old_codec = BlockCodec::Codec::kStored;
+  record.header.delta_codec = BlockCodec::Codec::kStored;
+  record.header.flags = continued ? kContinued : 0;
+  record.header.pid = static_cast<uint32_t>(pid);
+  const char *old_stored{old_data}, *delta_stored{delta_.data()};
+  if (length >= kCompactSize && length < kMaxCompactSize &&
+      BlockCodec::Best() != BlockCodec::Codec::kStored) {
+    BlockCodec::Codec codec{BlockCodec::Best()};
+    size_t bound{BlockCodec::Bound(length)};
+    compressed_.resize(2 * bound);
+    size_t size{BlockCodec::Compress(codec, old_data, length,
+                                     compressed_.data())};
+    if (size && size < length) {
+      record.header.old_codec = codec;
+      record.header.old_size = size;
+      old_stored = compressed_.data();
+    }
+    size = BlockCodec::Compress(codec, delta_.data(), length,
+                                compressed_.data() + bound);
+    if (size && size < length) {
+      record.header.delta_codec = codec;
+      record.header.delta_size = size;
+      delta_stored = compressed_.data() + bound;
+    }
+  }
+
+  size_t stored{record.header.old_size + record.header.delta_size};
+  record.offset = fd_ < 0 ? data_.size() : file_size_ + sizeof(RecordHeader);
+  records_.push_back(record);
+  try {
+    if (fd_ < 0) {
+      data_.insert(data_.end(), old_stored,
+                   old_stored + record.header.old_size);
+      data_.insert(data_.end(), delta_stored,
+                   delta_stored + record.header.delta_size);
+    } else if (!Tools::PwriteAll(fd_,
+                                 reinterpret_cast<const char *>(&record.header),
+                                 sizeof(RecordHeader), file_size_) ||
+               !Tools::PwriteAll(fd_, old_stored, record.header.old_size,
+                                 record.offset) ||
+               !Tools::PwriteAll(fd_, delta_stored, record.header.delta_size,
+                                 record.offset + record.header.old_size))
+      throw JournalFileEx();
+  } catch (...) {
+    records_.pop_back();
+    if (fd_ < 0)
+      data_.resize(record.offset);
+    else
+      Cut();
+    throw;
+  }
+
+  if (fd_ >= 0)
+    file_size_ = record.offset + stored;
+  if (!continued)
+    writes_++;
+  stored_size_ += stored;
+  raw_size_ += length;
+}
+
+/*!
+ \brief Load bytes of a record.
+ \param [in] record The record.
+ \param [out] old_data Buffer of record.header.length bytes for old bytes.
+ \param [out] new_data Buffer of record.header.length bytes for new bytes, or
+ nullptr if they are not needed.
+ \throw JournalFileEx If the bytes cannot be read or decompressed.
+ \throw std::bad_alloc If memory cannot be allocated.
+*/
+void WriteJournal::Load(const Record &record, char *old_data,
+                        char *new_data) const noexcept(false) {
+
+  const RecordHeader &header{record.header};
+  std::vector<char> buffer;
+  const char *stored{data_.data() + record.offset};
+  if (fd_ >= 0) {
+    buffer.resize(header.old_size + (new_data ? header.delta_size : 0));
+    if (!Tools::PreadAll(fd_, buffer.data(), buffer.size(), record.offset))
+      throw JournalFileEx();
+    stored = buffer.data();
+  }
+
+  if (!BlockCodec::Decompress(header.old_codec, stored, header.old_size,
+                              old_data, header.length))
+    throw JournalFileEx();
+  if (!new_data)
+    return;
+  if (!BlockCodec::Decompress(header.delta_codec, stored + header.old_size,
+                              header.delta_size, new_data, header.length))
+    throw JournalFileEx();
+  for (size_t i{0}; i < header.length; i++)
+    new_data[i] ^= old_data[i];
+}
+
+/*!
+ \brief Queue writes that undo the latest writes.
+ \param [in] writes Amount of writes to undo.
+ \param [in] pid PID of the process memory of which is restored.
+ \param [out] batch WriteBatch to add writes of old bytes to.
+ \return Amount of writes queued, less than writes if the journal has less
+ writes or a write to another process is reached.
+ \throw JournalFileEx If the bytes cannot be read or decompressed.
+ \throw std::bad_alloc If memory cannot be allocated.
+
+ Records are added from the latest one, so if the batch is applied in order
+ (or coalesced), the oldest bytes of every address are written.
+*/
+size_t WriteJournal::Inverse(size_t writes, pid_t pid,
+                             WriteBatch &batch) const noexcept(false) {
+  std::vector<char> old_data;
+  size_t queued{0};
+  for (size_t num{records_.size()};
+       num > 0 && queued < writes &&
+       records_[num - 1].header.pid == static_cast<uint32_t>(pid);
+       num--) {
+    const Record &record{records_[num - 1]};
+    old_data.resize(record.header.length);
+    Load(record, old_data.data(), nullptr);
+    batch.Add(record.header.address, old_data.data(), record.header.length);
+    if (!(record.header.flags & kContinued))
+      queued++;
+  }
+  return queued;
+}
+
+/*!
+ \brief Drop the latest writes after they are undone.
+ \param [in] writes Amount of writes.
+ \throw JournalFileEx If the undo record cannot be written to the file (no
+ write is dropped then).
+*/
+void WriteJournal::Drop(size_t writes) noexcept(false) {
+
+  writes = std::min(writes, writes_);
+  if (fd_ >= 0) {
+    RecordHeader header{};
+    header.length = writes;
+    header.old_codec = BlockCodec::Codec::kStored;
+    header.delta_codec = BlockCodec::Codec::kStored;
+    header.flags = kUndo;
+    if (!Tools::PwriteAll(fd_, reinterpret_cast<const char *>(&header),
+                          sizeof(header), file_size_)) {
+      Cut();
+      throw JournalFileEx();
+    }
+    file_size_ += sizeof(header);
+  }
+  for (size_t i{0}; i < writes; i++)
+    PopWrite();
+}
+
+/*!
+ \brief Cut off a partly written record at the end of the file.
+
+ If the file cannot be truncated, the record is cut off by Open, as it is
+ shorter than its header says.
+*/
+void WriteJournal::Cut() noexcept {
+  if (ftruncate(fd_, static_cast<off_t>(file_size_)) != 0)
+    return;
+}
+
+/*!
+ \brief Drop records of the latest write.
+*/
+void WriteJournal::PopWrite() noexcept {
+  while (!records_.empty()) {
+    Record record{records_.back()};
+    records_.pop_back();
+    stored_size_ -= record.header.old_size + record.header.delta_size;
+    raw_size_ -= record.header.length;
+    if (fd_ < 0)
+      data_.resize(record.offset);
+    if (!(record.header.flags & kContinued)) {
+      writes_--;
+      return;
+    }
+  }
+}
@@ -0,0 +1,195 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+/*!
+ \file
+ \brief WriteJournal header
+
+ A header that contains the definition of WriteJournal class.
+*/
+
+#ifndef MEMORYACCESSOR_SRC_WRITEJOURNAL_H_
+#define MEMORYACCESSOR_SRC_WRITEJOURNAL_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "blockcodec.h"
+#include "writebatch.h"
+
+/*!
+ \brief A class that records writes to memory so they can be undone.
+
+ Every write is recorded with the PID, its address, the old bytes and the new
+ bytes before it is done. The new bytes are kept as the XOR of old and new
+ bytes, which is mostly zeros for a patch, and both parts of a write of
+ kCompactSize bytes or more are compressed by BlockCodec when it makes them
+ smaller.
+
+ Records are kept in memory, or appended to a journal file opened by Open:
+ - Header: magic and version;
+ - RecordHeader of every record followed by the old bytes and the XOR part.
+
+ A write that spans several segments is recorded by pieces, and pieces after
+ the first one are flagged as continued, so the write is undone as a whole.
+ Undone writes are dropped from memory, and the file gets a record flagged as
+ undo with the amount of writes, so the file is only appended to and gives the
+ same writes when it is opened again.
+*/
+class WriteJournal {
+public:
+  constexpr static char kMagic[8]{'M', 'A', 'J', 'O',
+                                  'U', 'R', '\r', '\n'}; //!< File magic.
+  constexpr static uint32_t kVersion{1}; //!< Version of the format.
+  constexpr static size_t kCompactSize{
+      0x100}; //!< Minimum size of a write that is compressed.
+  constexpr static size_t kMaxCompactSize{
+      0x40000000}; //!< Size of a write from which it is not compressed.
+  constexpr static uint8_t kContinued{1}; //!< Flag of a continued piece.
+  constexpr static uint8_t kUndo{2};      //!< Flag of an undo record.
+
+  /*!
+   \brief Ex: A journal file cannot be written or read
+
+   This exception is thrown when a journal file cannot be created, written or
+   read, or it is not a valid journal.
+  */
+  class JournalFileEx : public std::exception {
+    /*!
+     \brief "what" function of the exception.
+     \return C-string descripting the exception.
+    */
+    virtual const char *what() const noexcept override {
+      return "Error in writing or reading a journal file";
+    }
+  };
+
+  /*!
+   \brief Header of a journal file.
+  */
+  struct Header {
+    char magic[8];     //!< kMagic.
+    uint32_t version;  //!< kVersion.
+    uint32_t reserved; //!< Zero.
+  };
+
+  /*!
+   \brief Header of a record.
+  */
+  struct RecordHeader {
+    uint64_t address;    //!< Address of the write.
+    uint64_t length;     //!< Length of the write (or amount of undone writes).
+    uint64_t old_size;   //!< Size of stored old bytes.
+    uint64_t delta_size; //!< Size of the stored XOR of old and new bytes.
+    BlockCodec::Codec old_codec;   //!< Codec of old bytes.
+    BlockCodec::Codec delta_codec; //!< Codec of the XOR part.
+    uint8_t flags;                 //!< kContinued, kUndo.
+    uint8_t reserved;              //!< Zero.
+    uint32_t pid;                  //!< PID of the process.
+  };
+
+  /*!
+   \brief A struct that represents a recorded piece of a write.
+  */
+  struct Record {
+    RecordHeader header; //!< The header.
+    uint64_t offset;     //!< Offset of stored bytes in the file or buffer.
+  };
+
+  WriteJournal() noexcept = default;
+
+  /*!
+   \brief Copy constructor (deleted).
+   \param [in] origin WriteJournal instance to copy from.
+
+   Create a new object by copying an old one. Prohibited.
+  */
+  WriteJournal(const WriteJournal &origin) = delete;
+
+  /*!
+   \brief Copy-assignment operator (deleted).
+   \param [in] origin WriteJournal instance to copy from.
+
+   Assign an object by copying other object. Prohibited.
+  */
+  WriteJournal &operator=(const WriteJournal &origin) = delete;
+
+  ~WriteJournal() noexcept;
+
+  void Open(const std::string &path) noexcept(false);
+  void Close() noexcept;
+
+  /*!
+   \brief Get the path of the journal file.
+   \return The path, or an empty string if records are kept in memory.
+  */
+  const std::string &Path() const noexcept { return path_; }
+
+  void Add(pid_t pid, size_t address, const char *old_data,
+           const char *new_data, size_t length, bool continued) noexcept(false);
+
+  /*!
+   \brief Get recorded pieces of writes.
+   \return A reference to std::vector of records in order of writes.
+  */
+  const std::vector<Record> &Records() const noexcept { return records_; }
+
+  /*!
+   \brief Get the amount of recorded writes.
+   \return Amount of records that are not continued.
+  */
+  size_t Writes() const noexcept { return writes_; }
+
+  /*!
+   \brief Get the amount of stored bytes.
+   \return Sum of stored sizes of all records.
+  */
+  uint64_t StoredSize() const noexcept { return stored_size_; }
+
+  /*!
+   \brief Get the amount of recorded bytes.
+   \return Sum of lengths of all records.
+  */
+  uint64_t RawSize() const noexcept { return raw_size_; }
+
+  void Load(const Record &record, char *old_data,
+            char *new_data) const noexcept(false);
+  size_t Inverse(size_t writes, pid_t pid,
+                 WriteBatch &batch) const noexcept(false);
+  void Drop(size_t writes) noexcept(false);
+
+private:
+  void Cut() noexcept;
+  void PopWrite() noexcept;
+
+  std::string path_;             //!< Path of the journal file.
+  int fd_{-1};                   //!< Descriptor of the file, -1 if in memory.
+  uint64_t file_size_{0};        //!< Size of the file.
+  std::vector<char> data_;       //!< Stored bytes of records kept in memory.
+  std::vector<char> delta_;      //!< Buffer for the XOR part.
+  std::vector<char> compressed_; //!< Buffer for compressed bytes.
+  std::vector<Record> records_;  //!< Records of writes that are not undone.
+  size_t writes_{0};             //!< Amount of writes that are not undone.
+  uint64_t stored_size_{0};      //!< Sum of stored sizes of records.
+  uint64_t raw_size_{0};         //!< Sum of lengths of records.
+};
+
+#endif // MEMORYACCESSOR_SRC_WRITEJOURNAL_H_
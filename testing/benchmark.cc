@@ -0,0 +1,128 @@
+//    MemoryAccessor - A tool for accessing /proc/PID/mem
+//    Copyright (C) 2024  zloymish
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/*!
+ \file
+ \brief Benchmark source
+
+  A source that measures the speed of comparing copies of memory in buffers
+  backed by 4 KiB pages and by huge pages.
+
+  Usage: benchmark [size in MiB] [passes]
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include "bufferallocator.h"
+#include "diffscanner.h"
+
+namespace memoryaccessor_benchmark {
+
+/*!
+ \brief Measure filling and comparing of two buffers.
+ \param [in] size Size of the buffers in bytes.
+ \param [in] passes Amount of passes of comparing.
+ \param [in] huge_pages Back the buffers by huge pages.
+
+ The buffers are compared by DiffScanner::Compare in blocks of
+ DiffScanner::kTaskSize bytes, as "diff" does. One byte in every 64 KiB
+ differs. Print the backing, the speed of the first touch and the best speed of
+ comparing.
+*/
+void Measure(size_t size, uint64_t passes, bool huge_pages) {
+  using Clock = std::chrono::steady_clock;
+  BufferAllocator::Backing backing;
+  auto old_data{BufferAllocator::Allocate(size, huge_pages, &backing)};
+  auto new_data{BufferAllocator::Allocate(size, huge_pages)};
+
+  Clock::time_point begin{Clock::now()};
+  std::memset(old_data.get(), 0x11, size);
+  std::memset(new_data.get(), 0x11, size);
+  double fill_seconds{
+      std::chrono::duration<double>(Clock::now() - begin).count()};
+  for (size_t offset{0}; offset < size; offset += 0x10000)
+    new_data[offset] = 0x22;
+
+  DiffScanner scanner;
+  DiffScanner::Piece piece;
+  double best_seconds{0};
+  for (uint64_t pass{0}; pass < passes; pass++) {
+    begin = Clock::now();
+    for (size_t offset{0}; offset < size; offset += DiffScanner::kTaskSize)
+      scanner.Compare(old_data.get() + offset, new_data.get() + offset,
+                      std::min(DiffScanner::kTaskSize, size - offset), offset,
+                      4, piece);
+    double seconds{
+        std::chrono::duration<double>(Clock::now() - begin).count()};
+    if (!pass || seconds < best_seconds)
+      best_seconds = seconds;
+  }
+
+  double gib{static_cast<double>(size) / 0x40000000};
+  std::cout << std::left << std::setw(24)
+            << BufferAllocator::BackingName(backing) << std::right
+            << std::fixed << std::setprecision(2) << " fill "
+            << std::setw(8) << 2 * gib / fill_seconds << " GiB/s, compare "
+            << std::setw(8) << 2 * gib / best_seconds << " GiB/s"
+            << std::endl;
+}
+
+} // namespace memoryaccessor_benchmark
+
+/*!
+ \brief Main function of the benchmark.
+ \param [in] argc Amount of arguments.
+ \param [in] argv Arguments: size of buffers in MiB (default is 1024) and
+ amount of passes (default is 5).
+ \return Exit code.
+*/
+int main(int argc, char *argv[]) {
+  size_t size{1024};
+  uint64_t passes{5};
+  try {
+    if (argc > 1)
+      size = std::stoull(argv[1]);
+    if (argc > 2)
+      passes = std::stoull(argv[2]);
+  } catch (const std::exception &ex) {
+    std::cerr << "Usage: " << argv[0] << " [size in MiB] [passes]"
+              << std::endl;
+    return 1;
+  }
+  if (!size || !passes) {
+    std::cerr << "Size and passes must be greater than 0." << std::endl;
+    return 1;
+  }
+
+  std::cout << "Comparing 2 x " << size << " MiB, best of " << passes
+            << " passes:" << std::endl;
+  try {
+    memoryaccessor_benchmark::Measure(size * 0x100000, passes, false);
+    memoryaccessor_benchmark::Measure(size * 0x100000, passes, true);
+  } catch (const std::bad_alloc &ex) {
+    std::cerr << "Not enough memory." << std::endl;
+    return 1;
+  }
+  return 0;
+}
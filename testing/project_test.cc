@@ -26,13 +26,17 @@
 #include "project_test.h"
 
 #include <doctest/doctest.h>
+#include <elf.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <algorithm> // std::min
 #include <array>
+#include <atomic>
 #include <bit> // std::bit_width
 #include <cstdint>
 #include <cstdio>
@@ -40,19 +44,40 @@
 #include <fstream>
 #include <ios>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <sstream>
 #include <streambuf>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <unordered_set>
 #include <vector>
 
 #include "argvparser.h"
+#include "blockcodec.h"
+#include "blockreader.h"
+#include "blockwriter.h"
+#include "bufferallocator.h"
 #include "console.h"
+#include "corewriter.h"
+#include "diffevents.h"
+#include "diffscanner.h"
 #include "hexviewer.h"
+#include "mapsdelta.h"
 #include "memoryaccessor.h"
+#include "pageheatmap.h"
+#include "pagerepository.h"
+#include "pointerindex.h"
+#include "regionfilter.h"
 #include "segmentinfo.h"
+#include "snapshotfile.h"
+#include "snapshotstore.h"
 #include "tools.h"
+#include "valuefreezer.h"
+#include "watchpoint.h"
+#include "writebatch.h"
+#include "writejournal.h"
 
 int argc{0};          //!< Number of arguments sent with the program.
 char **argv{nullptr}; //!< Array of arguments sent with the program.
@@ -102,6 +127,26 @@ int main(int argc, char **argv) {
   // Конец заимствования.
 }
 
+namespace memoryaccessor_testing {
+
+/*!
+ \brief Make a segment with the given boundaries.
+ \param [in] start Start address.
+ \param [in] end End address.
+ \return SegmentInfo object.
+
+  Make a SegmentInfo object with the given boundaries and other fields set to
+ zeros.
+*/
+SegmentInfo make_segment(size_t start, size_t end) {
+  SegmentInfo segment_info{};
+  segment_info.start = start;
+  segment_info.end = end;
+  return segment_info;
+}
+
+} // namespace memoryaccessor_testing
+
 TEST_SUITE_BEGIN("Tools");
 
 namespace memoryaccessor_testing::tools {
@@ -345,6 +390,46 @@ TEST_CASE("Find differences: seq length 1") {
   }
 }
 
+TEST_CASE("Hash block") {
+  auto block{std::make_unique<char[]>(0x1000)};
+  uint64_t hash{tools.HashBlock(block.get(), 0x1000)};
+  REQUIRE(tools.HashBlock(block.get(), 0x1000) == hash);
+  REQUIRE(tools.HashBlock(block.get(), 0xfff) != hash);
+
+  for (size_t pos : {0, 1, 31, 32, 0x7ff, 0xfff}) {
+    block[pos] = 1;
+    REQUIRE(tools.HashBlock(block.get(), 0x1000) != hash);
+    block[pos] = 0;
+  }
+
+  std::string s1{"0123456789abc"}, s2{"0123456789abd"};
+  REQUIRE(tools.HashBlock(s1.c_str(), s1.length()) !=
+          tools.HashBlock(s2.c_str(), s2.length()));
+}
+
+TEST_CASE("Peak RSS") { REQUIRE(tools.PeakRss() > 0); }
+
+TEST_CASE("Write and read whole buffers of a file") {
+  std::string path{"/tmp/memoryaccessor_test.tools"};
+  int fd{open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600)};
+  REQUIRE(fd >= 0);
+  unlink(path.c_str());
+
+  std::string head{"head"}, body(0x3000, 'b'), tail{"tail"};
+  REQUIRE(Tools::PwriteAll(fd, head.data(), head.size(), 0x10));
+  std::vector<iovec> iov{{body.data(), body.size()}, {tail.data(), 0},
+                         {tail.data(), tail.size()}};
+  REQUIRE(Tools::PwritevAll(fd, iov, 0x10 + head.size()));
+
+  std::string read(head.size() + body.size() + tail.size(), '\0');
+  REQUIRE(Tools::PreadAll(fd, read.data(), read.size(), 0x10));
+  REQUIRE(read == head + body + tail);
+  // reading past the end of the file fails
+  REQUIRE(!Tools::PreadAll(fd, read.data(), read.size(), 0x11));
+  close(fd);
+  REQUIRE(!Tools::PwriteAll(fd, head.data(), head.size(), 0));
+}
+
 TEST_SUITE_END();
 
 TEST_SUITE_BEGIN("MemoryAccessor");
@@ -437,6 +522,35 @@ TEST_CASE("Address not in segment") {
   }
 }
 
+TEST_CASE("Contiguous size") {
+  auto segment{[](size_t start, size_t end) {
+    SegmentInfo segment_info;
+    segment_info.start = start;
+    segment_info.end = end;
+    return segment_info;
+  }};
+  memory_accessor.Reset();
+  try {
+    memory_accessor.SetPid(getpid());
+    memory_accessor.segment_infos_ = {segment(0x1000, 0x2000),
+                                      segment(0x2000, 0x3000),
+                                      segment(0x4000, 0x5000)};
+    REQUIRE(memory_accessor.ContiguousSize(0x1800, 0x10000) == 0x1800);
+    REQUIRE(memory_accessor.ContiguousSize(0x1800, 0x100) == 0x100);
+    REQUIRE(memory_accessor.ContiguousSize(0x4000, 0x10000) == 0x1000);
+  } catch (...) {
+    REQUIRE(false);
+  }
+  bool thrown{false};
+  try {
+    memory_accessor.ContiguousSize(0x3800, 1);
+  } catch (const MemoryAccessor::AddressNotInSegmentEx &ex) {
+    thrown = true;
+  }
+  REQUIRE(thrown);
+  memory_accessor.Reset();
+}
+
 TEST_CASE("Check segment number: positive") {
   try {
     memory_accessor.SetPid(getpid());
@@ -505,6 +619,48 @@ TEST_CASE("Double Reset") {
   REQUIRE(memory_accessor.special_segment_found_.size() == 0);
 }
 
+TEST_CASE("Maps version: changed by Reset") {
+  try {
+    memory_accessor.SetPid(getpid());
+    memory_accessor.ParseMaps();
+  } catch (...) {
+    REQUIRE(false);
+  }
+
+  uint64_t version{memory_accessor.GetMapsVersion()};
+  memory_accessor.Reset();
+  REQUIRE(memory_accessor.GetMapsVersion() != version);
+}
+
+TEST_CASE("Maps version: new mapping keeps previous segments") {
+  try {
+    memory_accessor.SetPid(getpid());
+    memory_accessor.ParseMaps();
+  } catch (...) {
+    REQUIRE(false);
+  }
+
+  uint64_t version{memory_accessor.GetMapsVersion()};
+  size_t size{memory_accessor.segment_infos_.size()};
+  memory_accessor.ParseMaps(); // the same text, nothing is parsed
+  REQUIRE(memory_accessor.GetMapsVersion() == version);
+
+  void *mapping{mmap(nullptr, 0x3000, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0)};
+  REQUIRE(mapping != MAP_FAILED);
+  memory_accessor.ParseMaps();
+  munmap(mapping, 0x3000);
+
+  REQUIRE(memory_accessor.GetMapsVersion() != version);
+  REQUIRE(memory_accessor.GetPreviousSegmentInfos().size() == size);
+
+  MapsDelta maps_delta;
+  maps_delta.Compute(memory_accessor.GetPreviousSegmentInfos(),
+                     memory_accessor.segment_infos_);
+  REQUIRE(!maps_delta.Empty());
+  memory_accessor.Reset();
+}
+
 namespace memoryaccessor_testing::memoryaccessor {
 
 /*!
@@ -1244,320 +1400,2508 @@ TEST_CASE("Print hex: zero length, show_hex == true") {
 
 TEST_SUITE_END();
 
-TEST_SUITE_BEGIN("Console");
+TEST_SUITE_BEGIN("PointerIndex");
 
-namespace memoryaccessor_testing::console {
+TEST_CASE("Pointer index: find pointers in block") {
+  PointerIndex pointer_index;
+  pointer_index.BeginBuild(
+      {memoryaccessor_testing::make_segment(0x1000, 0x2000),
+       memoryaccessor_testing::make_segment(0x2000, 0x3000),
+       memoryaccessor_testing::make_segment(0x5000, 0x6000)},
+      1, 0);
 
-/*!
- \brief Replace streambuf of stream by one provided in ostringstream.
- \param [in,out] stream Stream to perform replacement.
- \param [in] oss std::ostringstream containing std::streambuf replacement.
- \return Pointer to old std::streambuf of the stream.
+  size_t words[]{0x1008, 0x5, 0x2fff, 0x3000, 0x5000, 0x1008, 0x4000};
+  pointer_index.AddBlock(reinterpret_cast<const char *>(words), sizeof(words),
+                         0x1000);
+  pointer_index.FinishBuild();
 
-  Replace std::streambuf of stream by one provided in std::ostringstream, so all
- data coming from stream will be redirected to std::ostringstream.
-*/
-std::streambuf *replace_streambuf(std::ios &stream,
-                                  const std::ostringstream &oss) {
-  // Заимствование, источник кода:
-  // https://stackoverflow.com/questions/4191089/how-to-unit-test-function-writing-to-stdout-stdcout
-  // Начало заимствования (есть изменения):
-  std::streambuf *p_streambuf = stream.rdbuf();
-  stream.rdbuf(oss.rdbuf());
-  return p_streambuf;
-  // Конец заимствования.
+  REQUIRE(pointer_index.Size() == 4);
+
+  auto [first, last] = pointer_index.Find(0x1008, 1);
+  REQUIRE(last - first == 2);
+  REQUIRE(first->location == 0x1000);
+  REQUIRE((first + 1)->location == 0x1028);
+
+  std::tie(first, last) = pointer_index.Find(0x2000, 0x4000);
+  REQUIRE(last - first == 2);
+  REQUIRE(first->target == 0x2fff);
+  REQUIRE((first + 1)->target == 0x5000);
 }
 
-} // namespace memoryaccessor_testing::console
+TEST_CASE("Pointer index: unaligned block") {
+  PointerIndex pointer_index;
+  pointer_index.BeginBuild(
+      {memoryaccessor_testing::make_segment(0x1000, 0x2000)}, 1, 0);
 
-TEST_CASE("Print name and version: not null") {
-  std::ostringstream oss;
-  std::streambuf *p_cout_streambuf{
-      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+  char block[sizeof(size_t) * 3]{};
+  size_t word{0x1010};
+  std::memcpy(block + sizeof(size_t), &word, sizeof(size_t));
+  pointer_index.AddBlock(block + 4, sizeof(block) - 4, 0x1004);
+  pointer_index.FinishBuild();
 
-  console.PrintNameVer();
-  REQUIRE(oss.str() != "");
+  auto [first, last] = pointer_index.Find(0x1010, 1);
+  REQUIRE(last - first == 1);
+  REQUIRE(first->location == 0x1008);
+}
 
-  std::cout.rdbuf(p_cout_streambuf);
+TEST_CASE("Pointer index: validity") {
+  PointerIndex pointer_index;
+  REQUIRE(!pointer_index.IsValid(0, 0));
+  pointer_index.BeginBuild({}, 1, 2);
+  REQUIRE(!pointer_index.IsValid(1, 2));
+  pointer_index.FinishBuild();
+  REQUIRE(pointer_index.IsValid(1, 2));
+  REQUIRE(!pointer_index.IsValid(1, 3));
+  REQUIRE(!pointer_index.IsValid(2, 2));
+  pointer_index.Reset();
+  REQUIRE(!pointer_index.IsValid(1, 2));
 }
 
-TEST_CASE("Print name and version") {
-  std::ostringstream oss;
-  std::streambuf *p_cout_streambuf{
-      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+TEST_SUITE_END();
 
-  console.PrintNameVer();
-  REQUIRE(oss.str() ==
-          console.kProjectName + " " + console.kProjectVersion + "\n");
+TEST_SUITE_BEGIN("BufferAllocator");
 
-  std::cout.rdbuf(p_cout_streambuf);
+TEST_CASE("Buffer allocator: backings") {
+  BufferAllocator::Backing backing;
+  auto small{BufferAllocator::Allocate(100, true, &backing)};
+  REQUIRE(backing == BufferAllocator::Backing::kHeap);
+  REQUIRE(reinterpret_cast<uintptr_t>(small.get()) %
+              BufferAllocator::kAlignment ==
+          0);
+
+  auto pages{BufferAllocator::Allocate(BufferAllocator::kHugePageSize + 1,
+                                       false, &backing)};
+  REQUIRE(backing == BufferAllocator::Backing::kPages);
+  REQUIRE(pages.get_deleter().mapped_size ==
+          2 * BufferAllocator::kHugePageSize);
+  REQUIRE(reinterpret_cast<uintptr_t>(pages.get()) %
+              BufferAllocator::kHugePageSize ==
+          0);
+  pages[BufferAllocator::kHugePageSize] = 1;
+
+  auto huge{BufferAllocator::Allocate(BufferAllocator::kHugePageSize, true,
+                                      &backing)};
+  REQUIRE(backing != BufferAllocator::Backing::kHeap);
+  std::memset(huge.get(), 1, BufferAllocator::kHugePageSize);
 }
 
-TEST_CASE("Console start: not null") {
-  std::ostringstream oss;
-  std::streambuf *p_cout_streambuf{
-      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+TEST_SUITE_END();
 
-  console.Start();
-  REQUIRE(oss.str() != "");
+TEST_SUITE_BEGIN("BlockCodec");
+
+TEST_CASE("Block codec: RLE round trip") {
+  std::string data(0x3000, '\0');
+  data.replace(0x10, 5, "hello");
+  data.replace(0x100, 3, "aaa");              // too short for a run
+  data.replace(0x200, 0x90, 0x90, 'b');       // a run with a long length
+  for (size_t i{0x1000}; i < 0x1100; i++)     // literals longer than 0x80
+    data[i] = static_cast<char>(i * 7 + 1);
+  data.back() = 'z';
+
+  std::vector<char> compressed(BlockCodec::Bound(data.size()));
+  size_t size{BlockCodec::Compress(BlockCodec::Codec::kRle, data.data(),
+                                   data.size(), compressed.data())};
+  REQUIRE(size > 0);
+  REQUIRE(size < 0x200);
+  std::string result(data.size(), '\1');
+  REQUIRE(BlockCodec::Decompress(BlockCodec::Codec::kRle, compressed.data(),
+                                 size, result.data(), result.size()));
+  REQUIRE(result == data);
+
+  // truncated data and a wrong raw size are detected
+  REQUIRE(!BlockCodec::Decompress(BlockCodec::Codec::kRle, compressed.data(),
+                                  size - 1, result.data(), result.size()));
+  REQUIRE(!BlockCodec::Decompress(BlockCodec::Codec::kRle, compressed.data(),
+                                  size, result.data(), result.size() - 1));
+
+  // random data does not grow beyond the bound
+  std::string random(0x1000, '\0');
+  uint64_t state{1};
+  for (char &c : random) {
+    state = state * 6364136223846793005 + 1442695040888963407;
+    c = static_cast<char>(state >> 56);
+  }
+  size = BlockCodec::Compress(BlockCodec::Codec::kRle, random.data(),
+                              random.size(), compressed.data());
+  REQUIRE(size <= BlockCodec::Bound(random.size()));
+  REQUIRE(BlockCodec::Decompress(BlockCodec::Codec::kRle, compressed.data(),
+                                 size, result.data(), random.size()));
+  REQUIRE(result.substr(0, random.size()) == random);
+}
 
-  std::cout.rdbuf(p_cout_streambuf);
+TEST_CASE("Block codec: compress a batch") {
+  std::string zeros(0x1000, '\0'), text(0x1000, '\0');
+  uint64_t state{1};
+  for (char &c : text) {
+    state = state * 6364136223846793005 + 1442695040888963407;
+    c = static_cast<char>(state >> 56);
+  }
+  std::vector<BlockCodec::Block> blocks(3);
+  blocks[0].data = zeros.data();
+  blocks[0].size = zeros.size();
+  blocks[1].data = text.data();
+  blocks[1].size = text.size();
+  blocks[2].data = zeros.data();
+  blocks[2].size = 10;
+  try {
+    BlockCodec::CompressBatch(BlockCodec::Codec::kRle, blocks, 4);
+  } catch (...) {
+    REQUIRE(false);
+  }
+  REQUIRE(blocks[0].codec == BlockCodec::Codec::kRle);
+  REQUIRE(blocks[0].StoredSize() < 0x10);
+  // a block that does not become smaller is stored
+  REQUIRE(blocks[1].codec == BlockCodec::Codec::kStored);
+  REQUIRE(blocks[1].Stored() == text.data());
+  REQUIRE(blocks[1].StoredSize() == text.size());
+  REQUIRE(blocks[2].codec == BlockCodec::Codec::kRle);
+  REQUIRE(blocks[2].StoredSize() == 2);
 }
 
-TEST_CASE("Console start") {
-  std::ostringstream oss;
-  std::streambuf *p_cout_streambuf{
-      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+TEST_CASE("Block codec: write and read a block file") {
+  std::string path{"/tmp/memoryaccessor_test.blocks"};
+  std::string data(BlockWriter::kBlockSize * 5 + 123, '\0');
+  for (size_t i{0}; i < data.size(); i += 0x1000)
+    std::memcpy(data.data() + i, &i, sizeof(i));
+  {
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    BlockWriter writer(file, BlockCodec::Best(), 2);
+    std::ostream stream{&writer};
+    stream.write(data.data(), 1000);
+    stream.write(data.data() + 1000, static_cast<std::streamsize>(
+                                         data.size() - 1000));
+    REQUIRE(writer.Finish());
+    REQUIRE(writer.RawSize() == data.size());
+    REQUIRE(writer.StoredSize() < data.size() / 10);
+  }
 
-  console.Start();
-  REQUIRE(oss.str() == console.kProjectName + " " + console.kProjectVersion +
-                           "\nType \"help\" for help.\n");
+  BlockReader reader;
+  try {
+    reader.Open(path);
+    REQUIRE(reader.Size() == data.size());
+    std::string result(data.size(), '\1');
+    REQUIRE(reader.Read(0, result.data(), result.size()) == data.size());
+    REQUIRE(result == data);
+
+    // a range across blocks
+    size_t offset{BlockWriter::kBlockSize * 3 - 0x800};
+    REQUIRE(reader.Read(offset, result.data(), 0x1000) == 0x1000);
+    REQUIRE(result.substr(0, 0x1000) == data.substr(offset, 0x1000));
+    REQUIRE(reader.Read(data.size() - 10, result.data(), 100) == 10);
+    REQUIRE(reader.Read(data.size(), result.data(), 100) == 0);
+  } catch (...) {
+    REQUIRE(false);
+  }
+  reader.Close();
 
-  std::cout.rdbuf(p_cout_streambuf);
+  // a file without the trailer is not valid
+  REQUIRE(truncate(path.c_str(), 1000) == 0);
+  bool thrown{false};
+  try {
+    reader.Open(path);
+  } catch (const BlockReader::BlockFileEx &ex) {
+    thrown = true;
+  }
+  REQUIRE(thrown);
+  unlink(path.c_str());
 }
 
-namespace memoryaccessor_testing::console {
+TEST_SUITE_END();
 
-/*!
- \brief Perform test on Console::HandleCommand function.
- \param [in,out] oss std::ostringstream with redirected std::cout and/or
- std::cerr. \param [in] command Line with command. \param [in] result_substr
- Desired substring of result starting from the beginning.
+TEST_SUITE_BEGIN("SnapshotStore");
+
+TEST_CASE("Snapshot store: lay out readable segments") {
+  SnapshotStore snapshot_store;
+  SegmentInfo readable{memoryaccessor_testing::make_segment(0x1000, 0x3000)},
+      not_readable{memoryaccessor_testing::make_segment(0x3000, 0x4000)},
+      readable2{memoryaccessor_testing::make_segment(0x8000, 0x9000)};
+  readable.mode = readable2.mode = 0b1010;
+  std::vector<SegmentInfo> infos{readable, not_readable, readable2};
+
+  snapshot_store.Update(infos);
+  REQUIRE(snapshot_store.Regions().size() == 2);
+  REQUIRE(snapshot_store.Regions()[1].num == 2);
+  REQUIRE(snapshot_store.Regions()[1].fresh);
+  REQUIRE(!snapshot_store.Regions()[1].valid);
+  REQUIRE(snapshot_store.Retired().empty());
+  REQUIRE(snapshot_store.StoredBytes() == 0x3000);
+
+  infos.erase(infos.begin() + 1);
+  snapshot_store.Update(infos);
+  REQUIRE(snapshot_store.Regions().size() == 2);
+  REQUIRE(!snapshot_store.Regions()[0].fresh);
+  REQUIRE(snapshot_store.Regions()[1].num == 1);
+  REQUIRE(snapshot_store.Retired().empty());
+
+  // a resized segment keeps its buffer, data up to the old end stays valid
+  infos[1].end += 0x1000;
+  snapshot_store.Regions()[1].valid = true;
+  snapshot_store.Update(infos);
+  REQUIRE(!snapshot_store.Regions()[0].fresh);
+  REQUIRE(!snapshot_store.Regions()[1].fresh);
+  REQUIRE(snapshot_store.Regions()[1].end == 0xa000);
+  REQUIRE(snapshot_store.Regions()[1].valid_end == 0x9000);
+  REQUIRE(snapshot_store.Retired().empty());
+  REQUIRE(snapshot_store.StoredBytes() == 0x4000);
+
+  infos[1].end -= 0x1800;
+  snapshot_store.Update(infos);
+  REQUIRE(snapshot_store.Regions()[1].end == 0x8800);
+  REQUIRE(snapshot_store.Regions()[1].valid_end == 0x8800);
+  REQUIRE(snapshot_store.StoredBytes() == 0x2800);
+}
 
-  Perform test on Console::HandleCommand function and compare result with
- specified substring.
-*/
-void test_handle_command(std::ostringstream &oss, const std::string &command,
-                         const std::string &result_substr) {
-  ::console.HandleCommand(command);
-  REQUIRE(oss.str().substr(0, result_substr.length()) == result_substr);
-  oss.str("");
+TEST_CASE("Snapshot store: resize big copies in place") {
+  SnapshotStore snapshot_store;
+  SegmentInfo segment_info{
+      memoryaccessor_testing::make_segment(0x10000000, 0x103ff000)};
+  segment_info.mode = 0b1000;
+
+  snapshot_store.Update({segment_info});
+  char *data{snapshot_store.Regions()[0].data.get()};
+  std::memcpy(data + 0x3feff0, "0123456789abcdef", 16);
+
+  // growing within the mapping keeps the buffer
+  segment_info.end += 0x1000;
+  snapshot_store.Update({segment_info});
+  REQUIRE(snapshot_store.Regions()[0].data.get() == data);
+  snapshot_store.Regions()[0].data[0x3fffff] = 1;
+
+  // growing past it remaps the buffer, the data moves with it
+  segment_info.end += 0x400000;
+  snapshot_store.Update({segment_info});
+  REQUIRE(snapshot_store.Retired().empty());
+  data = snapshot_store.Regions()[0].data.get();
+  REQUIRE(std::memcmp(data + 0x3feff0, "0123456789abcdef", 16) == 0);
+  REQUIRE(data[0x3fffff] == 1);
+  data[0x7fffff] = 2;
+
+  segment_info.end = 0x10001000;
+  snapshot_store.Update({segment_info});
+  REQUIRE(snapshot_store.StoredBytes() == 0x1000);
+  REQUIRE(snapshot_store.Regions()[0].blocks.size() == 1);
 }
 
-} // namespace memoryaccessor_testing::console
+TEST_CASE("Snapshot store: buffers of unmoved segments are kept") {
+  SnapshotStore snapshot_store;
+  SegmentInfo first{memoryaccessor_testing::make_segment(0x1000, 0x1010)},
+      second{memoryaccessor_testing::make_segment(0x2000, 0x2010)},
+      inserted{memoryaccessor_testing::make_segment(0x1800, 0x1810)};
+  first.mode = second.mode = inserted.mode = 0b1000;
+
+  snapshot_store.Update({first, second});
+  std::memcpy(snapshot_store.Regions()[1].data.get(), "0123456789abcdef", 16);
+  const char *data{snapshot_store.Regions()[1].data.get()};
+
+  snapshot_store.Update({inserted, second});
+  REQUIRE(snapshot_store.Regions().size() == 2);
+  REQUIRE(snapshot_store.Regions()[0].fresh);
+  REQUIRE(snapshot_store.Regions()[1].data.get() == data);
+  REQUIRE(std::memcmp(data, "0123456789abcdef", 16) == 0);
+  REQUIRE(snapshot_store.Retired().size() == 1);
+  REQUIRE(snapshot_store.Retired()[0].start == 0x1000);
+
+  snapshot_store.Reset();
+  REQUIRE(snapshot_store.Regions().empty());
+  REQUIRE(snapshot_store.Retired().empty());
+}
 
-TEST_CASE("Handle empty command") {
-  std::ostringstream oss;
-  std::streambuf *p_cout_streambuf{
-      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+TEST_CASE("Snapshot store: hash mode") {
+  SnapshotStore snapshot_store;
+  SegmentInfo segment_info{
+      memoryaccessor_testing::make_segment(0x10000, 0x20000)};
+  segment_info.mode = 0b1000;
+
+  snapshot_store.SetHashMode(true);
+  snapshot_store.Update({segment_info});
+  REQUIRE(snapshot_store.HashMode());
+  REQUIRE(!snapshot_store.Regions()[0].data);
+  REQUIRE(snapshot_store.Regions()[0].hashes);
+  REQUIRE(snapshot_store.StoredBytes() == 0x10 * sizeof(uint64_t));
+
+  REQUIRE(snapshot_store.FindHotPage(0x10000) == nullptr);
+  REQUIRE(snapshot_store.AddHotPage(0x10000, 0) != nullptr);
+  REQUIRE(snapshot_store.AddHotPage(0x11000, 2) != nullptr);
+  REQUIRE(snapshot_store.FindHotPage(0x10000) != nullptr);
+  REQUIRE(snapshot_store.HotPagesCount() == 2);
+  snapshot_store.AgeHotPages(3, 2);
+  REQUIRE(snapshot_store.FindHotPage(0x10000) == nullptr);
+  REQUIRE(snapshot_store.FindHotPage(0x11000) != nullptr);
+
+  for (size_t i{0}; i <= SnapshotStore::kMaxHotPages; i++)
+    snapshot_store.AddHotPage(0x100000 + i * SnapshotStore::kPageSize, 3);
+  REQUIRE(snapshot_store.HotPagesCount() == SnapshotStore::kMaxHotPages);
+
+  snapshot_store.SetHashMode(false);
+  REQUIRE(snapshot_store.Regions().empty());
+  REQUIRE(snapshot_store.HotPagesCount() == 0);
+}
 
-  console.HandleCommand("");
-  REQUIRE(oss.str().length() == 0);
+TEST_CASE("Snapshot store: spill copies over the budget") {
+  SnapshotStore snapshot_store;
+  SegmentInfo first{memoryaccessor_testing::make_segment(0x1000, 0x2000)},
+      second{memoryaccessor_testing::make_segment(0x3000, 0x4000)};
+  first.mode = second.mode = 0b1000;
 
-  std::cout.rdbuf(p_cout_streambuf);
+  snapshot_store.SetBudget(0x1000, "/nonexistent");
+  bool thrown{false};
+  try {
+    snapshot_store.Update({first, second});
+  } catch (const SnapshotStore::ScratchFileEx &ex) {
+    thrown = true;
+  }
+  REQUIRE(thrown);
+  REQUIRE(snapshot_store.Regions().empty());
+
+  snapshot_store.SetBudget(0x1000, "/tmp");
+  snapshot_store.Update({first, second});
+  REQUIRE(!snapshot_store.Regions()[0].spilled);
+  REQUIRE(snapshot_store.Regions()[1].spilled);
+  REQUIRE(snapshot_store.StoredBytes() == 0x2000);
+  REQUIRE(snapshot_store.SpilledBytes() == 0x1000);
+  std::memcpy(snapshot_store.Regions()[1].data.get(), "0123456789abcdef", 16);
+  snapshot_store.AdviseSpilled();
+
+  // the copy in RAM is released, the spilled one fits in the budget now
+  snapshot_store.Update({second});
+  snapshot_store.ReleaseRetired();
+  snapshot_store.Rebalance();
+  REQUIRE(snapshot_store.SpilledBytes() == 0);
+  REQUIRE(!snapshot_store.Regions()[0].spilled);
+  REQUIRE(std::memcmp(snapshot_store.Regions()[0].data.get(),
+                      "0123456789abcdef", 16) == 0);
 }
 
-TEST_CASE("Handle whitespace command") {
-  std::ostringstream oss;
-  std::streambuf *p_cout_streambuf{
-      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+TEST_SUITE_END();
 
-  console.HandleCommand(std::string(5, ' '));
-  REQUIRE(oss.str().length() == 0);
+TEST_SUITE_BEGIN("SnapshotFile");
+
+TEST_CASE("Snapshot file: save and open own memory") {
+  using memoryaccessor_testing::make_segment;
+  char *pages{static_cast<char *>(mmap(nullptr, 0x3000, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))};
+  REQUIRE(pages != MAP_FAILED);
+  std::memcpy(pages, "snap", 4);
+  std::memcpy(pages + 0x2ffc, "shot", 4);
+  size_t address{reinterpret_cast<size_t>(pages)};
+
+  SegmentInfo data{make_segment(address, address + 0x3000)},
+      guard{make_segment(0x10000, 0x12000)};
+  data.mode = 0b1100;
+  data.path = "[data]";
+  guard.mode = 0b0000;
+  guard.path = "[guard]";
+
+  std::string path{"/tmp/memoryaccessor_test.snap"};
+  SnapshotFile::SaveStats stats;
+  try {
+    memory_accessor.SetPid(getpid());
+    memory_accessor.OpenSharedMem();
+    REQUIRE(SnapshotFile::Save(path, getpid(), {guard, data}, memory_accessor,
+                               BlockCodec::Codec::kStored, 1,
+                               [] { return false; }, stats) == 0);
+    // stopped saving deletes the file
+    REQUIRE(SnapshotFile::Save(path + ".stopped", getpid(), {guard, data},
+                               memory_accessor, BlockCodec::Codec::kStored, 1,
+                               [] { return true; }, stats) == 2);
+    REQUIRE(access((path + ".stopped").c_str(), F_OK) != 0);
+    REQUIRE(SnapshotFile::Save(path + ".rle", getpid(), {guard, data},
+                               memory_accessor, BlockCodec::Codec::kRle, 2,
+                               [] { return false; }, stats) == 0);
+    REQUIRE(stats.compressed_pages == 2);
+    REQUIRE(SnapshotFile::Save(path, getpid(), {guard, data}, memory_accessor,
+                               BlockCodec::Codec::kStored, 1,
+                               [] { return false; }, stats) == 0);
+  } catch (...) {
+    REQUIRE(false);
+  }
+  memory_accessor.CloseSharedMem();
+  REQUIRE(stats.pages == 5);
+  REQUIRE(stats.missing_pages == 2);
+  REQUIRE(stats.zero_pages == 1);
+  REQUIRE(stats.compressed_pages == 0);
 
-  std::cout.rdbuf(p_cout_streambuf);
+  SnapshotFile snapshot_file;
+  try {
+    snapshot_file.Open(path);
+  } catch (...) {
+    REQUIRE(false);
+  }
+  REQUIRE(snapshot_file.GetHeader().pid == static_cast<uint64_t>(getpid()));
+  REQUIRE(snapshot_file.Segments().size() == 2);
+  REQUIRE(snapshot_file.Segments()[1].start == address);
+  REQUIRE(snapshot_file.Segments()[1].mode == 0b1100);
+  REQUIRE(snapshot_file.Segments()[1].path == "[data]");
+  char buffer[SnapshotFile::kPageSize];
+  REQUIRE(snapshot_file.Page(0, 1, buffer) == nullptr);
+  REQUIRE(std::string(snapshot_file.Page(1, 0, buffer), 4) == "snap");
+  REQUIRE(std::string(snapshot_file.Page(1, 1, buffer), 0x1000) ==
+          std::string(0x1000, '\0'));
+  REQUIRE(std::string(snapshot_file.Page(1, 2, buffer) + 0xffc, 4) == "shot");
+  REQUIRE(snapshot_file.Page(1, 2, buffer) != buffer);
+
+  // compressed pages are decompressed to the buffer
+  try {
+    snapshot_file.Open(path + ".rle");
+  } catch (...) {
+    REQUIRE(false);
+  }
+  REQUIRE(snapshot_file.Segments().size() == 2);
+  REQUIRE(snapshot_file.Page(0, 1, buffer) == nullptr);
+  REQUIRE(snapshot_file.Page(1, 0, buffer) == buffer);
+  REQUIRE(std::string(buffer, 4) == "snap");
+  REQUIRE(std::string(buffer + 4, 0xffc) == std::string(0xffc, '\0'));
+  REQUIRE(std::string(snapshot_file.Page(1, 2, buffer) + 0xffc, 4) == "shot");
+  snapshot_file.Close();
+  unlink((path + ".rle").c_str());
+
+  // a stored page must not be shorter than its part of the segment
+  int fd{open(path.c_str(), O_WRONLY)};
+  REQUIRE(fd >= 0);
+  uint32_t short_size{0x800};
+  REQUIRE(pwrite(fd, &short_size, sizeof(short_size),
+                 sizeof(SnapshotFile::Header) +
+                     2 * sizeof(SnapshotFile::SegmentRecord) +
+                     4 * sizeof(SnapshotFile::PageEntry) +
+                     offsetof(SnapshotFile::PageEntry, size)) ==
+          sizeof(short_size));
+  close(fd);
+  bool thrown{false};
+  try {
+    snapshot_file.Open(path);
+  } catch (const SnapshotFile::SnapshotFileEx &ex) {
+    thrown = true;
+  }
+  REQUIRE(thrown);
+
+  // a truncated file is not a snapshot
+  REQUIRE(truncate(path.c_str(), 100) == 0);
+  thrown = false;
+  try {
+    snapshot_file.Open(path);
+  } catch (const SnapshotFile::SnapshotFileEx &ex) {
+    thrown = true;
+  }
+  REQUIRE(thrown);
+
+  unlink(path.c_str());
+  munmap(pages, 0x3000);
 }
 
-TEST_CASE("Handle unknown command") {
-  std::ostringstream oss;
-  std::streambuf *p_cerr_streambuf{
-      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+TEST_SUITE_END();
 
-  std::string command{"abcdef"};
-  memoryaccessor_testing::console::test_handle_command(
-      oss, command, command + ": command not found\n");
+TEST_SUITE_BEGIN("PageRepository");
+
+TEST_CASE("Page repository: store distinct pages and travel in time") {
+  using memoryaccessor_testing::make_segment;
+  char *pages{static_cast<char *>(mmap(nullptr, 0x4000, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))};
+  REQUIRE(pages != MAP_FAILED);
+  std::memset(pages, 'a', 0x2000); // two equal pages, a zero page, other page
+  std::memset(pages + 0x3000, 'b', 0x1000);
+  size_t address{reinterpret_cast<size_t>(pages)};
+  SegmentInfo data{make_segment(address, address + 0x4000)};
+  data.mode = 0b1100;
+  data.path = "[data]";
+
+  std::string dir{"/tmp/memoryaccessor_test.repo"};
+  PageRepository repository;
+  PageRepository::AddStats stats[4];
+  try {
+    memory_accessor.SetPid(getpid());
+    memory_accessor.OpenSharedMem();
+    repository.Open(dir, true, tools);
+    REQUIRE(repository.Add(getpid(), {data}, memory_accessor, tools,
+                           [] { return false; }, stats[0]) == 0);
+    REQUIRE(repository.Add(getpid(), {data}, memory_accessor, tools,
+                           [] { return false; }, stats[1]) == 0);
+    pages[0x3010] = 'c';
+    REQUIRE(repository.Add(getpid(), {data}, memory_accessor, tools,
+                           [] { return false; }, stats[2]) == 0);
+    REQUIRE(repository.Add(getpid(), {data}, memory_accessor, tools,
+                           [] { return true; }, stats[3]) == 2);
+  } catch (...) {
+    REQUIRE(false);
+  }
+  memory_accessor.CloseSharedMem();
+  REQUIRE(stats[0].pages == 4);
+  REQUIRE(stats[0].new_pages == 2);
+  REQUIRE(stats[0].zero_pages == 1);
+  REQUIRE(stats[1].new_pages == 0);
+  REQUIRE(stats[2].new_pages == 1);
+
+  // reopening rebuilds the index from hashes
+  try {
+    repository.Open(dir, false, tools);
+  } catch (...) {
+    REQUIRE(false);
+  }
+  REQUIRE(repository.Headers().size() == 3);
+  REQUIRE(repository.PagesCount() == 3);
+  REQUIRE(repository.Find(0) == PageRepository::kNone);
+  REQUIRE(repository.Find(UINT64_MAX) == 2);
+
+  PageRepository::Snapshot snapshot;
+  char buf[0x20];
+  size_t checked{0};
+  try {
+    repository.Load(0, snapshot);
+    REQUIRE(snapshot.segment_infos.size() == 1);
+    REQUIRE(snapshot.segment_infos[0].path == "[data]");
+    REQUIRE(snapshot.segment_infos[0].mode == 0b1100);
+    REQUIRE(repository.Read(snapshot, address + 0x300c, buf, 8) == 8);
+    REQUIRE(std::string(buf, 8) == "bbbbbbbb");
+    REQUIRE(repository.Read(snapshot, address + 0x3ff8, buf, 0x10) == 8);
+    repository.Load(2, snapshot);
+    REQUIRE(repository.Read(snapshot, address + 0x300c, buf, 8) == 8);
+    REQUIRE(std::string(buf, 8) == "bbbbcbbb");
+
+    REQUIRE(repository.LastChange(address + 0x3010, 1, checked) == 2);
+    REQUIRE(checked == 2);
+    REQUIRE(repository.LastChange(address + 0x3011, 0x10, checked) ==
+            PageRepository::kNone);
+    REQUIRE(checked == 3);
+  } catch (...) {
+    REQUIRE(false);
+  }
+  repository.Close();
+
+  for (const char *name : {"/snapshots/0", "/snapshots/1", "/snapshots/2",
+                           "/pages", "/hashes"})
+    unlink((dir + name).c_str());
+  rmdir((dir + "/snapshots").c_str());
+  rmdir(dir.c_str());
+  munmap(pages, 0x4000);
+}
 
-  std::cerr.rdbuf(p_cerr_streambuf);
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN("CoreWriter");
+
+TEST_CASE("Core writer: plan and write own memory") {
+  using memoryaccessor_testing::make_segment;
+  char *pages{static_cast<char *>(mmap(nullptr, 0x2000, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))};
+  REQUIRE(pages != MAP_FAILED);
+  std::memcpy(pages + 0x1000, "core", 4);
+  size_t address{reinterpret_cast<size_t>(pages)};
+
+  SegmentInfo library{make_segment(0x10000, 0x13000)},
+      code{make_segment(0x13000, 0x14000)},
+      guard{make_segment(0x14000, 0x15000)},
+      data{make_segment(address, address + 0x2000)};
+  library.path = code.path = "/lib/library.so";
+  library.mode = 0b1000;
+  code.mode = 0b1010;
+  code.offset = 0x3000;
+  data.mode = 0b1100;
+
+  CoreWriter core_writer;
+  std::string path{"/tmp/memoryaccessor_test.core"};
+  try {
+    memory_accessor.SetPid(getpid());
+    memory_accessor.OpenSharedMem();
+    memory_accessor.OpenPagemap();
+    core_writer.Plan(getpid(), {library, code, guard, data}, memory_accessor,
+                     true);
+    REQUIRE(core_writer.Loads().size() == 4);
+    REQUIRE(core_writer.Loads()[0].file_size == 0x1000);
+    REQUIRE(core_writer.Loads()[1].file_size == 0);
+    REQUIRE(core_writer.Loads()[2].file_size == 0);
+    REQUIRE(core_writer.Loads()[3].file_size == 0x2000);
+    REQUIRE(core_writer.Loads()[3].flags == (PF_R | PF_W));
+    REQUIRE(core_writer.Write(path, memory_accessor, [] { return false; }) ==
+            0);
+  } catch (...) {
+    REQUIRE(false);
+  }
+  memory_accessor.ClosePagemap();
+  memory_accessor.CloseSharedMem();
+
+  // the untouched page is skipped, the library page cannot be read
+  REQUIRE(core_writer.WrittenBytes() == 0x1000);
+  std::ifstream file{path, std::ios::binary};
+  std::string core{std::istreambuf_iterator<char>(file),
+                   std::istreambuf_iterator<char>()};
+  REQUIRE(core.size() == core_writer.FileSize());
+  REQUIRE(core.substr(0, SELFMAG) == ELFMAG);
+  REQUIRE(core.substr(core_writer.Loads()[3].file_offset + 0x1000, 4) ==
+          "core");
+  REQUIRE(core.find("/lib/library.so") != std::string::npos);
+
+  unlink(path.c_str());
+  munmap(pages, 0x2000);
 }
 
-TEST_CASE("Handle command with quotes") {
-  std::ostringstream oss;
-  std::streambuf *p_cerr_streambuf{
-      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+TEST_SUITE_END();
 
-  std::string command{"abc def"};
-  memoryaccessor_testing::console::test_handle_command(
-      oss, "\"" + command + "\"", command + ": command not found\n");
+TEST_SUITE_BEGIN("MapsDelta");
+
+TEST_CASE("Maps delta: types of changes") {
+  using memoryaccessor_testing::make_segment;
+  std::vector<SegmentInfo> old_infos{
+      make_segment(0x1000, 0x2000), make_segment(0x2000, 0x3000),
+      make_segment(0x4000, 0x5000), make_segment(0x6000, 0x7000),
+      make_segment(0x9000, 0xa000)},
+      new_infos{make_segment(0x1000, 0x2000), make_segment(0x2000, 0x3800),
+                make_segment(0x4000, 0x5000), make_segment(0x8000, 0x9000),
+                make_segment(0x9000, 0xa000)};
+  new_infos[2].mode = 0b1000;
+  new_infos[4].start = 0x8800;
+  new_infos[3].end = 0x8800;
+
+  MapsDelta maps_delta;
+  maps_delta.Compute(old_infos, new_infos);
+  const std::vector<MapsDelta::Change> &changes{maps_delta.Changes()};
+  REQUIRE(changes.size() == 6);
+  REQUIRE(changes[0].type == MapsDelta::ChangeType::kUnchanged);
+  REQUIRE(changes[1].type == MapsDelta::ChangeType::kResized);
+  REQUIRE(changes[2].type == MapsDelta::ChangeType::kProtection);
+  REQUIRE(changes[3].type == MapsDelta::ChangeType::kRemoved);
+  REQUIRE(changes[3].old_num == 3);
+  REQUIRE(changes[3].new_num == MapsDelta::kNone);
+  REQUIRE(changes[4].type == MapsDelta::ChangeType::kAdded);
+  REQUIRE(changes[4].new_num == 3);
+  REQUIRE(changes[5].type == MapsDelta::ChangeType::kResized);
+  REQUIRE(!maps_delta.Empty());
+
+  maps_delta.Compute(old_infos, old_infos);
+  REQUIRE(maps_delta.Empty());
+  REQUIRE(maps_delta.Overlaps().size() == old_infos.size());
+}
 
-  std::cerr.rdbuf(p_cerr_streambuf);
+TEST_CASE("Maps delta: overlaps") {
+  using memoryaccessor_testing::make_segment;
+  MapsDelta maps_delta;
+  maps_delta.Compute(
+      {make_segment(0x1000, 0x4000), make_segment(0x5000, 0x6000)},
+      {make_segment(0x0, 0x2000), make_segment(0x2000, 0x3000),
+       make_segment(0x3800, 0x5800)});
+
+  const std::vector<MapsDelta::Overlap> &overlaps{maps_delta.Overlaps()};
+  REQUIRE(overlaps.size() == 4);
+  REQUIRE(overlaps[0].start == 0x1000);
+  REQUIRE(overlaps[0].end == 0x2000);
+  REQUIRE(overlaps[1].new_num == 1);
+  REQUIRE(overlaps[2].start == 0x3800);
+  REQUIRE(overlaps[2].end == 0x4000);
+  REQUIRE(overlaps[3].old_num == 1);
+  REQUIRE(overlaps[3].start == 0x5000);
+  REQUIRE(overlaps[3].end == 0x5800);
 }
 
-TEST_CASE("Handle command with escape sequences") {
-  std::ostringstream oss;
-  std::streambuf *p_cerr_streambuf{
-      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+TEST_SUITE_END();
 
-  std::string command{"\\\\\\\"\\a\\b\\f\\n\\r\\t\\v"};
-  memoryaccessor_testing::console::test_handle_command(
-      oss, command,
-      std::string("\\\"\a\b\f\n\r\t\v") + ": command not found\n");
+TEST_SUITE_BEGIN("DiffScanner");
+
+TEST_CASE("Diff scanner: scan piece") {
+  std::string old_data{"aaaaaaaaaaaaaaaaaaaa"},
+      new_data{"bbaaabbbaabbaaaaaaab"};
+  DiffScanner::Piece piece;
+  DiffScanner::ScanPiece(old_data.c_str(), new_data.c_str(), old_data.length(),
+                         0x1000, 2, piece);
+
+  REQUIRE(piece.address == 0x1000);
+  REQUIRE(piece.head.length == 2);
+  REQUIRE(piece.head.new_bytes == "bb");
+  REQUIRE(piece.found.size() == 1);
+  REQUIRE(piece.found[0].address == 0x100a);
+  REQUIRE(piece.found[0].old_bytes == "aa");
+  REQUIRE(piece.tail.address == 0x1013);
+  REQUIRE(piece.tail.length == 1);
+
+  DiffScanner::ScanPiece(old_data.c_str(), old_data.c_str(), old_data.length(),
+                         0x1000, 2, piece);
+  REQUIRE(piece.head.length == 0);
+  REQUIRE(piece.found.empty());
+  REQUIRE(piece.tail.length == 0);
+
+  DiffScanner::ScanPiece(old_data.c_str(), new_data.c_str(), 2, 0x1000, 2,
+                         piece);
+  REQUIRE(piece.head.length == 2);
+  REQUIRE(piece.tail.length == 0);
+}
 
-  std::cerr.rdbuf(p_cerr_streambuf);
+TEST_CASE("Diff scanner: scan typed values") {
+  constexpr size_t kCount{40};
+  int32_t old_values[kCount]{}, new_values[kCount]{};
+  new_values[3] = 5;   // +5
+  new_values[17] = -2; // -2
+  new_values[39] = 7;  // +7
+  DiffScanner::Query query{DiffScanner::ValueType::kInt32};
+  DiffScanner::Piece piece;
+  const char *old_data{reinterpret_cast<const char *>(old_values)},
+      *new_data{reinterpret_cast<const char *>(new_values)};
+
+  DiffScanner::ScanTyped(old_data, new_data, sizeof(old_values), 0x1000, query,
+                         piece);
+  REQUIRE(piece.changed);
+  REQUIRE(piece.head.length == 0);
+  REQUIRE(piece.tail.length == 0);
+  REQUIRE(piece.found.size() == 3);
+  REQUIRE(piece.found[1].address == 0x1000 + 17 * sizeof(int32_t));
+  REQUIRE(piece.found[1].length == sizeof(int32_t));
+
+  query.predicate = DiffScanner::Predicate::kAdd;
+  query.int_value = 5;
+  DiffScanner::ScanTyped(old_data, new_data, sizeof(old_values), 0x1000, query,
+                         piece);
+  REQUIRE(piece.found.size() == 1);
+  REQUIRE(piece.found[0].address == 0x1000 + 3 * sizeof(int32_t));
+
+  query.predicate = DiffScanner::Predicate::kDecreased;
+  DiffScanner::ScanTyped(old_data, new_data, sizeof(old_values), 0x1000, query,
+                         piece);
+  REQUIRE(piece.found.size() == 1);
+  REQUIRE(piece.found[0].address == 0x1000 + 17 * sizeof(int32_t));
+
+  query.type = DiffScanner::ValueType::kUint32; // -2 is a big increase
+  query.predicate = DiffScanner::Predicate::kIncreased;
+  DiffScanner::ScanTyped(old_data, new_data, sizeof(old_values), 0x1000, query,
+                         piece);
+  REQUIRE(piece.found.size() == 3);
+
+  // values are aligned in victim process
+  DiffScanner::ScanTyped(old_data, new_data, sizeof(old_values), 0x1002, query,
+                         piece);
+  REQUIRE(!piece.found.empty());
+  for (const DiffScanner::Run &run : piece.found)
+    REQUIRE(run.address % sizeof(int32_t) == 0);
+
+  double old_doubles[kCount]{}, new_doubles[kCount]{};
+  new_doubles[9] = 0.001;
+  new_doubles[20] = 2.0;
+  query = {DiffScanner::ValueType::kDouble, DiffScanner::Predicate::kNear, 0,
+           0.01};
+  DiffScanner::ScanTyped(reinterpret_cast<const char *>(old_doubles),
+                         reinterpret_cast<const char *>(new_doubles),
+                         sizeof(old_doubles), 0x1000, query, piece);
+  REQUIRE(piece.found.size() == 1);
+  REQUIRE(piece.found[0].address == 0x1000 + 9 * sizeof(double));
+
+  DiffScanner::ScanTyped(old_data, old_data, sizeof(old_values), 0x1000, query,
+                         piece);
+  REQUIRE(!piece.changed);
+  REQUIRE(piece.found.empty());
 }
 
-TEST_CASE("Handle command: help") {
-  std::ostringstream oss;
-  std::streambuf *p_cout_streambuf{
-      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+TEST_CASE("Diff scanner: scan ranges") {
+  std::string old_data(100, 'a'), new_data(old_data);
+  new_data.replace(0, 3, "bbb"); // starts the block
+  new_data.replace(40, 20, std::string(20, 'c'));
+  new_data[63] = 'd'; // merged with the previous range
+  new_data[80] = 'e'; // too far
+  new_data[99] = 'f'; // ends the block
+  DiffScanner::Piece piece;
+
+  DiffScanner::ScanRanges(old_data.data(), new_data.data(), old_data.length(),
+                          0x1000, 4, piece);
+  REQUIRE(piece.changed);
+  REQUIRE(piece.found.empty());
+  REQUIRE(piece.ranges.size() == 4);
+  REQUIRE(piece.ranges[0].address == 0x1000);
+  REQUIRE(piece.ranges[0].length == 3);
+  REQUIRE(piece.ranges[1].address == 0x1000 + 40);
+  REQUIRE(piece.ranges[1].length == 24);
+  REQUIRE(piece.ranges[1].preview == DiffScanner::kPreviewSize);
+  REQUIRE(std::string(piece.ranges[1].new_bytes.data(), 4) == "cccc");
+  REQUIRE(piece.ranges[2].address == 0x1000 + 80);
+  REQUIRE(piece.ranges[2].length == 1);
+  REQUIRE(piece.ranges[3].address == 0x1000 + 99);
+  REQUIRE(piece.ranges[3].preview == 1);
+
+  DiffScanner::ScanRanges(old_data.data(), new_data.data(), old_data.length(),
+                          0x1000, 0, piece);
+  REQUIRE(piece.ranges.size() == 5);
+
+  DiffScanner::ScanRanges(old_data.data(), old_data.data(), old_data.length(),
+                          0x1000, 4, piece);
+  REQUIRE(!piece.changed);
+  REQUIRE(piece.ranges.empty());
+}
 
-  memoryaccessor_testing::console::test_handle_command(
-      oss, "help",
-      console.kProjectName + " " + console.kProjectVersion + "\n" +
-          console.kProjectDescription + "\nCommands:\n");
+TEST_CASE("Diff scanner: scan own memory with threads") {
+  constexpr size_t kSize{3 * DiffScanner::kTaskSize + 0x1000};
+  char *buf{static_cast<char *>(mmap(nullptr, kSize, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))};
+  REQUIRE(buf != MAP_FAILED);
+  std::memset(buf, 0, kSize);
 
-  std::cout.rdbuf(p_cout_streambuf);
+  try {
+    memory_accessor.SetPid(getpid());
+    memory_accessor.OpenSharedMem();
+  } catch (...) {
+    REQUIRE(false);
+  }
+
+  SegmentInfo segment_info{memoryaccessor_testing::make_segment(
+      reinterpret_cast<size_t>(buf), reinterpret_cast<size_t>(buf) + kSize)};
+  segment_info.mode = 0b1100;
+  SnapshotStore snapshot_store;
+  DiffScanner diff_scanner;
+  diff_scanner.SetThreads(4);
+
+  std::vector<size_t> found;
+  auto merge{[&found](const DiffScanner::Result &result) {
+    for (const DiffScanner::Piece &piece : result.pieces)
+      for (const DiffScanner::Run &run : piece.found)
+        found.push_back(run.address);
+  }};
+  auto never{[] { return false; }};
+
+  snapshot_store.Update({segment_info});
+  REQUIRE(diff_scanner.Scan(memory_accessor, snapshot_store, tools, 2, 0,
+                            merge, never) == 0);
+  REQUIRE(found.empty());
+  REQUIRE(snapshot_store.Regions()[0].valid);
+
+  buf[0x100] = buf[0x101] = 1;
+  buf[DiffScanner::kTaskSize + 5] = buf[DiffScanner::kTaskSize + 6] = 1;
+  buf[2 * DiffScanner::kTaskSize + 7] = 1;
+  buf[3 * DiffScanner::kTaskSize + 0x10] = buf[3 * DiffScanner::kTaskSize +
+                                               0x11] = 1;
+  snapshot_store.Update({segment_info});
+  REQUIRE(diff_scanner.Scan(memory_accessor, snapshot_store, tools, 2, 1,
+                            merge, never) == 0);
+  REQUIRE(found == std::vector<size_t>{
+                       reinterpret_cast<size_t>(buf) + 0x100,
+                       reinterpret_cast<size_t>(buf) + DiffScanner::kTaskSize +
+                           5,
+                       reinterpret_cast<size_t>(buf) +
+                           3 * DiffScanner::kTaskSize + 0x10});
+
+  REQUIRE(diff_scanner.Scan(memory_accessor, snapshot_store, tools, 2, 2,
+                            merge, [] { return true; }) == 2);
+
+  munmap(buf, kSize);
+  memory_accessor.Reset();
 }
 
-TEST_CASE("Handle command: name") {
-  std::ostringstream oss;
-  std::streambuf *p_cout_streambuf{
-      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
-  std::streambuf *p_cerr_streambuf{
-      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+TEST_CASE("Diff scanner: resized segment") {
+  constexpr size_t kSize{2 * DiffScanner::kTaskSize};
+  char *buf{static_cast<char *>(mmap(nullptr, kSize, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))};
+  REQUIRE(buf != MAP_FAILED);
+  std::memset(buf, 0, kSize);
 
-  memoryaccessor_testing::console::test_handle_command(oss, "name", "Usage:");
-  std::string name{std::string(16, 'a')};
-  memoryaccessor_testing::console::test_handle_command(
-      oss, "name " + name, "No PID found by name: " + name);
-  memoryaccessor_testing::console::test_handle_command(
+  try {
+    memory_accessor.SetPid(getpid());
+    memory_accessor.OpenSharedMem();
+  } catch (...) {
+    REQUIRE(false);
+  }
+
+  size_t address{reinterpret_cast<size_t>(buf)};
+  SegmentInfo segment_info{memoryaccessor_testing::make_segment(
+      address, address + DiffScanner::kTaskSize / 2)};
+  segment_info.mode = 0b1100;
+  SnapshotStore snapshot_store;
+  DiffScanner diff_scanner;
+
+  std::vector<size_t> found;
+  auto merge{[&found](const DiffScanner::Result &result) {
+    for (const DiffScanner::Piece &piece : result.pieces)
+      for (const DiffScanner::Run &run : piece.found)
+        found.push_back(run.address);
+  }};
+  auto never{[] { return false; }};
+
+  snapshot_store.Update({segment_info});
+  REQUIRE(diff_scanner.Scan(memory_accessor, snapshot_store, tools, 1, 0,
+                            merge, never) == 0);
+
+  // the old part is compared, the new one is only read
+  buf[0x10] = buf[DiffScanner::kTaskSize] = 1;
+  segment_info.end = address + kSize;
+  snapshot_store.Update({segment_info});
+  REQUIRE(!snapshot_store.Regions()[0].fresh);
+  REQUIRE(diff_scanner.Scan(memory_accessor, snapshot_store, tools, 1, 1,
+                            merge, never) == 0);
+  REQUIRE(found == std::vector<size_t>{address + 0x10});
+  REQUIRE(snapshot_store.Regions()[0].valid_end == address + kSize);
+
+  buf[DiffScanner::kTaskSize + 1] = 1;
+  REQUIRE(diff_scanner.Scan(memory_accessor, snapshot_store, tools, 1, 2,
+                            merge, never) == 0);
+  REQUIRE(found == std::vector<size_t>{address + 0x10,
+                                       address + DiffScanner::kTaskSize + 1});
+
+  munmap(buf, kSize);
+  memory_accessor.Reset();
+}
+
+TEST_CASE("Diff scanner: adaptive mode") {
+  constexpr size_t kSize{2 * DiffScanner::kTaskSize};
+  char *buf{static_cast<char *>(mmap(nullptr, kSize, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))};
+  REQUIRE(buf != MAP_FAILED);
+  std::memset(buf, 0, kSize);
+
+  try {
+    memory_accessor.SetPid(getpid());
+    memory_accessor.OpenSharedMem();
+  } catch (...) {
+    REQUIRE(false);
+  }
+
+  SegmentInfo segment_info{memoryaccessor_testing::make_segment(
+      reinterpret_cast<size_t>(buf), reinterpret_cast<size_t>(buf) + kSize)};
+  segment_info.mode = 0b1100;
+  SnapshotStore snapshot_store;
+  DiffScanner diff_scanner;
+  diff_scanner.SetAdaptive(true);
+
+  std::vector<size_t> found;
+  auto merge{[&found](const DiffScanner::Result &result) {
+    for (const DiffScanner::Piece &piece : result.pieces)
+      for (const DiffScanner::Run &run : piece.found)
+        found.push_back(run.address);
+  }};
+  auto never{[] { return false; }};
+
+  // the 1st block changes on every pass, the 2nd one never does
+  uint64_t pass{0};
+  for (; pass < 5; pass++) {
+    buf[0x10]++;
+    snapshot_store.Update({segment_info});
+    REQUIRE(diff_scanner.Scan(memory_accessor, snapshot_store, tools, 1, pass,
+                              merge, never) == 0);
+  }
+  REQUIRE(diff_scanner.TotalBytes() == kSize);
+  REQUIRE(diff_scanner.ScannedBytes() == DiffScanner::kTaskSize);
+  REQUIRE(snapshot_store.Regions()[0].blocks[0].period == 1);
+  REQUIRE(snapshot_store.Regions()[0].blocks[1].period > 1);
+
+  // a change in a skipped block is found when the block is read again
+  found.clear();
+  buf[DiffScanner::kTaskSize + 0x20] = 1;
+  for (; snapshot_store.Regions()[0].blocks[1].next_pass > pass; pass++) {
+    snapshot_store.Update({segment_info});
+    REQUIRE(diff_scanner.Scan(memory_accessor, snapshot_store, tools, 1, pass,
+                              merge, never) == 0);
+  }
+  REQUIRE(found.empty());
+  snapshot_store.Update({segment_info});
+  REQUIRE(diff_scanner.Scan(memory_accessor, snapshot_store, tools, 1, pass,
+                            merge, never) == 0);
+  REQUIRE(found == std::vector<size_t>{reinterpret_cast<size_t>(buf) +
+                                       DiffScanner::kTaskSize + 0x20});
+  REQUIRE(snapshot_store.Regions()[0].blocks[1].period == 1);
+
+  munmap(buf, kSize);
+  memory_accessor.Reset();
+}
+
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN("DiffEvents");
+
+TEST_CASE("Diff events: collapse repeated changes") {
+  DiffEvents diff_events;
+  std::ostringstream json;
+  std::vector<std::tuple<DiffEvents::EventType, size_t, uint64_t, uint64_t>>
+      events;
+  diff_events.SetJsonStream(&json);
+  diff_events.SetConsumer([&events](const DiffEvents::Event &event) {
+    events.push_back({event.type, event.address, event.count, event.total});
+  });
+
+  diff_events.Record(0x2000, "\x01", "\x02", 1, 1, "[heap]", 100);
+  diff_events.Record(0x1000, "a", "b", 1, 1, "a \"b\"", 100);
+  diff_events.Record(0x2000, "\x02", "\x03", 1, 1, "[heap]", 100.5);
+  diff_events.Record(0x2000, "\x03", "\x04", 1, 1, "[heap]", 100.6);
+  diff_events.Flush(100.7, false); // 1st flush is always done
+  diff_events.Record(0x1000, "b", "c", 1, 1, "a \"b\"", 100.8);
+  diff_events.Flush(101, false); // too early
+  REQUIRE(events.size() == 3);
+  diff_events.Flush(101, true);
+
+  using Type = DiffEvents::EventType;
+  REQUIRE(events == decltype(events){{Type::kChange, 0x2000, 1, 1},
+                                     {Type::kChange, 0x1000, 1, 1},
+                                     {Type::kRepeat, 0x2000, 2, 3},
+                                     {Type::kRepeat, 0x1000, 1, 2}});
+  REQUIRE(diff_events.Changes() == 5);
+  REQUIRE(diff_events.Addresses() == 2);
+
+  std::vector<std::string> lines;
+  std::istringstream iss(json.str());
+  for (std::string line; std::getline(iss, line);)
+    lines.push_back(line);
+  REQUIRE(lines.size() == 4);
+  REQUIRE(lines[0] ==
+          R"({"type":"change","time":100.000000,"address":"0x2000",)"
+          R"("segment":"[heap]","old":"01","new":"02","size":1,)"
+          R"("count":1,"total":1})");
+  REQUIRE(lines[1].find(R"("segment":"a \"b\"")") != std::string::npos);
+  REQUIRE(lines[2].find(
+              R"("old":"03","new":"04","size":1,"count":2,"total":3)") !=
+          std::string::npos);
+
+  auto top{diff_events.Top()};
+  REQUIRE(top.size() == 2);
+  REQUIRE(top[0].first == 0x2000);
+  REQUIRE(top[1].first == 0x1000);
+
+  json.str("");
+  diff_events.WriteSummary(json, 102);
+  REQUIRE(json.str() ==
+          R"({"type":"summary","time":102.000000,"changes":5,"addresses":2,)"
+          R"("top":[{"address":"0x2000","segment":"[heap]","total":3},)"
+          R"({"address":"0x1000","segment":"a \"b\"","total":2}]})"
+          "\n");
+}
+
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN("RegionFilter");
+
+TEST_CASE("Region filter: glob") {
+  REQUIRE(RegionFilter::Glob("[heap]", "[heap]"));
+  REQUIRE(!RegionFilter::Glob("[heap]", "[stack]"));
+  REQUIRE(RegionFilter::Glob("*.so*", "/usr/lib/libc.so.6"));
+  REQUIRE(RegionFilter::Glob("/usr/*/lib?.so.6", "/usr/lib/libc.so.6"));
+  REQUIRE(!RegionFilter::Glob("*.so", "/usr/lib/libc.so.6"));
+  REQUIRE(RegionFilter::Glob("*", ""));
+  REQUIRE(!RegionFilter::Glob("?", ""));
+}
+
+TEST_CASE("Region filter: invalid terms") {
+  RegionFilter region_filter;
+  for (const char *expression :
+       {"perm=q", "perm=", "name", "size>", "size<1T", "size>-1", "addr=10",
+        "addr=20-10", "!addr=10-20", "anon,unknown"}) {
+    bool thrown{false};
+    try {
+      region_filter.Parse(expression);
+    } catch (const RegionFilter::ParseEx &ex) {
+      thrown = true;
+    }
+    REQUIRE(thrown);
+    REQUIRE(region_filter.Empty());
+  }
+}
+
+TEST_CASE("Region filter: compile") {
+  std::vector<SegmentInfo> segment_infos{
+      memoryaccessor_testing::make_segment(0x1000, 0x3000),
+      memoryaccessor_testing::make_segment(0x3000, 0x4000),
+      memoryaccessor_testing::make_segment(0x5000, 0x105000),
+      memoryaccessor_testing::make_segment(0x200000, 0x201000)};
+  segment_infos[0].mode = 0b1010; // r-xp
+  segment_infos[0].inode_id = 1;
+  segment_infos[0].path = "/usr/bin/prog";
+  segment_infos[1].mode = 0b1100; // rw-p
+  segment_infos[1].inode_id = 1;
+  segment_infos[1].path = "/usr/bin/prog";
+  segment_infos[2].mode = 0b1100; // rw-p
+  segment_infos[2].path = "[heap]";
+  segment_infos[3].mode = 0b1000; // r--p
+  segment_infos[3].path = "[vvar]";
+
+  auto starts{[&segment_infos](RegionFilter &region_filter) {
+    std::vector<size_t> result;
+    for (const RegionFilter::Interval &interval :
+         region_filter.Compile(segment_infos))
+      result.push_back(interval.start);
+    return result;
+  }};
+
+  RegionFilter region_filter;
+  REQUIRE(starts(region_filter).size() == 4);
+
+  region_filter.Parse("perm=rw");
+  REQUIRE(starts(region_filter) == std::vector<size_t>{0x3000, 0x5000});
+  region_filter.Parse("perm=rp,!perm=x,!name=[vvar]");
+  REQUIRE(starts(region_filter) == std::vector<size_t>{0x3000, 0x5000});
+  region_filter.Parse("file,name=*/prog");
+  REQUIRE(starts(region_filter) == std::vector<size_t>{0x1000, 0x3000});
+  region_filter.Parse("anon,size>1K,size<1M");
+  REQUIRE(starts(region_filter) == std::vector<size_t>{0x200000});
+  region_filter.Parse("size>0xfffff");
+  REQUIRE(starts(region_filter) == std::vector<size_t>{0x5000});
+
+  // ranges are merged and cut segments
+  region_filter.Parse("addr=2000-3800,addr=6000-7000,addr=6800-8000");
+  const std::vector<RegionFilter::Interval> &intervals{
+      region_filter.Compile(segment_infos)};
+  REQUIRE(intervals.size() == 3);
+  REQUIRE((intervals[0].start == 0x2000 && intervals[0].end == 0x3000 &&
+           intervals[0].num == 0));
+  REQUIRE((intervals[1].start == 0x3000 && intervals[1].end == 0x3800 &&
+           intervals[1].num == 1));
+  REQUIRE((intervals[2].start == 0x6000 && intervals[2].end == 0x8000 &&
+           intervals[2].num == 2));
+  REQUIRE(region_filter.Expression() ==
+          "addr=2000-3800,addr=6000-7000,addr=6800-8000");
+}
+
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN("WriteBatch");
+
+TEST_CASE("Write batch: apply to own memory") {
+  long page_size{sysconf(_SC_PAGESIZE)};
+  char *buf{static_cast<char *>(mmap(nullptr, 2 * page_size,
+                                     PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))};
+  REQUIRE(buf != MAP_FAILED);
+  std::memset(buf, 0, 2 * page_size);
+  REQUIRE(mprotect(buf + page_size, page_size, PROT_READ) == 0);
+
+  try {
+    memory_accessor.SetPid(getpid());
+    memory_accessor.OpenSharedMem();
+  } catch (...) {
+    REQUIRE(false);
+  }
+
+  WriteBatch write_batch;
+  write_batch.Add(reinterpret_cast<size_t>(buf) + 0x10, "abc", 3);
+  write_batch.Add(reinterpret_cast<size_t>(buf) + 0x20, "", 0);
+  write_batch.Add(reinterpret_cast<size_t>(buf) + page_size + 0x30, "de", 2);
+  write_batch.Add(reinterpret_cast<size_t>(buf) + 0x40, "f", 1);
+  REQUIRE(write_batch.Size() == 3);
+
+  // the 2nd write is to a read-only page and goes through /proc/PID/mem
+  REQUIRE(write_batch.Apply(memory_accessor) == 3);
+  REQUIRE(std::string(buf + 0x10, 3) == "abc");
+  REQUIRE(std::string(buf + page_size + 0x30, 2) == "de");
+  REQUIRE(buf[0x40] == 'f');
+  for (const WriteBatch::Entry &entry : write_batch.Entries())
+    REQUIRE(entry.done);
+
+  write_batch.Clear();
+  REQUIRE(write_batch.Empty());
+
+  munmap(buf, 2 * page_size);
+  memory_accessor.Reset();
+}
+
+TEST_CASE("Write batch: coalesce and validate") {
+  using memoryaccessor_testing::make_segment;
+  WriteBatch write_batch;
+  write_batch.Add(0x1010, "abcd", 4);
+  write_batch.Add(0x2000, "x", 1);
+  write_batch.Add(0x1000, "0123456789abcdefgh", 18);
+  write_batch.Add(0x1012, "ZZ", 2);
+  write_batch.Add(0x1001, "!", 1);
+  write_batch.Coalesce();
+
+  REQUIRE(write_batch.Size() == 2);
+  REQUIRE(write_batch.Bytes() == 21);
+  const WriteBatch::Entry &range{write_batch.Entries()[0]};
+  REQUIRE(range.address == 0x1000);
+  REQUIRE(range.length == 20);
+  REQUIRE(write_batch.Entries()[1].address == 0x2000);
+
+  size_t entry{SIZE_MAX};
+  std::vector<SegmentInfo> segment_infos{make_segment(0x1000, 0x1010),
+                                         make_segment(0x1010, 0x2000)};
+  segment_infos[0].mode = 0b1000;
+  segment_infos[1].mode = 0b1100;
+  REQUIRE(write_batch.Validate(segment_infos, entry) ==
+          WriteBatch::Problem::kNotMapped);
+  REQUIRE(entry == 1);
+  segment_infos.push_back(make_segment(0x2000, 0x3000));
+  segment_infos.back().mode = 0b0100;
+  REQUIRE(write_batch.Validate(segment_infos, entry) ==
+          WriteBatch::Problem::kNotReadable);
+  REQUIRE(entry == 1);
+  segment_infos.back().mode = 0b1000;
+  REQUIRE(write_batch.Validate(segment_infos, entry) ==
+          WriteBatch::Problem::kNone);
+}
+
+TEST_CASE("Write batch: commit to own memory") {
+  long page_size{sysconf(_SC_PAGESIZE)};
+  char *buf{static_cast<char *>(mmap(nullptr, page_size,
+                                     PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))};
+  REQUIRE(buf != MAP_FAILED);
+  std::memset(buf, 'o', page_size);
+
+  // a shared mapping of a file opened read-only cannot be written at all
+  std::string path{"/tmp/memoryaccessor_test.batch"};
+  std::ofstream(path, std::ios::binary) << std::string(page_size, 'r');
+  int fd{open(path.c_str(), O_RDONLY)};
+  REQUIRE(fd >= 0);
+  char *file_map{static_cast<char *>(
+      mmap(nullptr, page_size, PROT_READ, MAP_SHARED, fd, 0))};
+  close(fd);
+  unlink(path.c_str());
+  REQUIRE(file_map != MAP_FAILED);
+
+  try {
+    memory_accessor.SetPid(getpid());
+    memory_accessor.OpenSharedMem();
+  } catch (...) {
+    REQUIRE(false);
+  }
+
+  WriteBatch write_batch;
+  write_batch.Add(reinterpret_cast<size_t>(buf) + 0x10, "abc", 3);
+  write_batch.Add(reinterpret_cast<size_t>(buf) + 0x13, "de", 2);
+  write_batch.Coalesce();
+  REQUIRE(write_batch.Commit(memory_accessor) == 0);
+  REQUIRE(std::string(buf + 0x10, 5) == "abcde");
+  REQUIRE(write_batch.Failed() == SIZE_MAX);
+
+  // a batch is recorded to a journal as one write before it is written
+  WriteJournal journal;
+  write_batch.Clear();
+  write_batch.Add(reinterpret_cast<size_t>(buf) + 0x20, "fg", 2);
+  write_batch.Add(reinterpret_cast<size_t>(buf) + 0x30, "h", 1);
+  write_batch.Coalesce();
+  REQUIRE(write_batch.Commit(memory_accessor, &journal) == 0);
+  REQUIRE(journal.Writes() == 1);
+  REQUIRE(journal.Records().size() == 2);
+  REQUIRE(journal.Records()[1].header.flags & WriteJournal::kContinued);
+  char old_data[2];
+  journal.Load(journal.Records()[0], old_data, nullptr);
+  REQUIRE(std::string(old_data, 2) == "oo");
+  write_batch.Clear();
+  write_batch.Add(reinterpret_cast<size_t>(buf) + 0x40, "i", 1);
+  REQUIRE(write_batch.Journal(memory_accessor, journal, true) == 0);
+  REQUIRE(journal.Writes() == 1);
+  REQUIRE(journal.Records().size() == 3);
+  REQUIRE(buf[0x40] == 'o');
+
+  // the 2nd range fails, so the 1st one gets its old data back
+  write_batch.Clear();
+  write_batch.Add(reinterpret_cast<size_t>(buf) + 0x10, "xyz", 3);
+  write_batch.Add(reinterpret_cast<size_t>(file_map), "w", 1);
+  write_batch.Coalesce();
+  size_t failed{reinterpret_cast<size_t>(buf) < reinterpret_cast<size_t>(
+                                                    file_map)
+                    ? size_t{1}
+                    : size_t{0}};
+  REQUIRE(write_batch.Commit(memory_accessor) == 2);
+  REQUIRE(write_batch.Failed() == failed);
+  REQUIRE(std::string(buf + 0x10, 5) == "abcde");
+  REQUIRE(file_map[0] == 'r');
+
+  munmap(file_map, page_size);
+  munmap(buf, page_size);
+  memory_accessor.Reset();
+}
+
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN("WriteJournal");
+
+TEST_CASE("Write journal: record, load and undo in memory") {
+  WriteJournal journal;
+  std::string old_small{"abcd"}, new_small{"wxyz"};
+  std::string old_big(0x2000, 'o'), new_big{old_big};
+  new_big[0x100] = 'n';
+  journal.Add(1, 0x1000, old_small.data(), new_small.data(), 4, false);
+  journal.Add(1, 0x1002, old_big.data(), new_big.data(), old_big.size(),
+              false);
+  journal.Add(1, 0x9000, "pq", "rs", 2, true);
+  REQUIRE(journal.Writes() == 2);
+  REQUIRE(journal.Records().size() == 3);
+  REQUIRE(journal.RawSize() == 0x2006);
+  // both parts of the big write are runs, so they are compressed
+  REQUIRE(journal.StoredSize() < 0x100);
+
+  std::string old_data(0x2000, '\0'), new_data(0x2000, '\0');
+  journal.Load(journal.Records()[1], old_data.data(), new_data.data());
+  REQUIRE(old_data == old_big);
+  REQUIRE(new_data == new_big);
+
+  // the oldest bytes are queued last, so they win when coalesced
+  WriteBatch batch;
+  REQUIRE(journal.Inverse(5, 1, batch) == 2);
+  REQUIRE(batch.Size() == 3);
+  REQUIRE(batch.Entries()[0].address == 0x9000);
+  batch.Coalesce();
+  REQUIRE(batch.Size() == 2);
+  REQUIRE(batch.Bytes() == 0x2004);
+
+  batch.Clear();
+  REQUIRE(journal.Inverse(1, 2, batch) == 0);
+  REQUIRE(batch.Empty());
+
+  journal.Drop(1);
+  REQUIRE(journal.Writes() == 1);
+  REQUIRE(journal.Records().size() == 1);
+  REQUIRE(journal.RawSize() == 4);
+  journal.Load(journal.Records()[0], old_data.data(), new_data.data());
+  REQUIRE(old_data.substr(0, 4) == old_small);
+  REQUIRE(new_data.substr(0, 4) == new_small);
+}
+
+TEST_CASE("Write journal: file") {
+  std::string path{"/tmp/memoryaccessor_test.journal"};
+  unlink(path.c_str());
+  {
+    WriteJournal journal;
+    journal.Open(path);
+    REQUIRE(journal.Path() == path);
+    journal.Add(7, 0x1000, "aa", "bb", 2, false);
+    journal.Add(7, 0x2000, "cc", "dd", 2, false);
+    journal.Add(7, 0x3000, "ee", "ff", 2, false);
+    journal.Drop(1);
+  }
+
+  WriteJournal journal;
+  journal.Open(path);
+  REQUIRE(journal.Writes() == 2);
+  REQUIRE(journal.Records()[1].header.address == 0x2000);
+  REQUIRE(journal.Records()[1].header.pid == 7);
+  std::string old_data(2, '\0'), new_data(2, '\0');
+  journal.Load(journal.Records()[1], old_data.data(), new_data.data());
+  REQUIRE(old_data == "cc");
+  REQUIRE(new_data == "dd");
+  journal.Close();
+
+  // a partly written record is cut off
+  std::ofstream(path, std::ios::binary | std::ios::app) << "garbage";
+  journal.Open(path);
+  REQUIRE(journal.Writes() == 2);
+  journal.Add(7, 0x4000, "gg", "hh", 2, false);
+  journal.Close();
+  journal.Open(path);
+  REQUIRE(journal.Writes() == 3);
+  journal.Close();
+
+  std::ofstream(path, std::ios::binary) << "not a journal";
+  bool thrown{false};
+  try {
+    journal.Open(path);
+  } catch (const WriteJournal::JournalFileEx &ex) {
+    thrown = true;
+  }
+  REQUIRE(thrown);
+  unlink(path.c_str());
+}
+
+TEST_CASE("Write journal: record writes of MemoryAccessor") {
+  std::string data(0x100, 'a');
+  WriteJournal journal;
+  try {
+    memory_accessor.SetPid(getpid());
+    memory_accessor.ParseMaps();
+    memory_accessor.SetJournal(&journal);
+    size_t done_amount{0};
+    memory_accessor.Write("bcd", reinterpret_cast<size_t>(data.data()) + 1, 3,
+                          done_amount);
+    REQUIRE(done_amount == 3);
+  } catch (...) {
+    memory_accessor.SetJournal(nullptr);
+    REQUIRE(false);
+  }
+  memory_accessor.SetJournal(nullptr);
+  REQUIRE(data.substr(0, 5) == "abcda");
+
+  REQUIRE(journal.Writes() == 1);
+  const WriteJournal::Record &record{journal.Records()[0]};
+  REQUIRE(record.header.address == reinterpret_cast<size_t>(data.data()) + 1);
+  REQUIRE(record.header.pid == static_cast<uint32_t>(getpid()));
+  std::string old_data(3, '\0'), new_data(3, '\0');
+  journal.Load(record, old_data.data(), new_data.data());
+  REQUIRE(old_data == "aaa");
+  REQUIRE(new_data == "bcd");
+  memory_accessor.Reset();
+}
+
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN("ValueFreezer");
+
+TEST_CASE("Value freezer: hold values of own memory") {
+  volatile int32_t values[2]{1, 2};
+  size_t address{reinterpret_cast<size_t>(values)};
+  int32_t frozen[2]{100, 200};
+  std::string data_0(reinterpret_cast<const char *>(&frozen[0]), 4),
+      data_1(reinterpret_cast<const char *>(&frozen[1]), 4);
+
+  ValueFreezer freezer;
+  REQUIRE(!freezer.Active());
+  REQUIRE(freezer.Freeze(getpid(), address, data_0, "i32 100", 100000));
+  REQUIRE(freezer.Freeze(getpid(), address + 4, data_1, "i32 200", 100000));
+  REQUIRE(freezer.Active());
+  REQUIRE(freezer.Size() == 2);
+  REQUIRE(freezer.Values()[1].text == "i32 200");
+
+  bool exited{false};
+  for (int i{0}; i < 1000 && freezer.GetStats(exited).ticks < 3; i++)
+    usleep(1000);
+  REQUIRE(freezer.GetStats(exited).ticks >= 3);
+  REQUIRE(!exited);
+  REQUIRE(values[0] == 100);
+  REQUIRE(values[1] == 200);
+
+  // the value is written again on the next tick
+  values[0] = 5;
+  uint64_t ticks{freezer.GetStats(exited).ticks};
+  for (int i{0}; i < 1000 && freezer.GetStats(exited).ticks < ticks + 2; i++)
+    usleep(1000);
+  REQUIRE(values[0] == 100);
+
+  REQUIRE(freezer.Unfreeze(address));
+  REQUIRE(!freezer.Unfreeze(address));
+  REQUIRE(freezer.Active());
+  values[0] = 5;
+  ticks = freezer.GetStats(exited).ticks;
+  for (int i{0}; i < 1000 && freezer.GetStats(exited).ticks < ticks + 2; i++)
+    usleep(1000);
+  REQUIRE(values[0] == 5);
+  REQUIRE(values[1] == 200);
+
+  REQUIRE(freezer.Unfreeze(address + 4));
+  REQUIRE(!freezer.Active());
+  REQUIRE(freezer.Size() == 0);
+}
+
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN("Watchpoint");
+
+TEST_CASE("Watchpoint: valid ranges") {
+  REQUIRE(Watchpoint::Valid(0x1000, 8));
+  REQUIRE(Watchpoint::Valid(0x1002, 2));
+  REQUIRE(Watchpoint::Valid(0x1003, 1));
+  REQUIRE(!Watchpoint::Valid(0x1004, 8));
+  REQUIRE(!Watchpoint::Valid(0x1000, 3));
+  REQUIRE(!Watchpoint::Valid(0x1000, 16));
+  REQUIRE(!Watchpoint::Valid(0x1000, 0));
+
+  Watchpoint watchpoint;
+  bool thrown{false};
+  try {
+    watchpoint.Open(getpid(), 0x1001, 4, false);
+  } catch (const Watchpoint::BreakpointEx &ex) {
+    thrown = true;
+  }
+  REQUIRE(thrown);
+  REQUIRE(watchpoint.Threads() == 0);
+}
+
+TEST_CASE("Watchpoint: writes to own memory") {
+  alignas(8) static volatile uint64_t value{0};
+  size_t address{reinterpret_cast<size_t>(&value)};
+
+  Watchpoint watchpoint;
+  try {
+    watchpoint.Open(getpid(), address, 8, false);
+  } catch (const Watchpoint::BreakpointEx &ex) {
+    return; // hardware breakpoints are not available
+  }
+  REQUIRE(watchpoint.Threads() >= 1);
+
+  for (uint64_t i{1}; i <= 5; i++)
+    value = i;
+  uint64_t read_value{value};
+  REQUIRE(read_value == 5);
+
+  std::vector<Watchpoint::Hit> hits;
+  REQUIRE(watchpoint.Wait(1000));
+  watchpoint.Collect(hits);
+  REQUIRE(hits.size() == 5);
+  for (const Watchpoint::Hit &hit : hits) {
+    REQUIRE(hit.tid == gettid());
+    REQUIRE(hit.ip == hits[0].ip);
+  }
+
+  // a thread started later is watched after Rescan
+  std::atomic<bool> go{false}, done{false};
+  std::thread thread([&go, &done] {
+    while (!go)
+      std::this_thread::yield();
+    value = 6;
+    done = true;
+  });
+  REQUIRE(watchpoint.Rescan());
+  REQUIRE(watchpoint.Threads() >= 2);
+  go = true;
+  thread.join();
+  hits.clear();
+  REQUIRE(watchpoint.Wait(1000));
+  watchpoint.Collect(hits);
+  REQUIRE(hits.size() == 1);
+  REQUIRE(hits[0].tid != gettid());
+
+  watchpoint.Close();
+  REQUIRE(watchpoint.Threads() == 0);
+  REQUIRE(watchpoint.Lost() == 0);
+}
+
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN("PageHeatmap");
+
+TEST_CASE("Page heatmap: count writes by hashes") {
+  constexpr size_t kPageSize{PageHeatmap::kPageSize};
+  constexpr size_t kSize{4 * kPageSize};
+  char *buf{static_cast<char *>(mmap(nullptr, kSize, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))};
+  REQUIRE(buf != MAP_FAILED);
+  std::memset(buf, 0, kSize);
+
+  try {
+    memory_accessor.SetPid(getpid());
+    memory_accessor.OpenSharedMem();
+  } catch (...) {
+    REQUIRE(false);
+  }
+
+  SegmentInfo segment_info{memoryaccessor_testing::make_segment(
+      reinterpret_cast<size_t>(buf), reinterpret_cast<size_t>(buf) + kSize)};
+  segment_info.path = "test";
+  PageHeatmap heatmap;
+  heatmap.SetSoftDirty(false);
+  heatmap.Update({segment_info});
+  REQUIRE(heatmap.Sample(memory_accessor, tools) == kSize);
+
+  // page 1 is written before 3 samples, page 3 before 1 sample
+  for (int i{0}; i < 3; i++) {
+    buf[kPageSize + 1]++;
+    if (i == 1)
+      buf[3 * kPageSize]++;
+    heatmap.Update({segment_info});
+    heatmap.Sample(memory_accessor, tools);
+  }
+
+  REQUIRE(PageHeatmap::Writes(heatmap.Regions()[0]) == 4);
+  std::vector<PageHeatmap::Page> top{heatmap.Top(10)};
+  REQUIRE(top.size() == 2);
+  REQUIRE(top[0].address == reinterpret_cast<size_t>(buf) + kPageSize);
+  REQUIRE(top[0].count == 3);
+  REQUIRE(top[1].count == 1);
+
+  std::array<uint64_t, PageHeatmap::kHistogramSize> histogram{
+      heatmap.Histogram()};
+  REQUIRE(histogram[0] == 1); // 1 write
+  REQUIRE(histogram[1] == 1); // 2-3 writes
+
+  std::ostringstream csv;
+  heatmap.WriteCsv(csv);
+  REQUIRE(csv.str().starts_with("address,segment,writes\n"));
+  REQUIRE(csv.str().find(",\"test\",3\n") != std::string::npos);
+
+  // the segment disappears, its counters are kept
+  heatmap.Update({});
+  REQUIRE(heatmap.Regions().empty());
+  REQUIRE(heatmap.Retired().size() == 1);
+  REQUIRE(heatmap.Top(1).size() == 1);
+
+  munmap(buf, kSize);
+  memory_accessor.Reset();
+}
+
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN("Console");
+
+namespace memoryaccessor_testing::console {
+
+/*!
+ \brief Replace streambuf of stream by one provided in ostringstream.
+ \param [in,out] stream Stream to perform replacement.
+ \param [in] oss std::ostringstream containing std::streambuf replacement.
+ \return Pointer to old std::streambuf of the stream.
+
+  Replace std::streambuf of stream by one provided in std::ostringstream, so all
+ data coming from stream will be redirected to std::ostringstream.
+*/
+std::streambuf *replace_streambuf(std::ios &stream,
+                                  const std::ostringstream &oss) {
+  // Заимствование, источник кода:
+  // https://stackoverflow.com/questions/4191089/how-to-unit-test-function-writing-to-stdout-stdcout
+  // Начало заимствования (есть изменения):
+  std::streambuf *p_streambuf = stream.rdbuf();
+  stream.rdbuf(oss.rdbuf());
+  return p_streambuf;
+  // Конец заимствования.
+}
+
+} // namespace memoryaccessor_testing::console
+
+TEST_CASE("Print name and version: not null") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+
+  console.PrintNameVer();
+  REQUIRE(oss.str() != "");
+
+  std::cout.rdbuf(p_cout_streambuf);
+}
+
+TEST_CASE("Print name and version") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+
+  console.PrintNameVer();
+  REQUIRE(oss.str() ==
+          console.kProjectName + " " + console.kProjectVersion + "\n");
+
+  std::cout.rdbuf(p_cout_streambuf);
+}
+
+TEST_CASE("Console start: not null") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+
+  console.Start();
+  REQUIRE(oss.str() != "");
+
+  std::cout.rdbuf(p_cout_streambuf);
+}
+
+TEST_CASE("Console start") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+
+  console.Start();
+  REQUIRE(oss.str() == console.kProjectName + " " + console.kProjectVersion +
+                           "\nType \"help\" for help.\n");
+
+  std::cout.rdbuf(p_cout_streambuf);
+}
+
+namespace memoryaccessor_testing::console {
+
+/*!
+ \brief Perform test on Console::HandleCommand function.
+ \param [in,out] oss std::ostringstream with redirected std::cout and/or
+ std::cerr. \param [in] command Line with command. \param [in] result_substr
+ Desired substring of result starting from the beginning.
+
+  Perform test on Console::HandleCommand function and compare result with
+ specified substring.
+*/
+void test_handle_command(std::ostringstream &oss, const std::string &command,
+                         const std::string &result_substr) {
+  ::console.HandleCommand(command);
+  REQUIRE(oss.str().substr(0, result_substr.length()) == result_substr);
+  oss.str("");
+}
+
+} // namespace memoryaccessor_testing::console
+
+TEST_CASE("Handle empty command") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+
+  console.HandleCommand("");
+  REQUIRE(oss.str().length() == 0);
+
+  std::cout.rdbuf(p_cout_streambuf);
+}
+
+TEST_CASE("Handle whitespace command") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+
+  console.HandleCommand(std::string(5, ' '));
+  REQUIRE(oss.str().length() == 0);
+
+  std::cout.rdbuf(p_cout_streambuf);
+}
+
+TEST_CASE("Handle unknown command") {
+  std::ostringstream oss;
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+
+  std::string command{"abcdef"};
+  memoryaccessor_testing::console::test_handle_command(
+      oss, command, command + ": command not found\n");
+
+  std::cerr.rdbuf(p_cerr_streambuf);
+}
+
+TEST_CASE("Handle command with quotes") {
+  std::ostringstream oss;
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+
+  std::string command{"abc def"};
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "\"" + command + "\"", command + ": command not found\n");
+
+  std::cerr.rdbuf(p_cerr_streambuf);
+}
+
+TEST_CASE("Handle command with escape sequences") {
+  std::ostringstream oss;
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+
+  std::string command{"\\\\\\\"\\a\\b\\f\\n\\r\\t\\v"};
+  memoryaccessor_testing::console::test_handle_command(
+      oss, command,
+      std::string("\\\"\a\b\f\n\r\t\v") + ": command not found\n");
+
+  std::cerr.rdbuf(p_cerr_streambuf);
+}
+
+TEST_CASE("Handle command: help") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "help",
+      console.kProjectName + " " + console.kProjectVersion + "\n" +
+          console.kProjectDescription + "\nCommands:\n");
+
+  std::cout.rdbuf(p_cout_streambuf);
+}
+
+TEST_CASE("Handle command: name") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+
+  memoryaccessor_testing::console::test_handle_command(oss, "name", "Usage:");
+  std::string name{std::string(16, 'a')};
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "name " + name, "No PID found by name: " + name);
+  memoryaccessor_testing::console::test_handle_command(
       oss, "name " + memoryaccessor_testing::tools::get_self_name(), "Found");
 
   std::cout.rdbuf(p_cout_streambuf);
   std::cerr.rdbuf(p_cerr_streambuf);
 }
 
-TEST_CASE("Handle command: pid") {
+TEST_CASE("Handle command: pid") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+
+  memoryaccessor_testing::console::test_handle_command(oss, "pid", "Usage:");
+  std::string pid_str{std::to_string(memoryaccessor_testing::tools::max_pid_t)};
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "pid " + pid_str,
+      "The process with PID " + pid_str + " does not exist.");
+  pid_str = std::to_string(getpid());
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "pid " + pid_str,
+      "Set PID: " + pid_str + "\nParsing /proc/" + pid_str + "/maps...\nFound");
+
+  std::cout.rdbuf(p_cout_streambuf);
+  std::cerr.rdbuf(p_cerr_streambuf);
+}
+
+namespace memoryaccessor_testing::console {
+
+/*!
+ \brief Convert size_t to hex string.
+ \param [in] num Number to convert.
+ \param [in] width Minimum amount of digits in output.
+ \return String with hex representation of number.
+
+  Convert size_t to hex string with specified width filled with '0'.
+*/
+std::string size_t_to_hex(const size_t &num, size_t width) {
+  std::ostringstream oss;
+  oss << std::setfill('0') << std::setw(width) << std::hex << num;
+  return oss.str();
+}
+
+} // namespace memoryaccessor_testing::console
+
+TEST_CASE("Handle command: maps") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+
+  console.HandleCommand("pid " + std::to_string(getpid()));
+  oss.str("");
+
+  SegmentInfo si0{memory_accessor.segment_infos_[0]};
+
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "maps",
+      std::string(std::log10(memory_accessor.segment_infos_.size() - 1), ' ') +
+          "0. " + memoryaccessor_testing::console::size_t_to_hex(si0.start) +
+          "-" + memoryaccessor_testing::console::size_t_to_hex(si0.end) + " " +
+          tools.EncodePermissions(si0.mode) + " " +
+          memoryaccessor_testing::console::size_t_to_hex(si0.offset, 8) + " " +
+          memoryaccessor_testing::console::size_t_to_hex(si0.major_id, 2) +
+          ":" +
+          memoryaccessor_testing::console::size_t_to_hex(si0.minor_id, 2) +
+          " " + std::to_string(si0.inode_id));
+
+  std::cout.rdbuf(p_cout_streambuf);
+}
+
+TEST_CASE("Handle command: view") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+
+  console.HandleCommand("pid " + std::to_string(getpid()));
+  oss.str("");
+
+  memoryaccessor_testing::console::test_handle_command(oss, "view", "Usage:");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "view 0",
+      memoryaccessor_testing::console::size_t_to_hex(
+          memory_accessor.segment_infos_[0].start));
+
+  const SegmentInfo &si0{memory_accessor.segment_infos_[0]};
+  memoryaccessor_testing::console::test_handle_command(
+      oss,
+      "view -s addr=" +
+          memoryaccessor_testing::console::size_t_to_hex(si0.start + 0x10) +
+          "-" +
+          memoryaccessor_testing::console::size_t_to_hex(si0.start + 0x20),
+      memoryaccessor_testing::console::size_t_to_hex(si0.start + 0x10));
+
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "view -s perm=q", "Invalid filter term: perm=q");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "view -s name=nothing", "No memory is selected by the filter.");
+
+  std::cout.rdbuf(p_cout_streambuf);
+  std::cerr.rdbuf(p_cerr_streambuf);
+}
+
+TEST_CASE("Handle command: read") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+
+  console.HandleCommand("pid " + std::to_string(getpid()));
+  oss.str("");
+
+  SegmentInfo si0{memory_accessor.segment_infos_[0]};
+
+  memoryaccessor_testing::console::test_handle_command(oss, "read", "Usage:");
+  memoryaccessor_testing::console::test_handle_command(
+      oss,
+      "read " + memoryaccessor_testing::console::size_t_to_hex(si0.start) +
+          " 1",
+      memoryaccessor_testing::console::size_t_to_hex(si0.start));
+
+  std::cout.rdbuf(p_cout_streambuf);
+}
+
+TEST_CASE("Handle command: write") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+
+  console.HandleCommand("pid " + std::to_string(getpid()));
+  oss.str("");
+
+  SegmentInfo si0{memory_accessor.segment_infos_[0]};
+
+  memoryaccessor_testing::console::test_handle_command(oss, "write", "Usage:");
+  memoryaccessor_testing::console::test_handle_command(
+      oss,
+      "write " + memoryaccessor_testing::console::size_t_to_hex(si0.start) +
+          " 0 a",
+      "0 bytes written.");
+
+  // a regular file is mapped and written at once
+  std::string data(0x3000, 'a'), path{"/tmp/memoryaccessor_test.write"};
+  std::string address{memoryaccessor_testing::console::size_t_to_hex(
+      reinterpret_cast<size_t>(data.data()))};
+  std::ofstream(path, std::ios::binary) << std::string(0x2000, 'b');
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write " + address + " 12288 -f " + path,
+      "File size is less than amount, setting amount to file size.\n"
+      "8192 bytes written in ");
+  REQUIRE(data == std::string(0x2000, 'b') + std::string(0x1000, 'a'));
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write " + address + " 0 -f " + path, "0 bytes written.");
+  unlink(path.c_str());
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write " + address + " 4 -f " + path,
+      path + ": could not open file");
+  REQUIRE(data == std::string(0x2000, 'b') + std::string(0x1000, 'a'));
+
+  std::cerr.rdbuf(p_cerr_streambuf);
+  std::cout.rdbuf(p_cout_streambuf);
+}
+
+TEST_CASE("Handle command: journal, undo, revert-all") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+
+  console.HandleCommand("pid " + std::to_string(getpid()));
+  oss.str("");
+
+  std::string data(0x3000, 'a'), path{"/tmp/memoryaccessor_test.write"};
+  std::string address{memoryaccessor_testing::console::size_t_to_hex(
+      reinterpret_cast<size_t>(data.data()))};
+  std::ofstream(path, std::ios::binary) << std::string(0x2000, 'c');
+
+  memoryaccessor_testing::console::test_handle_command(oss, "journal x",
+                                                       "Usage:");
+  memoryaccessor_testing::console::test_handle_command(oss, "undo",
+                                                       "Journal is off");
+  memoryaccessor_testing::console::test_handle_command(oss, "journal on",
+                                                       "Journal is on.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "journal on", "Journal is already on.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write " + address + " 3 bbb", "3 bytes written.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write " + address + " 8192 -f " + path, "8192 bytes written in ");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write " + address + " 2 dd", "2 bytes written.");
+  REQUIRE(data.substr(0, 4) == "ddcc");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "journal", "Journal in memory: 3 writes, 8197 bytes recorded");
+
+  memoryaccessor_testing::console::test_handle_command(oss, "undo x",
+                                                       "Not a(n) count: x");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "undo", "1 writes undone, 2 bytes restored.");
+  REQUIRE(data.substr(0, 4) == "cccc");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "revert-all", "2 writes undone, 8192 bytes restored.");
+  REQUIRE(data == std::string(0x3000, 'a'));
+  memoryaccessor_testing::console::test_handle_command(oss, "revert-all",
+                                                       "No writes to undo.");
+
+  // writes done by blocks of buffer_size_ bytes are undone as one write
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write " + address + " 10240 " + std::string(0x2800, 'e'),
+      "10240 bytes written.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write " + address + " 10240 -f /dev/zero", "10240 bytes written.");
+  REQUIRE(data == std::string(0x2800, '\0') + std::string(0x800, 'a'));
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "undo", "1 writes undone, 10240 bytes restored.");
+  REQUIRE(data == std::string(0x2800, 'e') + std::string(0x800, 'a'));
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "undo", "1 writes undone, 10240 bytes restored.");
+  REQUIRE(data == std::string(0x3000, 'a'));
+
+  // a batch commit is undone as one write
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "batch begin", "Batch started");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write " + address + " 2 ff", "Queued 2 bytes at 0x");
+  memoryaccessor_testing::console::test_handle_command(
+      oss,
+      "write " +
+          memoryaccessor_testing::console::size_t_to_hex(
+              reinterpret_cast<size_t>(data.data()) + 0x1000) +
+          " 2 gg",
+      "Queued 2 bytes at 0x");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "batch commit", "2 writes committed as 2 ranges, 4 bytes verified.");
+  REQUIRE(data.substr(0, 2) == "ff");
+  REQUIRE(data.substr(0x1000, 2) == "gg");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "undo", "1 writes undone, 4 bytes restored.");
+  REQUIRE(data == std::string(0x3000, 'a'));
+  memoryaccessor_testing::console::test_handle_command(oss, "journal off",
+                                                       "Journal is off.");
+  unlink(path.c_str());
+
+  std::cerr.rdbuf(p_cerr_streambuf);
+  std::cout.rdbuf(p_cout_streambuf);
+}
+
+TEST_CASE("Handle command: watch") {
   std::ostringstream oss;
   std::streambuf *p_cout_streambuf{
       memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
   std::streambuf *p_cerr_streambuf{
       memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
 
-  memoryaccessor_testing::console::test_handle_command(oss, "pid", "Usage:");
-  std::string pid_str{std::to_string(memoryaccessor_testing::tools::max_pid_t)};
+  console.HandleCommand("pid " + std::to_string(getpid()));
+  oss.str("");
+
+  memoryaccessor_testing::console::test_handle_command(oss, "watch", "Usage:");
+  memoryaccessor_testing::console::test_handle_command(oss, "watch 1000",
+                                                       "Usage:");
+  memoryaccessor_testing::console::test_handle_command(oss, "watch 1000 4 x",
+                                                       "Usage:");
   memoryaccessor_testing::console::test_handle_command(
-      oss, "pid " + pid_str,
-      "The process with PID " + pid_str + " does not exist.");
-  pid_str = std::to_string(getpid());
+      oss, "watch 1000 a", "Not a(n) length: a");
   memoryaccessor_testing::console::test_handle_command(
-      oss, "pid " + pid_str,
-      "Set PID: " + pid_str + "\nParsing /proc/" + pid_str + "/maps...\nFound");
+      oss, "watch 1000 3",
+      "Length must be 1, 2, 4 or 8 and address must be aligned to it.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "watch 1002 4 rw",
+      "Length must be 1, 2, 4 or 8 and address must be aligned to it.");
 
+  std::cerr.rdbuf(p_cerr_streambuf);
   std::cout.rdbuf(p_cout_streambuf);
+}
+
+TEST_CASE("Handle command: freeze, unfreeze") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+
+  console.HandleCommand("pid " + std::to_string(getpid()));
+  oss.str("");
+
+  volatile int64_t value{1};
+  std::string address{memoryaccessor_testing::console::size_t_to_hex(
+      reinterpret_cast<size_t>(&value))};
+
+  memoryaccessor_testing::console::test_handle_command(oss, "freeze",
+                                                       "No values are frozen.");
+  memoryaccessor_testing::console::test_handle_command(oss, "freeze 0 i64",
+                                                       "Usage:");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "freeze " + address + " i8 1", "Invalid type: i8");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "freeze " + address + " i64 1 5", "Period must be at least 10 us.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "freeze " + address + " i64 1 18446744073709552",
+      "Specified period is too big: 18446744073709552");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "freeze 0 i64 1", "Value at 0x0 is not inside segments.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "freeze " + address + " i64 -7 200",
+      "Frozen 0x" + address + ", 1 values are written every 200 us.");
+  for (int i{0}; i < 1000 && value != -7; i++)
+    usleep(1000);
+  REQUIRE(value == -7);
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "freeze",
+      "1 values of PID " + std::to_string(getpid()) +
+          " are written every 200 us.\n0x" + address + " i64 -7\nTicks: ");
+
+  memoryaccessor_testing::console::test_handle_command(oss, "unfreeze",
+                                                       "Usage:");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "unfreeze 10", "Value at 0x10 is not frozen.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "unfreeze " + address, "Unfrozen 0x" + address + ".");
+  memoryaccessor_testing::console::test_handle_command(oss, "unfreeze all",
+                                                       "0 values unfrozen.");
+  memoryaccessor_testing::console::test_handle_command(oss, "freeze",
+                                                       "No values are frozen.");
+
   std::cerr.rdbuf(p_cerr_streambuf);
+  std::cout.rdbuf(p_cout_streambuf);
 }
 
-namespace memoryaccessor_testing::console {
+TEST_CASE("Handle command: batch") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
 
-/*!
- \brief Convert size_t to hex string.
- \param [in] num Number to convert.
- \param [in] width Minimum amount of digits in output.
- \return String with hex representation of number.
+  console.HandleCommand("pid " + std::to_string(getpid()));
+  oss.str("");
 
-  Convert size_t to hex string with specified width filled with '0'.
-*/
-std::string size_t_to_hex(const size_t &num, size_t width) {
+  std::string data(0x100, 'a');
+  size_t data_address{reinterpret_cast<size_t>(data.data())};
+  std::string address{
+      memoryaccessor_testing::console::size_t_to_hex(data_address)},
+      address_4{
+          memoryaccessor_testing::console::size_t_to_hex(data_address + 4)};
+
+  memoryaccessor_testing::console::test_handle_command(oss, "batch x",
+                                                       "Usage:");
+  memoryaccessor_testing::console::test_handle_command(oss, "batch commit",
+                                                       "No batch is open.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "batch begin", "Batch started");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write " + address + " 4 bbbb", "Queued 4 bytes at 0x");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write " + address_4 + " 2 cc", "Queued 2 bytes at 0x");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write " + address + " 4 -f /dev/null",
+      "Writes from files cannot be queued");
+  REQUIRE(data == std::string(0x100, 'a'));
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "batch", "0x" + address + " 4\n0x" + address_4 + " 2\n2 writes");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "batch commit", "2 writes committed as 1 ranges, 6 bytes verified.");
+  REQUIRE(data.substr(0, 7) == "bbbbcca");
+
+  memoryaccessor_testing::console::test_handle_command(oss, "batch begin",
+                                                       "Batch started");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write " + address + " 1 d", "Queued 1 bytes");
+  memoryaccessor_testing::console::test_handle_command(oss, "batch abort",
+                                                       "1 writes dropped.");
+  REQUIRE(data[0] == 'b');
+
+  memoryaccessor_testing::console::test_handle_command(oss, "batch begin",
+                                                       "Batch started");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "write 0 1 d", "Queued 1 bytes");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "batch commit", "Range at 0x0 of 1 bytes is not inside segments");
+  memoryaccessor_testing::console::test_handle_command(oss, "batch abort",
+                                                       "1 writes dropped.");
+
+  std::cerr.rdbuf(p_cerr_streambuf);
+  std::cout.rdbuf(p_cout_streambuf);
+}
+
+TEST_CASE("Handle command: diff") {
   std::ostringstream oss;
-  oss << std::setfill('0') << std::setw(width) << std::hex << num;
-  return oss.str();
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+
+  console.HandleCommand("pid " + std::to_string(getpid()));
+  oss.str("");
+
+  memoryaccessor_testing::console::test_handle_command(oss, "diff", "Usage:");
+
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "diff 0", "Length must be greater than 0.");
+  memoryaccessor_testing::console::test_handle_command(oss, "diff -i x 4",
+                                                       "Not a(n) interval: x");
+  memoryaccessor_testing::console::test_handle_command(oss, "diff -b",
+                                                       "Usage:");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "diff -o /nonexistent/events 4",
+      "/nonexistent/events: could not open file");
+  memoryaccessor_testing::console::test_handle_command(oss, "diff -t i8",
+                                                       "Invalid type: i8");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "diff -m inc 4", "Predicate needs a type.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "diff -t i32 -m *2", "Invalid predicate: *2");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "diff -t u16 70000", "Value is out of range: 70000");
+  memoryaccessor_testing::console::test_handle_command(oss, "diff -g 4 4",
+                                                       "Gap needs key -r.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "diff -r -t i32", "Ranges cannot be typed.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "diff -p -l 16 4", "Limit cannot be used with key -p.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "diff -l 0 4", "Limit must be greater than 0.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "diff -d /tmp 4", "Scratch directory needs key -l.");
+
+  std::cout.rdbuf(p_cout_streambuf);
+  std::cerr.rdbuf(p_cerr_streambuf);
 }
 
-} // namespace memoryaccessor_testing::console
+TEST_CASE("Handle command: xref") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
 
-TEST_CASE("Handle command: maps") {
+  console.HandleCommand("pid " + std::to_string(getpid()));
+  oss.str("");
+
+  auto target{std::make_unique<size_t>(0)};
+
+  memoryaccessor_testing::console::test_handle_command(oss, "xref", "Usage:");
+  memoryaccessor_testing::console::test_handle_command(
+      oss,
+      "xref " + memoryaccessor_testing::console::size_t_to_hex(
+                    reinterpret_cast<size_t>(target.get())),
+      "Building pointer index...\nIndexed ");
+
+  std::cout.rdbuf(p_cout_streambuf);
+}
+
+TEST_CASE("Handle command: heatmap") {
   std::ostringstream oss;
   std::streambuf *p_cout_streambuf{
       memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
 
   console.HandleCommand("pid " + std::to_string(getpid()));
   oss.str("");
 
-  SegmentInfo si0{memory_accessor.segment_infos_[0]};
+  memoryaccessor_testing::console::test_handle_command(oss, "heatmap",
+                                                       "Usage:");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "heatmap 0", "Duration must be greater than 0.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "heatmap -i x 1", "Not a(n) interval: x");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "heatmap -p -i 100 -s name=[stack] 1",
+      "Sampling writes of PID " + std::to_string(getpid()) +
+          " for 1 s. Press Ctrl-C to stop.\nSampled ");
+
+  std::cout.rdbuf(p_cout_streambuf);
+  std::cerr.rdbuf(p_cerr_streambuf);
+}
+
+TEST_CASE("Handle command: core") {
+  std::ostringstream oss;
+  std::streambuf *p_cout_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
 
+  console.HandleCommand("pid " + std::to_string(getpid()));
+  oss.str("");
+
+  memoryaccessor_testing::console::test_handle_command(oss, "core", "Usage:");
   memoryaccessor_testing::console::test_handle_command(
-      oss, "maps",
-      std::string(std::log10(memory_accessor.segment_infos_.size() - 1), ' ') +
-          "0. " + memoryaccessor_testing::console::size_t_to_hex(si0.start) +
-          "-" + memoryaccessor_testing::console::size_t_to_hex(si0.end) + " " +
-          tools.EncodePermissions(si0.mode) + " " +
-          memoryaccessor_testing::console::size_t_to_hex(si0.offset, 8) + " " +
-          memoryaccessor_testing::console::size_t_to_hex(si0.major_id, 2) +
-          ":" +
-          memoryaccessor_testing::console::size_t_to_hex(si0.minor_id, 2) +
-          " " + std::to_string(si0.inode_id));
+      oss, "core -j x /tmp/memoryaccessor_test.core",
+      "Not a(n) amount of threads: x");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "core /tmp/memoryaccessor_test.core",
+      "Writing core of PID " + std::to_string(getpid()) +
+          " to /tmp/memoryaccessor_test.core. Press Ctrl-C to stop.\nWrote ");
+  unlink("/tmp/memoryaccessor_test.core");
 
   std::cout.rdbuf(p_cout_streambuf);
+  std::cerr.rdbuf(p_cerr_streambuf);
 }
 
-TEST_CASE("Handle command: view") {
+TEST_CASE("Handle command: snapshot") {
   std::ostringstream oss;
   std::streambuf *p_cout_streambuf{
       memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
 
   console.HandleCommand("pid " + std::to_string(getpid()));
   oss.str("");
 
-  memoryaccessor_testing::console::test_handle_command(oss, "view", "Usage:");
+  memoryaccessor_testing::console::test_handle_command(oss, "snapshot",
+                                                       "Usage:");
   memoryaccessor_testing::console::test_handle_command(
-      oss, "view 0",
-      memoryaccessor_testing::console::size_t_to_hex(
-          memory_accessor.segment_infos_[0].start));
+      oss, "snapshot diff /tmp/memoryaccessor_test.snap", "Usage:");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "snapshot save -q /tmp/memoryaccessor_test.snap",
+      "Keys -q, -g and -o are used only by \"snapshot diff\".");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "snapshot diff -s anon a b",
+      "Keys -s and -z are used only by \"snapshot save\".");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "snapshot restore -z a",
+      "Keys -s and -z are used only by \"snapshot save\".");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "snapshot diff /tmp/memoryaccessor_test.nonexistent live",
+      "/tmp/memoryaccessor_test.nonexistent: not a snapshot file or could not "
+      "be read");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "snapshot save -s perm=r,name=* /tmp/memoryaccessor_test.snap",
+      "Saving memory of PID " + std::to_string(getpid()) +
+          " to /tmp/memoryaccessor_test.snap. Press Ctrl-C to stop.\nSaved ");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "snapshot diff -q -g x /tmp/memoryaccessor_test.snap live",
+      "Not a(n) gap: x");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "snapshot diff -q /tmp/memoryaccessor_test.snap "
+           "/tmp/memoryaccessor_test.snap",
+      "Changes: 0 at 0 address(es).\nCompared ");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "snapshot diff -k a b",
+      "Key -k is used only by \"snapshot restore\".");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "snapshot restore a b", "Usage:");
+
+  // only pages that differ are written back
+  char *pages{static_cast<char *>(mmap(nullptr, 0x3000, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))};
+  REQUIRE(pages != MAP_FAILED);
+  std::memset(pages, 'a', 0x3000);
+  std::ostringstream range;
+  range << std::hex << reinterpret_cast<size_t>(pages) << '-'
+        << reinterpret_cast<size_t>(pages) + 0x3000;
+  // pages are compressed, so they are decompressed while restoring
+  console.HandleCommand("snapshot save -z -s addr=" + range.str() +
+                        " /tmp/memoryaccessor_test.snap");
+  REQUIRE(oss.str().find(", 3 compressed by ") != std::string::npos);
+  oss.str("");
+  pages[0x10] = 'b';
+  pages[0x2ff0] = 'b';
+  console.HandleCommand("journal on");
+  oss.str("");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "snapshot restore /tmp/memoryaccessor_test.snap",
+      "Restoring memory of PID " + std::to_string(getpid()) +
+          " from /tmp/memoryaccessor_test.snap. Press Ctrl-C to stop.\n"
+          "Restored 2 of 2 differing page(s) in 1 segment(s), compared 0.0 "
+          "MiB.\n");
+  REQUIRE(pages[0x10] == 'a');
+  REQUIRE(pages[0x2ff0] == 'a');
+  // the restore is recorded to the journal as one write
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "undo", "1 writes undone, 8192 bytes restored.");
+  REQUIRE(pages[0x10] == 'b');
+  REQUIRE(pages[0x2ff0] == 'b');
+  console.HandleCommand("journal off");
+  oss.str("");
+  munmap(pages, 0x3000);
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "snapshot restore /tmp/memoryaccessor_test.snap",
+      "Restoring memory of PID " + std::to_string(getpid()) +
+          " from /tmp/memoryaccessor_test.snap. Press Ctrl-C to stop.\n"
+          "Skipped " +
+          range.str() + " rw-p : ");
+
+  // a segment saved whole is skipped if it grew
+  char *area{static_cast<char *>(mmap(nullptr, 0x5000, PROT_NONE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))};
+  REQUIRE(area != MAP_FAILED);
+  REQUIRE(mprotect(area + 0x1000, 0x2000, PROT_READ | PROT_WRITE) == 0);
+  range.str("");
+  range << std::hex << reinterpret_cast<size_t>(area) + 0x1000 << '-'
+        << reinterpret_cast<size_t>(area) + 0x3000;
+  console.HandleCommand("snapshot save -s addr=" + range.str() +
+                        " /tmp/memoryaccessor_test.snap");
+  oss.str("");
+  REQUIRE(mprotect(area + 0x3000, 0x1000, PROT_READ | PROT_WRITE) == 0);
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "snapshot restore /tmp/memoryaccessor_test.snap",
+      "Restoring memory of PID " + std::to_string(getpid()) +
+          " from /tmp/memoryaccessor_test.snap. Press Ctrl-C to stop.\n"
+          "Skipped " +
+          range.str() + " rw-p : resized.\n");
+  munmap(area, 0x5000);
+  unlink("/tmp/memoryaccessor_test.snap");
 
   std::cout.rdbuf(p_cout_streambuf);
+  std::cerr.rdbuf(p_cerr_streambuf);
 }
 
-TEST_CASE("Handle command: read") {
+TEST_CASE("Handle command: repo") {
   std::ostringstream oss;
   std::streambuf *p_cout_streambuf{
       memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
 
   console.HandleCommand("pid " + std::to_string(getpid()));
   oss.str("");
 
-  SegmentInfo si0{memory_accessor.segment_infos_[0]};
+  memoryaccessor_testing::console::test_handle_command(oss, "repo", "Usage:");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "repo read /tmp/memoryaccessor_test.repo", "Usage:");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "repo list -t 1 /tmp/memoryaccessor_test.repo",
+      "Key -t is used only by \"repo read\".");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "repo changed -i 1 /tmp/memoryaccessor_test.repo 0",
+      "Keys -s and -i are used only by \"repo save\".");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "repo read /tmp/memoryaccessor_test.repo 0 0",
+      "Amount must be greater than 0.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "repo list /tmp/memoryaccessor_test.nonexistent",
+      "/tmp/memoryaccessor_test.nonexistent: not a page repository or could "
+      "not be opened");
 
-  memoryaccessor_testing::console::test_handle_command(oss, "read", "Usage:");
   memoryaccessor_testing::console::test_handle_command(
-      oss,
-      "read " + memoryaccessor_testing::console::size_t_to_hex(si0.start) +
-          " 1",
-      memoryaccessor_testing::console::size_t_to_hex(si0.start));
+      oss, "repo save -s name=[stack] /tmp/memoryaccessor_test.repo",
+      "Saved snapshot 0: ");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "repo save -s name=[stack] /tmp/memoryaccessor_test.repo",
+      "Saved snapshot 1: ");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "repo list /tmp/memoryaccessor_test.repo", "0     ");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "repo read -t 0 /tmp/memoryaccessor_test.repo 0",
+      "No snapshot was taken by this time.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "repo changed /tmp/memoryaccessor_test.repo 0 16",
+      "Not changed in 2 snapshot(s).");
+
+  const std::string dir{"/tmp/memoryaccessor_test.repo"};
+  for (const char *name : {"/snapshots/0", "/snapshots/1", "/pages", "/hashes"})
+    unlink((dir + name).c_str());
+  rmdir((dir + "/snapshots").c_str());
+  rmdir(dir.c_str());
 
   std::cout.rdbuf(p_cout_streambuf);
+  std::cerr.rdbuf(p_cerr_streambuf);
 }
 
-TEST_CASE("Handle command: write") {
+TEST_CASE("Handle command: unpack") {
   std::ostringstream oss;
   std::streambuf *p_cout_streambuf{
       memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
 
   console.HandleCommand("pid " + std::to_string(getpid()));
   oss.str("");
 
-  SegmentInfo si0{memory_accessor.segment_infos_[0]};
+  std::string data(0x3000, '\0');
+  data.replace(0x1000, 7, "payload");
+  std::string address{memoryaccessor_testing::console::size_t_to_hex(
+      reinterpret_cast<size_t>(data.data()))};
+  std::string path{"/tmp/memoryaccessor_test.z"},
+      out_path{"/tmp/memoryaccessor_test.unpacked"};
 
-  memoryaccessor_testing::console::test_handle_command(oss, "write", "Usage:");
   memoryaccessor_testing::console::test_handle_command(
-      oss,
-      "write " + memoryaccessor_testing::console::size_t_to_hex(si0.start) +
-          " 0 a",
-      "0 bytes written.");
+      oss, "read -r -z " + address + " 16", "Key -z requires -f.");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "read -r -z -f " + path + " " + address + " 12288",
+      "Compressed 12288 bytes to ");
+  memoryaccessor_testing::console::test_handle_command(oss, "unpack " + path,
+                                                       "Usage:");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "unpack /tmp/memoryaccessor_test.nonexistent " + out_path,
+      "/tmp/memoryaccessor_test.nonexistent: not a compressed file or could "
+      "not be read");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "unpack " + path + " " + out_path + " 20000",
+      "Offset is beyond the data (12288 bytes).");
+
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "unpack " + path + " " + out_path, "12288 bytes unpacked.");
+  std::ifstream unpacked(out_path, std::ios::binary);
+  std::string result{std::istreambuf_iterator<char>(unpacked),
+                     std::istreambuf_iterator<char>()};
+  REQUIRE(result == data);
+  unpacked.close();
+
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "unpack " + path + " " + out_path + " 4096 7",
+      "7 bytes unpacked.");
+  unpacked.open(out_path, std::ios::binary);
+  result.assign(std::istreambuf_iterator<char>(unpacked),
+                std::istreambuf_iterator<char>());
+  REQUIRE(result == "payload");
+  unlink(path.c_str());
+  unlink(out_path.c_str());
 
   std::cout.rdbuf(p_cout_streambuf);
+  std::cerr.rdbuf(p_cerr_streambuf);
 }
 
-TEST_CASE("Handle command: diff") {
+TEST_CASE("Handle command: mapwatch") {
   std::ostringstream oss;
   std::streambuf *p_cout_streambuf{
       memoryaccessor_testing::console::replace_streambuf(std::cout, oss)};
 
+  std::streambuf *p_cerr_streambuf{
+      memoryaccessor_testing::console::replace_streambuf(std::cerr, oss)};
+
   console.HandleCommand("pid " + std::to_string(getpid()));
   oss.str("");
 
-  memoryaccessor_testing::console::test_handle_command(oss, "diff", "Usage:");
+  memoryaccessor_testing::console::test_handle_command(
+      oss, "mapwatch x", "Not a(n) interval: x");
 
   std::cout.rdbuf(p_cout_streambuf);
+  std::cerr.rdbuf(p_cerr_streambuf);
 }
 
 TEST_CASE("Handle command: await") {
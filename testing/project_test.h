@@ -43,6 +43,8 @@
 */
 namespace memoryaccessor_testing {
 
+SegmentInfo make_segment(size_t start, size_t end);
+
 /*!
  \brief Fields used in testing tools.
 